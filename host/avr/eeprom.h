@@ -0,0 +1,51 @@
+/*------------------------------------------------------------------------------
+Name:       eeprom.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: Host (simulation)
+
+Content:    Host stand-in for <avr/eeprom.h>
+
+            EEMEM variables are ordinary memory, and the eeprom_xxx()
+            functions access them directly.  The EEPROM controller itself
+            (EECR/EEAR/EEDR, EE_READY interrupt) is not simulated, so data
+            read through the registers is not meaningful.
+------------------------------------------------------------------------------*/
+
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <inttypes.h>
+#include <string.h>
+
+#define EEMEM
+
+#define eeprom_is_ready()   1
+#define eeprom_busy_wait()  ((void) 0)
+
+static inline uint8_t eeprom_read_byte(const uint8_t *address)
+{
+    return *address;
+}
+
+static inline void eeprom_read_block(void *dest, const void *src, size_t size)
+{
+    memcpy(dest, src, size);
+}
+
+static inline void eeprom_update_byte(uint8_t *address, uint8_t value)
+{
+    *address = value;
+}
+
+static inline void eeprom_update_block(const void *src, void *dest, size_t size)
+{
+    memcpy(dest, src, size);
+}
+
+#endif  // HOST_AVR_EEPROM_H
@@ -0,0 +1,33 @@
+/*------------------------------------------------------------------------------
+Name:       interrupt.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: Host (simulation)
+
+Content:    Host stand-in for <avr/interrupt.h>
+
+            Interrupt handlers become ordinary functions named after their
+            vector (e.g. TIMER0_COMPA_vect), which a benchmark may call
+            directly or deliver with hal_irq_start().  Delivered handlers
+            never nest, so ISR_NOBLOCK behaves as ISR_BLOCK.
+------------------------------------------------------------------------------*/
+
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#include "hal.h"
+
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+
+#define ISR(vector, ...)    void vector(void); void vector(void)
+
+#define sei()               hal_sei()
+#define cli()               hal_cli()
+
+#endif  // HOST_AVR_INTERRUPT_H
@@ -0,0 +1,218 @@
+/*------------------------------------------------------------------------------
+Name:       io.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: Host (simulation)
+
+Content:    Host stand-in for <avr/io.h>
+
+            ATmega328 I/O registers are bytes of hal_io[], indexed by their
+            data memory address, so registers keep the same relative layout
+            as on the target (portdef.h finds DDRx and PINx from PORTx).
+            Registers are plain memory: reads return whatever was last
+            written, by the firmware or by a benchmark simulating a pin.
+------------------------------------------------------------------------------*/
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <inttypes.h>
+
+#include "hal.h"
+
+#define _SFR_MEM8(a)        (hal_io[a])
+#define _SFR_MEM16(a)       (*(volatile uint16_t *) &hal_io[a])
+#define _BV(b)              (1 << (b))
+
+// Registers
+
+#define PINB    _SFR_MEM8(0x23)
+#define DDRB    _SFR_MEM8(0x24)
+#define PORTB   _SFR_MEM8(0x25)
+#define PINC    _SFR_MEM8(0x26)
+#define DDRC    _SFR_MEM8(0x27)
+#define PORTC   _SFR_MEM8(0x28)
+#define PIND    _SFR_MEM8(0x29)
+#define DDRD    _SFR_MEM8(0x2A)
+#define PORTD   _SFR_MEM8(0x2B)
+#define TIFR0   _SFR_MEM8(0x35)
+#define TIFR1   _SFR_MEM8(0x36)
+#define TIFR2   _SFR_MEM8(0x37)
+#define PCIFR   _SFR_MEM8(0x3B)
+#define EIFR    _SFR_MEM8(0x3C)
+#define EIMSK   _SFR_MEM8(0x3D)
+#define EECR    _SFR_MEM8(0x3F)
+#define EEDR    _SFR_MEM8(0x40)
+#define EEAR    _SFR_MEM16(0x41)
+#define GTCCR   _SFR_MEM8(0x43)
+#define TCCR0A  _SFR_MEM8(0x44)
+#define TCCR0B  _SFR_MEM8(0x45)
+#define TCNT0   _SFR_MEM8(0x46)
+#define OCR0A   _SFR_MEM8(0x47)
+#define OCR0B   _SFR_MEM8(0x48)
+#define SPCR    _SFR_MEM8(0x4C)
+#define SPSR    _SFR_MEM8(0x4D)
+#define SPDR    _SFR_MEM8(0x4E)
+#define SMCR    _SFR_MEM8(0x53)
+#define MCUSR   _SFR_MEM8(0x54)
+#define MCUCR   _SFR_MEM8(0x55)
+#define SREG    _SFR_MEM8(0x5F)
+#define PRR     _SFR_MEM8(0x64)
+#define PCICR   _SFR_MEM8(0x68)
+#define EICRA   _SFR_MEM8(0x69)
+#define PCMSK0  _SFR_MEM8(0x6B)
+#define PCMSK1  _SFR_MEM8(0x6C)
+#define PCMSK2  _SFR_MEM8(0x6D)
+#define TIMSK0  _SFR_MEM8(0x6E)
+#define TIMSK1  _SFR_MEM8(0x6F)
+#define TIMSK2  _SFR_MEM8(0x70)
+#define ADC     _SFR_MEM16(0x78)
+#define ADCL    _SFR_MEM8(0x78)
+#define ADCH    _SFR_MEM8(0x79)
+#define ADCSRA  _SFR_MEM8(0x7A)
+#define ADCSRB  _SFR_MEM8(0x7B)
+#define ADMUX   _SFR_MEM8(0x7C)
+#define DIDR0   _SFR_MEM8(0x7E)
+#define TCCR1A  _SFR_MEM8(0x80)
+#define TCCR1B  _SFR_MEM8(0x81)
+#define TCCR1C  _SFR_MEM8(0x82)
+#define TCNT1   _SFR_MEM16(0x84)
+#define ICR1    _SFR_MEM16(0x86)
+#define OCR1A   _SFR_MEM16(0x88)
+#define OCR1B   _SFR_MEM16(0x8A)
+#define TCCR2A  _SFR_MEM8(0xB0)
+#define TCCR2B  _SFR_MEM8(0xB1)
+#define TCNT2   _SFR_MEM8(0xB2)
+#define OCR2A   _SFR_MEM8(0xB3)
+#define OCR2B   _SFR_MEM8(0xB4)
+#define ASSR    _SFR_MEM8(0xB6)
+#define UCSR0A  _SFR_MEM8(0xC0)
+#define UCSR0B  _SFR_MEM8(0xC1)
+#define UCSR0C  _SFR_MEM8(0xC2)
+#define UBRR0   _SFR_MEM16(0xC4)
+#define UBRR0L  _SFR_MEM8(0xC4)
+#define UBRR0H  _SFR_MEM8(0xC5)
+#define UDR0    _SFR_MEM8(0xC6)
+
+// Register bits
+#define SPIF    7
+#define WCOL    6
+#define SPI2X   0
+#define SPIE    7
+#define SPE     6
+#define DORD    5
+#define MSTR    4
+#define CPOL    3
+#define CPHA    2
+#define SPR1    1
+#define SPR0    0
+#define WGM00   0
+#define WGM01   1
+#define WGM02   3
+#define COM0A1  7
+#define COM0A0  6
+#define COM0B1  5
+#define COM0B0  4
+#define CS00    0
+#define CS01    1
+#define CS02    2
+#define OCIE0B  2
+#define OCIE0A  1
+#define TOIE0   0
+#define OCF0B   2
+#define OCF0A   1
+#define TOV0    0
+#define COM1A1  7
+#define COM1A0  6
+#define COM1B1  5
+#define COM1B0  4
+#define WGM11   1
+#define WGM10   0
+#define WGM13   4
+#define WGM12   3
+#define CS12    2
+#define CS11    1
+#define CS10    0
+#define ICIE1   5
+#define OCIE1B  2
+#define OCIE1A  1
+#define TOIE1   0
+#define TOV1    0
+#define OCF1A   1
+#define COM2A1  7
+#define COM2A0  6
+#define WGM21   1
+#define WGM20   0
+#define WGM22   3
+#define CS22    2
+#define CS21    1
+#define CS20    0
+#define OCIE2B  2
+#define OCIE2A  1
+#define TOIE2   0
+#define OCF2B   2
+#define OCF2A   1
+#define TOV2    0
+#define AS2     5
+#define PCIE0   0
+#define PCIE1   1
+#define PCIE2   2
+#define RXC0    7
+#define TXC0    6
+#define UDRE0   5
+#define FE0     4
+#define DOR0    3
+#define U2X0    1
+#define RXCIE0  7
+#define TXCIE0  6
+#define UDRIE0  5
+#define RXEN0   4
+#define TXEN0   3
+#define UCSZ01  2
+#define UCSZ00  1
+#define EERIE   3
+#define EEMPE   2
+#define EEPE    1
+#define EERE    0
+#define ADEN    7
+#define ADSC    6
+#define ADATE   5
+#define ADIF    4
+#define ADIE    3
+#define ADPS2   2
+#define ADPS1   1
+#define ADPS0   0
+#define REFS1   7
+#define REFS0   6
+#define ADLAR   5
+#define SE      0
+#define SM0     1
+#define SM1     2
+#define SM2     3
+#define PORF    0
+#define EXTRF   1
+#define BORF    2
+#define WDRF    3
+#define INT0    0
+#define INT1    1
+#define ISC00   0
+#define ISC01   1
+#define ISC10   2
+#define ISC11   3
+#define UCSZ02  2
+#define RXB80   1
+#define TXB80   0
+#define UPE0    2
+#define MPCM0   0
+
+// Memory sizes
+
+#define E2END   0x3FF
+#define RAMEND  0x8FF
+
+#endif  // HOST_AVR_IO_H
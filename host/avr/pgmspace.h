@@ -0,0 +1,35 @@
+/*------------------------------------------------------------------------------
+Name:       pgmspace.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: Host (simulation)
+
+Content:    Host stand-in for <avr/pgmspace.h>
+
+            Program memory is ordinary memory on the host.
+------------------------------------------------------------------------------*/
+
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <inttypes.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P               const char *
+#define PSTR(s)             (s)
+
+#define pgm_read_byte(a)    (*(const uint8_t *) (a))
+#define pgm_read_word(a)    (*(const uint16_t *) (a))
+#define pgm_read_dword(a)   (*(const uint32_t *) (a))
+
+#define memcpy_P            memcpy
+#define strlen_P            strlen
+#define strcpy_P            strcpy
+
+#endif  // HOST_AVR_PGMSPACE_H
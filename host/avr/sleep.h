@@ -0,0 +1,34 @@
+/*------------------------------------------------------------------------------
+Name:       sleep.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: Host (simulation)
+
+Content:    Host stand-in for <avr/sleep.h>
+
+            sleep_cpu() waits for the next delivered interrupt (see
+            hal_sleep()).  As on the target, an interrupt made pending while
+            they were disabled is serviced after the sleep instruction when
+            a sei() directly precedes it.
+------------------------------------------------------------------------------*/
+
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+#include <avr/io.h>
+
+#include "hal.h"
+
+#define SLEEP_MODE_IDLE     0
+
+#define set_sleep_mode(mode) (SMCR = (SMCR & ~(_BV(SM0) | _BV(SM1) | _BV(SM2))) | ((mode) << SM0))
+#define sleep_enable()      (SMCR |= _BV(SE))
+#define sleep_disable()     (SMCR &= ~_BV(SE))
+#define sleep_cpu()         hal_sleep()
+
+#endif  // HOST_AVR_SLEEP_H
@@ -0,0 +1,657 @@
+/*------------------------------------------------------------------------------
+Name:       bench.c
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: Host (simulation)
+
+Content:    Host benchmarks for the firmware modules
+
+            Usage:  build/host/bench [name...]
+
+            Runs the named benchmarks (all if none are named):
+
+            nixie_out   Characters written through stdio to a display stream
+            refresh     nixie_display_refresh() and nixie_display_queue()
+                        (+ SPI transfer), full and half intensity
+            button      button_scan() with bouncing button inputs
+            player      player_start() and player_service() over a corpus of
+                        tunes
+            events      Event queue under a simulated 20kHz interrupt load
+                        of mixed event classes, checked for lost,
+                        duplicated or re-ordered events
+
+            Times are host nanoseconds, with the cost of reading the clock
+            taken off each sample.  They are for comparing one build with
+            another, not a prediction of target cycle counts.  Exits with
+            status 1 if the event queue check fails.
+------------------------------------------------------------------------------*/
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdio.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "hal.h"
+#include "portdef.h"
+#include "spi.h"
+#include "timer.h"
+#include "button.h"
+#include "event.h"
+#include "nixie.h"
+#include "sound.h"
+#include "player.h"
+
+//------------------------------------------------------------------------------
+
+// Display streams, as declared by the firmware's main program
+// (ClockDisplay.c refers to them)
+
+FILE            primary;
+nixie_stream_t  primary_stream;
+uint8_t         primary_data[NIXIE_SEGDATA_BYTES];
+
+FILE            secondary;
+nixie_stream_t  secondary_stream;
+uint8_t         secondary_data[NIXIE_SEGDATA_BYTES];
+
+// Interrupt handlers (timer.c)
+
+void TIMER0_COMPA_vect(void);
+
+// Per-benchmark statistics
+
+typedef struct {
+    uint32_t calls;         // Samples taken
+    uint64_t total;         // Sum of sample times, nS
+    uint32_t worst;         // Longest sample, nS
+} bench_t;
+
+// Cost of reading the clock, taken off each sample
+static uint32_t bench_overhead;
+
+// Button input simulation, pseudo-random number state
+static uint32_t bench_random = 1;
+
+// Tune corpus for the player benchmark
+
+static const char *const bench_tunes[] = {
+    "TQ:120:M8:O4:CHGFIED>CH<GFIED>CH<GFIEFDH.",
+    "TQ:120:M8:O4[0:3:CQDEFGAB>]0:CW",
+    "T:180:O5:K-BEA:EIEIEQCIEQGQ<GQW",
+    "TQ:96:M7:O3:P2:C/D/E/F/G/A/B/>C/D/E/F/G/A/B/>CW",
+    "TI:200:V7:O6:CSDSESFSGSASBS>CS<BSASGSFSESDSCS,RQ*O4:CYDYEYFYGYAYBY"
+};
+
+#define BENCH_TUNES         (sizeof(bench_tunes) / sizeof(bench_tunes[0]))
+
+// Event queue stress, shared with the simulated interrupt
+// The interrupt posts a fixed mix of events (stress_pattern[]) from several
+// classes.  Sequenced kinds carry their own sequence number as data, and
+// the post count at which each sequence number was used is kept so that the
+// order events of different classes are removed in can be checked.  The
+// rotary and one-second kinds are coalesced by the queue, so only their
+// totals (steps, seconds) can be checked.
+
+typedef struct {
+    event_id event;
+    uint8_t sequenced;          // Data is a sequence number, else a count to be summed
+    uint8_t sequence;           // Next sequence number
+    uint32_t posted;            // Events (or steps/seconds) posted
+    uint32_t lost;              // Events (or steps/seconds) dropped, queue full
+    uint32_t received;          // Events (or steps/seconds) received
+    uint32_t explained;         // Sequence gaps matched against <lost>
+    uint8_t expected;           // Next sequence number expected
+    uint32_t order[256];        // stress_posted when each sequence number was posted
+} stress_kind_t;
+
+#define STRESS_PRESSED      0
+#define STRESS_RELEASED     1
+#define STRESS_ROTARY       2
+#define STRESS_TIMER        3
+#define STRESS_SECOND       4
+#define STRESS_DISPLAY      5
+#define STRESS_KINDS        6
+
+static volatile stress_kind_t stress_kind[STRESS_KINDS] = {
+    [STRESS_PRESSED]  = { .event = BUTTON2_PRESSED,     .sequenced = 1 },
+    [STRESS_RELEASED] = { .event = BUTTON2_RELEASED,    .sequenced = 1 },
+    [STRESS_ROTARY]   = { .event = RIGHT_ROTARY_MOVED,  .sequenced = 0 },
+    [STRESS_TIMER]    = { .event = TIMER_EXPIRED,       .sequenced = 1 },
+    [STRESS_SECOND]   = { .event = ONE_SECOND_ELAPSED,  .sequenced = 0 },
+    [STRESS_DISPLAY]  = { .event = CROSSFADE_DONE,      .sequenced = 1 }
+};
+
+static const uint8_t stress_pattern[] = {
+    STRESS_TIMER, STRESS_PRESSED, STRESS_ROTARY, STRESS_DISPLAY,
+    STRESS_TIMER, STRESS_RELEASED, STRESS_ROTARY, STRESS_SECOND
+};
+
+#define STRESS_PATTERN      (sizeof(stress_pattern) / sizeof(stress_pattern[0]))
+
+// Foreground stall (ns) every STRESS_STALL_EVERY events received, long
+// enough for some class queues to fill
+
+#define STRESS_STALL_EVERY  4096
+#define STRESS_STALL_NS     4000000ULL
+
+static volatile uint32_t stress_posted;
+
+// Removal order checks: post count of the last sequenced event removed
+// (index 1: user input, 0: timer/display), and the post count before the
+// last fetch of all classes that returned a timer/display event
+
+static uint32_t stress_last_order[2];
+static uint8_t stress_started[2];
+static uint32_t stress_priority_mark;
+
+/******************************************************************************
+ * bench_reset(*b)
+ *
+ * Clear benchmark statistics
+ ******************************************************************************/
+
+static void bench_reset(bench_t *b)
+{
+    memset(b, 0, sizeof(*b));
+}
+
+/******************************************************************************
+ * bench_sample(*b, start)
+ *
+ * Add one sample, timed from <start> (hal_time_ns()) to now
+ ******************************************************************************/
+
+static inline void bench_sample(bench_t *b, uint64_t start)
+{
+    uint32_t elapsed;
+
+    elapsed = hal_time_ns() - start;
+    elapsed = (elapsed > bench_overhead) ? elapsed - bench_overhead : 0;
+
+    b->calls++;
+    b->total += elapsed;
+    if (elapsed > b->worst) {
+        b->worst = elapsed;
+    }
+}
+
+/******************************************************************************
+ * bench_report(*name, *b)
+ *
+ * Print benchmark statistics
+ ******************************************************************************/
+
+static void bench_report(const char *name, const bench_t *b)
+{
+    printf("%-24s %10" PRIu32 " %10.1f %10" PRIu32 "\n", name, b->calls,
+        b->calls ? (double) b->total / b->calls : 0.0, b->worst);
+}
+
+/******************************************************************************
+ * bench_calibrate()
+ *
+ * Measure the cost of a timed sample with nothing in it
+ ******************************************************************************/
+
+static void bench_calibrate(void)
+{
+    uint32_t best = UINT32_MAX;
+    uint32_t elapsed;
+    uint64_t start;
+    uint16_t count;
+
+    for (count = 0; count < 10000; count++) {
+        start = hal_time_ns();
+        elapsed = hal_time_ns() - start;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    bench_overhead = best;
+}
+
+/******************************************************************************
+ * bench_init()
+ *
+ * Bring up the firmware modules used by the benchmarks, as main() does
+ ******************************************************************************/
+
+static void bench_init(void)
+{
+    hal_reset();
+    hal_irq_stop();
+
+    spi_init();
+    timer_init();
+    sound_init();
+    clear_events();
+
+    nixie_stream_init(&primary, &primary_stream, primary_data);
+    nixie_stream_init(&secondary, &secondary_stream, secondary_data);
+    nixie_show_stream(&primary);
+    nixie_display_enable(1);
+    nixie_display_dim(NIXIE_DIM_FULL);
+
+    // Buttons released (inputs pulled up)
+
+    PINB = 0xFF;
+    PINC = 0xFF;
+    PIND = 0xFF;
+
+    sei();
+}
+
+/******************************************************************************
+ * bench_nixie_out()
+ *
+ * Character output to a display stream through stdio
+ ******************************************************************************/
+
+static void bench_nixie_out(void)
+{
+    static const char *const text[] = {
+        "\f123456",
+        "\r*5<12>34.56",
+        "\n|`XY@3_7^8!9$&",
+        "\v~[[12]]$#{}123456789"
+    };
+    bench_t b;
+    uint64_t start;
+    uint32_t count;
+    uint8_t index;
+
+    bench_reset(&b);
+
+    for (count = 0; count < 20000; count++) {
+        for (index = 0; index < sizeof(text) / sizeof(text[0]); index++) {
+            start = hal_time_ns();
+            fputs(text[index], &secondary);
+            bench_sample(&b, start);
+        }
+    }
+
+    bench_report("nixie_out (per string)", &b);
+}
+
+/******************************************************************************
+ * bench_refresh()
+ *
+ * Display refresh, at full intensity and dimmed
+ ******************************************************************************/
+
+static void bench_refresh(void)
+{
+    bench_t b;
+    uint64_t start;
+    uint32_t count;
+    uint8_t pass;
+
+    fputs("\f*3123*6456<>XY", &primary);
+
+    for (pass = 0; pass < 2; pass++) {
+        nixie_display_dim(pass ? NIXIE_DIM_FULL / 2 : NIXIE_DIM_FULL);
+        bench_reset(&b);
+
+        for (count = 0; count < 200000; count++) {
+            start = hal_time_ns();
+            nixie_display_refresh();
+            nixie_display_queue();
+            bench_sample(&b, start);
+            hal_spi_drain();
+        }
+
+        bench_report(pass ? "refresh (dimmed)" : "refresh", &b);
+    }
+
+    nixie_display_dim(NIXIE_DIM_FULL);
+}
+
+/******************************************************************************
+ * bench_button()
+ *
+ * Button scanning, with random presses that bounce for a few samples
+ ******************************************************************************/
+
+static uint8_t bench_rand(void)
+{
+    bench_random = bench_random * 1103515245UL + 12345;
+
+    return bench_random >> 16;
+}
+
+static void bench_button(void)
+{
+    bench_t b;
+    uint64_t start;
+    uint32_t count;
+    uint8_t pressed = 0;
+    uint8_t bounce = 0;
+    uint8_t pins;
+
+    button_enable(1);
+    bench_reset(&b);
+
+    for (count = 0; count < 200000; count++) {
+
+        // Every 100 ticks press or release a random set of buttons, with
+        // contact bounce for the first 20
+
+        if (!(count % 100)) {
+            pressed = bench_rand() & bench_rand();
+            bounce = 20;
+        }
+        pins = ~pressed;
+        if (bounce) {
+            bounce--;
+            pins ^= bench_rand() & bench_rand();
+        }
+
+        PINC = (PINC & ~0x3E) | (pins & 0x3E);
+        PINB = (PINB & ~BM(BUTTON0_PIN)) | ((pins & 0x01) << BUTTON0_PIN);
+        PIND = (PIND & ~(0x03 << LEFT_BUTTON_PIN)) | (((pins >> 6) & 0x03) << LEFT_BUTTON_PIN);
+
+        start = hal_time_ns();
+        button_scan();
+        bench_sample(&b, start);
+
+        // Collect the resulting events now and then
+
+        if (!(count % 50)) {
+            while (get_next_event(0).event != NO_EVENT);
+        }
+    }
+
+    button_enable(0);
+    clear_events();
+
+    bench_report("button_scan", &b);
+}
+
+/******************************************************************************
+ * bench_player()
+ *
+ * Compile and play each tune of the corpus
+ ******************************************************************************/
+
+static void bench_player(void)
+{
+    bench_t compile;
+    bench_t service;
+    uint64_t start;
+    uint32_t ticks;
+    uint8_t tune;
+
+    bench_reset(&compile);
+    bench_reset(&service);
+
+    for (tune = 0; tune < BENCH_TUNES; tune++) {
+        start = hal_time_ns();
+        player_start(bench_tunes[tune], PLAYER_MEM_RAM);
+        bench_sample(&compile, start);
+
+        // Play until done, or for at most a minute of player ticks
+
+        for (ticks = 0; ticks < 60UL * PLAYER_TICKS_PER_SECOND; ticks++) {
+            start = hal_time_ns();
+            sound_service();
+            player_service();
+            bench_sample(&service, start);
+
+            if (player_is_stopped()) {
+                break;
+            }
+        }
+    }
+
+    player_stop();
+    sound_off();
+
+    bench_report("player_start", &compile);
+    bench_report("player_service", &service);
+}
+
+/******************************************************************************
+ * bench_events()
+ *
+ * Event queue stress test
+ *
+ * Notes:   A simulated interrupt runs the system tick interrupt and posts
+ *          the next event of stress_pattern[]; the foreground takes events
+ *          off the queue (sleeping in event_idle() when there are none),
+ *          stalling now and then so that queues overflow.  For each kind:
+ *
+ *          - every event posted must be received once and in order, a
+ *            sequence gap is only allowed where event_overflows() counted
+ *            that many posts of the kind as lost
+ *          - posted = received + lost (steps or seconds, if coalesced)
+ *
+ *          and across classes:
+ *
+ *          - user-input events, and timer/display events, must each be
+ *            removed in the order they were posted
+ *          - a timer/display event must not be removed by a fetch that
+ *            selects user input while a user-input event posted before the
+ *            fetch was waiting
+ ******************************************************************************/
+
+static void stress_interrupt(void)
+{
+    static uint8_t step;
+    volatile stress_kind_t *kind;
+    uint8_t data;
+
+    TIMER0_COMPA_vect();
+
+    kind = &stress_kind[stress_pattern[step]];
+    if (++step >= STRESS_PATTERN) {
+        step = 0;
+    }
+
+    if (kind->sequenced) {
+        data = kind->sequence++;
+        kind->order[data] = stress_posted;
+    }
+    else {
+        data = 1;                       // One step, or one second
+    }
+
+    event_overflows(1);
+    add_event(kind->event, data);
+    if (event_overflows(1)) {
+        kind->lost++;
+    }
+    kind->posted++;
+    stress_posted++;
+}
+
+static uint8_t stress_check(const event_t *event, uint32_t mark, uint8_t all)
+{
+    volatile stress_kind_t *kind;
+    uint32_t order;
+    uint8_t input;
+    uint8_t gap;
+    uint8_t errors = 0;
+
+    for (kind = stress_kind; kind < &stress_kind[STRESS_KINDS]; kind++) {
+        if (kind->event == event->event) {
+            break;
+        }
+    }
+    if (kind == &stress_kind[STRESS_KINDS]) {
+        return 1;                       // Not posted by the stress interrupt
+    }
+
+    if (!kind->sequenced) {
+        kind->received += (kind->event == ONE_SECOND_ELAPSED) ?
+                          event->data : (uint8_t) event->signed_data;
+        return 0;
+    }
+    kind->received++;
+
+    // Events may only go missing when that many were dropped
+
+    gap = event->data - kind->expected;
+    if (gap > kind->lost - kind->explained) {
+        errors++;
+    }
+    else {
+        kind->explained += gap;
+    }
+    kind->expected = event->data + 1;
+
+    // Order within the user-input and timer/display groups
+
+    order = kind->order[event->data];
+    input = (event_mask(event->event) & EM_INPUT) != 0;
+    if (stress_started[input] && (order < stress_last_order[input])) {
+        errors++;
+    }
+    stress_started[input] = 1;
+    stress_last_order[input] = order;
+
+    // User input first
+
+    if (input) {
+        if (order < stress_priority_mark) {
+            errors++;
+        }
+    }
+    else if (all) {
+        stress_priority_mark = mark;
+    }
+
+    return errors;
+}
+
+static uint8_t bench_events(void)
+{
+    volatile stress_kind_t *kind;
+    event_t event;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t stall;
+    uint32_t received = 0;
+    uint32_t errors = 0;
+    uint32_t lost = 0;
+    uint32_t posted;
+    uint32_t mark;
+    uint16_t mask;
+
+    clear_events();
+    event_overflows(1);
+    for (kind = stress_kind; kind < &stress_kind[STRESS_KINDS]; kind++) {
+        kind->sequence = 0;
+        kind->expected = 0;
+        kind->posted = 0;
+        kind->lost = 0;
+        kind->received = 0;
+        kind->explained = 0;
+    }
+    stress_posted = 0;
+    stress_started[0] = 0;
+    stress_started[1] = 0;
+    stress_priority_mark = 0;
+    hal_irq_count(1);
+
+    start = hal_time_ns();
+    hal_irq_start(stress_interrupt, 50);
+
+    // Alternate fetches of all classes with fetches of timer/display
+    // events only, which are not held back by waiting user input
+
+    do {
+        mark = stress_posted;
+        mask = (received & 0x03) ? EM_ALL : (EM_TIMER | EM_DISPLAY);
+        event = get_next_event(mask);
+        if (event.event == NO_EVENT) {
+            event_idle();
+            continue;
+        }
+        errors += stress_check(&event, mark, mask == EM_ALL);
+        received++;
+
+        if (!(received % STRESS_STALL_EVERY)) {
+            stall = hal_time_ns();
+            while (hal_time_ns() - stall < STRESS_STALL_NS);
+        }
+    } while (hal_time_ns() - start < 2000000000ULL);
+
+    hal_irq_stop();
+    elapsed = hal_time_ns() - start;
+
+    mark = stress_posted;
+    while ((event = get_next_event(EM_ALL)).event != NO_EVENT) {
+        errors += stress_check(&event, mark, 1);
+        received++;
+    }
+
+    posted = stress_posted;
+    for (kind = stress_kind; kind < &stress_kind[STRESS_KINDS]; kind++) {
+        if (kind->received + kind->lost != kind->posted) {
+            errors++;
+        }
+        lost += kind->lost;
+    }
+
+    printf("events: %" PRIu32 " interrupts, %" PRIu32 " posted, %" PRIu32 " received, "
+        "%" PRIu32 " lost, %.0f events/s, %" PRIu32 " errors\n",
+        hal_irq_count(0), posted, received, lost,
+        received * 1e9 / elapsed, errors);
+
+    return !errors;
+}
+
+/******************************************************************************
+ * main()
+ ******************************************************************************/
+
+static uint8_t bench_selected(int argc, char **argv, const char *name)
+{
+    int index;
+
+    if (argc < 2) {
+        return 1;
+    }
+    for (index = 1; index < argc; index++) {
+        if (!strcmp(argv[index], name)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t ok = 1;
+
+    bench_calibrate();
+    bench_init();
+
+    printf("%-24s %10s %10s %10s\n", "benchmark", "samples", "mean nS", "max nS");
+
+    if (bench_selected(argc, argv, "nixie_out")) {
+        bench_nixie_out();
+    }
+    if (bench_selected(argc, argv, "refresh")) {
+        bench_refresh();
+    }
+    if (bench_selected(argc, argv, "button")) {
+        bench_button();
+    }
+    if (bench_selected(argc, argv, "player")) {
+        bench_player();
+    }
+    if (bench_selected(argc, argv, "events")) {
+        ok = bench_events();
+    }
+
+    return ok ? 0 : 1;
+}
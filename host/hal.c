@@ -0,0 +1,614 @@
+/*------------------------------------------------------------------------------
+Name:       hal.c
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: Host (simulation)
+
+Content:    Host hardware abstraction layer
+
+            Built without -fpack-struct, unlike the firmware modules, as it
+            shares host C library structures (sigaction etc.) with the host.
+            Only FILE, which is explicitly packed, is shared with the
+            firmware.
+------------------------------------------------------------------------------*/
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#include "delay.h"
+#include "hal.h"
+
+// Not declared by the host stand-in for <stdio.h>
+
+int vsnprintf(char *str, size_t size, const char *fmt, va_list ap);
+
+// SPI transfer-complete interrupt handler (spi.c)
+
+void SPI_STC_vect(void);
+
+#define barrier()           __asm__ __volatile__ ("" ::: "memory")
+
+//------------------------------------------------------------------------------
+
+// I/O registers
+volatile uint8_t hal_io[HAL_IO_SIZE];
+
+// Global interrupt enable flag
+volatile uint8_t hal_irq_enabled;
+
+// Set when an interrupt arrived while interrupts were disabled
+static volatile sig_atomic_t hal_irq_pending;
+
+// Periodic interrupt handler, NULL if none
+static void (*volatile hal_irq_handler)(void);
+
+// Number of interrupts delivered
+static volatile uint32_t hal_irq_delivered;
+
+// Console (host standard output) line buffer
+static char hal_line[128];
+static uint8_t hal_line_length;
+
+static int hal_console_put(char ch, FILE *stream);
+static int hal_console_get(FILE *stream);
+
+static FILE hal_console = FDEV_SETUP_STREAM(hal_console_put, hal_console_get, _FDEV_SETUP_RW);
+
+FILE *__iob[3] = {&hal_console, &hal_console, &hal_console};
+
+/******************************************************************************
+ * hal_reset()
+ *
+ * Return the simulated hardware to its power-on state
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Registers are cleared and interrupts disabled.  A periodic
+ *          interrupt that has been started keeps running, but is held
+ *          pending until interrupts are enabled.
+ ******************************************************************************/
+
+void hal_reset(void)
+{
+    uint16_t index;
+
+    hal_irq_enabled = 0;
+    barrier();
+    hal_irq_pending = 0;
+
+    for (index = 0; index < HAL_IO_SIZE; index++) {
+        hal_io[index] = 0;
+    }
+}
+
+/******************************************************************************
+ * hal_irq_deliver()
+ *
+ * Run the periodic interrupt handler, as the CPU would on an interrupt
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Interrupts are disabled while the handler runs, and enabled
+ *          again on return (RETI).
+ ******************************************************************************/
+
+static void hal_irq_deliver(void)
+{
+    void (*handler)(void);
+
+    hal_irq_pending = 0;
+    hal_irq_enabled = 0;
+    barrier();
+
+    handler = hal_irq_handler;
+    if (handler) {
+        handler();
+        hal_irq_delivered++;
+    }
+
+    barrier();
+    hal_irq_enabled = 1;
+}
+
+/******************************************************************************
+ * hal_signal(sig)
+ *
+ * Host timer signal handler, the periodic interrupt request
+ *
+ * Inputs:  sig         Signal number (SIGALRM)
+ *
+ * Returns: Nothing
+ *
+ * Notes:   The host blocks the signal while this runs, so delivered
+ *          interrupts never nest.
+ ******************************************************************************/
+
+static void hal_signal(int sig)
+{
+    (void) sig;
+
+    if (hal_irq_enabled) {
+        hal_irq_deliver();
+    }
+    else {
+        hal_irq_pending = 1;
+    }
+}
+
+/******************************************************************************
+ * hal_cli()
+ *
+ * Disable interrupts
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+void hal_cli(void)
+{
+    hal_irq_enabled = 0;
+    barrier();
+}
+
+/******************************************************************************
+ * hal_sei()
+ *
+ * Enable interrupts
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   A pending interrupt is delivered at once, unless sleep is
+ *          enabled: as on the target, the sleep instruction that follows
+ *          sei() is executed first, and the interrupt then wakes the CPU.
+ ******************************************************************************/
+
+void hal_sei(void)
+{
+    barrier();
+    hal_irq_enabled = 1;
+
+    while (hal_irq_pending && !(SMCR & _BV(SE))) {
+        hal_irq_deliver();
+    }
+}
+
+/******************************************************************************
+ * hal_irq_restore(*state)
+ *
+ * Restore interrupt state at the end of an ATOMIC_BLOCK()
+ *
+ * Inputs:  *state      Interrupt enable flag saved at the start of the block
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+void hal_irq_restore(const uint8_t *state)
+{
+    if (*state) {
+        hal_sei();
+    }
+}
+
+/******************************************************************************
+ * hal_irq_start(*handler, period_us)
+ *
+ * Start a periodic interrupt
+ *
+ * Inputs:  *handler    Interrupt handler (typically an ISR, e.g.
+ *                      TIMER0_COMPA_vect)
+ *          period_us   Interval between interrupts, microseconds
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Interrupts are delivered by a host timer signal, so they
+ *          pre-empt the foreground at arbitrary points, but only when the
+ *          interrupt flag is set.  The host may not be able to keep up
+ *          with very short periods.
+ ******************************************************************************/
+
+void hal_irq_start(void (*handler)(void), uint32_t period_us)
+{
+    struct sigaction action;
+    struct itimerval timer;
+
+    hal_irq_stop();
+    hal_irq_handler = handler;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = hal_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGALRM, &action, NULL);
+
+    timer.it_interval.tv_sec = period_us / 1000000UL;
+    timer.it_interval.tv_usec = period_us % 1000000UL;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+/******************************************************************************
+ * hal_irq_stop()
+ *
+ * Stop the periodic interrupt
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+void hal_irq_stop(void)
+{
+    struct itimerval timer;
+
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_REAL, &timer, NULL);
+
+    hal_irq_handler = NULL;
+    hal_irq_pending = 0;
+}
+
+/******************************************************************************
+ * uint32_t hal_irq_count(reset)
+ *
+ * Read/reset the number of interrupts delivered
+ *
+ * Inputs:  reset       Count is reset to 0 if nonzero
+ *
+ * Returns: Number of periodic interrupts delivered
+ ******************************************************************************/
+
+uint32_t hal_irq_count(uint8_t reset)
+{
+    uint32_t count;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        count = hal_irq_delivered;
+        if (reset) {
+            hal_irq_delivered = 0;
+        }
+    }
+
+    return count;
+}
+
+/******************************************************************************
+ * hal_sleep()
+ *
+ * Wait for an interrupt (sleep_cpu())
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Does nothing unless sleep is enabled.  Returns at once if an
+ *          interrupt is pending, after delivering it, or if no interrupt
+ *          could wake the CPU (interrupts disabled or no periodic
+ *          interrupt), where the target would sleep forever.
+ ******************************************************************************/
+
+void hal_sleep(void)
+{
+    sigset_t block;
+    sigset_t old;
+
+    if (!(SMCR & _BV(SE))) {
+        return;
+    }
+
+    sigemptyset(&block);
+    sigaddset(&block, SIGALRM);
+    sigprocmask(SIG_BLOCK, &block, &old);
+
+    if (!hal_irq_pending && hal_irq_enabled && hal_irq_handler) {
+        sigsuspend(&old);
+    }
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    while (hal_irq_pending && hal_irq_enabled) {
+        hal_irq_deliver();
+    }
+}
+
+/******************************************************************************
+ * hal_spi_drain()
+ *
+ * Complete an SPI transfer in progress
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Runs the SPI transfer-complete interrupt, with interrupts
+ *          disabled, for each byte until spi.c disables it at the end of
+ *          the transfer.
+ ******************************************************************************/
+
+void hal_spi_drain(void)
+{
+    uint8_t state;
+
+    while (SPCR & _BV(SPIE)) {
+        state = hal_irq_enabled;
+        hal_cli();
+        SPSR |= _BV(SPIF);
+        SPI_STC_vect();
+        hal_irq_restore(&state);
+    }
+}
+
+/******************************************************************************
+ * uint64_t hal_time_ns()
+ *
+ * Read the host monotonic clock
+ *
+ * Inputs:  None
+ *
+ * Returns: Time, nanoseconds from an arbitrary starting point
+ ******************************************************************************/
+
+uint64_t hal_time_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/******************************************************************************
+ * Software delays (delay.h)
+ *
+ * The target versions count instruction cycles; these sleep instead.
+ * Interrupts arriving during the delay are taken as they would be on the
+ * target.
+ ******************************************************************************/
+
+static void hal_delay_ns(uint64_t ns)
+{
+    struct timespec delay;
+
+    delay.tv_sec = ns / 1000000000ULL;
+    delay.tv_nsec = ns % 1000000000ULL;
+    while (nanosleep(&delay, &delay) < 0);
+}
+
+void short_delay(uint16_t cyc4)
+{
+    hal_delay_ns(cyc4 * 4000ULL / (F_CPU / 1000000UL));
+}
+
+void delay_us(uint16_t us)
+{
+    hal_delay_ns(us * 1000ULL);
+}
+
+void delay_ms(uint16_t ms)
+{
+    hal_delay_ns(ms * 1000000ULL);
+}
+
+/******************************************************************************
+ * Console stream
+ *
+ * Output is collected a line at a time and written to the host's standard
+ * output.  There is no console input.
+ ******************************************************************************/
+
+static void hal_console_flush(void)
+{
+    if (hal_line_length) {
+        if (write(STDOUT_FILENO, hal_line, hal_line_length) < 0) {
+            // Nowhere to report it
+        }
+        hal_line_length = 0;
+    }
+}
+
+static void __attribute__((destructor)) hal_console_exit(void)
+{
+    hal_console_flush();
+}
+
+static int hal_console_put(char ch, FILE *stream)
+{
+    (void) stream;
+
+    hal_line[hal_line_length++] = ch;
+    if ((ch == '\n') || (hal_line_length >= sizeof(hal_line))) {
+        hal_console_flush();
+    }
+
+    return 0;
+}
+
+static int hal_console_get(FILE *stream)
+{
+    (void) stream;
+
+    return _FDEV_EOF;
+}
+
+/******************************************************************************
+ * stdio functions (avr-libc semantics)
+ ******************************************************************************/
+
+int hal_fputc(int c, FILE *stream)
+{
+    if (!(stream->flags & _FDEV_SETUP_WRITE) || !stream->put) {
+        return EOF;
+    }
+
+    return (stream->put(c, stream) == 0) ? (unsigned char) c : EOF;
+}
+
+int hal_fputs(const char *str, FILE *stream)
+{
+    int status = 0;
+
+    for ( ; *str; str++) {
+        if (hal_fputc(*str, stream) == EOF) {
+            status = EOF;
+        }
+    }
+
+    return status;
+}
+
+int hal_puts(const char *str)
+{
+    if ((hal_fputs(str, stdout) == EOF) || (hal_fputc('\n', stdout) == EOF)) {
+        return EOF;
+    }
+
+    return 0;
+}
+
+int hal_fgetc(FILE *stream)
+{
+    int c;
+
+    if (!(stream->flags & _FDEV_SETUP_READ) || !stream->get) {
+        return EOF;
+    }
+
+    c = stream->get(stream);
+
+    return (c < 0) ? EOF : (unsigned char) c;
+}
+
+/******************************************************************************
+ * int hal_vfprintf(*stream, *fmt, ap)
+ *
+ * Formatted output to a stream
+ *
+ * Inputs:  *stream     Output stream
+ *          *fmt        avr-libc format string
+ *          ap          Arguments
+ *
+ * Returns: Number of characters written, or EOF if the stream failed
+ *
+ * Notes:   The format is translated for the host C library before use:
+ *          %S becomes %s, and a single 'l' length modifier is dropped,
+ *          since a target long is the size of a host int.
+ ******************************************************************************/
+
+int hal_vfprintf(FILE *stream, const char *fmt, va_list ap)
+{
+    char format[256];
+    char text[256];
+    char *out;
+    uint16_t length;
+    uint8_t conversion;
+    char ch;
+    va_list copy;
+    int count;
+    int index;
+    int status;
+
+    // Translate the format
+
+    length = 0;
+    conversion = 0;
+    for ( ; *fmt && (length < sizeof(format) - 2); fmt++) {
+        ch = *fmt;
+        if (!conversion) {
+            conversion = (ch == '%');
+        }
+        else if (ch == 'l') {
+            if (fmt[1] == 'l') {
+                format[length++] = 'l';
+                format[length++] = 'l';
+                fmt++;
+            }
+            continue;
+        }
+        else {
+            if (ch == 'S') {
+                ch = 's';
+            }
+            if (strchr("diouxXcspfeEgGaAn%", ch)) {
+                conversion = 0;
+            }
+        }
+        format[length++] = ch;
+    }
+    format[length] = 0;
+
+    // Format, then send the text through the stream
+
+    va_copy(copy, ap);
+    count = vsnprintf(text, sizeof(text), format, copy);
+    va_end(copy);
+    if (count < 0) {
+        return EOF;
+    }
+
+    out = text;
+    if (count >= (int) sizeof(text)) {
+        out = malloc(count + 1);
+        if (!out) {
+            return EOF;
+        }
+        vsnprintf(out, count + 1, format, ap);
+    }
+
+    status = count;
+    for (index = 0; index < count; index++) {
+        if (hal_fputc(out[index], stream) == EOF) {
+            status = EOF;
+        }
+    }
+
+    if (out != text) {
+        free(out);
+    }
+
+    return status;
+}
+
+int hal_fprintf(FILE *stream, const char *fmt, ...)
+{
+    va_list ap;
+    int count;
+
+    va_start(ap, fmt);
+    count = hal_vfprintf(stream, fmt, ap);
+    va_end(ap);
+
+    return count;
+}
+
+int hal_printf(const char *fmt, ...)
+{
+    va_list ap;
+    int count;
+
+    va_start(ap, fmt);
+    count = hal_vfprintf(stdout, fmt, ap);
+    va_end(ap);
+
+    return count;
+}
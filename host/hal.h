@@ -0,0 +1,101 @@
+/*------------------------------------------------------------------------------
+Name:       hal.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: Host (simulation)
+
+Content:    Host hardware abstraction layer
+
+            Provides what the target hardware would to the firmware modules
+            built for the host (see the "host" target in ./shake), and a few
+            controls for the benchmarks in bench.c:
+
+            - I/O registers, as bytes of hal_io[] (see avr/io.h)
+            - The global interrupt flag.  cli()/sei() and ATOMIC_BLOCK()
+              clear and set it; an interrupt that arrives while it is clear
+              is held pending and delivered as soon as it is set again.
+            - A periodic interrupt source (hal_irq_start()), delivered
+              asynchronously by a host timer signal, so that code running
+              in the foreground is really pre-empted
+            - An SPI shift register that completes transfers on request
+              (hal_spi_drain())
+            - A monotonic clock for timing
+            - The software delays of delay.h, which sleep rather than count
+              cycles
+------------------------------------------------------------------------------*/
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <inttypes.h>
+
+// Size of the I/O register space (data memory addresses 0..HAL_IO_SIZE-1)
+
+#define HAL_IO_SIZE         256
+
+//------------------------------------------------------------------------------
+
+// I/O registers
+extern volatile uint8_t hal_io[HAL_IO_SIZE];
+
+// Global interrupt enable flag (SREG I bit)
+extern volatile uint8_t hal_irq_enabled;
+
+//------------------------------------------------------------------------------
+
+// Public (exported) functions:
+
+// Clear registers, interrupts disabled (as after a reset)
+
+void hal_reset(void);
+
+// Disable/enable interrupts (cli()/sei())
+
+void hal_cli(void);
+void hal_sei(void);
+
+// Disable interrupts, returns 1 (used by ATOMIC_BLOCK())
+// Inline, so that the compiler can see the block is entered exactly once
+
+static inline uint8_t hal_irq_disable(void)
+{
+    hal_irq_enabled = 0;
+    __asm__ __volatile__ ("" ::: "memory");
+
+    return 1;
+}
+
+// Restore interrupt state saved by ATOMIC_BLOCK()
+
+void hal_irq_restore(const uint8_t *state);
+
+// Deliver <handler> as an interrupt every <period_us> microseconds
+
+void hal_irq_start(void (*handler)(void), uint32_t period_us);
+
+// Stop delivering the periodic interrupt
+
+void hal_irq_stop(void);
+
+// Read/reset number of interrupts delivered
+
+uint32_t hal_irq_count(uint8_t reset);
+
+// Wait for the next interrupt (sleep_cpu())
+
+void hal_sleep(void);
+
+// Complete an SPI transfer in progress, as the shift register would
+
+void hal_spi_drain(void);
+
+// Read monotonic time, nanoseconds
+
+uint64_t hal_time_ns(void);
+
+#endif  // HAL_H
@@ -0,0 +1,86 @@
+/*------------------------------------------------------------------------------
+Name:       stdio.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: Host (simulation)
+
+Content:    Host stand-in for avr-libc <stdio.h>
+
+            Device streams work as with avr-libc: a FILE holds put/get
+            functions and a <udata> pointer, and formatted output is sent
+            through the stream's put function one character at a time.
+            %S (program memory string) is accepted, and is the same as %s.
+            The functions are renamed to hal_xxx() so that they do not
+            clash with the host C library.  stdout and stderr start out
+            writing to the host's standard output.
+------------------------------------------------------------------------------*/
+
+#ifndef HOST_STDIO_H
+#define HOST_STDIO_H
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stddef.h>
+
+#define EOF                 (-1)
+
+#define _FDEV_SETUP_READ    0x01
+#define _FDEV_SETUP_WRITE   0x02
+#define _FDEV_SETUP_RW      (_FDEV_SETUP_READ | _FDEV_SETUP_WRITE)
+
+#define _FDEV_ERR           (-1)
+#define _FDEV_EOF           (-2)
+
+// Same layout as avr-libc's, packed whatever the structure packing flags
+
+typedef struct __file {
+    char *buf;
+    unsigned char unget;
+    uint8_t flags;
+    int size;
+    int len;
+    int (*put)(char, struct __file *);
+    int (*get)(struct __file *);
+    void *udata;
+} __attribute__((__packed__)) FILE;
+
+#define FDEV_SETUP_STREAM(p, g, f) { .put = (p), .get = (g), .flags = (f), .udata = 0 }
+
+#define fdev_set_udata(stream, u) do { (stream)->udata = (u); } while (0)
+#define fdev_get_udata(stream)  ((stream)->udata)
+
+extern FILE *__iob[3];
+
+#define stdin               (__iob[0])
+#define stdout              (__iob[1])
+#define stderr              (__iob[2])
+
+#define fputc               hal_fputc
+#define putchar(c)          hal_fputc((c), stdout)
+#define fputs               hal_fputs
+#define fputs_P             hal_fputs
+#define puts                hal_puts
+#define puts_P              hal_puts
+#define vfprintf            hal_vfprintf
+#define vfprintf_P          hal_vfprintf
+#define fprintf             hal_fprintf
+#define fprintf_P           hal_fprintf
+#define printf              hal_printf
+#define printf_P            hal_printf
+#define fgetc               hal_fgetc
+#define getchar()           hal_fgetc(stdin)
+
+int hal_fputc(int c, FILE *stream);
+int hal_fputs(const char *str, FILE *stream);
+int hal_puts(const char *str);
+int hal_vfprintf(FILE *stream, const char *fmt, va_list ap);
+int hal_fprintf(FILE *stream, const char *fmt, ...);
+int hal_printf(const char *fmt, ...);
+int hal_fgetc(FILE *stream);
+
+#endif  // HOST_STDIO_H
@@ -0,0 +1,29 @@
+/*------------------------------------------------------------------------------
+Name:       atomic.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: Host (simulation)
+
+Content:    Host stand-in for <util/atomic.h>
+
+            As with avr-libc, the block restores the interrupt state however
+            it is left (including by return or break).
+------------------------------------------------------------------------------*/
+
+#ifndef HOST_UTIL_ATOMIC_H
+#define HOST_UTIL_ATOMIC_H
+
+#include <inttypes.h>
+
+#include "hal.h"
+
+#define ATOMIC_RESTORESTATE uint8_t hal_sreg_save __attribute__((__cleanup__(hal_irq_restore))) = hal_irq_enabled
+
+#define ATOMIC_BLOCK(type)  for (type, hal_todo = hal_irq_disable(); hal_todo; hal_todo = 0)
+
+#endif  // HOST_UTIL_ATOMIC_H
@@ -0,0 +1,34 @@
+/*------------------------------------------------------------------------------
+Name:       crc16.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: Host (simulation)
+
+Content:    Host stand-in for <util/crc16.h>
+
+            Same results as the avr-libc versions of these functions.
+------------------------------------------------------------------------------*/
+
+#ifndef HOST_UTIL_CRC16_H
+#define HOST_UTIL_CRC16_H
+
+#include <inttypes.h>
+
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data)
+{
+    uint8_t bit;
+
+    crc ^= (uint16_t) data << 8;
+    for (bit = 0; bit < 8; bit++) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+
+    return crc;
+}
+
+#endif  // HOST_UTIL_CRC16_H
@@ -17,6 +17,8 @@ Content:    Clock display top level: Display time & date
 
 //------------------------------------------------------------------------------
 
+// Start the clock display tasks (see task.h)
+
 void ClockDisplay(void);
 
 #endif  // CLOCKDISPLAY_H
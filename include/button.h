@@ -33,6 +33,21 @@ Content:    Button decoding routines
 
 #define BUTTON_CHORD_DELAY      MS_TO_TICKS(750)
 
+// Number of consecutive identical samples needed to debounce a button
+// (fixed by the 2-bit vertical counter in button_scan())
+
+#define BUTTON_DEBOUNCE_SAMPLES 4
+
+// Button sampling interval, in button_scan() calls (TIMER0 ticks)
+// A button is debounced after about BUTTON_SHORT_DELAY.
+
+#define BUTTON_SAMPLE_TICKS     (BUTTON_SHORT_DELAY / BUTTON_DEBOUNCE_SAMPLES)
+
+// Long press and chord delays in samples; must be less than 256
+
+#define BUTTON_LONG_SAMPLES     (BUTTON_LONG_DELAY / BUTTON_SAMPLE_TICKS)
+#define BUTTON_CHORD_SAMPLES    (BUTTON_CHORD_DELAY / BUTTON_SAMPLE_TICKS)
+
 //------------------------------------------------------------------------------
 
 // Button status bitmap
@@ -63,6 +78,10 @@ void reset_buttons(void);
 
 void button_enable(uint8_t enable);
  
+// Read time at which button state was last latched
+
+uint16_t button_timestamp(void);
+
 // Read un-debounced button status
 
 button_t read_button_state(void);
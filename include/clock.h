@@ -31,8 +31,19 @@ typedef struct {
     uint16_t year;
     uint8_t month;
     uint8_t day;
+    uint8_t weekday;            // 0 = Sunday; set by get_date(), ignored by set_date()
 } date_t;
 
+// Range of years that can be kept
+// The seconds count overflows in February of the year after CLOCK_LAST_YEAR
+
+#define CLOCK_EPOCH_YEAR    2000
+#define CLOCK_LAST_YEAR     2135
+
+// Largest oscillator trim accepted by clock_trim(), ppm
+
+#define CLOCK_MAX_TRIM      10000
+
 //------------------------------------------------------------------------------
 
 // Public (exported) functions
@@ -47,12 +58,24 @@ void set_time_24(time_t *t);
 void get_date(date_t *d);
 void set_date(date_t *d);
 
+uint32_t clock_get_seconds(void);
+void clock_set_seconds(uint32_t seconds);
+
+uint8_t leap_year(uint16_t year);
 uint8_t days_in_month(uint8_t month, uint16_t year);
 
-void time_date_init(void);
+uint16_t date_to_days(const date_t *d);
+void days_to_date(uint16_t days, date_t *d);
+
+uint8_t time_date_init(void);
+
+void clock_trim(int16_t ppm);
+int16_t clock_get_trim(void);
 
 void clock_run(uint8_t run_flag);
 
 void time_date_update(void);
 
+uint8_t clock_tick(void);
+
 #endif
@@ -0,0 +1,102 @@
+/*------------------------------------------------------------------------------
+Name:       config.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: ATmega168 or ATmega328
+
+Content:    EEPROM-backed configuration store
+
+            Settings are kept in a RAM shadow of a checksummed EEPROM block,
+            which is restored with a single block read at startup.  Changed
+            bytes are marked dirty and written back in the background, one
+            byte per EEPROM ready interrupt, once no further change has been
+            made for CONFIG_WRITE_DELAY seconds.  Nothing waits for the
+            EEPROM write time.
+
+            The last-known time is logged every CONFIG_LOG_INTERVAL seconds
+            to a ring of CONFIG_LOG_SLOTS entries, so that each EEPROM cell
+            is written only once per CONFIG_LOG_SLOTS log entries.
+------------------------------------------------------------------------------*/
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "power.h"
+
+// Seconds without further changes before settings are written back
+
+#define CONFIG_WRITE_DELAY  5
+
+// Seconds between last-known time log entries, and number of ring slots
+// With these values each EEPROM cell of the ring is written about 3300
+// times a year.
+
+#define CONFIG_LOG_INTERVAL 600
+#define CONFIG_LOG_SLOTS    16
+
+// Configuration block layout version
+// Must be changed whenever config_t changes, stored settings with another
+// version are replaced by the defaults
+
+#define CONFIG_VERSION      2
+
+// Persistent settings
+
+typedef struct {
+    uint8_t clock_24;       // Nonzero for 24 hour time display
+    uint8_t crossfade_rate; // Clock display crossfade rate, 0..MAX_NIXIE_CROSSFADE_RATE
+    uint8_t brightness;     // Clock display intensity, '*n' escape scale 0..9
+    uint8_t volume;         // Sound gain, 0..SOUND_MAX_GAIN
+    int16_t clock_trim;     // Oscillator trim, ppm (see clock_trim())
+    power_schedule_t power; // Display dim/blank schedule
+} config_t;
+
+//------------------------------------------------------------------------------
+
+// Public (exported) functions:
+
+// Restore settings from EEPROM (or defaults), must be called before
+// interrupts are enabled
+// Returns nonzero if stored settings were found
+
+uint8_t config_init(void);
+
+// Read the present settings
+
+void config_get(config_t *config);
+
+// Change settings, changed bytes are written back after CONFIG_WRITE_DELAY
+
+void config_put(const config_t *config);
+
+// Start writing back changed settings without waiting for CONFIG_WRITE_DELAY
+
+void config_flush(void);
+
+// Determine if any setting or log entry is waiting to be written
+
+uint8_t config_busy(void);
+
+// Read the most recently logged time
+// Returns nonzero if a valid log entry was found
+
+uint8_t config_last_time(uint32_t *seconds);
+
+// Read a byte of EEPROM without disturbing a background write
+
+uint8_t config_read_byte(const uint8_t *address);
+
+// Read/reset count of EEPROM bytes written
+
+uint16_t config_writes(uint8_t reset);
+
+// Write-back and log timing, must be called once per second
+
+void config_tick(void);
+
+#endif  // CONFIG_H
@@ -12,18 +12,56 @@ Target CPU: ATmega168 or ATmega328
 Content:    Event queue management
 
 Note:       All public functions in this library are thread-safe
+
+            When EVENT_TRACE is enabled (it is off by default, as it costs
+            about 250 bytes of RAM), each event carries the (low 16 bits
+            of the) TIMER0 tick count at which it occurred at its source:
+            the button_scan() sample that latched a button change, the first
+            encoder step since the last read, etc.  Every event removed from
+            the queue is logged with its removal time in a small ring buffer,
+            as is the start of each display change (nixie_crossfade()) that
+            follows user input.  event_trace_dump() prints the log, giving
+            the input-to-display latency.
 ------------------------------------------------------------------------------*/
 
 #ifndef EVENT_H
 #define EVENT_H
 
-// Size of event queue (number of pending events it can hold)
+#include <stdio.h>
+
+// Set to 1 (e.g. -DEVENT_TRACE=1) to add event timestamps and the event
+// trace to the build, for measuring input-to-display latency
+
+#ifndef EVENT_TRACE
+#define EVENT_TRACE         0
+#endif
+
+// Number of records kept by the event trace, must be a power of 2
+
+#define EVENT_TRACE_SIZE    16
+
+// Size of event queues (number of pending events each can hold)
+// Each event class (see EM_xxx masks below) has its own queue.
+
+#define EVENT_QUEUE_SIZE    8
+
+// Number of event classes
 
-#define EVENT_QUEUE_SIZE    16
+#define EVENT_CLASSES       9
+
+// Wake-source flags, passed to event_signal() by interrupt handlers
+
+#define EVENT_WAKE_BUTTON   (1 << 0)    // Button state latched by button_scan()
+#define EVENT_WAKE_ROTARY   (1 << 1)    // Rotary encoder moved
+#define EVENT_WAKE_TIMER    (1 << 2)    // Event timer expired
+#define EVENT_WAKE_SERIAL   (1 << 3)    // Serial data received
+#define EVENT_WAKE_QUEUE    (1 << 4)    // Event added to queue
+#define EVENT_WAKE_ALL      0x1F
 
 //------------------------------------------------------------------------------
 
-// Event type masks
+// Event class masks, used to select events fetched by get_next_event() and
+// wait_next_event().  A mask of 0 selects all events.
 
 #define EM_PRESSED          (1 << 0)
 #define EM_RELEASE          (1 << 1)
@@ -33,6 +71,11 @@ Note:       All public functions in this library are thread-safe
 #define EM_RIGHTR           (1 << 5)
 #define EM_CHORD            (1 << 6)
 #define EM_TIMER            (1 << 7)
+#define EM_DISPLAY          (1 << 8)
+
+#define EM_INPUT            (EM_PRESSED | EM_RELEASE | EM_SHORT | EM_LONG | \
+                             EM_LEFTR | EM_RIGHTR | EM_CHORD)
+#define EM_ALL              (EM_INPUT | EM_TIMER | EM_DISPLAY)
 
 // Event types
 //
@@ -81,11 +124,15 @@ typedef enum {
 
     BUTTON_CHORD,
 
-    RIGHT_ROTARY_MOVED,
+    RIGHT_ROTARY_MOVED,     // Signed data is position change (coalesced)
     LEFT_ROTARY_MOVED,
 
     TIMER_EXPIRED,
-    ONE_SECOND_ELAPSED
+    ONE_SECOND_ELAPSED,     // Data is number of seconds elapsed (coalesced)
+
+    CROSSFADE_DONE,         // Display crossfade started by nixie_crossfade() completed
+
+    DISPLAY_CHANGED         // Not queued; event trace record of a display change
 } event_id;
 
 // Event record
@@ -96,6 +143,9 @@ typedef struct {
         uint8_t data;
         int8_t signed_data;
     };
+#if EVENT_TRACE
+    uint16_t time;          // TIMER0 tick count when event occurred at source
+#endif
 } event_t;
 
 //------------------------------------------------------------------------------
@@ -104,23 +154,47 @@ typedef struct {
 
 void clear_events(void);
 
+// Discard pending events of the selected classes
+
+void flush_events(uint16_t mask);
+
 // Add a new event to the event queue
 
 void add_event(event_id event, uint8_t data);
 
+// Notify event manager of activity from an interrupt handler
+
+void event_signal(uint8_t source);
+
+// Sleep until an interrupt occurs, unless activity has been signalled
+
+void event_idle(void);
+
+// Read/reset count of events lost due to a full queue
+
+uint8_t event_overflows(uint8_t reset);
+
 // Remove/return an event from the event queue
 
-event_t get_next_event(uint8_t mask);
+event_t get_next_event(uint16_t mask);
 
 // Remove/return an event from the event queue.
 // Wait for a new event to occur if the queue is empty (blocking call)
 
-event_t wait_next_event(uint8_t mask);
+event_t wait_next_event(uint16_t mask);
 
 // Return next event in event queue, but do not remove it
 
 event_t unget_next_event(void);
 
+// Check event sources, return classes with events waiting (EM_xxx)
+
+uint16_t event_scan(void);
+
+// Determine class of an event (EM_xxx)
+
+uint16_t event_mask(event_id event);
+
 // Event identification functions
 
 uint8_t is_button_pressed_event(event_id event);
@@ -134,4 +208,12 @@ uint8_t is_right_rotary_event(event_id event);
 uint8_t is_rotary_event(event_id event);
 uint8_t is_timer_event(event_id event);
 
+// Log the start of a display change in the event trace
+
+void event_trace_display(void);
+
+// Print and clear the event trace
+
+void event_trace_dump(FILE *stream);
+
 #endif  // EVENT_H
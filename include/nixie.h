@@ -22,6 +22,10 @@ Content:    Nixie display driver routines
 
 #define NIXIE_SEGMENTS           64
 
+// Number of bytes needed to send one display bit-plane (1 bit per segment)
+
+#define NIXIE_PLANE_BYTES        (NIXIE_SEGMENTS / 8)
+
 // Number of segments per nixie digit (tube)
 
 #define NIXIE_SEGMENTS_PER_DIGIT 10
@@ -30,21 +34,71 @@ Content:    Nixie display driver routines
 
 #define NIXIE_DISPLAY_WIDTH     6
 
+// Display refresh uses binary-code modulation (BCM): each segment intensity
+// level is sent as NIXIE_BCM_BITS bit-planes, where bit-plane <n> is shown
+// for (NIXIE_BCM_UNIT << n) TIMER0 counts.  One full BCM frame therefore
+// lasts NIXIE_BCM_UNIT * ((1 << NIXIE_BCM_BITS) - 1) TIMER0 counts (about
+// 3mS, or ~330 full refreshes/sec when F_CPU = 16000000).
+// The longest bit-plane must be shorter than one TIMER0 period.
+
+#define NIXIE_BCM_BITS          6
+#define NIXIE_BCM_UNIT          3
+
+// Segment intensity levels are stored as NIXIE_LEVEL_BITS bits per segment,
+// packed two segments per byte (segment 2n in the low half of byte n), so
+// a display stream needs NIXIE_SEGDATA_BYTES of segment data.
+
+#define NIXIE_LEVEL_BITS        4
+#define NIXIE_LEVEL_MASK        ((1 << NIXIE_LEVEL_BITS) - 1)
+#define NIXIE_SEGDATA_BYTES     (NIXIE_SEGMENTS / 2)
+
 // Number of allowable intensity levels: 0 is off, MAX_NIXIE_INTENSITY is
 // full-on.
-// This value, along with the TIMER0 OCR0A interrupt rate (625x/sec when
-// F_CPU = 16000000), determines the display PWM period.
 
-#define MAX_NIXIE_INTENSITY     9
+#define MAX_NIXIE_INTENSITY     NIXIE_LEVEL_MASK
+
+// Convert an intensity level to a BCM value (0..(1 << NIXIE_BCM_BITS) - 1)
+// The level bits are replicated into the low bits, so full-on stays full-on.
+
+#define NIXIE_LEVEL_TO_BCM(l)   (((l) << (NIXIE_BCM_BITS - NIXIE_LEVEL_BITS)) | \
+                                 ((l) >> (2 * NIXIE_LEVEL_BITS - NIXIE_BCM_BITS)))
 
 // Default/normal nixie intensity level ('~' level)
 
-#define NOMINAL_NIXIE_INTENSITY 9
+#define NOMINAL_NIXIE_INTENSITY MAX_NIXIE_INTENSITY
+
+// Convert a '*n' intensity escape digit (0..9) to an intensity level
+
+#define NIXIE_INTENSITY_STEP(n) (((n) * MAX_NIXIE_INTENSITY + 4) / 9)
 
 // Maximum (slowest) nixie display crossfade rate
 
 #define MAX_NIXIE_CROSSFADE_RATE 3
 
+// BCM frames per crossfade level step at the fastest crossfade rate
+// Each level spans about this many BCM values, so a fade takes as long as
+// if every BCM value were stepped through.
+
+#define NIXIE_FADE_FRAMES       (1 << (NIXIE_BCM_BITS - NIXIE_LEVEL_BITS))
+
+// Global dimming (see nixie_display_dim()): each bit-plane is shown for
+// (level / NIXIE_DIM_FULL) of its time, and blanked for the rest.  Levels
+// are 0 (blank) .. NIXIE_DIM_FULL (full intensity).
+
+#define NIXIE_DIM_BITS          5
+#define NIXIE_DIM_FULL          (1 << NIXIE_DIM_BITS)
+
+// Shortest lit or blanked part of a dimmed bit-plane, TIMER0 counts
+// The refresh interrupt may be held off by other interrupts for longer than
+// one count, so shorter parts are rounded to all-lit or all-blanked and the
+// difference is carried over to the next bit-plane.
+
+#define NIXIE_DIM_MIN_COUNTS    NIXIE_BCM_UNIT
+
+// BCM frames each cathode is lit for by the cathode exercise (about 100mS)
+
+#define NIXIE_EXERCISE_FRAMES   32
+
 // Digit offsets for neon lamps (as used by set_nixie_segment())
 
 #define NIXIE_LEFT_LAMP         (NIXIE_DISPLAY_WIDTH + 0)
@@ -52,6 +106,18 @@ Content:    Nixie display driver routines
 #define NIXIE_AUX_A             (NIXIE_DISPLAY_WIDTH + 2)
 #define NIXIE_AUX_B             (NIXIE_DISPLAY_WIDTH + 3)
 
+// Number of digits, including neon lamp/AUX pseudo-digits
+
+#define NIXIE_DIGITS            (NIXIE_DISPLAY_WIDTH + 4)
+
+// BCD nibble value shown as a blank digit by nixie_put_bcd()
+
+#define NIXIE_BCD_BLANK         0x0F
+
+// Dirty-digit bitmap value with all digits marked as changed
+
+#define NIXIE_DIRTY_ALL         ((uint16_t) ((1 << NIXIE_DIGITS) - 1))
+
 //------------------------------------------------------------------------------
 
 // Output control flags used by nixie_out()
@@ -83,35 +149,102 @@ typedef enum {
 // stdio FILE structure.
 
 typedef struct {
-    uint8_t *segdata;                   // Pointer to display segment intensity buffer
+    uint8_t *segdata;                   // Pointer to display segment intensity buffer (packed)
     uint8_t cursor;                     // Cursor position, next char output here
     uint8_t intensity;                  // Intensity level of segments written
     state_t state;                      // Output mode, see state_t
     control_t control;                  // Output control flags
+    uint16_t dirty;                     // Digits changed since last crossfade, bit n = digit n
 } nixie_stream_t;
 
+// Display layer, shows some digits of another stream on top of the
+// displayed stream (see nixie_layer_init())
+
+typedef struct nixie_layer {
+    struct nixie_layer *next;           // Next (same or lower priority) layer
+    nixie_stream_t *stream;             // Stream whose segments are shown
+    uint16_t mask;                      // Digits owned by the layer, bit n = digit n
+    uint8_t priority;                   // Higher priority layers are shown on top
+    uint8_t visible;                    // Layer is shown if nonzero
+} nixie_layer_t;
+
 //------------------------------------------------------------------------------
 
 // Perform nixie display refresh (typically called from interrupt)
-void nixie_display_refresh(void);
+// Returns the number of TIMER0 counts until the next call
+uint8_t nixie_display_refresh(void);
+
+// Start sending the following bit-plane, after nixie_display_refresh()
+// (kept apart so that the next refresh can be scheduled first)
+void nixie_display_queue(void);
 
 // Enable or disable nixie display
 void nixie_display_enable(uint8_t enable);
 
+// Scale the intensity of the whole display, 0..NIXIE_DIM_FULL
+void nixie_display_dim(uint8_t level);
+
+// Read the global dimming level
+uint8_t nixie_display_level(void);
+
+// Light every cathode of every tube in turn, <passes> times over
+// (runs from interrupts, 0 stops an exercise in progress)
+void nixie_exercise(uint8_t passes);
+
+// Determine if a cathode exercise is in progress
+uint8_t nixie_exercise_busy(void);
+
+// Cathode exercise service, steps an exercise in progress
+// Must be called periodically (typically from the timer tick interrupt)
+void nixie_exercise_service(void);
+
 // Set up a nixie display output stream (create 'virtual' displays)
 void nixie_stream_init(FILE *stream, nixie_stream_t *control, uint8_t *segdata);
 
 // Select output stream to present on nixie display
 void nixie_show_stream(FILE *stream);
 
+// Replace the entire segment pattern of a display stream
+// (tear-free: a displayed stream changes at the next BCM frame boundary)
+void nixie_load_frame(FILE *stream, const uint8_t *frame);
+
+// Read/reset count of frames replaced before they could be shown
+uint8_t nixie_frame_drops(uint8_t reset);
+
+// Add a display layer (initially hidden) on top of the displayed stream
+void nixie_layer_init(nixie_layer_t *layer, FILE *stream, uint16_t mask, uint8_t priority);
+
+// Remove a display layer
+void nixie_layer_remove(nixie_layer_t *layer);
+
+// Show or hide a display layer
+void nixie_layer_show(nixie_layer_t *layer, uint8_t visible);
+
+// Change the digits owned by a display layer
+void nixie_layer_mask(nixie_layer_t *layer, uint16_t mask);
+
 // Cross-fade display from current display segment pattern to another
+// (returns immediately, CROSSFADE_DONE event is posted when complete)
 void nixie_crossfade(FILE *to_stream);
 
+// Determine if a crossfade is in progress
+uint8_t nixie_crossfade_busy(void);
+
+// Crossfade service, steps a crossfade in progress
+// Must be called periodically (typically from the timer tick interrupt)
+void nixie_crossfade_service(void);
+
 // Set nixie display crossfade rate
 void nixie_crossfade_rate(uint8_t rate);
 
 // Character-oriented output to a display stream, stdio-compatible
 // Converts character data to a nixie segment pattern
-int16_t nixie_out(char ch, FILE *stream);
+int nixie_out(char ch, FILE *stream);
+
+// Write a two-digit packed BCD value into a display stream (bypasses stdio)
+void nixie_put_bcd(FILE *stream, uint8_t digit, uint8_t bcd);
+
+// Set the neon lamps of a display stream (bypasses stdio)
+void nixie_put_lamps(FILE *stream, uint8_t left, uint8_t right);
 
 #endif  // NIXIE_H
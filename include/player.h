@@ -17,26 +17,30 @@ Content:    Simple single-note music player, loosely based on IBM/GWBASIC
 #define BEEPER_H
 
 // Invocation rate for player_service(), calls per second
+// player_service() is called from the TIMER2 compare interrupt, so this
+// must match TIMER2_FREQUENCY (see timer.h)
 
-#define PLAYER_TICKS_PER_SECOND  625
+#define PLAYER_TICKS_PER_SECOND  500
 
-// Type definitions
+// Size of compiled player code buffer, bytes (max. 255)
+// Each note or rest takes 2 bytes.  Play strings too long to fit are
+// played up to the point at which the buffer filled.
+
+#define PLAYER_CODE_SIZE    128
+
+// Maximum number of distinct note/rest durations in a play string
+// When playing a stream, the code buffer and duration table are each split
+// into two halves, so PLAYER_DURATIONS must be even.
 
-typedef enum {              // Timer prescaler options
-    PRESCALE_STOP = 0,      //   Timer stopped 
-    PRESCALE_1 = 1,         //   F_CPU / 1
-    PRESCALE_8 = 2,         //   F_CPU / 8
-    PRESCALE_64 = 3,        //   F_CPU / 64
-    PRESCALE_256 = 4,       //   F_CPU / 256
-    PRESCALE_1024 = 5,      //   F_CPU / 1024
-    PRESCALE_EXT_L = 6,     //   External, falling edge
-    PRESCALE_EXT_H = 7      //   External, rising edge
-} prescale_t;
+#define PLAYER_DURATIONS    16
+
+// Type definitions
 
 typedef enum {              // Player string memory space fetch options
     PLAYER_MEM_RAM,         //   Fetch player string from RAM
     PLAYER_MEM_PGM,         //   Fetch player string from FLASH/program memory
     PLAYER_MEM_EEPROM,      //   Fetch player string from EEPROM
+    PLAYER_MEM_STREAM,      //   Read player string from serial port
     PLAYER_MEM_UNKNOWN
 } player_space_t;
 
@@ -44,22 +48,6 @@ typedef enum {              // Player string memory space fetch options
 
 // Public (exported) functions:
 
-// Turn on tone generator
-
-void beep_period(uint16_t period, prescale_t prescale);
-
-// Turn off tone generator (set output volume to 0)
-
-void beep_mute(uint8_t mute);
-
-// Set output volume
-
-void beep_gain(uint8_t gain);
-
-// Initialize tone generator (timer)
-
-void beeper_init(void);
-
 // Start playing a music string (init music player)
 
 void player_start(const char *str, player_space_t mem_space);
@@ -72,6 +60,16 @@ void player_stop(void);
 
 uint8_t player_is_stopped(void);
 
+// Read and compile a stream started with PLAYER_MEM_STREAM
+// Must be called regularly until it returns 0.  Bookmarks ([ and ]) are
+// not supported in streams and are ignored.
+
+uint8_t player_poll(void);
+
+// Read/reset count of times a stream could not be read fast enough
+
+uint8_t player_underruns(uint8_t reset);
+
 // Player service, interprets and plays a music string
 // Must be called periodically (typically from a timer interrupt)
 
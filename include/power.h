@@ -0,0 +1,100 @@
+/*------------------------------------------------------------------------------
+Name:       power.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: ATmega168 or ATmega328
+
+Content:    Display power management
+
+            Once a second the global display dimming level (see
+            nixie_display_dim()) is set to the lowest of:
+
+            - POWER_DIM_LEVEL during the scheduled dim window, or 0 (blank)
+              during the blank window
+            - POWER_IDLE_LEVEL after the idle-dim time without user input,
+              or 0 after the idle-blank time
+            - The ambient light level, if a light sensor is fitted
+
+            User input (any button or encoder event) undoes idle dimming
+            within a second, and overrides the blank window for
+            POWER_WAKE_TIME seconds.  The level falls by POWER_FADE_STEP per
+            second, and rises straight away.
+
+            Once an hour, on the hour, each cathode of every tube is lit in
+            turn (see nixie_exercise()) unless the display is blanked.
+------------------------------------------------------------------------------*/
+
+#ifndef POWER_H
+#define POWER_H
+
+// Set to 1 if a light sensor is connected to ADC input POWER_LIGHT_CHANNEL
+// The reading must rise with the ambient light level.
+
+#ifndef POWER_LIGHT_SENSOR
+#define POWER_LIGHT_SENSOR  0
+#endif
+
+// ADC input of the light sensor
+// ADC6 and ADC7 are analog-only inputs (TQFP/QFN packages), so fitting a
+// sensor does not take a port pin away from anything else.
+
+#define POWER_LIGHT_CHANNEL 7
+
+// Dimming levels, 0 (blank) .. NIXIE_DIM_FULL
+
+#define POWER_DIM_LEVEL     (NIXIE_DIM_FULL / 4)    // Scheduled dim window
+#define POWER_IDLE_LEVEL    (NIXIE_DIM_FULL / 2)    // No recent user input
+#define POWER_LIGHT_MIN     (NIXIE_DIM_FULL / 8)    // Light sensor in darkness
+
+// Level decrease per second while dimming
+
+#define POWER_FADE_STEP     2
+
+// Seconds the display stays on after user input during the blank window
+
+#define POWER_WAKE_TIME     30
+
+// Passes through all cathodes made by the hourly cathode exercise
+
+#define POWER_EXERCISE_PASSES 2
+
+// Power management schedule
+// Hours are 0..23.  A window starts at the start of its <start> hour and
+// ends at the start of its <end> hour, and is disabled if <start> equals
+// <end>.  Idle times of 0 are disabled.
+
+typedef struct {
+    uint8_t dim_start;      // Dim window
+    uint8_t dim_end;
+    uint8_t blank_start;    // Blank window
+    uint8_t blank_end;
+    uint8_t idle_dim;       // Minutes without user input before dimming
+    uint8_t idle_blank;     // Minutes without user input before blanking
+} power_schedule_t;
+
+//------------------------------------------------------------------------------
+
+// Public (exported) functions:
+
+// Initialize power management (and light sensor ADC, if fitted)
+
+void power_init(const power_schedule_t *schedule);
+
+// Change the power management schedule
+
+void power_schedule(const power_schedule_t *schedule);
+
+// Note user input, safe to call from interrupt handlers
+
+void power_activity(void);
+
+// Power management service, must be called once per second
+
+void power_tick(void);
+
+#endif  // POWER_H
@@ -0,0 +1,115 @@
+/*------------------------------------------------------------------------------
+Name:       profile.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: ATmega168 or ATmega328
+
+Content:    Interrupt service cycle-budget profiler
+
+            Each profiled stage is timestamped on entry and exit using the
+            TIMER2 counter (TIMER2_US_PER_TICK resolution).  Minimum,
+            maximum and mean execution times, the worst-case number of
+            passes through a stage's inner loop, and the number of times a
+            stage was re-entered before it finished (overruns) are kept in
+            RAM and can be printed with profile_dump().
+------------------------------------------------------------------------------*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+
+// Set to 0 to remove all profiler instrumentation from the build
+
+#ifndef PROFILE_ENABLE
+#define PROFILE_ENABLE      1
+#endif
+
+// Profiled stages
+// Keep in step with the stage name table in profile.c
+
+typedef enum {
+    PROFILE_TICK,           // Entire TIMER0_COMPA (system tick) interrupt
+    PROFILE_REFRESH,        // nixie_display_queue(), TIMER0_COMPB interrupt
+    PROFILE_CROSSFADE,      // nixie_crossfade_service()
+    PROFILE_BUTTON,         // button_scan()
+    PROFILE_TIMER,          // timer_update()
+    PROFILE_PLAYER,         // player_service(), TIMER2_COMPA interrupt
+    PROFILE_STAGES          // Not a stage, number of stages
+} profile_stage_t;
+
+// Statistics for one stage, as returned by profile_summary()
+
+typedef struct {
+    uint16_t min;           // Shortest run, microseconds
+    uint16_t max;           // Longest run, microseconds
+    uint16_t mean;          // Mean run time, microseconds
+    uint8_t max_passes;     // Largest number of inner loop passes in a run
+    uint8_t overruns;       // Number of times the stage was re-entered
+    uint16_t samples;       // Number of runs measured
+} profile_summary_t;
+
+//------------------------------------------------------------------------------
+
+// Instrumentation macros
+//
+// PROFILE_START() and PROFILE_END() must be used in pairs, in the same
+// block, around the code to be measured.  PROFILE_PASS() marks one pass
+// through a loop inside a stage that is being measured.  PROFILE_OVERRUN()
+// records an overrun detected by other means, such as a stage whose
+// interrupt is masked while it runs.
+
+#if PROFILE_ENABLE
+
+#define PROFILE_START(stage)    uint8_t profile_t_##stage = profile_start(stage)
+#define PROFILE_END(stage)      profile_end(stage, profile_t_##stage)
+#define PROFILE_PASS(stage)     profile_pass(stage)
+#define PROFILE_OVERRUN(stage)  profile_overrun(stage)
+
+#else
+
+#define PROFILE_START(stage)
+#define PROFILE_END(stage)
+#define PROFILE_PASS(stage)
+#define PROFILE_OVERRUN(stage)
+
+#endif
+
+//------------------------------------------------------------------------------
+
+// Public (exported) functions:
+
+// Mark entry to a stage, returns timestamp to be passed to profile_end()
+
+uint8_t profile_start(profile_stage_t stage);
+
+// Mark exit from a stage, update statistics
+
+void profile_end(profile_stage_t stage, uint8_t start);
+
+// Count one pass through a stage's inner loop
+
+void profile_pass(profile_stage_t stage);
+
+// Count an overrun of a stage
+
+void profile_overrun(profile_stage_t stage);
+
+// Clear all collected statistics
+
+void profile_reset(void);
+
+// Read collected statistics for one stage
+
+void profile_summary(profile_stage_t stage, profile_summary_t *summary);
+
+// Print collected statistics
+
+void profile_dump(FILE *stream);
+
+#endif  // PROFILE_H
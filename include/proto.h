@@ -0,0 +1,94 @@
+/*------------------------------------------------------------------------------
+Name:       proto.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: ATmega168 or ATmega328
+
+Content:    Binary framed host command/telemetry protocol
+
+            Frame format (all multi-byte values little-endian):
+
+            <PROTO_SYNC> <length> <type> <payload...> <crc lo> <crc hi>
+
+            <length> is the number of payload bytes (0..PROTO_MAX_PAYLOAD).
+            The CRC is CRC-16/XMODEM (polynomial 0x1021, initial value 0)
+            calculated over <length>, <type> and the payload.
+
+            Every valid command frame is answered by a frame of type
+            (<type> | PROTO_REPLY).  Frames with a bad CRC or length are
+            answered by a PROTO_NAK frame.  Unless noted otherwise, the reply
+            payload is a single PROTO_STATUS_xxx byte.
+------------------------------------------------------------------------------*/
+
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdio.h>
+
+// Frame start marker
+// Not a printable or control character, so frames may be mixed with
+// terminal input
+
+#define PROTO_SYNC          0xA5
+
+// Largest payload accepted (telemetry reply)
+
+#define PROTO_MAX_PAYLOAD   65
+
+// Frame is abandoned if the next byte does not arrive within this time
+// (TIMER0 ticks)
+
+#define PROTO_TIMEOUT       MS_TO_TICKS(100)
+
+// Command frame types
+
+#define PROTO_PING          0x00    // No payload; reply payload is protocol version
+#define PROTO_SET_CLOCK     0x01    // Set time and date: hour minute second year(2) month day
+#define PROTO_GET_CLOCK     0x02    // No payload; reply payload as PROTO_SET_CLOCK
+#define PROTO_FRAME         0x03    // Load display stream: stream # (0,1) + NIXIE_SEGDATA_BYTES
+                                    // packed levels (segment 2n in low 4 bits of byte n)
+                                    // A displayed stream changes between refresh frames (no tearing)
+#define PROTO_PLAY          0x04    // Play string (no terminator); empty payload stops player
+#define PROTO_TELEMETRY     0x05    // Optional reset flag; reply payload is telemetry (see proto.c)
+#define PROTO_TRIM          0x06    // Set clock trim: ppm(2, signed); no payload reads trim(2)
+#define PROTO_POWER         0x07    // Set power schedule: dim start/end, blank start/end (hours),
+                                    // idle dim/blank (minutes); no payload reads schedule
+
+#define PROTO_REPLY         0x80    // Added to command type in reply frames
+#define PROTO_NAK           0xFF    // Reply to a frame that could not be received
+
+// Reply status codes
+
+#define PROTO_STATUS_OK     0
+#define PROTO_STATUS_LENGTH 1       // Payload length incorrect for command
+#define PROTO_STATUS_VALUE  2       // Parameter out of range
+#define PROTO_STATUS_TYPE   3       // Unknown command type
+#define PROTO_STATUS_CRC    4       // CRC mismatch
+
+// Protocol version returned by PROTO_PING
+
+#define PROTO_VERSION       3
+
+//------------------------------------------------------------------------------
+
+// Public (exported) functions:
+
+// Select the display streams loaded by PROTO_FRAME commands
+
+void proto_init(FILE *stream0, FILE *stream1);
+
+// Process one byte of serial input
+// Returns nonzero if the byte was taken as part of a frame
+
+uint8_t proto_input(uint8_t ch);
+
+// Read/reset count of frames received with a bad CRC or length
+
+uint8_t proto_errors(uint8_t reset);
+
+#endif  // PROTO_H
@@ -15,13 +15,33 @@ Content:    Rotary encoder support
 #ifndef ROTARY_H
 #define ROTARY_H
 
+// Encoder numbers, used by rotary_acceleration()
+
+#define ROTARY_LEFT         0
+#define ROTARY_RIGHT        1
+#define ROTARY_ENCODERS     2
+
+//------------------------------------------------------------------------------
+
+// Public (exported) functions:
+
 void rotary_init(void);
 
+void rotary_acceleration(uint8_t index, uint8_t enable);
+
 uint8_t rotary_status(void);
 
+// Read/reset count of invalid encoder transitions
+
+uint8_t rotary_errors(uint8_t reset);
+
+// Read time of the first step not yet read
+
+uint16_t rotary_timestamp(uint8_t index);
+
 int8_t left_rotary_relative(void);
-int8_t left_rotary_absolute(void);
+int16_t left_rotary_absolute(void);
 int8_t right_rotary_relative(void);
-int8_t right_rotary_absolute(void);
+int16_t right_rotary_absolute(void);
 
 #endif
@@ -54,10 +54,17 @@ enum serial_io_mode {
 #endif
 
 // Set the size of the transmit and receive buffers
-// Limit: 256 bytes unless SERIAL_LARGE_BUFFERS is undefined
+// Sizes must be powers of 2.
+// Limit: 128 bytes unless SERIAL_LARGE_BUFFERS is defined
 
-#define RX_BUFSIZE      16
-#define TX_BUFSIZE      32
+#define RX_BUFSIZE      32
+#define TX_BUFSIZE      64
+
+// Receive buffer fill levels at which XOFF and XON are sent, when flow
+// control is enabled (see serial_flow_control())
+
+#define RX_XOFF_LEVEL   (RX_BUFSIZE / 2)
+#define RX_XON_LEVEL    (RX_BUFSIZE / 4)
 
 //-----------------------------------------------------------------------------
 
@@ -121,6 +128,10 @@ void serial_in_blocking(uint8_t mode);
 
 void serial_out_blocking(uint8_t mode);
 
+// Enable or disable XON/XOFF flow control for serial input
+
+void serial_flow_control(uint8_t mode);
+
 // Check if serial input buffer is empty
 
 uint8_t serial_in_empty(void);
@@ -137,6 +148,14 @@ serial_t serial_in_used(void);
 
 serial_t serial_in_free(void);
 
+// Get pointer to and length of contiguous data in the serial input buffer
+
+serial_t serial_in_span(const uint8_t **data);
+
+// Remove data read through serial_in_span() from the serial input buffer
+
+void serial_in_consume(serial_t count);
+
 // Check if serial output buffer is empty
 
 uint8_t serial_out_empty(void);
@@ -157,6 +176,14 @@ serial_t serial_out_used(void);
 
 serial_t serial_out_free(void);
 
+// Get pointer to and length of contiguous free space in the serial output buffer
+
+serial_t serial_out_span(uint8_t **data);
+
+// Queue data written through serial_out_span() for transmission
+
+void serial_out_commit(serial_t count);
+
 // Initialize the serial port (USART0)
 
 uint16_t serial_init(uint16_t baud, uint8_t mode);
@@ -169,6 +196,18 @@ int16_t serial_in(void);
 
 void serial_out(uint8_t data);
 
+// Write block of data in RAM to the serial output buffer
+
+uint16_t serial_write(const void *data, uint16_t length);
+
+// Write block of data in program space (FLASH) to the serial output buffer
+
+uint16_t serial_write_P(const void *data, uint16_t length);
+
+// Read block of data from the serial input buffer
+
+uint16_t serial_read(void *data, uint16_t length);
+
 // Output CR/LF sequence
 
 void serial_crlf(void);
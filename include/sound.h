@@ -0,0 +1,81 @@
+/*------------------------------------------------------------------------------
+Name:       sound.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: ATmega168/328
+
+Content:    Wavetable (DDS) sound generator
+------------------------------------------------------------------------------*/
+
+#ifndef SOUND_H
+#define SOUND_H
+
+// Number of voices mixed by the sample interrupt
+
+#define SOUND_VOICES        3
+
+// TIMER1 PWM period (TOP value)
+// The PWM carrier frequency, which is also the sample rate, is
+// F_CPU / (SOUND_PWM_TOP + 1): 31.25 kHz with a 16 MHz clock
+
+#define SOUND_PWM_TOP       511
+#define SOUND_SAMPLE_RATE   (F_CPU / (SOUND_PWM_TOP + 1))
+
+// Number of notes in the note table
+// Notes are numbered (octave * 12 + semitone), C0 = 0, B9 = 119
+
+#define SOUND_NOTES         120
+
+// Volume range accepted by sound_gain()
+
+#define SOUND_MAX_GAIN      7
+
+// Envelope timing, in level change (0..255) per sound_service() call
+
+#define SOUND_ATTACK_STEP   64
+#define SOUND_DECAY_STEP    4
+#define SOUND_SUSTAIN_LEVEL 160
+#define SOUND_RELEASE_STEP  16
+
+//------------------------------------------------------------------------------
+
+// Public (exported) functions:
+
+// Initialize sound generator (TIMER1 and output pin)
+
+void sound_init(void);
+
+// Start playing a note on a voice
+
+void sound_note(uint8_t voice, uint8_t note);
+
+// End the note playing on a voice (fades out)
+
+void sound_release(uint8_t voice);
+
+// Silence all voices immediately
+
+void sound_off(void);
+
+// Mute or un-mute output
+
+void sound_mute(uint8_t mute);
+
+// Set output volume, 0..SOUND_MAX_GAIN
+
+void sound_gain(uint8_t gain);
+
+// Determine if any voice is sounding
+
+uint8_t sound_active(void);
+
+// Envelope service, must be called periodically (PLAYER_TICKS_PER_SECOND)
+
+void sound_service(void);
+
+#endif  // SOUND_H
@@ -17,10 +17,34 @@ Content:    SPI (Serial Peripheral Interface) support routines - header
 
 #include <stdint.h>
 
+// Transfer option flags for spi_data_queue()
+
+#define SPI_LATCH           (1 << 0)    // Pulse display driver latch when done
+
 //-----------------------------------------------------------------------------
 
+// Initialize SPI subsystem
+
 void spi_init(void);
 
-void spi_data_out(void *data, uint8_t size);
+// Start an interrupt-driven transfer (returns 0 if SPI is busy)
+
+uint8_t spi_data_queue(const void *data, uint8_t size, uint8_t flags);
+
+// Determine if a transfer is in progress
+
+uint8_t spi_busy(void);
+
+// Wait for transfer in progress to finish
+
+void spi_wait(void);
+
+// Pulse display driver latch pin
+
+void spi_latch(void);
+
+// Send a data block, latch it into the display driver when done
+
+void spi_data_out(const void *data, uint8_t size);
 
 #endif
@@ -0,0 +1,192 @@
+/*------------------------------------------------------------------------------
+Name:       task.h
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: ATmega168 or ATmega328
+
+Content:    Cooperative (stackless) task scheduler
+
+            A task is a function that is called again and again by
+            task_run(), and that returns to it whenever it has to wait.
+            The TASK_xxx wait macros record where the task stopped, and it
+            carries on from there the next time it is called, so a task
+            reads as a simple loop, like the blocking UI code it replaces:
+
+                static void Blink(task_t *task)
+                {
+                    TASK_BEGIN(task);
+                    do {
+                        TASK_WAIT_EVENT(task, EM_PRESSED);
+                        ...
+                        TASK_DELAY(task, MS_TO_TICKS(500));
+                    } while (1);
+                    TASK_END(task);
+                }
+
+            Rules for task functions:
+
+            - Local variables are NOT preserved across a wait, anything
+              that must be kept has to be static (or in a static structure)
+            - The wait macros may only be used in the task function itself,
+              not in functions it calls, and at most one may be used per
+              source line
+            - Blocking calls (wait_next_event(), delay_ms() etc.) hold up
+              every other task, and must not be used
+
+            Events are fetched by the scheduler, and each one is given to
+            every task waiting for an event of its class.  Each task also
+            names the event classes it handles when it is started: events of
+            those classes are kept while the task runs, waiting or not (e.g.
+            during a TASK_DELAY()), and handed over when it next waits for
+            them.  Events of classes that no task handles or is waiting for
+            are discarded.  The CPU is put to sleep (event_idle()) when no
+            task has anything to do.
+------------------------------------------------------------------------------*/
+
+#ifndef TASK_H
+#define TASK_H
+
+#include <stddef.h>
+
+#include "event.h"
+#include "timer.h"
+
+// Task wait flags (task_t.wait)
+
+#define TASK_DONE           0x00    // Not running
+#define TASK_READY          0x01    // Run again as soon as possible
+#define TASK_POLL           0x02    // Run again after each interrupt (condition test)
+#define TASK_EVENT          0x04    // Run when an event of the waited-for classes arrives
+
+// Task control block
+
+typedef struct task task_t;
+
+typedef void (*task_fn_t)(task_t *task);
+
+struct task {
+    task_t *next;           // Next task in run queue
+    task_fn_t run;          // Task function
+    void *resume;           // Where the task function carries on, NULL at start
+    uint8_t wait;           // What the task is waiting for, TASK_xxx flags
+    uint16_t mask;          // Event classes waited for (EM_xxx), with TASK_EVENT
+    uint16_t keep;          // Event classes kept for the task while it runs (EM_xxx)
+    uint16_t until;         // TASK_DELAY() end time, TIMER0 ticks (low 16 bits)
+    event_t event;          // Event that woke the task, NO_EVENT if none
+};
+
+//------------------------------------------------------------------------------
+
+// Task function wait macros
+
+#define TASK_LABEL_(line)   task_resume_##line
+#define TASK_LABEL(line)    TASK_LABEL_(line)
+
+// Start of task function body, carries on from the last wait
+
+#define TASK_BEGIN(task)                                                    \
+    do {                                                                    \
+        if ((task)->resume) {                                               \
+            goto *(task)->resume;                                           \
+        }                                                                   \
+    } while (0)
+
+// End the task (also ends when the task function returns)
+
+#define TASK_END(task)                                                      \
+    do {                                                                    \
+        (task)->wait = TASK_DONE;                                           \
+        return;                                                             \
+    } while (0)
+
+// Let other tasks run, then carry on
+// (the scheduler clears task->wait before calling the task function)
+
+#define TASK_YIELD(task)                                                    \
+    do {                                                                    \
+        (task)->resume = &&TASK_LABEL(__LINE__);                            \
+        (task)->wait = TASK_READY;                                          \
+    TASK_LABEL(__LINE__):                                                   \
+        if ((task)->wait == TASK_READY) {                                   \
+            return;                                                         \
+        }                                                                   \
+    } while (0)
+
+// Wait until <cond> is true
+// <cond> is tested each time an interrupt has occurred
+
+#define TASK_WAIT_UNTIL(task, cond)                                         \
+    do {                                                                    \
+        (task)->resume = &&TASK_LABEL(__LINE__);                            \
+    TASK_LABEL(__LINE__):                                                   \
+        if (!(cond)) {                                                      \
+            (task)->wait = TASK_POLL;                                       \
+            return;                                                         \
+        }                                                                   \
+    } while (0)
+
+// Wait for an event of the classes selected by <classes> (EM_xxx)
+// The event is left in task->event
+
+#define TASK_WAIT_EVENT(task, classes)                                      \
+    do {                                                                    \
+        (task)->mask = (classes);                                           \
+        (task)->event.event = NO_EVENT;                                     \
+        (task)->resume = &&TASK_LABEL(__LINE__);                            \
+    TASK_LABEL(__LINE__):                                                   \
+        if ((task)->event.event == NO_EVENT) {                              \
+            (task)->wait = TASK_EVENT;                                      \
+            return;                                                         \
+        }                                                                   \
+    } while (0)
+
+// Wait for an event of the classes selected by <classes>, or until <cond>
+// is true.  task->event is NO_EVENT if the wait ended because of <cond>.
+
+#define TASK_WAIT_EVENT_UNTIL(task, classes, cond)                          \
+    do {                                                                    \
+        (task)->mask = (classes);                                           \
+        (task)->event.event = NO_EVENT;                                     \
+        (task)->resume = &&TASK_LABEL(__LINE__);                            \
+    TASK_LABEL(__LINE__):                                                   \
+        if (((task)->event.event == NO_EVENT) && !(cond)) {                 \
+            (task)->wait = TASK_EVENT | TASK_POLL;                          \
+            return;                                                         \
+        }                                                                   \
+    } while (0)
+
+// Wait for <ticks> TIMER0 ticks (at most 32767)
+
+#define TASK_DELAY(task, ticks)                                             \
+    do {                                                                    \
+        (task)->until = (uint16_t) timer_ticks() + (ticks);                 \
+        TASK_WAIT_UNTIL(task,                                               \
+            (int16_t) ((uint16_t) timer_ticks() - (task)->until) >= 0);     \
+    } while (0)
+
+//------------------------------------------------------------------------------
+
+// Public (exported) functions:
+
+// Add a task to the run queue, or restart it from the beginning
+
+void task_start(task_t *task, task_fn_t run, uint16_t keep);
+
+// End a task
+
+void task_stop(task_t *task);
+
+// Determine if a task is running
+
+uint8_t task_running(const task_t *task);
+
+// Run tasks until none are left
+
+void task_run(void);
+
+#endif  // TASK_H
@@ -30,9 +30,27 @@ Content:    "Heartbeat" timing ISR, used for RTC, timing functions, and
 
 #define TIMER0_FREQUENCY    (F_CPU / TIMER0_PRESCALER / TIMER0_PERIOD_TICKS)
 
+// Timer 2 period and prescaler
+// Prescaler must be one of: 1, 8, 32, 64, 128, 256, 1024
+// TIMER2 drives timekeeping (clock_tick()) and the music player
+// (PLAYER_TICKS_PER_SECOND), and its counter is used as a timebase to
+// timestamp profiled code
+
+#define TIMER2_PERIOD_TICKS 250
+#define TIMER2_PRESCALER    128
+
+// Timer 2 frequency (Hz) and resolution (microseconds per count)
+
+#define TIMER2_FREQUENCY    (F_CPU / TIMER2_PRESCALER / TIMER2_PERIOD_TICKS)
+#define TIMER2_US_PER_TICK  (TIMER2_PRESCALER / (F_CPU / 1000000UL))
+
 // Number of general-purpose event timers to allocate
 
-#define NUM_EVENT_TIMERS    8
+#define NUM_EVENT_TIMERS    16
+
+// Timer ID returned when no timer is available/expired
+
+#define TIMER_NONE          0xFF
 
 //------------------------------------------------------------------------------
 
@@ -56,7 +74,10 @@ void timer_restart(uint8_t timer_id, uint16_t period, uint8_t recurring);
 void timer_reset(uint8_t timer_id);
 uint16_t timer_read(uint8_t timer_id);
 uint8_t timer_expired(uint8_t timer_id, uint8_t reset);
+uint8_t timer_next_expired(void);
 uint8_t timer_status(void);
+uint32_t timer_expiry(uint8_t timer_id);
+uint32_t timer_ticks(void);
 
 #endif  // TIMER_H
 
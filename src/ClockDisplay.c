@@ -20,7 +20,6 @@ Content:    Clock display top level: Display time & date
 #include <stdio.h>
 
 #include "portdef.h"
-#include "delay.h"
 #include "serial.h"
 #include "nixie.h"
 #include "player.h"
@@ -28,6 +27,10 @@ Content:    Clock display top level: Display time & date
 #include "event.h"
 #include "timer.h"
 #include "clock.h"
+#include "profile.h"
+#include "proto.h"
+#include "config.h"
+#include "task.h"
 
 //------------------------------------------------------------------------------
 
@@ -35,19 +38,64 @@ Content:    Clock display top level: Display time & date
 #define MAX_YEAR                2099
 
 #define BLINK_LOW_INTENSITY     '1'
-#define BLINK_HIGH_INTENSITY    '9'
-#define NORMAL_INTENSITY        '9'
+
+// Events handled by the main clock display loop
+
+#define CLOCK_EVENTS            (EM_PRESSED | EM_LONG | EM_TIMER)
+
+// Events handled by time/date setting
+
+#define EDIT_EVENTS             (EM_INPUT | EM_TIMER)
+
+// Display layer priorities
+
+#define STATUS_LAYER            1       // AM/PM and alarm annunciators
+#define FIELD_LAYER             2       // Blinking time/date element being set
+
+// Digits of time/date element <n> (SELECT_HOURS..SELECT_SECONDS, or
+// SELECT_MONTH..SELECT_YEAR)
+
+#define FIELD_DIGITS(n)         ((uint16_t) 0x03 << (2 * ((n) - 1)))
 
 //------------------------------------------------------------------------------
 
 extern FILE primary, secondary;
 
+// Annunciator lamps (AUX A/B) layer, written only when they change
+
+static FILE             status;
+static nixie_stream_t   status_control;
+static uint8_t          status_data[NIXIE_SEGDATA_BYTES];
+static nixie_layer_t    status_layer;
+
+// Edit field layer, holds the time/date being set at low intensity
+// Blinking the selected element is done by showing/hiding this layer over
+// its digits, so the display is only rewritten when a value changes.
+
+static FILE             field;
+static nixie_stream_t   field_control;
+static uint8_t          field_data[NIXIE_SEGDATA_BYTES];
+static nixie_layer_t    field_layer;
+
 typedef enum {
     MODE_CLOCK_12,
     MODE_CLOCK_24,
     MODE_DATE
 } clock_mode_t;
 
+// Clock display render cache entry
+// Everything that determines what ClockDisplay() draws; the display is
+// only redrawn when this changes.
+
+typedef struct {
+    clock_mode_t mode;          // What is shown (12/24 hour time or date)
+    uint8_t field[3];           // Hour, minute, second or month, day, year
+    uint8_t flags;              // RENDER_xxx annunciator flags
+} render_t;
+
+#define RENDER_PM               0x01    // PM lamp (AUX A)
+#define RENDER_ALARM            0x02    // Alarm annunciator (AUX B), for future use
+
 typedef enum {
     REPEAT_OFF,
     REPEAT_ON,
@@ -66,28 +114,157 @@ typedef enum {
     SELECT_CANCEL = 5
 } select_mode_t;
 
+// Tasks
+// The clock display and host link run all the time.  The clock display
+// starts time/date setting and terminal mode, and waits for them to end.
+
+static task_t           clock_task;
+static task_t           edit_task;
+static task_t           terminal_task;
+static task_t           host_task;
+
+// Time or date being set by the edit task (SetTime() or SetDate())
+
+static uint8_t          edit_mode;      // SetTime() display mode (clock_mode_t)
+static time_t           edit_time;
+static date_t           edit_date;
+static uint8_t          edit_set;       // Non-zero if the new value was accepted
+
+/******************************************************************************
+ * int16_t wrap_add(value, delta, min, max)
+ *
+ * Add a (possibly accelerated) rotary encoder movement to a value
+ *
+ * Inputs:  value       Present value, min..max
+ *          delta       Signed change
+ *          min, max    Range of value
+ *
+ * Returns: New value, wrapped around to stay within min..max
+ ******************************************************************************/
+
+static int16_t wrap_add(int16_t value, int8_t delta, int16_t min, int16_t max)
+{
+    int16_t range = max - min + 1;
+
+    value = (value - min + delta) % range;
+    if (value < 0) {
+        value += range;
+    }
+
+    return value + min;
+}
+
 /******************************************************************************
+ * uint8_t to_bcd(value)
+ *
+ * Convert a binary value to packed BCD
+ *
+ * Inputs:  value       Value to convert, 0..99
  *
+ * Returns: Tens digit in the upper 4 bits, units digit in the lower 4 bits
  ******************************************************************************/
 
-uint8_t SetTime(uint8_t mode, time_t *time)
+static uint8_t to_bcd(uint8_t value)
 {
+    uint8_t tens = 0;
+
+    while (value >= 10) {
+        value -= 10;
+        tens++;
+    }
+
+    return (tens << 4) | value;
+}
+
+/******************************************************************************
+ * render_clock(*frame)
+ *
+ * Draw a time or date into the secondary (crossfade target) display stream
+ *
+ * Inputs:  *frame      What to draw
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Writes the digits directly, bypassing stdio, so only digits that
+ *          changed are marked dirty for the crossfade.  The 12 hour clock
+ *          shows the hour without a leading zero.
+ ******************************************************************************/
+
+static void render_clock(const render_t *frame)
+{
+    uint8_t bcd;
+    uint8_t lamps;
+
+    bcd = to_bcd(frame->field[0]);
+    if ((frame->mode == MODE_CLOCK_12) && (bcd < 0x10)) {
+        bcd |= NIXIE_BCD_BLANK << 4;
+    }
+    nixie_put_bcd(&secondary, 0, bcd);
+    nixie_put_bcd(&secondary, 2, to_bcd(frame->field[1]));
+    nixie_put_bcd(&secondary, 4, to_bcd(frame->field[2]));
+
+    lamps = (frame->mode != MODE_DATE);
+    nixie_put_lamps(&secondary, lamps, lamps);
+
+    nixie_out((frame->flags & RENDER_PM) ? 'X' : 'x', &status);
+    nixie_out((frame->flags & RENDER_ALARM) ? 'Y' : 'y', &status);
+}
+
+/******************************************************************************
+ * field_open()
+ *
+ * Add the (empty, visible) edit field layer to the display
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   The layer owns no digits until given a mask.  It must be removed
+ *          with nixie_layer_remove() when editing is finished.
+ ******************************************************************************/
+
+static void field_open(void)
+{
+    nixie_stream_init(&field, &field_control, field_data);
+    nixie_layer_init(&field_layer, &field, 0, FIELD_LAYER);
+    nixie_layer_show(&field_layer, 1);
+}
+
+/******************************************************************************
+ * SetTime(*task)
+ *
+ * Time setting task
+ *
+ * Notes:   Edits edit_time, shown as a 12 or 24 hour time (edit_mode).
+ *          When the task ends, edit_set is non-zero if the time was set
+ *          rather than cancelled.
+ ******************************************************************************/
+
+void SetTime(task_t *task)
+{
+    uint8_t         mode = edit_mode;
+    time_t          *time = &edit_time;
     event_t         event;
-    select_mode_t   selected;
-    uint8_t         blink;
-    uint8_t         refresh;
-    repeat_mode_t   repeat;
-    uint8_t         hi, mi, si;
+    uint16_t        digits;
     uint8_t         hour, am_pm;
     button_t        button;
-    uint8_t         blink_timer;
-    uint8_t         repeat_timer;
+
+    static select_mode_t    selected;
+    static uint8_t          blink;
+    static uint8_t          refresh;
+    static repeat_mode_t    repeat;
+    static uint8_t          blink_timer;
+    static uint8_t          repeat_timer;
+
+    TASK_BEGIN(task);
 
     selected = SELECT_HOURS;
-    blink = BLINK_LOW_INTENSITY;
+    blink = 1;
     refresh = 1;
     repeat = REPEAT_OFF;
 
+    field_open();
+
     // Allocate/init event timers for blinking & button repeat
 
     blink_timer = timer_start(MS_TO_TICKS(200), 1);
@@ -95,14 +272,12 @@ uint8_t SetTime(uint8_t mode, time_t *time)
 
     do {
         // Display refresh
-        // Updated when time is changed, or when blink timer expires
-        // Blinks (low-high intensity) the current time element being set
+        // Updated when time is changed or another element is selected
+        // The edit field layer covers the element being set, and is blinked
+        // (low-high intensity) by the blink timer
 
         if (refresh) {
             refresh = 0;
-            hi = (selected == SELECT_HOURS) ? blink : NORMAL_INTENSITY;
-            mi = (selected == SELECT_MINUTES) ? blink : NORMAL_INTENSITY;
-            si = (selected == SELECT_SECONDS) ? blink : NORMAL_INTENSITY;
             if (mode == MODE_CLOCK_12) {
                 hour_24_to_12(time->hour, &hour, &am_pm);
                 am_pm = am_pm ? 'X' : 'x';
@@ -111,22 +286,27 @@ uint8_t SetTime(uint8_t mode, time_t *time)
                 hour = time->hour;
                 am_pm = 'x';
             }
-            fprintf_P(&primary, PSTR("\r*%c%2u~.*%c%02u~.*%c%02u*%c%c"),
-                                hi, hour,
-                                mi, time->minute,
-                                si, time->second,
-                                hi, am_pm);
+            fprintf_P(&primary, PSTR("\r~%2u.%02u.%02u%c"),
+                                hour, time->minute, time->second, am_pm);
+            fprintf_P(&field, PSTR("\r*%c%2u%02u%02u%c"), BLINK_LOW_INTENSITY,
+                                hour, time->minute, time->second, am_pm);
+
+            digits = FIELD_DIGITS(selected);
+            if (selected == SELECT_HOURS) {
+                digits |= (uint16_t) BM(NIXIE_AUX_A);
+            }
+            nixie_layer_mask(&field_layer, digits);
         }
 
-        event = wait_next_event(0);
+        TASK_WAIT_EVENT(task, EDIT_EVENTS);
+        event = task->event;
 
         // Check for blink or autorepeat timer expiration
 
         if (event.event == TIMER_EXPIRED) {
             if (event.data == blink_timer) {
-                blink = (blink == BLINK_LOW_INTENSITY) ? 
-                        BLINK_HIGH_INTENSITY : BLINK_LOW_INTENSITY;
-                refresh = 1;
+                blink = !blink;
+                nixie_layer_show(&field_layer, blink);
             }
 
             // Auto-repeat button handling
@@ -267,7 +447,8 @@ uint8_t SetTime(uint8_t mode, time_t *time)
             else if (selected > SELECT_SECONDS) {
                 selected = SELECT_HOURS;
             }
-            blink = BLINK_LOW_INTENSITY;
+            blink = 1;
+            nixie_layer_show(&field_layer, blink);
             refresh = 1;
         }
 
@@ -279,37 +460,19 @@ uint8_t SetTime(uint8_t mode, time_t *time)
             // Inc/dec hours if selected
 
             if (selected == SELECT_HOURS) {
-                time->hour += event.data;
-                if (time->hour & 0x80) {
-                    time->hour += 24;
-                }
-                else if (time->hour >= 24) {
-                    time->hour -= 24;
-                }
+                time->hour = wrap_add(time->hour, event.signed_data, 0, 23);
             }
 
             // Inc/dec minutes if selected
 
             else if (selected == SELECT_MINUTES) {
-                time->minute += event.data;
-                if (time->minute & 0x80) {
-                    time->minute += 60;
-                }
-                else if (time->minute >= 60) {
-                    time->minute -= 60;
-                }
+                time->minute = wrap_add(time->minute, event.signed_data, 0, 59);
             }
 
             // Inc/dec seconds if selected
 
             else if (selected == SELECT_SECONDS) {
-                time->second += event.data;
-                if (time->second & 0x80) {
-                    time->second += 60;
-                }
-                else if (time->second >= 60) {
-                    time->second -= 60;
-                }
+                time->second = wrap_add(time->second, event.signed_data, 0, 59);
             }
         }
 
@@ -352,39 +515,52 @@ uint8_t SetTime(uint8_t mode, time_t *time)
 
     } while (selected <= SELECT_SECONDS);
 
-    // Deallocate event timers
+    // Deallocate event timers, remove edit field
 
     timer_stop(blink_timer);
     timer_stop(repeat_timer);
+    nixie_layer_remove(&field_layer);
 
-    return (selected == SELECT_SET);
+    edit_set = (selected == SELECT_SET);
+    TASK_END(task);
 }
 
 /******************************************************************************
+ * SetDate(*task)
+ *
+ * Date setting task
  *
+ * Notes:   Edits edit_date.  When the task ends, edit_set is non-zero if the
+ *          date was set rather than cancelled.
  ******************************************************************************/
 
 #define NO_REFRESH      0
 #define DO_REFRESH      1
 #define CHANGED_REFRESH 2
 
-uint8_t SetDate(date_t *date)
+void SetDate(task_t *task)
 {
+    date_t          *date = &edit_date;
     event_t         event;
-    select_mode_t   selected;
-    uint8_t         blink;
-    uint8_t         refresh;
-    repeat_mode_t   repeat;
-    uint8_t         mi, di, yi;
+    uint8_t         di;
     button_t        button;
-    uint8_t         blink_timer;
-    uint8_t         repeat_timer;
+
+    static select_mode_t    selected;
+    static uint8_t          blink;
+    static uint8_t          refresh;
+    static repeat_mode_t    repeat;
+    static uint8_t          blink_timer;
+    static uint8_t          repeat_timer;
+
+    TASK_BEGIN(task);
 
     selected = SELECT_MONTH;
-    blink = BLINK_LOW_INTENSITY;
+    blink = 1;
     refresh = DO_REFRESH;
     repeat = REPEAT_OFF;
 
+    field_open();
+
     // Allocate/init event timers for blinking & button repeat
 
     blink_timer = timer_start(MS_TO_TICKS(200), 1);
@@ -392,8 +568,9 @@ uint8_t SetDate(date_t *date)
 
     do {
         // Display refresh
-        // Updated when date is changed, or when blink timer expires
-        // Blinks (low-high intensity) the current date element being set
+        // Updated when date is changed or another element is selected
+        // The edit field layer covers the element being set, and is blinked
+        // (low-high intensity) by the blink timer
 
         if (refresh) {
             if (refresh == CHANGED_REFRESH) {
@@ -404,24 +581,22 @@ uint8_t SetDate(date_t *date)
             }
             refresh = NO_REFRESH;
 
-            mi = (selected == SELECT_MONTH) ? blink : NORMAL_INTENSITY;
-            di = (selected == SELECT_DAY) ? blink : NORMAL_INTENSITY;
-            yi = (selected == SELECT_YEAR) ? blink : NORMAL_INTENSITY;
-            fprintf_P(&primary, PSTR("\r*%c%02u*%c%02u*%c%02u"),
-                                mi, date->month,
-                                di, date->day,
-                                yi, date->year % 100);
+            fprintf_P(&primary, PSTR("\r~%02u%02u%02u"),
+                                date->month, date->day, date->year % 100);
+            fprintf_P(&field, PSTR("\r*%c%02u%02u%02u"), BLINK_LOW_INTENSITY,
+                                date->month, date->day, date->year % 100);
+            nixie_layer_mask(&field_layer, FIELD_DIGITS(selected));
         }
 
-        event = wait_next_event(0);
+        TASK_WAIT_EVENT(task, EDIT_EVENTS);
+        event = task->event;
 
         // Check for blink or autorepeat timer expiration
 
         if (event.event == TIMER_EXPIRED) {
             if (event.data == blink_timer) {
-                blink = (blink == BLINK_LOW_INTENSITY) ? 
-                        BLINK_HIGH_INTENSITY : BLINK_LOW_INTENSITY;
-                refresh = DO_REFRESH;
+                blink = !blink;
+                nixie_layer_show(&field_layer, blink);
             }
 
             // Auto-repeat button handling
@@ -562,7 +737,8 @@ uint8_t SetDate(date_t *date)
             else if (selected > SELECT_YEAR) {
                 selected = SELECT_MONTH;
             }
-            blink = BLINK_LOW_INTENSITY;
+            blink = 1;
+            nixie_layer_show(&field_layer, blink);
             refresh = DO_REFRESH;
         }
 
@@ -574,38 +750,21 @@ uint8_t SetDate(date_t *date)
             // Inc/dec month if selected
 
             if (selected == SELECT_MONTH) {
-                date->month += event.data;
-                if ((date->month < 1) || (date->month & 0x80)) {
-                    date->month += 12;
-                }
-                else if (date->month > 12) {
-                    date->month -= 12;
-                }
+                date->month = wrap_add(date->month, event.signed_data, 1, 12);
             }
 
             // Inc/dec day if selected
 
             else if (selected == SELECT_DAY) {
-                date->day += event.data;
                 di = days_in_month(date->month, date->year);
-                if ((date->day < 1) || (date->day & 0x80)) {
-                    date->day = di;
-                }
-                else if (date->day > di) {
-                    date->day = 1;
-                }
+                date->day = wrap_add(date->day, event.signed_data, 1, di);
             }
 
             // Inc/dec year if selected
 
             else if (selected == SELECT_YEAR) {
-                date->year += event.data;
-                if (date->year < MIN_YEAR) {
-                    date->year = MAX_YEAR;
-                }
-                else if (date->year > MAX_YEAR) {
-                    date->year = MIN_YEAR;
-                }
+                date->year = wrap_add(date->year, event.signed_data,
+                                      MIN_YEAR, MAX_YEAR);
             }
         }
 
@@ -648,39 +807,64 @@ uint8_t SetDate(date_t *date)
 
     } while (selected <= SELECT_YEAR);
 
-    // Deallocate event timers
+    // Deallocate event timers, remove edit field
 
     timer_stop(blink_timer);
     timer_stop(repeat_timer);
+    nixie_layer_remove(&field_layer);
 
-    return (selected == SELECT_SET);
+    edit_set = (selected == SELECT_SET);
+    TASK_END(task);
 }
 
 /******************************************************************************
+ * TerminalMode(*task)
+ *
+ * Terminal mode task
  *
+ * Notes:   Characters received are echoed and shown on the display, host
+ *          protocol frames are processed.  Ends on Esc or button 1.
  ******************************************************************************/
 
-void TerminalMode(void)
+void TerminalMode(task_t *task)
 {
-    event_t event;
     int16_t ch;
 
+    TASK_BEGIN(task);
+
     printf_P(PSTR("\r\nTerminal mode ready.\r\n"));
 
     fprintf_P(&primary, PSTR("\v\f"));
  
     do {
-        event = get_next_event(0);
-        if (event.event == BUTTON1_PRESSED) {
+        TASK_WAIT_EVENT_UNTIL(task, EM_PRESSED, !serial_in_empty());
+        if (task->event.event == BUTTON1_PRESSED) {
             break;
         }
 
         ch = serial_in();
 
         if (ch >= 0) {
+            if (proto_input(ch)) {      // Binary host protocol frame
+                continue;
+            }
             if (ch == '\e') {
                 break;
             }
+            if (ch == 0x10) {           // Ctrl-P: print profiler statistics
+                profile_dump(stdout);
+                continue;
+            }
+            if (ch == 0x05) {           // Ctrl-E: print and clear event trace
+                event_trace_dump(stdout);
+                continue;
+            }
+            if (ch == 0x02) {           // Ctrl-B: play music streamed until EOT
+                player_start(NULL, PLAYER_MEM_STREAM);
+                TASK_WAIT_UNTIL(task, !player_poll());
+                printf_P(PSTR("\r\nStream underruns: %u\r\n"), player_underruns(1));
+                continue;
+            }
             serial_out(ch);
             nixie_out(ch, &primary);
         }
@@ -688,55 +872,123 @@ void TerminalMode(void)
 
     printf_P(PSTR("\r\nTerminal mode exit\r\n"));
     nixie_out('\v', &primary);
+    TASK_END(task);
 }
 
 /******************************************************************************
+ * HostLink(*task)
+ *
+ * Host protocol task
  *
+ * Notes:   Processes host protocol frames (see proto.h) received while
+ *          terminal mode, which handles them itself, is not running.
+ *          Anything else received is discarded.
  ******************************************************************************/
 
-void ClockDisplay(void)
+void HostLink(task_t *task)
+{
+    int16_t ch;
+
+    TASK_BEGIN(task);
+
+    do {
+        TASK_WAIT_UNTIL(task, !task_running(&terminal_task) && !serial_in_empty());
+
+        while ((ch = serial_in()) >= 0) {
+            proto_input(ch);
+        }
+    } while (1);
+}
+
+/******************************************************************************
+ * ClockTask(*task)
+ *
+ * Clock display task
+ ******************************************************************************/
+
+void ClockTask(task_t *task)
 {
     event_t event;
     time_t time;
     date_t date;
     uint8_t am_pm;
-    uint8_t set = 0;
-    clock_mode_t display_mode = MODE_CLOCK_12;
-    clock_mode_t clock_mode = MODE_CLOCK_12;
+    render_t frame;
+    config_t config;
+
+    static render_t rendered;
+    static uint8_t rendered_valid;
+    static clock_mode_t display_mode;
+    static clock_mode_t clock_mode;
+
+    TASK_BEGIN(task);
+
+    rendered_valid = 0;
+
+    // Restore stored display settings
+
+    config_get(&config);
+    clock_mode = config.clock_24 ? MODE_CLOCK_24 : MODE_CLOCK_12;
+    display_mode = clock_mode;
 
 //  nixie_out('\f',&primary);
-    nixie_out('\f',&secondary);
+    fprintf_P(&secondary, PSTR("\f*%c"), '0' + config.brightness);
 
     nixie_show_stream(&primary);
-    nixie_crossfade_rate(1);
+    nixie_crossfade_rate(config.crossfade_rate);
+
+    // The annunciator lamps are a layer of their own, so they are not
+    // crossfaded with the rest of the display every second
+
+    nixie_stream_init(&status, &status_control, status_data);
+    nixie_layer_init(&status_layer, &status,
+                     BM(NIXIE_AUX_A) | BM(NIXIE_AUX_B), STATUS_LAYER);
+    nixie_layer_show(&status_layer, 1);
 
     do {
+        frame.mode = display_mode;
+        frame.flags = 0;
         switch (display_mode) {
-            set = 'y';      // For future alarm annunciator
             case MODE_CLOCK_12 :
                 get_time_12(&time, &am_pm);
-                am_pm = am_pm ? 'X' : 'x';
-                fprintf_P(&secondary, PSTR("\r~%2u.%02u.%02u%c%c"),
-                    time.hour, time.minute, time.second, am_pm, set);
+                if (am_pm) {
+                    frame.flags |= RENDER_PM;
+                }
+                frame.field[0] = time.hour;
+                frame.field[1] = time.minute;
+                frame.field[2] = time.second;
                 break;
 
             case MODE_CLOCK_24 :
                 get_time_24(&time);
-                fprintf_P(&secondary, PSTR("\r~x%02u.%02u.%02u%c"),
-                    time.hour, time.minute, time.second, set);
+                frame.field[0] = time.hour;
+                frame.field[1] = time.minute;
+                frame.field[2] = time.second;
                 break;
 
             case MODE_DATE :
                 get_date(&date);
-                date.year %= 100;
-                fprintf_P(&secondary, PSTR("\r~`x%02u%02u%02u%c"),
-                    date.month, date.day, date.year, set);
+                frame.field[0] = date.month;
+                frame.field[1] = date.day;
+                frame.field[2] = date.year % 100;
                 break;
         };
 
-        nixie_crossfade(&secondary);
+        // Redraw and crossfade only if the display would change, events
+        // that leave it as it is (e.g. a button handled elsewhere) cost
+        // nothing here
+
+        if (!rendered_valid || memcmp(&frame, &rendered, sizeof(frame))) {
+            render_clock(&frame);
+            rendered = frame;
+            rendered_valid = 1;
+            nixie_crossfade(&secondary);
+        }
+
+        // Crossfade runs in the background, its completion needs no action
+        // Events of other classes are discarded by the scheduler
 
-        event = wait_next_event(0);
+        TASK_WAIT_EVENT(task, CLOCK_EVENTS);
+        event = task->event;
 
         if (event.event == BUTTON0_PRESSED) {
             display_mode = (display_mode == MODE_DATE) ?
@@ -755,30 +1007,73 @@ void ClockDisplay(void)
                     fprintf_P(&secondary, PSTR("\f  12"));
                 }
                 nixie_crossfade(&secondary);
-                delay_ms(500);
+                TASK_DELAY(task, MS_TO_TICKS(500));
+                rendered_valid = 0;
+
+                config_get(&config);
+                config.clock_24 = (clock_mode == MODE_CLOCK_24);
+                config_put(&config);
             }
             display_mode = clock_mode;
         }
 
+        // Terminal mode and time/date setting write to the display directly,
+        // so the clock must be redrawn afterward
+
         else if (event.event == BUTTON1_LONG) {
-            TerminalMode();
+            nixie_layer_show(&status_layer, 0);
+            task_start(&terminal_task, TerminalMode, EM_PRESSED);
+            TASK_WAIT_UNTIL(task, !task_running(&terminal_task));
+
+            // Long presses and timer events kept for this task during the
+            // terminal session are stale, and must not start another mode
+
+            flush_events(EM_LONG | EM_TIMER);
+            nixie_layer_show(&status_layer, 1);
+            rendered_valid = 0;
         }
 
         else if (event.event == RIGHT_BUTTON_LONG) {
+            nixie_layer_show(&status_layer, 0);
             if (display_mode == MODE_DATE) {
-                get_date(&date);
-                set = SetDate(&date);
-                if (set) {
-                    set_date(&date);
-                }
+                get_date(&edit_date);
+                task_start(&edit_task, SetDate, EDIT_EVENTS);
             }
             else {
-                get_time_24(&time);
-                set = SetTime(clock_mode, &time);
-                if (set) {
-                    set_time_24(&time);
+                get_time_24(&edit_time);
+                edit_mode = clock_mode;
+                task_start(&edit_task, SetTime, EDIT_EVENTS);
+            }
+            TASK_WAIT_UNTIL(task, !task_running(&edit_task));
+            if (edit_set) {
+                if (display_mode == MODE_DATE) {
+                    set_date(&edit_date);
+                }
+                else {
+                    set_time_24(&edit_time);
                 }
             }
+            nixie_layer_show(&status_layer, 1);
+            rendered_valid = 0;
         }
     } while (1);
+}
+
+/******************************************************************************
+ * ClockDisplay()
+ *
+ * Start the clock display
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Starts the clock display and host link tasks, which are run by
+ *          task_run().
+ ******************************************************************************/
+
+void ClockDisplay(void)
+{
+    task_start(&clock_task, ClockTask, CLOCK_EVENTS);
+    task_start(&host_task, HostLink, 0);
 }       
@@ -17,7 +17,6 @@ Content:    Main program
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 //#include <avr/wdt.h>
-#include <avr/eeprom.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -30,8 +29,13 @@ Content:    Main program
 #include "timer.h"
 #include "nixie.h"
 #include "player.h"
+#include "sound.h"
 #include "event.h"
 #include "clock.h"
+#include "proto.h"
+#include "config.h"
+#include "power.h"
+#include "task.h"
 #include "ClockDisplay.h"
 
 //------------------------------------------------------------------------------
@@ -45,11 +49,13 @@ const char player_test[] PROGMEM = "TQ:120:M8:O4:CHGFIED>CH<GFIED>CH<GFIEFDH.";
 
 FILE            primary;
 nixie_stream_t  primary_stream;
-uint8_t         primary_data[NIXIE_SEGMENTS];
+uint8_t         primary_data[NIXIE_SEGDATA_BYTES];
 
 FILE            secondary;
 nixie_stream_t  secondary_stream;
-uint8_t         secondary_data[NIXIE_SEGMENTS];
+uint8_t         secondary_data[NIXIE_SEGDATA_BYTES];
+
+static task_t   test_task;
 
 /******************************************************************************
  *
@@ -108,14 +114,20 @@ void getstr(char *str, uint8_t max_len)
 }
 
 /******************************************************************************
+ * display_test(*task)
+ *
+ * Display test task
  *
+ * Notes:   Shows each digit in turn, once a second, then starts the clock
+ *          display.  Any other event cuts the test short.
  ******************************************************************************/
 
-void display_test(void)
+void display_test(task_t *task)
 {
-    uint8_t digit;
+    static uint8_t digit;
     uint8_t index;
-    event_t event;
+
+    TASK_BEGIN(task);
 
     nixie_crossfade_rate(3);
 
@@ -132,12 +144,14 @@ void display_test(void)
 
         nixie_crossfade(&secondary);
 
-        event = wait_next_event(0);
-
-        if (event.event != ONE_SECOND_ELAPSED) {
+        TASK_WAIT_EVENT(task, EM_ALL & ~EM_DISPLAY);
+        if (task->event.event != ONE_SECOND_ELAPSED) {
             break;
         }
     }
+
+    ClockDisplay();
+    TASK_END(task);
 }
 
 /******************************************************************************
@@ -146,6 +160,9 @@ void display_test(void)
 
 int main(void)
 {
+    uint8_t time_kept;
+    config_t config;
+
     // Initialize I/O's
 
     DDRB = 0b00101111;
@@ -159,14 +176,20 @@ int main(void)
     TCCR1A = 0b00000000;
     TCCR1B = 0b00000000;
 
+    // Restore stored settings
+
+    config_init();
+    config_get(&config);
+
     // Initialize peripherals
 
     serial_init(38400, IN_OUT_INT);
     spi_init();
     rotary_init();
     timer_init();
-    beeper_init();
-    time_date_init();
+    sound_init();
+    sound_gain(config.volume);
+    time_kept = time_date_init();
 
     clock_run(1);
     button_enable(1);
@@ -186,6 +209,11 @@ int main(void)
     nixie_stream_init(&secondary, &secondary_stream, secondary_data);
     nixie_show_stream(&primary);
     nixie_display_enable(1);
+    power_init(&config.power);
+
+    // Host protocol may load either display stream
+
+    proto_init(&primary, &secondary);
 
     // Ok to enable interrupts now
 
@@ -195,6 +223,9 @@ int main(void)
 
     delay_us(1000);         // Needed for FTDI USB-serial IC stabilization?
     printf_P(PSTR("\r\n%S\r\n"), hello);
+    if (time_kept) {
+        printf_P(PSTR("Time kept across reset\r\n"));
+    }
 
     // Player test
 
@@ -207,9 +238,10 @@ int main(void)
     } while (*str != '/');
 */
 
-    display_test();
+    // Run the user interface
 
-    ClockDisplay();
+    task_start(&test_task, display_test, EM_ALL & ~EM_DISPLAY);
+    task_run();
 
 /*  Event handler test
 
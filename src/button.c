@@ -10,6 +10,16 @@ Revision:   $Id$
 Target CPU: ATmega168 or ATmega328
 
 Content:    Button decoding routines
+
+            All eight buttons are debounced in parallel by a 2-bit vertical
+            counter: bit n of button_ct0 and button_ct1 form the counter for
+            button n.  A button's debounced state changes after
+            BUTTON_DEBOUNCE_SAMPLES consecutive samples that differ from it.
+
+            Long presses and chords are timed from a single timestamp, taken
+            whenever the debounced pattern changes, rather than by a timer
+            per button.  A button is therefore "long" once the pattern it is
+            part of has been held unchanged for BUTTON_LONG_DELAY.
 ------------------------------------------------------------------------------*/
 
 #include <inttypes.h>
@@ -18,6 +28,7 @@ Content:    Button decoding routines
 
 #include "portdef.h"
 #include "timer.h"
+#include "event.h"
 #include "button.h"
 
 //------------------------------------------------------------------------------
@@ -47,15 +58,25 @@ static volatile button_t button_short;
 // Latched buttons pressed > BUTTON_LONG_DELAY, set after button held long enough
 static volatile button_t button_long;
 
-// Un-debounced button state from last button_scan()
-static volatile button_t button_previous;
+// Vertical debounce counters, one bit of each per button
+static uint8_t button_ct0;
+static uint8_t button_ct1;
+
+// Calls to button_scan() until next sample
+static uint8_t button_divider;
+
+// Sample count, and its value when the debounced pattern last changed
+static uint8_t button_now;
+static uint8_t button_change;
 
-// Timer used to determine when a button chord has been held long enough
-// Reset whenever button press pattern changes
-static volatile uint16_t button_stable;
+// Buttons down that have not yet qualified as a long press
+static uint8_t button_waiting;
 
-// Button debounce timers, one per button
-static volatile uint16_t button_timer[NUM_BUTTONS];
+// Non-zero until the present debounced pattern has been latched as a chord
+static uint8_t button_chord_waiting;
+
+// TIMER0 tick count when a button event was last latched
+static volatile uint16_t button_time;
 
 /******************************************************************************
  * reset_buttons()
@@ -69,17 +90,19 @@ static volatile uint16_t button_timer[NUM_BUTTONS];
 
 void reset_buttons(void)
 {
-    uint8_t index;
-
     // Disable button scanning while resetting
 
     button_scan_enable = 0;
 
-    // Reset all button-down timers
+    // Reset debounce counters and timing
 
-    for (index = 0; index < NUM_BUTTONS; index++) {
-        button_timer[index] = 0;
-    }
+    button_ct0 = 0xFF;
+    button_ct1 = 0xFF;
+    button_divider = 0;
+    button_now = 0;
+    button_change = 0;
+    button_waiting = 0;
+    button_chord_waiting = 0;
 
     // Clear all button status registers
 
@@ -90,7 +113,6 @@ void reset_buttons(void)
     button_released.all = 0;
     button_short.all = 0;
     button_long.all = 0;
-    button_previous.all = 0;
 
     // Enable button scanning
 
@@ -112,6 +134,29 @@ void button_enable(uint8_t enable)
     button_scan_enable = enable;
 }
 
+/******************************************************************************
+ * uint16_t button_timestamp()
+ *
+ * Read the time at which button state was last latched
+ *
+ * Inputs:  None
+ *
+ * Returns: TIMER0 tick count (low 16 bits) of the button_scan() sample that
+ *          last latched a button press, release, long press or chord
+ ******************************************************************************/
+
+uint16_t button_timestamp(void)
+{
+    uint16_t time;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        time = button_time;
+    }
+
+    return time;
+}
+
 /******************************************************************************
  * button_t read_button_state()
  *
@@ -435,148 +480,101 @@ button_t reset_long_buttons(void)
  *          button_short        sets bits only
  *          button_long         sets bits only
  *          button_chord        sets/clears bits
- *          button_timer[]      all elements affected
  *
  *          This function should be called at a constant periodic rate,
- *          typically from a timer interrupt.  This function has been
- *          optimized to run quickly.
+ *          typically from a timer interrupt.  The buttons are sampled on
+ *          every BUTTON_SAMPLE_TICKS'th call; other calls return at once.
+ *
+ *          The button inputs are read with one access per port, which
+ *          relies on the pin assignments checked below.
  ******************************************************************************/
 
+#if (BUTTON1_PIN != 1) || (BUTTON2_PIN != 2) || (BUTTON3_PIN != 3) || \
+    (BUTTON4_PIN != 4) || (BUTTON5_PIN != 5) || \
+    (RIGHT_BUTTON_PIN != LEFT_BUTTON_PIN + 1)
+#error "button_scan() port mapping does not match button pin assignments"
+#endif
+
 void button_scan(void)
 {
-    register button_t button;           // Un-debounced state of buttons
-    register uint8_t  index;            // Button scan iterator
-    register uint8_t  mask;             // Bitmap iterator, 2^(0..7)
-    volatile register uint16_t *down_time_p; // Ptr to button-down timers
-    register uint16_t down_time;        // Current button down timer value
+    register uint8_t button;            // Un-debounced state of buttons
+    register uint8_t delta;             // Buttons differing from debounced
+    register uint8_t changed;           // Buttons whose debounced state changed
+    register uint8_t held;              // Samples since pattern changed
+    register uint8_t latched;           // Non-zero if any button event latched
 
-    // Exit if scanning disabled
+    // Exit if scanning disabled, or not yet time for the next sample
 
     if (!button_scan_enable) {
         return;
     }
 
-    // Read current button status and store as present button state
-    //
-    // Note: Using the construct { if (PINREAD(x)) {y = 1} } is more efficient
-    // than constructs like:
-    //   y = PINREAD(x) != 0;
-    //   or
-    //   y = PINREAD(x) ? 1 : 0;
-    // The method used below generates the tightest code when avr-gcc is used.
-
-    button.all = 0xFF;
-
-    if (PINREAD(BUTTON0)) {
-        button.button0 = 0;
-    }
-    if (PINREAD(BUTTON1)) {
-        button.button1 = 0;
-    }
-    if (PINREAD(BUTTON2)) {
-        button.button2 = 0;
-    }
-    if (PINREAD(BUTTON3)) {
-        button.button3 = 0;
-    }
-    if (PINREAD(BUTTON4)) {
-        button.button4 = 0;
-    }
-    if (PINREAD(BUTTON5)) {
-        button.button5 = 0;
-    }
-    if (PINREAD(LEFT_BUTTON)) {
-        button.left_button = 0;
-    }
-    if (PINREAD(RIGHT_BUTTON)) {
-        button.right_button = 0;
-    }
-
-    button_state = button;
-
-    // Check for change in button state
-    //
-    // A button "chord" is valid if the button state has not changed
-    // for a sufficiently long period of time (BUTTON_CHORD_DELAY).
-
-    if (button.all == button_previous.all) {
-        if (~button_stable) {   // Counter overflow check
-            button_stable++;
-        }
-        if (button_stable == BUTTON_CHORD_DELAY) {
-            button_chord = button;
-        }
-    }
-    else {
-        button_stable = 0;
+    if (++button_divider < BUTTON_SAMPLE_TICKS) {
+        return;
     }
+    button_divider = 0;
+    button_now++;
 
-    // Scan button status for changes, debounce buttons and register
-    // button events
-
-    // Put ptr to debounce counts in reg var for fast access
-    down_time_p = button_timer;
-    mask = 0x01;
-
-    for (index = 0; index < NUM_BUTTONS; index++) {
-        // Get debounce count for current button
-        down_time = *down_time_p;
-
-        if (button.all & mask) {
-
-            // Button is pressed (on)
-            // Do not increment button-down timer if it is at max already
-
-            if (~down_time) {   // Counter overflow check
-                down_time++;
-
-                if (down_time == BUTTON_SHORT_DELAY) {
-
-                    // Button down long enough to be considered debounced
-
-                    button_pressed.all |= mask;
-                    button_debounced.all |= mask;
-                }
+    // Read current button status and store as present button state
+    // Buttons 1-5 are on Port C bits 1-5, button 0 is on Port B and the
+    // rotary encoder buttons on Port D.  Inputs are low when pressed.
 
-                else if (down_time == BUTTON_LONG_DELAY) {
+    button = PIN(BUTTON1_PORT) & 0x3E;
+    button |= (PIN(BUTTON0_PORT) >> BUTTON0_PIN) & 0x01;
+    button |= (PIN(LEFT_BUTTON_PORT) << (6 - LEFT_BUTTON_PIN)) & 0xC0;
+    button = ~button;
 
-                    // Button down long enough to qualifiy as a long press
+    button_state.all = button;
+    latched = 0;
 
-                    button_long.all |= mask;
-                }
-            }
-        }
+    // Vertical counter debounce
+    // Counters of buttons matching their debounced state are held at 3;
+    // others count down, and the debounced state toggles when they wrap.
 
-        else {
+    delta = button ^ button_debounced.all;
+    button_ct0 = ~(button_ct0 & delta);
+    button_ct1 = button_ct0 ^ (button_ct1 & delta);
+    changed = delta & button_ct0 & button_ct1;
 
-            // Button is up (off)
+    // Register press and release events
+    // A button released before qualifying as a long press is a short press
 
-            if (down_time >= BUTTON_SHORT_DELAY) {
+    if (changed) {
+        button = button_debounced.all ^ changed;
+        button_debounced.all = button;
 
-                // Button was down long enough to be debounced, so generate
-                // a release event
+        button_pressed.all |= changed & button;
+        button_released.all |= changed & ~button;
+        button_short.all |= button_waiting & changed & ~button;
 
-                button_released.all |= mask;
-                button_debounced.all &= (uint8_t) ~mask;
+        button_waiting = (button_waiting | changed) & button;
+        button_change = button_now;
+        button_chord_waiting = 1;
+        latched = 1;
+    }
 
-                if (down_time < BUTTON_LONG_DELAY) {
+    // A button chord is valid if the debounced state has not changed for
+    // BUTTON_CHORD_DELAY, buttons still down after BUTTON_LONG_DELAY
+    // qualify as long presses
 
-                    // Button was down longer than minimum short time,
-                    // but not long enough for the long time, so it qualifies
-                    // as a short press
+    held = button_now - button_change;
 
-                    button_short.all |= mask;
-                }
-            }
+    if (button_chord_waiting && (held >= BUTTON_CHORD_SAMPLES)) {
+        button_chord = button_debounced;
+        button_chord_waiting = 0;
+        latched = 1;
+    }
 
-            down_time = 0;
-        }
+    if (button_waiting && (held >= BUTTON_LONG_SAMPLES)) {
+        button_long.all |= button_waiting;
+        button_waiting = 0;
+        latched = 1;
+    }
 
-        *down_time_p = down_time;
-        down_time_p++;
+    // Let the event manager know there is something to report
 
-        mask <<= 1;
+    if (latched) {
+        button_time = timer_ticks();
+        event_signal(EVENT_WAKE_BUTTON);
     }
-
-    button_previous = button;
 }
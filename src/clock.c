@@ -10,27 +10,217 @@ Revision:   $Id$
 Target CPU: ATmega168 or ATmega328
 
 Content:    Time & date managment functions
+
+            The clock is kept as a count of seconds since the start of
+            CLOCK_EPOCH_YEAR (00:00:00 1-Jan-2000).  A broken-down copy of
+            the time and date is kept alongside it for display; it is
+            advanced by one second at a time, and recalculated from the
+            seconds count only on minute boundaries (the date only when the
+            day changes).  Alarms and other comparisons can use the seconds
+            count directly (clock_get_seconds()).
+
+            Date conversions use the era-based day counting method (a
+            Gregorian calendar repeats every 400 years / 146097 days), which
+            needs no loops and handles the full leap year rule.
+
+            Time is kept by counting TIMER2 interrupts (clock_tick()).  The
+            count needed for one second is adjusted by a trim value, in
+            parts per million, to correct for the error of the CPU clock
+            oscillator.  The trim is kept with the other settings (config.c).
+
+            Time and date are kept in a section of RAM that is not cleared
+            at startup, and are carried over when the CPU is reset without
+            losing power (reset button, watchdog, etc.).  After a power
+            loss the clock starts from the last time logged to EEPROM.
 ------------------------------------------------------------------------------*/
 
 #include <inttypes.h>
+#include <stddef.h>
+#include <avr/io.h>
 #include <avr/pgmspace.h>
 #include <util/atomic.h>
 
+#include "portdef.h"
+#include "timer.h"
+#include "config.h"
 #include "clock.h"
 
 //------------------------------------------------------------------------------
 
-static time_t time;
-static date_t date;
+// Time and date, preserved across resets
+
+typedef struct {
+    uint16_t magic;             // CLOCK_MAGIC if contents are valid
+    uint32_t seconds;           // Seconds since start of CLOCK_EPOCH_YEAR
+    uint8_t check;              // Check byte, see clock_check()
+} clock_state_t;
+
+#define CLOCK_MAGIC         0xC10D
+
+#define SECONDS_PER_DAY     86400UL
+
+// Days from 1-Jan-2000 to 1-Mar-2000, the start of a 400 year era
+// Counting years from March puts the leap day at the end of the year.
+
+#define EPOCH_MARCH_DAYS    60
+#define DAYS_PER_ERA        146097UL
+
+// Day of week of 1-Jan-2000 (Saturday)
+
+#define EPOCH_WEEKDAY       6
+
+// Fractional second units added per TIMER2 tick
+// One second has elapsed when (TIMER2_FREQUENCY * (CLOCK_UNITS + trim))
+// units have been counted.
+
+#define CLOCK_UNITS         1000000UL
+
+static clock_state_t clock_state __attribute__ ((section (".noinit")));
 
 static uint8_t run;
 
+// Broken-down time and date, derived from clock_state.seconds
+
+static time_t clock_time;
+static date_t clock_date;
+static uint16_t clock_day;              // Day number of clock_date
+
+static uint32_t clock_fraction;         // Units counted toward next second
+static uint32_t clock_second;           // Units in one second, trimmed
+static int16_t clock_trim_ppm;          // Oscillator error, ppm
+
 //------------------------------------------------------------------------------
 
 const uint8_t days_month[] PROGMEM =
     {00, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
 //       Jan Feb Mar Apr May Jun Jul Aug Sep Oct Nov Dec
 
+/******************************************************************************
+ * uint8_t clock_check()
+ *
+ * Calculate check byte for the preserved time and date
+ *
+ * Inputs:  None
+ *
+ * Returns: Check byte
+ ******************************************************************************/
+
+static uint8_t clock_check(void)
+{
+    uint8_t *data = (uint8_t *) &clock_state;
+    uint8_t sum = 0x5A;
+    uint8_t index;
+
+    for (index = 0; index < offsetof(clock_state_t, check); index++) {
+        sum = (sum << 1 | sum >> 7) ^ data[index];
+    }
+
+    return sum;
+}
+
+/******************************************************************************
+ * clock_seal()
+ *
+ * Mark the preserved time and date as valid
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Must be called with interrupts disabled (or from the timer ISR)
+ *          whenever the time or date is changed.
+ ******************************************************************************/
+
+static void clock_seal(void)
+{
+    clock_state.magic = CLOCK_MAGIC;
+    clock_state.check = clock_check();
+}
+
+/******************************************************************************
+ * uint8_t clock_valid()
+ *
+ * Determine if the preserved time and date survived a reset
+ *
+ * Inputs:  None
+ *
+ * Returns: Nonzero if the time and date are intact and in range
+ ******************************************************************************/
+
+static uint8_t clock_valid(void)
+{
+    return (clock_state.magic == CLOCK_MAGIC) &&
+           (clock_state.check == clock_check());
+}
+
+/******************************************************************************
+ * clock_split()
+ *
+ * Recalculate the broken-down time and date from the seconds count
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Must be called with interrupts disabled (or from the timer ISR).
+ *          The date is only recalculated if the day has changed.
+ ******************************************************************************/
+
+static void clock_split(void)
+{
+    uint32_t seconds = clock_state.seconds;
+    uint16_t day;
+    uint16_t minutes;
+
+    day = seconds / SECONDS_PER_DAY;
+    seconds -= day * SECONDS_PER_DAY;
+
+    minutes = seconds / 60;
+    clock_time.second = seconds - minutes * 60;
+    clock_time.hour = minutes / 60;
+    clock_time.minute = minutes - clock_time.hour * 60;
+
+    if (day != clock_day) {
+        clock_day = day;
+        days_to_date(day, &clock_date);
+    }
+}
+
+/******************************************************************************
+ * clock_set(day, second)
+ *
+ * Set the clock
+ *
+ * Inputs:  day         Day number (days since start of CLOCK_EPOCH_YEAR)
+ *          second      Seconds since midnight
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Must be called with interrupts disabled.
+ ******************************************************************************/
+
+static void clock_set(uint16_t day, uint32_t second)
+{
+    clock_state.seconds = day * SECONDS_PER_DAY + second;
+    clock_seal();
+    clock_split();
+}
+
+/******************************************************************************
+ * uint32_t time_seconds(*t)
+ *
+ * Convert a time of day to seconds since midnight
+ *
+ * Inputs:  *t          Time of day (24 hour)
+ *
+ * Returns: Seconds since midnight
+ ******************************************************************************/
+
+static uint32_t time_seconds(const time_t *t)
+{
+    return (uint16_t) (t->hour * 60 + t->minute) * 60UL + t->second;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -56,7 +246,7 @@ void get_time_12(time_t *t, uint8_t *am_pm)
 {
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        *t = time;
+        *t = clock_time;
     }
 
     hour_24_to_12(t->hour, &(t->hour), am_pm);
@@ -70,7 +260,7 @@ void get_time_24(time_t *t)
 {
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        *t = time;
+        *t = clock_time;
     }
 }
 
@@ -80,15 +270,14 @@ void get_time_24(time_t *t)
 
 void set_time_12(time_t *t, uint8_t am_pm)
 {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-    {
-        time = *t;
+    time_t t_24 = *t;
 
-        time.hour--;
-        if (am_pm) {
-            time.hour += 12;
-        }
+    t_24.hour--;
+    if (am_pm) {
+        t_24.hour += 12;
     }
+
+    set_time_24(&t_24);
 }
 
 /******************************************************************************
@@ -97,9 +286,11 @@ void set_time_12(time_t *t, uint8_t am_pm)
 
 void set_time_24(time_t *t)
 {
+    uint32_t second = time_seconds(t);
+
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        time = *t;
+        clock_set(clock_day, second);
     }
 }
 
@@ -111,7 +302,7 @@ void get_date(date_t *d)
 {
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        *d = date;
+        *d = clock_date;
     }
 }
 
@@ -121,9 +312,167 @@ void get_date(date_t *d)
 
 void set_date(date_t *d)
 {
+    uint16_t day = date_to_days(d);
+
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        date = *d;
+        clock_set(day, time_seconds(&clock_time));
+    }
+}
+
+/******************************************************************************
+ * uint32_t clock_get_seconds()
+ *
+ * Read the clock
+ *
+ * Inputs:  None
+ *
+ * Returns: Seconds since start of CLOCK_EPOCH_YEAR
+ ******************************************************************************/
+
+uint32_t clock_get_seconds(void)
+{
+    uint32_t seconds;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        seconds = clock_state.seconds;
+    }
+
+    return seconds;
+}
+
+/******************************************************************************
+ * clock_set_seconds(seconds)
+ *
+ * Set the clock
+ *
+ * Inputs:  seconds     Seconds since start of CLOCK_EPOCH_YEAR
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+void clock_set_seconds(uint32_t seconds)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        clock_set(0, seconds);
+    }
+}
+
+/******************************************************************************
+ * uint8_t leap_year(year)
+ *
+ * Determine if a year is a leap year
+ *
+ * Inputs:  year        Year (Gregorian calendar)
+ *
+ * Returns: Nonzero if year is a leap year
+ *
+ * Notes:   Years divisible by 100 are not leap years, unless they are also
+ *          divisible by 400.  For a multiple of 4, divisible by 100 is the
+ *          same as divisible by 25, and divisible by 400 the same as
+ *          divisible by 16, so the division is only needed one year in four.
+ ******************************************************************************/
+
+uint8_t leap_year(uint16_t year)
+{
+    if (year & 0x0003) {
+        return 0;
     }
+
+    return ((year % 25) != 0) || ((year & 0x000F) == 0);
+}
+
+/******************************************************************************
+ * uint16_t date_to_days(*d)
+ *
+ * Convert a date to a day number
+ *
+ * Inputs:  *d          Date, CLOCK_EPOCH_YEAR to CLOCK_LAST_YEAR
+ *
+ * Returns: Days since start of CLOCK_EPOCH_YEAR
+ ******************************************************************************/
+
+uint16_t date_to_days(const date_t *d)
+{
+    uint16_t year = d->year;
+    uint8_t month = d->month;
+    uint16_t day_of_year;
+
+    // Count years from March, so that Jan/Feb belong to the year before
+
+    if (month > 2) {
+        month -= 3;
+    }
+    else {
+        month += 9;
+        year--;
+    }
+
+    day_of_year = (153 * month + 2) / 5 + d->day - 1;
+
+    if (year < CLOCK_EPOCH_YEAR) {
+        return day_of_year - (365 - EPOCH_MARCH_DAYS + 1);  // Jan/Feb 2000
+    }
+
+    year -= CLOCK_EPOCH_YEAR;
+
+    return 365U * year + year / 4 - year / 100 + day_of_year + EPOCH_MARCH_DAYS;
+}
+
+/******************************************************************************
+ * days_to_date(days, *d)
+ *
+ * Convert a day number to a date
+ *
+ * Inputs:  days        Days since start of CLOCK_EPOCH_YEAR
+ *          *d          Location to store date (including day of week)
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+void days_to_date(uint16_t days, date_t *d)
+{
+    uint32_t day_of_era;
+    uint16_t year_of_era;
+    uint16_t day_of_year;
+    uint8_t month;
+
+    // Day of the 400 year era starting 1-Mar-2000
+    // Jan/Feb 2000 are the last days of the era before
+
+    d->year = CLOCK_EPOCH_YEAR;
+    day_of_era = days;
+    if (days >= EPOCH_MARCH_DAYS) {
+        day_of_era -= EPOCH_MARCH_DAYS;
+    }
+    else {
+        day_of_era += DAYS_PER_ERA - EPOCH_MARCH_DAYS;
+        d->year -= 400;
+    }
+
+    // Correct for the leap days missing every 100 years, and the extra one
+    // on the last day of the era, then the year is a simple division
+
+    year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 -
+                   day_of_era / (DAYS_PER_ERA - 1)) / 365;
+    day_of_year = day_of_era -
+                  (365U * year_of_era + year_of_era / 4 - year_of_era / 100);
+
+    // Months from March have a regular 153 day / 5 month pattern
+
+    month = (5 * day_of_year + 2) / 153;
+    d->day = day_of_year - (153 * month + 2) / 5 + 1;
+    if (month < 10) {
+        d->month = month + 3;
+    }
+    else {
+        d->month = month - 9;
+        year_of_era++;
+    }
+    d->year += year_of_era;
+
+    d->weekday = (days + EPOCH_WEEKDAY) % 7;
 }
 
 /******************************************************************************
@@ -136,9 +485,7 @@ uint8_t days_in_month(uint8_t month, uint16_t year)
 
     ret = pgm_read_byte(&days_month[month]);
 
-    if ((month == 2) &&
-        ((year & 0x0003) == 0) &&
-        ((year % 100) != 0)) {
+    if ((month == 2) && leap_year(year)) {
         ret++;
     }
 
@@ -146,24 +493,140 @@ uint8_t days_in_month(uint8_t month, uint16_t year)
 }
 
 /******************************************************************************
+ * clock_set_second(ppm)
+ *
+ * Recalculate the length of one second for a trim value
+ *
+ * Inputs:  ppm         Oscillator error, parts per million
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+static void clock_set_second(int16_t ppm)
+{
+    uint32_t second = TIMER2_FREQUENCY * (CLOCK_UNITS + ppm);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        clock_trim_ppm = ppm;
+        clock_second = second;
+    }
+}
+
+/******************************************************************************
+ * uint8_t time_date_init()
+ *
+ * Initialize timekeeping
+ *
+ * Inputs:  None
+ *
+ * Returns: Nonzero if the time and date were kept from before a reset.
+ *          Otherwise, they are set to a default value.
+ *
+ * Notes:   Must be called before interrupts are enabled, after
+ *          config_init().  The preserved time and date are discarded after a
+ *          power-on or brown-out reset, as RAM contents are not reliable
+ *          then; the last time logged by config.c is used instead, if any.
+ ******************************************************************************/
+
+uint8_t time_date_init(void)
+{
+    time_t t;
+    date_t d;
+    config_t config;
+    uint32_t seconds;
+    uint8_t kept;
+
+    // Load stored oscillator trim
+
+    config_get(&config);
+    if ((config.clock_trim > CLOCK_MAX_TRIM) || (config.clock_trim < -CLOCK_MAX_TRIM)) {
+        config.clock_trim = 0;
+    }
+    clock_set_second(config.clock_trim);
+    clock_fraction = 0;
+
+    // Keep time and date unless power was lost
+
+    kept = !(MCUSR & (BM(PORF) | BM(BORF))) && clock_valid();
+    MCUSR &= INVBM(PORF) & INVBM(BORF);
+
+    clock_day = ~0;
+
+    if (kept) {
+        clock_split();
+    }
+    else if (config_last_time(&seconds)) {
+        clock_set(0, seconds);
+    }
+    else {
+        t.hour = 10;
+        t.minute = 0;
+        t.second = 0;
+
+        d.day = 27;
+        d.month = 6;
+        d.year = 2009;
+
+        clock_set(date_to_days(&d), time_seconds(&t));
+    }
+
+    return kept;
+}
+
+/******************************************************************************
+ * clock_trim(ppm)
  *
+ * Set clock oscillator trim
+ *
+ * Inputs:  ppm         Oscillator frequency error, parts per million.
+ *                      Positive if the oscillator is fast (clock gains time).
+ *                      Bounded to +/-CLOCK_MAX_TRIM.
+ *
+ * Returns: Nothing
+ *
+ * Notes:   The trim is saved with the other settings (see config_put()).
  ******************************************************************************/
 
-void time_date_init(void)
+void clock_trim(int16_t ppm)
 {
-    time_t time;
-    date_t date;
+    config_t config;
 
-    time.hour = 10;
-    time.minute = 0;
-    time.second = 0;
-    set_time_24(&time);
+    if (ppm > CLOCK_MAX_TRIM) {
+        ppm = CLOCK_MAX_TRIM;
+    }
+    else if (ppm < -CLOCK_MAX_TRIM) {
+        ppm = -CLOCK_MAX_TRIM;
+    }
+
+    clock_set_second(ppm);
 
-    date.day = 27;
-    date.month = 6;
-    date.year = 2009;
-    set_date(&date);
-}    
+    config_get(&config);
+    config.clock_trim = ppm;
+    config_put(&config);
+}
+
+/******************************************************************************
+ * int16_t clock_get_trim()
+ *
+ * Read clock oscillator trim
+ *
+ * Inputs:  None
+ *
+ * Returns: Trim value set by clock_trim(), parts per million
+ ******************************************************************************/
+
+int16_t clock_get_trim(void)
+{
+    int16_t ppm;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        ppm = clock_trim_ppm;
+    }
+
+    return ppm;
+}
 
 /******************************************************************************
  *
@@ -184,27 +647,37 @@ void time_date_update(void)
         return;
     }
 
-    time.second++;
-    if (time.second >= 60) {
-        time.second = 0;
- 
-        time.minute++;
-        if (time.minute >= 60) {
-            time.minute = 0;
- 
-            time.hour++;
-            if (time.hour >= 24) {
-                time.hour = 0;
- 
-                date.day++;
-                if (date.day > days_in_month(date.month, date.year)) {
-                    date.month++;
-                    if (date.month > 12) {
-                        date.month = 1;
-                        date.year++;
-                    }
-                }
-            }
-        }
+    clock_state.seconds++;
+    clock_seal();
+
+    clock_time.second++;
+    if (clock_time.second >= 60) {
+        clock_split();
+    }
+}
+
+/******************************************************************************
+ * uint8_t clock_tick()
+ *
+ * Timekeeping service, advances the time once per (trimmed) second
+ *
+ * Inputs:  None
+ *
+ * Returns: Nonzero if a second has elapsed
+ *
+ * Notes:   Must be called from the TIMER2 interrupt, TIMER2_FREQUENCY
+ *          times per second.
+ ******************************************************************************/
+
+uint8_t clock_tick(void)
+{
+    clock_fraction += CLOCK_UNITS;
+    if (clock_fraction < clock_second) {
+        return 0;
     }
+    clock_fraction -= clock_second;
+
+    time_date_update();
+
+    return 1;
 }
@@ -0,0 +1,494 @@
+/*------------------------------------------------------------------------------
+Name:       config.c
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: ATmega168 or ATmega328
+
+Content:    EEPROM-backed configuration store
+------------------------------------------------------------------------------*/
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "portdef.h"
+#include "clock.h"
+#include "config.h"
+
+//------------------------------------------------------------------------------
+
+// Configuration block, as stored in EEPROM and shadowed in RAM
+
+typedef struct {
+    uint8_t version;        // CONFIG_VERSION
+    config_t data;          // Settings
+    uint8_t check;          // Complement of the sum of all preceding bytes
+} config_block_t;
+
+// Last-known time log entry
+// Each entry's sequence number is one more than that of the entry before
+// it in the ring.  Bytes are written in order, so an entry cut short by a
+// reset fails its check and the entry before it is used instead.
+
+typedef struct {
+    uint8_t seq;            // Sequence number
+    uint32_t seconds;       // Clock time, seconds since start of CLOCK_EPOCH_YEAR
+    uint8_t check;          // Complement of the sum of all preceding bytes
+} config_log_t;
+
+// Dirty-byte bitmaps have one bit per byte
+
+typedef char config_block_fits[(sizeof(config_block_t) <= 16) ? 1 : -1];
+typedef char config_log_fits[(sizeof(config_log_t) <= 8) ? 1 : -1];
+
+#define CONFIG_CHECK_BIT    ((uint16_t) 1 << offsetof(config_block_t, check))
+#define CONFIG_ALL_BITS     ((uint16_t) ((1UL << sizeof(config_block_t)) - 1))
+#define CONFIG_LOG_ALL_BITS ((uint8_t) ((1 << sizeof(config_log_t)) - 1))
+
+// Settings used when none are stored
+
+static const config_block_t config_default PROGMEM = {
+    CONFIG_VERSION,
+    {
+        0,                  // 12 hour time display
+        1,                  // Crossfade rate
+        9,                  // Full brightness
+        5,                  // Volume
+        0,                  // No oscillator trim
+        {0, 0, 0, 0, 0, 0}  // No dim/blank windows, no idle dimming
+    },
+    0
+};
+
+// EEPROM image
+
+static config_block_t config_ee EEMEM;
+static config_log_t config_log_ee[CONFIG_LOG_SLOTS] EEMEM;
+
+// RAM shadow of the configuration block, and bytes not yet written back
+static config_block_t config_shadow;
+static volatile uint16_t config_dirty;
+
+// Seconds until changed settings may be written back
+static volatile uint8_t config_hold;
+
+// Log entry being (or last) written, its ring slot, and bytes not yet written
+static config_log_t config_log;
+static uint8_t config_log_slot;
+static volatile uint8_t config_log_dirty;
+
+// Seconds since the last log entry
+static uint16_t config_log_timer;
+
+// Time found in the log at startup
+static uint32_t config_last_seconds;
+static uint8_t config_last_valid;
+
+// Number of EEPROM bytes written
+static uint16_t config_write_count;
+
+/******************************************************************************
+ * uint8_t config_check(*data, size)
+ *
+ * Calculate the check byte of a block of data
+ *
+ * Inputs:  *data       Data to check
+ *          size        Number of bytes
+ *
+ * Returns: Complement of the sum of the bytes
+ *
+ * Notes:   The complement makes an all-zero block invalid.
+ ******************************************************************************/
+
+static uint8_t config_check(const void *data, uint8_t size)
+{
+    const uint8_t *p = data;
+    uint8_t sum = 0;
+
+    for ( ; size; size--) {
+        sum += *p;
+        p++;
+    }
+
+    return ~sum;
+}
+
+/******************************************************************************
+ * uint8_t config_init()
+ *
+ * Restore settings and the last-known time from EEPROM
+ *
+ * Inputs:  None
+ *
+ * Returns: Nonzero if valid stored settings were found, otherwise the
+ *          defaults are used (and are written back, CONFIG_WRITE_DELAY
+ *          seconds after interrupts are enabled)
+ *
+ * Notes:   Must be called before interrupts are enabled.  The settings are
+ *          restored with one block read.  The newest log entry is the last
+ *          of the run of consecutive sequence numbers that starts at slot 0.
+ ******************************************************************************/
+
+uint8_t config_init(void)
+{
+    uint8_t valid;
+    uint8_t slot;
+    uint8_t seq;
+    uint8_t next;
+    uint8_t count;
+
+    eeprom_read_block(&config_shadow, &config_ee, sizeof(config_shadow));
+
+    valid = (config_shadow.version == CONFIG_VERSION) &&
+            (config_shadow.check ==
+                config_check(&config_shadow, sizeof(config_shadow) - 1));
+
+    if (!valid) {
+        memcpy_P(&config_shadow, &config_default, sizeof(config_shadow));
+        config_shadow.check = config_check(&config_shadow, sizeof(config_shadow) - 1);
+        config_dirty = CONFIG_ALL_BITS;
+        config_hold = CONFIG_WRITE_DELAY;
+    }
+
+    // Find the newest log entry, new entries follow it
+
+    seq = eeprom_read_byte(&config_log_ee[0].seq);
+    for (slot = 0; slot < CONFIG_LOG_SLOTS - 1; slot++) {
+        next = eeprom_read_byte(&config_log_ee[slot + 1].seq);
+        if (next != (uint8_t) (seq + 1)) {
+            break;
+        }
+        seq = next;
+    }
+    config_log_slot = slot;
+    config_log.seq = seq;
+
+    // Take the time from it, or from the entry before it if it is damaged
+
+    for (count = 2; count; count--) {
+        config_log_t entry;
+
+        eeprom_read_block(&entry, &config_log_ee[slot], sizeof(entry));
+        if (entry.check == config_check(&entry, sizeof(entry) - 1)) {
+            config_last_seconds = entry.seconds;
+            config_last_valid = 1;
+            break;
+        }
+        slot = (slot ? slot : CONFIG_LOG_SLOTS) - 1;
+    }
+
+    return valid;
+}
+
+/******************************************************************************
+ * config_get(*config)
+ *
+ * Read the present settings
+ *
+ * Inputs:  *config     Location to store the settings
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+void config_get(config_t *config)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        *config = config_shadow.data;
+    }
+}
+
+/******************************************************************************
+ * config_put(*config)
+ *
+ * Change settings
+ *
+ * Inputs:  *config     New settings
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Only bytes that differ from the present settings are marked to
+ *          be written back.  Write-back starts once no change has been made
+ *          for CONFIG_WRITE_DELAY seconds, so a setting being adjusted
+ *          (e.g. with a rotary encoder) is written once, not at every step.
+ ******************************************************************************/
+
+void config_put(const config_t *config)
+{
+    const uint8_t *src;
+    uint8_t *dst;
+    uint16_t bit;
+    uint16_t changed;
+    uint8_t count;
+    uint8_t check;
+
+    src = (const uint8_t *) config;
+    dst = (uint8_t *) &config_shadow.data;
+    bit = (uint16_t) 1 << offsetof(config_block_t, data);
+    changed = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (count = sizeof(config_t); count; count--) {
+            if (*dst != *src) {
+                *dst = *src;
+                changed |= bit;
+            }
+            src++;
+            dst++;
+            bit <<= 1;
+        }
+
+        if (changed) {
+            check = config_check(&config_shadow, sizeof(config_shadow) - 1);
+            if (config_shadow.check != check) {
+                config_shadow.check = check;
+                changed |= CONFIG_CHECK_BIT;
+            }
+            config_dirty |= changed;
+            config_hold = CONFIG_WRITE_DELAY;
+        }
+    }
+}
+
+/******************************************************************************
+ * config_flush()
+ *
+ * Start writing back changed settings now
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Returns at once, use config_busy() to find out when all data has
+ *          been written.
+ ******************************************************************************/
+
+void config_flush(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        config_hold = 0;
+        if (config_dirty) {
+            EECR |= BM(EERIE);
+        }
+    }
+}
+
+/******************************************************************************
+ * uint8_t config_busy()
+ *
+ * Determine if EEPROM write-back is incomplete
+ *
+ * Inputs:  None
+ *
+ * Returns: Nonzero if any setting or log entry has not yet been written, or
+ *          an EEPROM write is in progress
+ ******************************************************************************/
+
+uint8_t config_busy(void)
+{
+    uint8_t busy;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        busy = config_dirty || config_log_dirty || !eeprom_is_ready();
+    }
+
+    return busy;
+}
+
+/******************************************************************************
+ * uint8_t config_last_time(*seconds)
+ *
+ * Read the time of the newest valid log entry found at startup
+ *
+ * Inputs:  *seconds    Location to store the time, seconds since start of
+ *                      CLOCK_EPOCH_YEAR
+ *
+ * Returns: Nonzero if a valid entry was found, <*seconds> is not changed
+ *          otherwise
+ ******************************************************************************/
+
+uint8_t config_last_time(uint32_t *seconds)
+{
+    if (config_last_valid) {
+        *seconds = config_last_seconds;
+    }
+
+    return config_last_valid;
+}
+
+/******************************************************************************
+ * uint8_t config_read_byte(*address)
+ *
+ * Read a byte of EEPROM
+ *
+ * Inputs:  *address    EEPROM address to read
+ *
+ * Returns: Byte read
+ *
+ * Notes:   Waits (with interrupts enabled) for any write in progress to
+ *          finish.  The address is set up with interrupts disabled, so the
+ *          background writer cannot start a write part way through the
+ *          read.  Use instead of eeprom_read_byte() once interrupts are
+ *          enabled.
+ ******************************************************************************/
+
+uint8_t config_read_byte(const uint8_t *address)
+{
+    uint8_t data = 0;
+    uint8_t done = 0;
+
+    do {
+        eeprom_busy_wait();
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if (eeprom_is_ready()) {
+                EEAR = (uint16_t) (uintptr_t) address;
+                EECR |= BM(EERE);
+                data = EEDR;
+                done = 1;
+            }
+        }
+    } while (!done);
+
+    return data;
+}
+
+/******************************************************************************
+ * uint16_t config_writes(reset)
+ *
+ * Read/reset count of EEPROM bytes written
+ *
+ * Inputs:  reset       Resets count to 0 if nonzero
+ *
+ * Returns: Number of bytes written (saturates at 0xFFFF)
+ ******************************************************************************/
+
+uint16_t config_writes(uint8_t reset)
+{
+    uint16_t count;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        count = config_write_count;
+        if (reset) {
+            config_write_count = 0;
+        }
+    }
+
+    return count;
+}
+
+/******************************************************************************
+ * config_tick()
+ *
+ * Write-back and log timing
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Must be called once per second.  Starts write-back of changed
+ *          settings when CONFIG_WRITE_DELAY has elapsed since the last
+ *          change, and writes a log entry every CONFIG_LOG_INTERVAL seconds
+ *          (skipped if the previous one is still being written).
+ ******************************************************************************/
+
+void config_tick(void)
+{
+    uint8_t start = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (config_hold) {
+            config_hold--;
+        }
+        if (!config_hold && config_dirty) {
+            start = 1;
+        }
+
+        config_log_timer++;
+        if ((config_log_timer >= CONFIG_LOG_INTERVAL) && !config_log_dirty) {
+            config_log_timer = 0;
+
+            config_log_slot++;
+            if (config_log_slot >= CONFIG_LOG_SLOTS) {
+                config_log_slot = 0;
+            }
+            config_log.seq++;
+            config_log.seconds = clock_get_seconds();
+            config_log.check = config_check(&config_log, sizeof(config_log) - 1);
+            config_log_dirty = CONFIG_LOG_ALL_BITS;
+            start = 1;
+        }
+
+        if (start) {
+            EECR |= BM(EERIE);
+        }
+    }
+}
+
+/******************************************************************************
+ * ISR(EE_READY_vect)
+ *
+ * EEPROM write-back interrupt
+ *
+ * Notes:   Runs whenever the EEPROM is ready while the interrupt is enabled,
+ *          and starts writing the next dirty byte: settings first (lowest
+ *          address first, so the check byte is written last), then the log
+ *          entry.  Bytes that already hold the right value are skipped
+ *          without being written.  The interrupt disables itself when there
+ *          is nothing left to write.
+ ******************************************************************************/
+
+ISR(EE_READY_vect, ISR_BLOCK)
+{
+    const uint8_t *data;
+    uint16_t address;
+    uint8_t index;
+
+    do {
+        if (config_dirty && !config_hold) {
+            for (index = 0; !(config_dirty & ((uint16_t) 1 << index)); index++) {
+                ;
+            }
+            config_dirty &= ~((uint16_t) 1 << index);
+            address = (uint16_t) (uintptr_t) &config_ee + index;
+            data = (const uint8_t *) &config_shadow + index;
+        }
+        else if (config_log_dirty) {
+            for (index = 0; !(config_log_dirty & BM(index)); index++) {
+                ;
+            }
+            config_log_dirty &= INVBM(index);
+            address = (uint16_t) (uintptr_t) &config_log_ee[config_log_slot] + index;
+            data = (const uint8_t *) &config_log + index;
+        }
+        else {
+            EECR &= INVBM(EERIE);
+            return;
+        }
+
+        EEAR = address;
+        EECR |= BM(EERE);
+    } while (EEDR == *data);
+
+    EEDR = *data;
+    EECR |= BM(EEMPE);
+    EECR |= BM(EEPE);
+
+    if (config_write_count < 0xFFFF) {
+        config_write_count++;
+    }
+}
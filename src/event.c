@@ -13,7 +13,11 @@ Content:    Event queue management
 ------------------------------------------------------------------------------*/
 
 #include <inttypes.h>
+#include <stdio.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
 #include <util/atomic.h>
 
 #include "portdef.h"
@@ -22,13 +26,166 @@ Content:    Event queue management
 #include "button.h"
 #include "timer.h"
 #include "event.h"
+#include "power.h"
 
 //------------------------------------------------------------------------------
 
+// Event queues
+//
+// Each event class (one per EM_xxx mask bit) has its own small ring buffer,
+// so that a filtered fetch only has to look at the head of each selected
+// class queue.  Every queued event is tagged with a sequence number, which
+// is used to return events from different classes in the order they were
+// queued.  Events in the timer and display classes are only returned when
+// no selected user-input (button/rotary) event is waiting.
+//
+// Sequence numbers wrap, and are compared by their (signed) difference, so
+// the order is only correct while every queued event is fewer than 32768
+// events old.  Classes may be kept queued for a long time (e.g. by a task
+// that waits for something else), but merged events (see event_coalesce())
+// take no new number, so this needs 32768 separate events to be queued
+// while the oldest one waits.
 
-static volatile uint8_t event_queue_head;
-static volatile uint8_t event_queue_tail;
-static event_t event_queue[EVENT_QUEUE_SIZE];
+static event_t event_buffer[EVENT_CLASSES][EVENT_QUEUE_SIZE];
+static uint16_t event_sequence[EVENT_CLASSES][EVENT_QUEUE_SIZE];
+static uint8_t event_head[EVENT_CLASSES];   // Next slot to be written
+static uint8_t event_tail[EVENT_CLASSES];   // Next slot to be read
+static uint8_t event_count[EVENT_CLASSES];  // Number of events in queue
+
+// Bitmap of classes that have events waiting (EM_xxx)
+
+static volatile uint16_t event_pending;
+
+// Sequence number for next event queued
+
+static uint16_t event_next_sequence;
+
+// Number of events that could not be queued (queue full)
+
+static volatile uint8_t event_overflow;
+
+// Wake-source flags (EVENT_WAKE_xxx), set from interrupt handlers when
+// something that scan_for_events() or an idle loop should look at changes
+
+static volatile uint8_t event_wake = EVENT_WAKE_ALL;
+
+#if EVENT_TRACE
+
+#if EVENT_TRACE_SIZE & (EVENT_TRACE_SIZE - 1)
+#error "EVENT_TRACE_SIZE must be a power of 2"
+#endif
+
+// Event trace record
+
+typedef struct {
+    event_id event;
+    uint8_t data;
+    uint16_t source;        // Time event occurred at its source
+    uint16_t consumed;      // Time event was removed from the queue
+} event_trace_t;
+
+// Event trace ring buffer
+// Once full, the oldest record is overwritten.
+
+static event_trace_t event_trace[EVENT_TRACE_SIZE];
+static uint8_t event_trace_head;            // Free-running write index
+static uint8_t event_trace_count;           // Number of records held
+
+// Source time of the last user-input event removed from the queue, and
+// non-zero if the display has not been changed since
+
+static uint16_t event_input_time;
+static uint8_t event_input_waiting;
+
+// Present time, for event timestamps
+
+#define EVENT_NOW()         ((uint16_t) timer_ticks())
+
+#else
+
+#define EVENT_NOW()         0
+
+#endif
+
+/******************************************************************************
+ * event_class(event)
+ *
+ * Determine class (EM_xxx mask bit number) of an event
+ *
+ * Inputs:  event       Event type
+ *
+ * Returns: Class number, 0..EVENT_CLASSES-1
+ ******************************************************************************/
+
+static uint8_t event_class(event_id event)
+{
+    uint8_t class;
+
+    if (event < LAST_BUTTON_EVENT) {
+        class = (event - BUTTON0_PRESSED) & 0x03;   // EM_PRESSED..EM_LONG
+    }
+    else if (event == LEFT_ROTARY_MOVED) {
+        class = 4;                                  // EM_LEFTR
+    }
+    else if (event == RIGHT_ROTARY_MOVED) {
+        class = 5;                                  // EM_RIGHTR
+    }
+    else if (event == BUTTON_CHORD) {
+        class = 6;                                  // EM_CHORD
+    }
+    else if (event == CROSSFADE_DONE) {
+        class = 8;                                  // EM_DISPLAY
+    }
+    else {
+        class = 7;                                  // EM_TIMER
+    }
+
+    return class;
+}
+
+/******************************************************************************
+ * event_mask(event)
+ *
+ * Determine the class mask of an event
+ *
+ * Inputs:  event       Event type
+ *
+ * Returns: Class mask, one of EM_xxx
+ ******************************************************************************/
+
+uint16_t event_mask(event_id event)
+{
+    return (uint16_t) BM(event_class(event));
+}
+
+/******************************************************************************
+ * flush_events(mask)
+ *
+ * Discard pending events
+ *
+ * Inputs:  mask        Classes of events to discard (EM_xxx), 0 for all
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+void flush_events(uint16_t mask)
+{
+    uint8_t class;
+
+    if (!mask) {
+        mask = EM_ALL;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (class = 0; class < EVENT_CLASSES; class++) {
+            if (mask & BM(class)) {
+                event_head[class] = event_tail[class] = event_count[class] = 0;
+            }
+        }
+        event_pending &= ~mask;
+    }
+}
 
 /******************************************************************************
  *
@@ -36,10 +193,129 @@ static event_t event_queue[EVENT_QUEUE_SIZE];
 
 void clear_events(void)
 {
+    flush_events(EM_ALL);
+}
+
+/******************************************************************************
+ * event_coalesce(class, event, data)
+ *
+ * Try to merge a new event into one already waiting in its class queue
+ *
+ * Inputs:  class       Class queue the event would be added to
+ *          event       Event type
+ *          data        Event data
+ *
+ * Returns: Non-zero if the event was merged (and need not be added)
+ *
+ * Notes:   Rotary encoder events are merged with the most recently queued
+ *          event, if it is a movement of the same encoder, by adding the
+ *          (signed) position changes.  ONE_SECOND_ELAPSED events are merged
+ *          with any waiting ONE_SECOND_ELAPSED event, the data field holding
+ *          the number of seconds elapsed.  Must be called with interrupts
+ *          disabled.
+ ******************************************************************************/
+
+static uint8_t event_coalesce(uint8_t class, event_id event, uint8_t data)
+{
+    event_t *p;
+    int16_t sum;
+    uint8_t index;
+    uint8_t count;
+
+    if (!event_count[class]) {
+        return 0;
+    }
+
+    if ((event == RIGHT_ROTARY_MOVED) || (event == LEFT_ROTARY_MOVED)) {
+        index = event_head[class] ? event_head[class] - 1 : EVENT_QUEUE_SIZE - 1;
+        if (event_sequence[class][index] == (uint16_t) (event_next_sequence - 1)) {
+            p = &event_buffer[class][index];
+            sum = p->signed_data + (int8_t) data;
+            if ((sum >= -128) && (sum <= 127)) {
+                p->signed_data = sum;
+                return 1;
+            }
+        }
+    }
+
+    else if (event == ONE_SECOND_ELAPSED) {
+        index = event_tail[class];
+        for (count = event_count[class]; count; count--) {
+            p = &event_buffer[class][index];
+            if (p->event == event) {
+                sum = p->data + data;
+                p->data = (sum > 255) ? 255 : sum;
+                return 1;
+            }
+            index++;
+            if (index >= EVENT_QUEUE_SIZE) {
+                index = 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * event_post(event, data, time)
+ *
+ * Add a new event to the event queue
+ *
+ * Inputs:  event       Event type
+ *          data        Event data
+ *          time        TIMER0 tick count when the event occurred at its
+ *                      source (ignored unless EVENT_TRACE is enabled)
+ *
+ * Returns: Nothing
+ *
+ * Notes:   An event merged into one already waiting keeps the time of the
+ *          waiting event.  Button and encoder events are reported to the
+ *          power manager as user input, whether or not they are queued.
+ ******************************************************************************/
+
+static void event_post(event_id event, uint8_t data, uint16_t time)
+{
+    uint8_t class;
+    uint8_t index;
+
+    class = event_class(event);
+    if (BM(class) & EM_INPUT) {
+        power_activity();
+    }
+
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        event_queue_head = 0;
-        event_queue_tail = 0;
+        if (!event_coalesce(class, event, data)) {
+
+            // New event is discarded if queue is full, events already
+            // waiting are never overwritten
+
+            if (event_count[class] >= EVENT_QUEUE_SIZE) {
+                if (event_overflow < 255) {
+                    event_overflow++;
+                }
+            }
+            else {
+                index = event_head[class];
+                event_buffer[class][index].event = event;
+                event_buffer[class][index].data = data;
+#if EVENT_TRACE
+                event_buffer[class][index].time = time;
+#endif
+                event_sequence[class][index] = event_next_sequence;
+                event_next_sequence++;
+
+                index++;
+                if (index >= EVENT_QUEUE_SIZE) {
+                    index = 0;
+                }
+                event_head[class] = index;
+                event_count[class]++;
+                event_pending |= BM(class);
+                event_wake |= EVENT_WAKE_QUEUE;
+            }
+        }
     }
 }
 
@@ -48,34 +324,216 @@ void clear_events(void)
  ******************************************************************************/
 
 void add_event(event_id event, uint8_t data)
+{
+    event_post(event, data, EVENT_NOW());
+}
+
+/******************************************************************************
+ * event_signal(source)
+ *
+ * Notify the event manager that an event source needs attention
+ *
+ * Inputs:  source      Wake-source flag(s), EVENT_WAKE_xxx
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Intended to be called from interrupt handlers.  The flags are
+ *          used by scan_for_events() to skip sources that have nothing new
+ *          to report, and prevent event_idle() from putting the CPU to sleep.
+ ******************************************************************************/
+
+void event_signal(uint8_t source)
 {
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        event_queue[event_queue_head].event = event;
-        event_queue[event_queue_head].data = data;
+        event_wake |= source;
+    }
+}
+
+/******************************************************************************
+ * event_idle()
+ *
+ * Put the CPU into idle sleep until an interrupt occurs
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Does not sleep if any wake-source flag has been set since the
+ *          last scan for events, so a wake-up that occurs just before this
+ *          function is called is not missed.  Interrupts are left enabled.
+ *          Timer, peripheral clocks and interrupts keep running in
+ *          SLEEP_MODE_IDLE, any interrupt (TIMER0, PCINT2, USART etc.) will
+ *          wake the CPU.
+ ******************************************************************************/
+
+void event_idle(void)
+{
+    set_sleep_mode(SLEEP_MODE_IDLE);
+
+    cli();
+    if (!event_wake) {
+        sleep_enable();
+        sei();                  // Instruction following sei() is always executed
+        sleep_cpu();            // before any pending interrupt is serviced
+        sleep_disable();
+    }
+    sei();
+}
+
+/******************************************************************************
+ * event_overflows(reset)
+ *
+ * Read number of events lost because the event queue was full
+ *
+ * Inputs:  reset       If non-zero, reset the count to 0
+ *
+ * Returns: Number of events lost (saturates at 255)
+ ******************************************************************************/
 
-        event_queue_head++;
-        if (event_queue_head >= EVENT_QUEUE_SIZE) {
-            event_queue_head = 0;
+uint8_t event_overflows(uint8_t reset)
+{
+    uint8_t count;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        count = event_overflow;
+        if (reset) {
+            event_overflow = 0;
+        }
+    }
+
+    return count;
+}
+
+#if EVENT_TRACE
+
+/******************************************************************************
+ * event_trace_add(event, data, source)
+ *
+ * Add a record to the event trace
+ *
+ * Inputs:  event       Event type
+ *          data        Event data
+ *          source      Time event occurred at its source
+ *
+ * Returns: Nothing
+ *
+ * Notes:   The present time is recorded as the consumed time.  Must be
+ *          called with interrupts disabled.
+ ******************************************************************************/
+
+static void event_trace_add(event_id event, uint8_t data, uint16_t source)
+{
+    event_trace_t *p = &event_trace[event_trace_head & (EVENT_TRACE_SIZE - 1)];
+
+    p->event = event;
+    p->data = data;
+    p->source = source;
+    p->consumed = EVENT_NOW();
+
+    event_trace_head++;
+    if (event_trace_count < EVENT_TRACE_SIZE) {
+        event_trace_count++;
+    }
+}
+
+#endif
+
+/******************************************************************************
+ * event_remove(*event, mask, peek)
+ *
+ * Fetch the oldest highest-priority event of the selected classes
+ *
+ * Inputs:  *event      Event fetched is written here (NO_EVENT if none)
+ *          mask        Classes of events to fetch (EM_xxx)
+ *          peek        If non-zero, the event is not removed from the queue
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Only the oldest event of each selected class needs to be looked
+ *          at, so the cost does not depend on the number of events queued.
+ ******************************************************************************/
+
+static void event_remove(event_t *event, uint16_t mask, uint8_t peek)
+{
+    uint16_t pending;
+    uint8_t class;
+    uint8_t best;
+    uint16_t best_sequence;
+    uint16_t sequence;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        // User input takes priority over timer and display events
+
+        pending = event_pending & mask;
+        if (pending & EM_INPUT) {
+            pending &= EM_INPUT;
         }
 
-        if (event_queue_head == event_queue_tail) {
-            event_queue_tail++;
+        // Find oldest waiting event among the selected classes
+
+        best = EVENT_CLASSES;
+        best_sequence = 0;
+        for (class = 0; pending; class++, pending >>= 1) {
+            if (pending & 0x01) {
+                sequence = event_sequence[class][event_tail[class]];
+                if ((best == EVENT_CLASSES) ||
+                    ((int16_t) (sequence - best_sequence) < 0)) {
+                    best = class;
+                    best_sequence = sequence;
+                }
+            }
+        }
+
+        if (best < EVENT_CLASSES) {
+            *event = event_buffer[best][event_tail[best]];
+
+            if (!peek) {
+#if EVENT_TRACE
+                event_trace_add(event->event, event->data, event->time);
+                if (BM(best) & EM_INPUT) {
+                    event_input_time = event->time;
+                    event_input_waiting = 1;
+                }
+#endif
+                event_tail[best]++;
+                if (event_tail[best] >= EVENT_QUEUE_SIZE) {
+                    event_tail[best] = 0;
+                }
+                event_count[best]--;
+                if (!event_count[best]) {
+                    event_pending &= ~BM(best);
+                }
+            }
+        }
+        else {
+            event->event = NO_EVENT;
+            event->data = 0;
+#if EVENT_TRACE
+            event->time = 0;
+#endif
         }
     }
 }
 
 /******************************************************************************
+ * scan_button_events()
  *
+ * Post events for button presses, releases, short/long presses and chords
+ * latched by button_scan()
  ******************************************************************************/
 
-static void scan_for_events()
+static void scan_button_events(void)
 {
     button_t pressed, released, bshort, blong, debounced;
-    int8_t index;
+    uint8_t index;
     uint8_t mask;
     event_id event;
+    uint16_t time;
 
+    time = button_timestamp();
     pressed = reset_buttons_pressed();
     released = reset_buttons_released();
     bshort = reset_short_buttons();
@@ -89,16 +547,16 @@ static void scan_for_events()
     mask = 0x01;
     for (index = 0; index < 8; index++) {
         if (pressed.all & mask) {
-            add_event(event + BUTTON0_PRESSED, debounced.all);
+            event_post(event + BUTTON0_PRESSED, debounced.all, time);
         }
         if (released.all & mask) {
-            add_event(event + BUTTON0_RELEASED, debounced.all);
+            event_post(event + BUTTON0_RELEASED, debounced.all, time);
         }
         if (bshort.all & mask) {
-            add_event(event + BUTTON0_SHORT, debounced.all);
+            event_post(event + BUTTON0_SHORT, debounced.all, time);
         }
         if (blong.all & mask) {
-            add_event(event + BUTTON0_LONG, debounced.all);
+            event_post(event + BUTTON0_LONG, debounced.all, time);
         }
         event += 4;
         mask <<= 1;
@@ -108,34 +566,63 @@ static void scan_for_events()
 
     pressed = reset_button_chord();
     if (pressed.all) {
-        add_event(BUTTON_CHORD, pressed.all);
+        event_post(BUTTON_CHORD, pressed.all, time);
     }
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
 
-    // Check right rotary encoder
+static void scan_for_events()
+{
+    int8_t index;
+    uint8_t mask;
+    uint8_t wake;
+    uint16_t time;
 
-    index = right_rotary_relative();
-    if (index) {
-        add_event(RIGHT_ROTARY_MOVED, index);
+    // Only look at sources that have signalled a change since the last scan
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        wake = event_wake;
+        event_wake = 0;
+    }
+
+    if (wake & EVENT_WAKE_BUTTON) {
+        scan_button_events();
     }
 
-    // Check left rotary encoder
+    if (wake & EVENT_WAKE_ROTARY) {
+
+        // Check right rotary encoder
 
-    index = left_rotary_relative();
-    if (index) {
-        add_event(LEFT_ROTARY_MOVED, index);
+        time = rotary_timestamp(ROTARY_RIGHT);
+        index = right_rotary_relative();
+        if (index) {
+            event_post(RIGHT_ROTARY_MOVED, index, time);
+        }
+
+        // Check left rotary encoder
+
+        time = rotary_timestamp(ROTARY_LEFT);
+        index = left_rotary_relative();
+        if (index) {
+            event_post(LEFT_ROTARY_MOVED, index, time);
+        }
     }
 
-    // Check event timers
+    if (wake & EVENT_WAKE_TIMER) {
 
-    mask = timer_status();
-    index = 0;
-    while (mask) {
-        if (mask & 0x01) {
-            timer_expired(index, 1);            // Resets timer-expiration flag
-            add_event(TIMER_EXPIRED, index);
+        // Check event timers
+
+        while (timer_status()) {
+            mask = timer_next_expired();        // Resets timer-expiration flag
+            if (mask == TIMER_NONE) {
+                break;
+            }
+            add_event(TIMER_EXPIRED, mask);
         }
-        index++;
-        mask >>= 1;
     }
 }
 
@@ -234,49 +721,80 @@ uint8_t is_timer_event(event_id event)
 }
 
 /******************************************************************************
+ * get_next_event(mask)
+ *
+ * Remove/return the next event of the selected classes from the event queue
+ *
+ * Inputs:  mask        Classes of events to fetch (EM_xxx), 0 for all
+ *
+ * Returns: Event, or NO_EVENT if no event of the selected classes is waiting
  *
+ * Notes:   Events of classes not selected by <mask> stay in the queue.
  ******************************************************************************/
 
-event_t get_next_event(uint8_t mask)
+event_t get_next_event(uint16_t mask)
 {
     event_t event;
 
-    do {
-        scan_for_events();
+    if (!mask) {
+        mask = EM_ALL;
+    }
 
-        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-        {
-            if (event_queue_head != event_queue_tail) {
-                event = event_queue[event_queue_tail];
- 
-                event_queue_tail++;
-                if (event_queue_tail >= EVENT_QUEUE_SIZE) {
-                    event_queue_tail = 0;
-                }
-            }
-            else {
-                event.event = NO_EVENT;
-                event.data = 0;
-            }
-        }
-    } while (0);
+    scan_for_events();
+    event_remove(&event, mask, 0);
 
     return event;
 }
 
 /******************************************************************************
+ * wait_next_event(mask)
+ *
+ * Remove/return the next event of the selected classes from the event queue,
+ * waiting for one to occur if none is waiting
  *
+ * Inputs:  mask        Classes of events to fetch (EM_xxx), 0 for all
+ *
+ * Returns: Event
+ *
+ * Notes:   The CPU is put into idle sleep (see event_idle()) while waiting.
  ******************************************************************************/
 
-event_t wait_next_event(uint8_t mask)
+event_t wait_next_event(uint16_t mask)
 {
-    while (event_queue_head == event_queue_tail) {
+    if (!mask) {
+        mask = EM_ALL;
+    }
+
+    while (!(event_pending & mask)) {
         scan_for_events();
+        if (!(event_pending & mask)) {
+            event_idle();
+        }
     }
 
     return get_next_event(mask);
 }
 
+/******************************************************************************
+ * event_scan()
+ *
+ * Check event sources, and determine which classes have events waiting
+ *
+ * Inputs:  None
+ *
+ * Returns: Classes (EM_xxx) of all the events waiting in the queue
+ *
+ * Notes:   Like get_next_event(), clears the wake-source flags, so that a
+ *          following event_idle() sleeps unless there is new activity.
+ ******************************************************************************/
+
+uint16_t event_scan(void)
+{
+    scan_for_events();
+
+    return event_pending;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -286,18 +804,86 @@ event_t unget_next_event(void)
     event_t event;
 
     scan_for_events();
+    event_remove(&event, EM_ALL, 1);
 
+    return event;
+}
+
+
+/******************************************************************************
+ * event_trace_display()
+ *
+ * Log the start of a display change in the event trace
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Called when a display change is started (nixie_crossfade()).
+ *          A DISPLAY_CHANGED record, with the source time of the user-input
+ *          event last removed from the queue, is only logged for the first
+ *          change after each input event; changes not caused by input
+ *          (e.g. the clock advancing) are not logged.
+ ******************************************************************************/
+
+void event_trace_display(void)
+{
+#if EVENT_TRACE
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        if (event_queue_head != event_queue_tail) {
-            event = event_queue[event_queue_tail];
-        }
-        else {
-            event.event = NO_EVENT;
-            event.data = 0;
+        if (event_input_waiting) {
+            event_input_waiting = 0;
+            event_trace_add(DISPLAY_CHANGED, 0, event_input_time);
         }
     }
-
-    return event;
+#endif
 }
 
+/******************************************************************************
+ * event_trace_dump(stream)
+ *
+ * Print and clear the event trace
+ *
+ * Inputs:  stream      Output stream (typically &serial_f)
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Records are printed oldest first.  Times are TIMER0 ticks
+ *          (modulo 65536), the latency from source to removal from the
+ *          queue (or to the display change) is printed in milliseconds.
+ *          Only a note is printed if EVENT_TRACE is not enabled.
+ ******************************************************************************/
+
+void event_trace_dump(FILE *stream)
+{
+#if EVENT_TRACE
+    event_trace_t record;
+    uint8_t index;
+    uint8_t count;
+
+    fprintf_P(stream, PSTR("\r\nevent data source consumed    ms\r\n"));
+
+    do {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            count = event_trace_count;
+            if (count) {
+                index = event_trace_head - count;
+                record = event_trace[index & (EVENT_TRACE_SIZE - 1)];
+                event_trace_count--;
+            }
+        }
+
+        if (count) {
+            fprintf_P(stream, PSTR("%5u  %02X %6u %8u %5lu\r\n"),
+                record.event,
+                record.data,
+                record.source,
+                record.consumed,
+                TICKS_TO_MS((uint32_t) (uint16_t) (record.consumed - record.source)));
+        }
+    } while (count);
+#else
+    fprintf_P(stream, PSTR("\r\nevent trace not built (EVENT_TRACE)\r\n"));
+#endif
+}
@@ -62,6 +62,7 @@ Intensity controls:
 ]       Increase intensity of subsequent segments output by 1
 *n      Set intensity of subsequent segments output to <n>.  n = '0'..'9'.
         Command is ignored if <n> is not an ASCII digit character.
+        <n> is scaled to the 0..MAX_NIXIE_INTENSITY range, so '9' is full-on.
 ~       Set intensity to nominal level
 
 Cursor control:
@@ -116,6 +117,7 @@ FILE        I/O stream object from stdio library
     flags       I/O mode flags
     *udata      Device-specific data pointer -> nixie_control_t
         *segdata    Pointer to display segment intensity data array
+                    (NIXIE_SEGDATA_BYTES, two 4-bit levels per byte)
         cursor      Virtual display cursor position (next digit/tube to update)
         intensity   Intensity level to apply to next displayable character
         state       Controls how next character output is interpreted
@@ -125,7 +127,41 @@ FILE        I/O stream object from stdio library
             overlay         Overlay new segment pattern onto existing pattern
             single_overlay  Overlay segments for next char only
             no_cursor_wrap  Do not wrap cursor when it goes off left or right side
+        dirty       Bitmap of digits whose segment data has changed since the
+                    stream was last used by nixie_crossfade()
     
+--------------------------------------------------------------------------------
+
+Display layers:
+
+The physical display shows the stream selected by nixie_show_stream() (the
+base), with any number of layers on top.  A layer is another display stream
+that owns a set of digits; where visible layers overlap, the one with the
+highest priority is shown.  Which array each digit is shown from is worked
+out only when a layer is added, removed, shown, hidden or given a new digit
+mask.  Writes to any shown array update the bit-planes of just the segments
+that changed, so e.g. a blinking edit field costs one layer show/hide per
+blink.  Crossfades are applied to the base only; digits covered by a layer
+keep fading underneath it and appear in their final state once uncovered.
+
+--------------------------------------------------------------------------------
+
+Global dimming and cathode exercise:
+
+nixie_display_dim() scales the whole display without touching any segment
+data: nixie_display_refresh() shows each bit-plane for part of its time and
+holds the driver blanked for the rest, so the refresh rate is unchanged.
+Neither part is made shorter than NIXIE_DIM_MIN_COUNTS, which the refresh
+interrupt can be relied on to time; a part that would be shorter is
+dropped, and its time carried over to the following bit-plane, so the
+lowest levels are less finely graded but the mean level is kept.
+
+nixie_exercise() lights each cathode of every tube in turn at full
+intensity, to keep cathodes that are rarely used from being poisoned.  The
+refresh interrupt sends a single exercise bit-plane in place of the display
+bit-planes while it runs, and nixie_exercise_service() steps it from the
+tick interrupt, so neither the segment data nor the application is involved.
+
 ------------------------------------------------------------------------------*/
 
 #include <inttypes.h>
@@ -135,6 +171,8 @@ FILE        I/O stream object from stdio library
 #include <stdio.h>
 
 #include "portdef.h"
+#include "spi.h"
+#include "event.h"
 #include "nixie.h"
 
 //------------------------------------------------------------------------------
@@ -147,8 +185,8 @@ typedef union {
         uint8_t crossfade_rate  : 2;    // Rate at which crossfade occurs (0=fastest)
         uint8_t crossfade_count : 2;    // Counter used for crossfade timing
         uint8_t unused4         : 1;
-        uint8_t one_cycle_done  : 1;    // One full refresh PWM cycle completed
-        uint8_t one_cycle_only  : 1;    // Refresh only one full PWM cycle, then stop
+        uint8_t one_cycle_done  : 1;    // One full refresh BCM frame completed
+        uint8_t crossfade_active: 1;    // Crossfade in progress (stepped by nixie_crossfade_service())
         uint8_t refresh_enable  : 1;    // Display refresh enable
     };
 } nixie_control_t;
@@ -158,9 +196,81 @@ typedef union {
 // Pointer to 'active' (displayed) nixie segment intensity pattern array
 static uint8_t *nixie_segment_ptr;
 
+// Control structure of the displayed stream
+static nixie_stream_t *nixie_display_stream;
+
+// Pointer to segment intensity pattern array being (or last) crossfaded to
+static uint8_t *nixie_crossfade_ptr;
+
+// Digits to be processed by the crossfade in progress, bit n = digit n
+static uint16_t nixie_crossfade_mask;
+
+// Display layers, highest priority first
+static nixie_layer_t *nixie_layers;
+
+// Segment array each digit is shown from, or NULL for the base (displayed
+// stream).  Maintained by nixie_compose().
+static uint8_t *nixie_digit_source[NIXIE_DIGITS];
+
+// Precomputed display bit-planes, one per BCM intensity bit.
+// Plane <n> holds bit <n> of the intensity level of every segment, already
+// packed in the order it is shifted out to the display driver.
+// Maintained from the active segment array whenever it is modified, so that
+// nixie_display_refresh() only has to send NIXIE_PLANE_BYTES bytes per entry.
+//
+// There are two sets of bit-planes.  The front set is shown; a whole new
+// segment pattern is built into the back set, and the sets are exchanged by
+// nixie_display_refresh() between BCM frames so that the new pattern never
+// appears part way through a frame.
+static uint8_t nixie_plane[2][NIXIE_BCM_BITS][NIXIE_PLANE_BYTES];
+
+// Bit-plane set being shown (0 or 1)
+static volatile uint8_t nixie_front;
+
+// Set when the back bit-plane set holds a new pattern waiting to be shown
+static volatile uint8_t nixie_swap_pending;
+
+// Set while the back bit-plane set is being built by nixie_plane_present()
+static volatile uint8_t nixie_plane_building;
+
+// Number of patterns replaced before they could be shown
+static uint8_t nixie_drop_count;
+
 // Nixie display control & status flags
 static volatile nixie_control_t nixie_control = {0b10000000};
 
+// BCM frames counted toward the next crossfade step
+static uint8_t nixie_fade_frames;
+
+// Global dimming level, 0..NIXIE_DIM_FULL
+static volatile uint8_t nixie_dim = NIXIE_DIM_FULL;
+
+// Lit time (TIMER0 counts, signed) owed to the following bit-planes by
+// rounding of the dimmed bit-plane times
+static int8_t nixie_dim_carry;
+
+// Bit-plane shifted into the display driver, or being sent, 0..NIXIE_BCM_BITS-1
+static uint8_t nixie_bit_plane;
+
+// Set by nixie_display_refresh() when nixie_display_queue() is to send the
+// following bit-plane
+static uint8_t nixie_queue_due;
+
+// Number of BCM frames shown (wraps)
+static volatile uint8_t nixie_frame_count;
+
+// Cathode exercise bit-planes, one shown while the other is built
+static uint8_t nixie_exercise_plane[2][NIXIE_PLANE_BYTES];
+
+// Exercise bit-plane shown, or NULL if no exercise is in progress
+static uint8_t * volatile nixie_exercise_ptr;
+
+// Exercise steps (cathodes) left to show, cathode lit by the present step,
+// and frame count at which the present step started
+static volatile uint8_t nixie_exercise_steps;
+static uint8_t nixie_exercise_cathode;
+static uint8_t nixie_exercise_frame;
+
 //------------------------------------------------------------------------------
 
 // Segment/drive line offsets for start of each nixie tube display element
@@ -171,6 +281,421 @@ static const uint8_t nixie_digit_offset[] PROGMEM =
 // 0   1   2   3   4   5  LL  RL  AA  AB
 // LL,RL = Left/Right lamp "decimal points"
 // AA,AB = Aux output A/B
+
+// Character dispatch table for nixie_out()
+//
+// One entry per 7-bit character.  Each entry holds an action code (ACT_xxx)
+// in the upper 6 bits and an argument in the lower 10 bits.  For displayable
+// characters (ACT_GLYPH, code 0) the argument is the segment mask to draw at
+// the cursor, bit n = segment n, so an entry with no action bits can be
+// drawn directly.
+
+#define ACT_SHIFT           10
+#define ACT_ARG_MASK        0x03FF
+
+#define ACT_GLYPH           0   // Draw segment mask at cursor
+#define ACT_IGNORE          1   // Not a recognized character
+#define ACT_LAMP_ON         2   // Turn on pseudo-digit <arg> (lamp/aux)
+#define ACT_LAMP_OFF        3   // Turn off pseudo-digit <arg>
+#define ACT_LAMPS_OFF       4   // Turn off both neon lamps
+#define ACT_LAMP_LEFT       5   // Turn on lamp to left of cursor
+#define ACT_LAMP_RIGHT      6   // Turn on lamp to right of cursor
+#define ACT_DIMMER          7   // Decrease intensity by 1
+#define ACT_BRIGHTER        8   // Increase intensity by 1
+#define ACT_NOMINAL         9   // Set nominal intensity
+#define ACT_PARAMETER       10  // Next character is parameter, <arg> = state_t
+#define ACT_SET_FLAGS       11  // Set control flags <arg> (CTL_xxx)
+#define ACT_CLEAR_FLAGS     12  // Clear control flags <arg>
+#define ACT_BACK_OVERLAY    13  // Cursor left, next character overlays
+#define ACT_CLEAR           14  // Clear display, cursor home if <arg> != 0
+#define ACT_HOME            15  // Cursor to leftmost digit
+#define ACT_LEFT            16  // Cursor left 1 digit
+#define ACT_RIGHT           17  // Cursor right 1 digit
+#define ACT_RESET           18  // Partial display reset
+
+#define ENTRY(action, arg)  ((uint16_t) (((action) << ACT_SHIFT) | (arg)))
+#define DIGIT(n)            ENTRY(ACT_GLYPH, BM(n))
+#define LETTER(n)           ENTRY(ACT_GLYPH, BM(0) | BM(n))
+
+// Output control flags (control_t) set/cleared by ACT_xxx_FLAGS entries
+
+#define CTL_NO_CURSOR_INC   0x01
+#define CTL_SINGLE_NO_INC   0x02
+#define CTL_OVERLAY         0x04
+#define CTL_SINGLE_OVERLAY  0x08
+#define CTL_NO_CURSOR_WRAP  0x10
+
+static const uint16_t nixie_char_action[128] PROGMEM = {
+    [0 ... 127] = ENTRY(ACT_IGNORE, 0),
+
+    ['0'] = DIGIT(0),   ['1'] = DIGIT(1),   ['2'] = DIGIT(2),
+    ['3'] = DIGIT(3),   ['4'] = DIGIT(4),   ['5'] = DIGIT(5),
+    ['6'] = DIGIT(6),   ['7'] = DIGIT(7),   ['8'] = DIGIT(8),
+    ['9'] = DIGIT(9),
+
+    ['A'] = LETTER(1),  ['B'] = LETTER(2),  ['C'] = LETTER(3),
+    ['D'] = LETTER(4),  ['E'] = LETTER(5),  ['F'] = LETTER(6),
+    ['G'] = LETTER(7),  ['H'] = LETTER(8),  ['I'] = LETTER(9),
+
+    ['a'] = LETTER(1),  ['b'] = LETTER(2),  ['c'] = LETTER(3),
+    ['d'] = LETTER(4),  ['e'] = LETTER(5),  ['f'] = LETTER(6),
+    ['g'] = LETTER(7),  ['h'] = LETTER(8),  ['i'] = LETTER(9),
+
+    [' '] = ENTRY(ACT_GLYPH, 0),
+
+    ['<'] = ENTRY(ACT_LAMP_ON, NIXIE_LEFT_LAMP),
+    ['>'] = ENTRY(ACT_LAMP_ON, NIXIE_RIGHT_LAMP),
+    ['('] = ENTRY(ACT_LAMP_OFF, NIXIE_LEFT_LAMP),
+    [')'] = ENTRY(ACT_LAMP_OFF, NIXIE_RIGHT_LAMP),
+    ['`'] = ENTRY(ACT_LAMPS_OFF, 0),
+    ['.'] = ENTRY(ACT_LAMP_LEFT, 0),
+    [','] = ENTRY(ACT_LAMP_RIGHT, 0),
+    ['X'] = ENTRY(ACT_LAMP_ON, NIXIE_AUX_A),
+    ['x'] = ENTRY(ACT_LAMP_OFF, NIXIE_AUX_A),
+    ['Y'] = ENTRY(ACT_LAMP_ON, NIXIE_AUX_B),
+    ['y'] = ENTRY(ACT_LAMP_OFF, NIXIE_AUX_B),
+
+    ['['] = ENTRY(ACT_DIMMER, 0),
+    [']'] = ENTRY(ACT_BRIGHTER, 0),
+    ['*'] = ENTRY(ACT_PARAMETER, SET_INTENSITY),
+    ['~'] = ENTRY(ACT_NOMINAL, 0),
+
+    ['$'] = ENTRY(ACT_CLEAR_FLAGS, CTL_NO_CURSOR_INC),
+    ['#'] = ENTRY(ACT_SET_FLAGS, CTL_NO_CURSOR_INC),
+    ['!'] = ENTRY(ACT_SET_FLAGS, CTL_SINGLE_NO_INC),
+    ['&'] = ENTRY(ACT_CLEAR_FLAGS, CTL_OVERLAY),
+    ['|'] = ENTRY(ACT_SET_FLAGS, CTL_OVERLAY),
+    ['_'] = ENTRY(ACT_SET_FLAGS, CTL_SINGLE_OVERLAY),
+    ['^'] = ENTRY(ACT_BACK_OVERLAY, 0),
+    ['@'] = ENTRY(ACT_PARAMETER, SET_CURSOR_POS),
+    ['{'] = ENTRY(ACT_SET_FLAGS, CTL_NO_CURSOR_WRAP),
+    ['}'] = ENTRY(ACT_CLEAR_FLAGS, CTL_NO_CURSOR_WRAP),
+
+    ['\f'] = ENTRY(ACT_CLEAR, 1),
+    ['\r'] = ENTRY(ACT_HOME, 0),
+    ['\n'] = ENTRY(ACT_CLEAR, 0),
+    ['\b'] = ENTRY(ACT_LEFT, 0),
+    ['\t'] = ENTRY(ACT_RIGHT, 0),
+    ['\v'] = ENTRY(ACT_RESET, 0)
+};
+
+/******************************************************************************
+ * uint8_t segment_level(*segdata, index)
+ *
+ * Read the intensity level of a segment from a packed segment array
+ *
+ * Inputs:  *segdata    Pointer to a segment array
+ *          index       Segment number, 0..NIXIE_SEGMENTS-1
+ *
+ * Returns: Intensity level, 0..MAX_NIXIE_INTENSITY
+ ******************************************************************************/
+
+static inline uint8_t segment_level(const uint8_t *segdata, uint8_t index)
+{
+    uint8_t packed = segdata[index >> 1];
+
+    if (index & 0x01) {
+        packed >>= NIXIE_LEVEL_BITS;
+    }
+
+    return packed & NIXIE_LEVEL_MASK;
+}
+
+/******************************************************************************
+ * uint8_t set_segment_level(*segdata, index, level)
+ *
+ * Write the intensity level of a segment into a packed segment array
+ *
+ * Inputs:  *segdata    Pointer to a segment array
+ *          index       Segment number, 0..NIXIE_SEGMENTS-1
+ *          level       Intensity level, 0..MAX_NIXIE_INTENSITY
+ *
+ * Returns: Non-zero if the level changed
+ ******************************************************************************/
+
+static inline uint8_t set_segment_level(uint8_t *segdata, uint8_t index, uint8_t level)
+{
+    uint8_t *p = &segdata[index >> 1];
+    uint8_t packed;
+
+    if (index & 0x01) {
+        packed = (*p & NIXIE_LEVEL_MASK) | (level << NIXIE_LEVEL_BITS);
+    }
+    else {
+        packed = (*p & (uint8_t) ~NIXIE_LEVEL_MASK) | level;
+    }
+
+    if (packed == *p) {
+        return 0;
+    }
+
+    *p = packed;
+    return 1;
+}
+
+/******************************************************************************
+ * nixie_plane_write(set, index, bcm)
+ *
+ * Set the bits of a segment in one set of display bit-planes
+ *
+ * Inputs:  set         Bit-plane set to modify (0 or 1)
+ *          index       Segment number, 0..NIXIE_SEGMENTS-1
+ *          bcm         BCM value of the segment, bit n goes to plane n
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Each plane byte holds eight segments, and may be written from
+ *          both the timer tick interrupt (crossfade) and the foreground,
+ *          so the update is made with interrupts disabled.
+ ******************************************************************************/
+
+static void nixie_plane_write(uint8_t set, uint8_t index, uint8_t bcm)
+{
+    register uint8_t *plane;
+    register uint8_t mask;
+    register uint8_t bit;
+
+    plane = &nixie_plane[set][0][index >> 3];
+    mask = BM(index & 0x07);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (bit = 0; bit < NIXIE_BCM_BITS; bit++) {
+            if (bcm & 0x01) {
+                *plane |= mask;
+            }
+            else {
+                *plane &= (uint8_t) ~mask;
+            }
+            bcm >>= 1;
+            plane += NIXIE_PLANE_BYTES;
+        }
+    }
+}
+
+/******************************************************************************
+ * nixie_plane_update(index, intensity)
+ *
+ * Update the precomputed display bit-planes for a single segment
+ *
+ * Inputs:  index       Segment number (offset into the segment intensity
+ *                      array), 0..NIXIE_SEGMENTS-1
+ *          intensity   New intensity level of the segment
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Must be called whenever a shown segment (see nixie_segment_changed())
+ *          is changed.  The level is converted to a BCM
+ *          value, and the segment is turned on in the bit-plane of each
+ *          BCM bit that is set, and turned off in the rest.  Intensity
+ *          values above MAX_NIXIE_INTENSITY are treated as full-on.
+ *
+ *          Both bit-plane sets are updated while a swap is pending, so the
+ *          change is kept whether or not the swap has happened yet, and
+ *          while the back set is being built, so that a change made by the
+ *          crossfade interrupt to a segment already built is not lost.
+ ******************************************************************************/
+
+static void nixie_plane_update(uint8_t index, uint8_t intensity)
+{
+    uint8_t set;
+    uint8_t last;
+
+    if (intensity > MAX_NIXIE_INTENSITY) {
+        intensity = MAX_NIXIE_INTENSITY;
+    }
+    intensity = NIXIE_LEVEL_TO_BCM(intensity);
+
+    if (nixie_swap_pending || nixie_plane_building) {
+        set = 0;
+        last = 1;
+    }
+    else {
+        set = nixie_front;
+        last = set;
+    }
+
+    for ( ; set <= last; set++) {
+        nixie_plane_write(set, index, intensity);
+    }
+}
+
+/******************************************************************************
+ * uint8_t *nixie_digit_segdata(digit)
+ *
+ * Find the segment array a digit is shown from
+ *
+ * Inputs:  digit       Digit (tube number), 0..NIXIE_DIGITS-1
+ *
+ * Returns: Segment array of the top visible layer that owns <digit>, else
+ *          the displayed stream's array (NULL if no stream is shown)
+ ******************************************************************************/
+
+static inline uint8_t *nixie_digit_segdata(uint8_t digit)
+{
+    uint8_t *segdata = nixie_digit_source[digit];
+
+    return segdata ? segdata : nixie_segment_ptr;
+}
+
+/******************************************************************************
+ * uint16_t nixie_shown_digits(*segdata)
+ *
+ * Determine which digits of the physical display a segment array supplies
+ *
+ * Inputs:  *segdata    Pointer to a segment array
+ *
+ * Returns: Bitmap of digits shown from <segdata>, bit n = digit n
+ ******************************************************************************/
+
+static uint16_t nixie_shown_digits(const uint8_t *segdata)
+{
+    uint16_t digits;
+    uint8_t digit;
+
+    digits = 0;
+    for (digit = 0; digit < NIXIE_DIGITS; digit++) {
+        if (nixie_digit_segdata(digit) == segdata) {
+            digits |= (uint16_t) BM(digit);
+        }
+    }
+
+    return digits;
+}
+
+/******************************************************************************
+ * nixie_plane_build(set)
+ *
+ * Rebuild a set of precomputed display bit-planes from the shown segment
+ * arrays
+ *
+ * Inputs:  set         Bit-plane set to build (0 or 1)
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Each digit is taken from the array it is shown from (the
+ *          displayed stream, or the layer that covers it).  Each segment is
+ *          turned on in the bit-plane of every BCM bit that is set in the
+ *          BCM value of its intensity level.  Each segment is read and
+ *          written with interrupts disabled, so that a crossfade step cannot
+ *          fall between the two.
+ ******************************************************************************/
+
+static void nixie_plane_build(uint8_t set)
+{
+    register uint8_t *segdata;
+    register uint8_t index;
+    register uint8_t count;
+    uint8_t digit;
+
+    for (digit = 0; digit < NIXIE_DIGITS; digit++) {
+        segdata = nixie_digit_segdata(digit);
+        index = pgm_read_byte(&nixie_digit_offset[digit]);
+        count = (digit < NIXIE_DISPLAY_WIDTH) ? NIXIE_SEGMENTS_PER_DIGIT : 1;
+
+        for ( ; count; count--, index++) {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {
+                nixie_plane_write(set, index, segdata ?
+                    NIXIE_LEVEL_TO_BCM(segment_level(segdata, index)) : 0);
+            }
+        }
+    }
+}
+
+/******************************************************************************
+ * nixie_plane_present()
+ *
+ * Show the active segment array without tearing
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Builds the back bit-plane set, then has nixie_display_refresh()
+ *          swap it to the front at the next BCM frame boundary.  If the
+ *          previous pattern was still waiting to be shown, it is discarded
+ *          and counted as a dropped frame.  The swap is done at once if
+ *          display refresh is disabled.
+ *
+ *          The back set is built with interrupts enabled; it is marked as
+ *          being built meanwhile so that nixie_plane_update() (called by
+ *          the crossfade interrupt) writes it as well as the front set.
+ ******************************************************************************/
+
+static void nixie_plane_present(void)
+{
+    uint8_t back;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (nixie_swap_pending) {
+            nixie_swap_pending = 0;
+            if (nixie_drop_count < 0xFF) {
+                nixie_drop_count++;
+            }
+        }
+        back = nixie_front ^ 1;
+        nixie_plane_building = 1;
+    }
+
+    nixie_plane_build(back);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        nixie_plane_building = 0;
+        if (nixie_control.refresh_enable) {
+            nixie_swap_pending = 1;
+        }
+        else {
+            nixie_front = back;
+        }
+    }
+}
+
+/******************************************************************************
+ * nixie_crossfade_cancel()
+ *
+ * Stop a crossfade in progress
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   The display is left as it was at the last crossfade step, and no
+ *          CROSSFADE_DONE event is posted.
+ ******************************************************************************/
+
+static void nixie_crossfade_cancel(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        nixie_control.crossfade_active = 0;
+    }
+}
+
+/******************************************************************************
+ * nixie_segment_changed(*segdata, digit, index)
+ *
+ * Propagate a segment intensity change to the display bit-planes
+ *
+ * Inputs:  *segdata    Pointer to the segment array that was modified
+ *          digit       Digit the segment belongs to
+ *          index       Segment number that was modified
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Does nothing unless <digit> of the physical display is presently
+ *          shown from <segdata>.
+ ******************************************************************************/
+
+static inline void nixie_segment_changed(uint8_t *segdata, uint8_t digit, uint8_t index)
+{
+    if (segdata == nixie_digit_segdata(digit)) {
+        nixie_plane_update(index, segment_level(segdata, index));
+    }
+}
+
 /******************************************************************************
  * nixie_display_refresh()
  *
@@ -178,232 +703,733 @@ static const uint8_t nixie_digit_offset[] PROGMEM =
  *
  * Inputs:  None
  *
- * Returns: Nothing
+ * Returns: Number of TIMER0 counts until this function should be called again
  *
- * Notes:   This routine is intended to be called from a periodically timed
- *          interrupt.  The interrupt routine must run at a rate fast enough
- *          to prevent display flicker.  To meet this goal, this function
- *          should be called at a rate no less than:
- *          30 * (MAX_NIXIE_INTENSITY + 1)
- *          times per second.  The '30' value is suggested as a minimum full
- *          display update rate (full updates per second).  This routine
- *          performs only one SUB-cycle of the display refresh per entry,
- *          and one full refresh cycle consists of (MAX_NIXIE_INTENSITY + 1)
- *          sub-cycles.  The display quality will suffer if the full-cycle
- *          refresh rate is much less than 30x/second, and it is suggested
- *          that a higher rate be used if possible, within the limits of
- *          available execution time.
+ * Notes:   This routine is intended to be called from the TIMER0 output
+ *          compare B interrupt, which is rescheduled by the value returned
+ *          each time it is called, followed by nixie_display_queue().
+ *          Display intensity is controlled by binary-code modulation: one
+ *          full refresh (BCM frame) consists of NIXIE_BCM_BITS bit-planes,
+ *          and bit-plane <n> is shown for (NIXIE_BCM_UNIT << n) counts so
+ *          that each segment is lit for a time proportional to its
+ *          intensity level.
+ *
+ *          Each entry marks the end of one bit-plane.  The next bit-plane,
+ *          which was queued for transfer via SPI on the previous entry, is
+ *          latched into the display driver, then nixie_display_queue()
+ *          queues the bit-plane after it so that it can be shifted out
+ *          while the present one is being shown.  If the previous transfer
+ *          has not yet finished (e.g. because the SPI interrupt was held
+ *          off), latching is retried one NIXIE_BCM_UNIT later and the
+ *          present bit-plane is shown slightly longer.
+ *
+ *          When the display is dimmed, a bit-plane with part of its time to
+ *          be blanked takes two entries: the first un-blanks the driver for
+ *          the lit part, the second blanks it for the rest.  Both parts are
+ *          at least NIXIE_DIM_MIN_COUNTS long, see nixie_display_dim().
  ******************************************************************************/
 
-void nixie_display_refresh(void)
+uint8_t nixie_display_refresh(void)
 {
-    static uint8_t intensity_count;     // Intensity counter, goes from 0..MAX_NIXIE_INTENSITY, incremented every entry
-    register uint8_t segment_index;     // Iterator to index segment intensity array, 0..NIXIE_SEGMENTS
-    register uint8_t nixie_data;        // Data accumulator, sent to SPI, 8 bits of segment on/off data
-    register uint8_t bit_mask;          // ORed into nixie_data if a given segment should be ON
+    static uint8_t dark;                // Blanked remainder of the present bit-plane, TIMER0 counts
+    uint8_t duration;
+    int16_t wanted;
+    uint8_t lit;
 
-    // Exit if display refresh disabled
+    // Keep the timebase running but do nothing if display refresh disabled
 
     if (!nixie_control.refresh_enable) {
-        return;
+        return NIXIE_BCM_UNIT << (NIXIE_BCM_BITS - 1);
+    }
+
+    // Dimmed: blank the driver for the rest of the present bit-plane
+
+    if (dark) {
+        BCLR(DRIVER_ENABLE);
+        duration = dark;
+        dark = 0;
+        return duration;
     }
 
-    // Set initial values for the segment bit-on mask and SPI data accumulator
+    // Retry shortly if the bit-plane to show next is still being sent
 
-    bit_mask = 0x01;
-    nixie_data = 0x00;
+    if (spi_busy()) {
+        return NIXIE_BCM_UNIT;
+    }
 
-    // Build and shift out via SPI 64 bits (NIXIE_SEGMENTS) worth of
-    // nixie segment on/off data
+    // Display driver has all 64 bits of data for the next bit-plane
+    // Pulse latch-data pin on display driver to show it
 
-    for (segment_index = 0; segment_index < NIXIE_SEGMENTS; segment_index++) {
+    spi_latch();
+    duration = NIXIE_BCM_UNIT << nixie_bit_plane;
+    nixie_queue_due = 1;
 
-        // A given nixie display segment should be ON for this PWM sub-cycle
-        // if its intensity setting is greater than the current sub-cycle
-        // count, which cycles from 0..MAX_NIXIE_INTENSITY and is incremented
-        // on every entry into the ISR.
+    // Show it for the dimmed part of its time (plus any time owed by
+    // earlier bit-planes), rounded so that neither the lit nor the blanked
+    // part is too short to be timed
 
-        if (nixie_segment_ptr[segment_index] > intensity_count) {
-            // Turn nixie segment on for this PWM subcycle
-            nixie_data |= bit_mask;
+    wanted = (((uint16_t) duration * nixie_dim) >> NIXIE_DIM_BITS) + nixie_dim_carry;
+    if (wanted < NIXIE_DIM_MIN_COUNTS) {
+        lit = 0;
+    }
+    else if (wanted > duration - NIXIE_DIM_MIN_COUNTS) {
+        lit = duration;
+    }
+    else {
+        lit = wanted;
+    }
+    nixie_dim_carry = wanted - lit;
+
+    // Un-blank the driver unless the bit-plane is blanked throughout
+
+    if (lit) {
+        BSET(DRIVER_ENABLE);
+        dark = duration - lit;
+        duration = lit;
+    }
+    else {
+        BCLR(DRIVER_ENABLE);
+    }
+
+    return duration;
+}
+
+/******************************************************************************
+ * nixie_display_queue()
+ *
+ * Start sending the following bit-plane to the display driver
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   To be called after each call to nixie_display_refresh(), from
+ *          the same interrupt.  Does nothing unless that call latched a
+ *          bit-plane.  The following bit-plane is latched by the next call
+ *          that finds its transfer complete.
+ ******************************************************************************/
+
+void nixie_display_queue(void)
+{
+    uint8_t *plane;
+
+    if (!nixie_queue_due) {
+        return;
+    }
+    nixie_queue_due = 0;
+
+    // Advance to the following bit-plane
+    // When all bit-planes have been shown, one BCM frame has completed
+
+    // A new bit-plane set waiting to be shown takes over here, so that a
+    // BCM frame is never made up of planes from two different patterns
+
+    nixie_bit_plane++;
+    if (nixie_bit_plane >= NIXIE_BCM_BITS) {
+        nixie_bit_plane = 0;
+        nixie_frame_count++;
+        nixie_control.one_cycle_done = 1;
+        if (nixie_swap_pending) {
+            nixie_front ^= 1;
+            nixie_swap_pending = 0;
         }
+    }
+
+    // A cathode exercise replaces every bit-plane
+
+    plane = nixie_exercise_ptr;
+    if (!plane) {
+        plane = nixie_plane[nixie_front][nixie_bit_plane];
+    }
+    spi_data_queue(plane, NIXIE_PLANE_BYTES, 0);
+}
+
+/******************************************************************************
+ * nixie_display_enable(enable)
+ *
+ * Enable or disable nixie display
+ *
+ * Inputs:  enable      Nonzero (TRUE) to enable nixie display
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Display is blanked and display refresh suspended if <enable> is
+ *          0/FALSE.
+ ******************************************************************************/
+
+void nixie_display_enable(uint8_t enable)
+{
+    if (enable) {
+        nixie_control.refresh_enable = 1;
+        BSET(DRIVER_ENABLE);
+    }
+    else {
+        nixie_control.refresh_enable = 0;
+        BCLR(DRIVER_ENABLE);
+    }
+}
+
+/******************************************************************************
+ * nixie_display_dim(level)
+ *
+ * Set the global dimming level
+ *
+ * Inputs:  level       Intensity of the whole display, 0 (blank) ..
+ *                      NIXIE_DIM_FULL (full intensity).  Larger values are
+ *                      treated as NIXIE_DIM_FULL.
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Takes effect from the next bit-plane.  Segment data, and the
+ *          intensity levels of the segments relative to each other, are
+ *          not affected.
+ ******************************************************************************/
+
+void nixie_display_dim(uint8_t level)
+{
+    nixie_dim = (level < NIXIE_DIM_FULL) ? level : NIXIE_DIM_FULL;
+}
+
+/******************************************************************************
+ * uint8_t nixie_display_level()
+ *
+ * Read the global dimming level
+ *
+ * Inputs:  None
+ *
+ * Returns: Level set by nixie_display_dim(), 0..NIXIE_DIM_FULL
+ ******************************************************************************/
+
+uint8_t nixie_display_level(void)
+{
+    return nixie_dim;
+}
+
+/******************************************************************************
+ * nixie_exercise_build()
+ *
+ * Build the next cathode exercise bit-plane and show it
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Cathode <nixie_exercise_cathode> of every tube is lit, the neon
+ *          lamps and AUX outputs are off.  The plane is built into the
+ *          exercise plane not being shown, so the one being sent is never
+ *          modified.
+ ******************************************************************************/
+
+static void nixie_exercise_build(void)
+{
+    register uint8_t *plane;
+    uint8_t digit;
+    uint8_t index;
+
+    plane = nixie_exercise_plane[(nixie_exercise_ptr == nixie_exercise_plane[0]) ? 1 : 0];
+
+    for (index = 0; index < NIXIE_PLANE_BYTES; index++) {
+        plane[index] = 0;
+    }
+    for (digit = 0; digit < NIXIE_DISPLAY_WIDTH; digit++) {
+        index = pgm_read_byte(&nixie_digit_offset[digit]) + nixie_exercise_cathode;
+        plane[index >> 3] |= BM(index & 0x07);
+    }
+
+    nixie_exercise_ptr = plane;
+}
+
+/******************************************************************************
+ * nixie_exercise(passes)
+ *
+ * Start or stop a cathode exercise
+ *
+ * Inputs:  passes      Number of times to step through all cathodes, or 0
+ *                      to stop an exercise in progress
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Each cathode is lit for NIXIE_EXERCISE_FRAMES BCM frames, so one
+ *          pass takes about a second.  The displayed pattern returns when
+ *          the exercise ends; it is kept up to date meanwhile.  Global
+ *          dimming still applies.
+ ******************************************************************************/
 
-        if (bit_mask & 0x80) {
+void nixie_exercise(uint8_t passes)
+{
+    uint16_t steps;
 
-            // 8 bits of segment data have been processed
-            // Send the data to the display driver via SPI, and reset data
-            // accumulator and bit-on mask for the next 8 bits of data to
-            // send out.
+    steps = (uint16_t) passes * NIXIE_SEGMENTS_PER_DIGIT;
 
-            while (!(SPSR & BM(SPIF))); // Wait for previous byte to finish shifting out
-            SPDR = nixie_data;
-            bit_mask = 0x01;
-            nixie_data = 0x00;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (!steps) {
+            nixie_exercise_steps = 0;
+            nixie_exercise_ptr = NULL;
         }
+        else {
+            nixie_exercise_steps = (steps < 0xFF) ? steps : 0xFF;
+            nixie_exercise_cathode = 0;
+            nixie_exercise_frame = nixie_frame_count;
+            nixie_exercise_build();
+        }
+    }
+}
+
+/******************************************************************************
+ * uint8_t nixie_exercise_busy()
+ *
+ * Determine if a cathode exercise is in progress
+ *
+ * Inputs:  None
+ *
+ * Returns: Non-zero if an exercise started by nixie_exercise() has not yet
+ *          completed, 0 otherwise
+ ******************************************************************************/
+
+uint8_t nixie_exercise_busy(void)
+{
+    return nixie_exercise_steps;
+}
+
+/******************************************************************************
+ * nixie_exercise_service()
+ *
+ * Step a cathode exercise in progress
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Intended to be called from the timer tick interrupt.  Does
+ *          nothing unless an exercise is in progress and its present
+ *          cathode has been lit for NIXIE_EXERCISE_FRAMES BCM frames.
+ ******************************************************************************/
+
+void nixie_exercise_service(void)
+{
+    if (!nixie_exercise_steps ||
+        ((uint8_t) (nixie_frame_count - nixie_exercise_frame) < NIXIE_EXERCISE_FRAMES)) {
+        return;
+    }
 
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        nixie_exercise_frame += NIXIE_EXERCISE_FRAMES;
+
+        if (!--nixie_exercise_steps) {
+            nixie_exercise_ptr = NULL;
+        }
         else {
+            if (++nixie_exercise_cathode >= NIXIE_SEGMENTS_PER_DIGIT) {
+                nixie_exercise_cathode = 0;
+            }
+            nixie_exercise_build();
+        }
+    }
+}
+
+/******************************************************************************
+ * clear_nixie_display(*control)
+ *
+ * Reset all segment data to 0 (off), clearing the (virtual) display
+ *
+ * Inputs:  *control    Pointer to a nixie virtual display control structure.
+ *                      All segment data in the array pointed to by its
+ *                      <segdata> field will be reset to 0 (off).
+ *
+ * Returns: Nothing
+ *
+ * Notes:   All digits are marked as dirty if any segment was on.
+ ******************************************************************************/
+
+static void clear_nixie_display(nixie_stream_t *control)
+{
+    uint8_t *segdata;
+    uint8_t count;
+    uint8_t changed;
+    uint16_t shown;
 
-            // Advance bit-on mask for the next display segment
+    segdata = control->segdata;
+    shown = nixie_shown_digits(segdata);
+
+    if (segdata == nixie_segment_ptr) {
+        nixie_crossfade_cancel();
+    }
+
+    // Clearing an array that supplies every digit turns off every segment
+    // in every bit-plane of both sets, so clear the planes along with it
+
+    if (shown == NIXIE_DIRTY_ALL) {
+        uint8_t *plane = &nixie_plane[0][0][0];
+
+        for (count = sizeof(nixie_plane); count; count--) {
+            *plane = 0;
+            plane++;
+        }
+    }
+
+    changed = 0;
+    for (count = NIXIE_SEGDATA_BYTES; count; count--) {
+        changed |= *segdata;
+        *segdata = 0;
+        segdata++;
+    }
 
-            bit_mask <<= 1;
+    if (changed) {
+        control->dirty = NIXIE_DIRTY_ALL;
+        if (shown && (shown != NIXIE_DIRTY_ALL)) {
+            nixie_plane_present();
         }
     }
+}
 
-    // Display driver has all 64 bits of data it needs
-    // Pulse latch-data pin on display driver
+/******************************************************************************
+ * nixie_control_init(*control)
+ *
+ * Initialize control data for a nixie display stream
+ *
+ * Inputs:  *control    Pointer to a nixie_stream_t control structure
+ *                      that holds control and state information for a virtual
+ *                      display.  This is the structure pointed to by the
+ *                      <udata> field in a nixie display FILE structure, and
+ *                      used/updated by the nixie_out() function.
+ *
+ * Returns: Nothing
+ ******************************************************************************/
 
-    while (!(SPSR & BM(SPIF))); // Wait for last byte to finish shifting out
-    BSET(DRIVER_LATCH);
-    BCLR(DRIVER_LATCH);
+static void nixie_control_init(nixie_stream_t *control)
+{
+    clear_nixie_display(control);
+    control->dirty = NIXIE_DIRTY_ALL;
+    control->cursor = 0;
+    control->intensity = MAX_NIXIE_INTENSITY;
+    control->control.all = 0;
+    control->state = NORMAL_OUTPUT;
+}
 
-    // Increment intensity counter for next display PWM sub-cycle
-    // When this count exceeds the max intensity setting, reset it to 0
+/******************************************************************************
+ * nixie_stream_init(*stream, *control, *segdata)
+ *
+ * Initialize a stdio FILE object for use as a nixie virtual display
+ * output stream
+ *
+ * Inputs:  *stream     Pointer to a FILE object (as defined in stdio.h) that
+ *                      will be used as a nixie virtual display output stream.
+ *                      Following initialization, the FILE object can be passed
+ *                      by any stdio fxxx(FILE, ...) or fxxx_P(FILE, ....)
+ *                      function to output data to a virtual display.
+ *          *control    Points to a nixie_stream_t object to be associated
+ *                      with the <stream>.  The <control> object is used by
+ *                      nixie_out(), and contains the control data needed to
+ *                      implement the virtual display.
+ *          *segdata    Points to an array of NIXIE_SEGDATA_BYTES bytes
+ *                      which represent the segment intensity levels of each
+ *                      display emitter or visual element.  Data in this array
+ *                      is manipulated based on the character stream received and
+ *                      processed by nixie_out().  If the virtual display is
+ *                      mapped to the physical display via nixie_show_stream(),
+ *                      this data is used by nixie_display_refresh() to control
+ *                      physical display segment intensity.
+ *
+ * Returns: Nothing
+ *
+ * Notes:   The caller must declare and allocate memory for the above objects,
+ *          then pass pointers to them to this function, which will
+ *          initialize them and link them together to build a FILE object
+ *          that can be used by the stdio library output functions.
+ ******************************************************************************/
 
-    intensity_count++;
-    if (intensity_count >= MAX_NIXIE_INTENSITY) {
-        intensity_count = 0;
-        nixie_control.one_cycle_done = 1;
+void nixie_stream_init(FILE *stream, nixie_stream_t *control, uint8_t *segdata)
+{
+    stream->put = &nixie_out;
+    stream->get = NULL;
+    stream->flags = _FDEV_SETUP_WRITE;
+    stream->udata = control;
+
+    ((nixie_stream_t *) (stream->udata))->segdata = segdata;
+
+    nixie_control_init(control);
+}
 
-        // Suspend display refresh if one-cycle-only mode in effect
-        // (Used for crossfade synchronization)
+/******************************************************************************
+ * nixie_show_stream(*stream)
+ *
+ * Set nixie output stream to present on physical display
+ *
+ * Inputs:  *stream     Pointer to a FILE object that has been initialized
+ *                      by nixie_stream_init().  The <stream> specified will
+ *                      be shown on the physical nixie display.
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Visible display layers remain on top of the new stream.
+ ******************************************************************************/
 
-        if (nixie_control.one_cycle_only) {
-            nixie_control.refresh_enable = 0;
+void nixie_show_stream(FILE *stream)
+{
+    nixie_crossfade_cancel();
+    nixie_display_stream = stream->udata;
+    nixie_segment_ptr = nixie_display_stream->segdata;
+    nixie_crossfade_ptr = NULL;         // Next crossfade must process all digits
+    nixie_plane_present();
+}
+
+/******************************************************************************
+ * nixie_compose()
+ *
+ * Work out which segment array each digit of the physical display is shown
+ * from
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Must be called whenever a layer is added, removed, shown, hidden
+ *          or its digit mask changes.  Each digit is taken from the highest
+ *          priority visible layer that owns it, otherwise from the displayed
+ *          stream.  The display is rebuilt (without tearing) only if the
+ *          source of at least one digit changed.
+ ******************************************************************************/
+
+static void nixie_compose(void)
+{
+    uint8_t *source[NIXIE_DIGITS];
+    nixie_layer_t *layer;
+    uint16_t mask;
+    uint8_t digit;
+    uint8_t changed;
+
+    for (digit = 0; digit < NIXIE_DIGITS; digit++) {
+        source[digit] = NULL;
+    }
+
+    for (layer = nixie_layers; layer; layer = layer->next) {
+        if (!layer->visible) {
+            continue;
+        }
+        mask = layer->mask;
+        for (digit = 0; mask; digit++, mask >>= 1) {
+            if ((mask & 0x01) && !source[digit]) {
+                source[digit] = layer->stream->segdata;
+            }
         }
-   }
+    }
+
+    changed = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (digit = 0; digit < NIXIE_DIGITS; digit++) {
+            if (nixie_digit_source[digit] != source[digit]) {
+                nixie_digit_source[digit] = source[digit];
+                changed = 1;
+            }
+        }
+    }
+
+    if (changed) {
+        nixie_plane_present();
+    }
+}
+
+/******************************************************************************
+ * nixie_layer_init(*layer, *stream, mask, priority)
+ *
+ * Add a display layer on top of the displayed stream
+ *
+ * Inputs:  *layer      Points to a nixie_layer_t object to be initialized
+ *                      and added to the display.  Must not already be in use.
+ *          *stream     Pointer to a FILE object that has been initialized
+ *                      by nixie_stream_init(), whose segments are shown by
+ *                      the layer
+ *          mask        Digits owned by the layer, bit n = digit n
+ *          priority    Layers with higher priority are shown on top of those
+ *                      with lower priority
+ *
+ * Returns: Nothing
+ *
+ * Notes:   The layer is hidden until nixie_layer_show() is used.  A layer
+ *          must be removed by nixie_layer_remove() before its memory is
+ *          reused.
+ ******************************************************************************/
 
+void nixie_layer_init(nixie_layer_t *layer, FILE *stream, uint16_t mask, uint8_t priority)
+{
+    nixie_layer_t *prev;
+
+    layer->stream = stream->udata;
+    layer->mask = mask & NIXIE_DIRTY_ALL;
+    layer->priority = priority;
+    layer->visible = 0;
+
+    // Insert after all layers of the same or higher priority
+
+    if (!nixie_layers || (nixie_layers->priority < priority)) {
+        layer->next = nixie_layers;
+        nixie_layers = layer;
+    }
+    else {
+        prev = nixie_layers;
+        while (prev->next && (prev->next->priority >= priority)) {
+            prev = prev->next;
+        }
+        layer->next = prev->next;
+        prev->next = layer;
+    }
 }
 
 /******************************************************************************
- * nixie_display_enable(enable)
+ * nixie_layer_remove(*layer)
  *
- * Enable or disable nixie display
+ * Remove a display layer
  *
- * Inputs:  enable      Nonzero (TRUE) to enable nixie display
+ * Inputs:  *layer      Layer previously added by nixie_layer_init()
  *
  * Returns: Nothing
  *
- * Notes:   Display is blanked and display refresh suspended if <enable> is
- *          0/FALSE.
+ * Notes:   The digits it covered are shown from the layers below it, or the
+ *          displayed stream.
  ******************************************************************************/
 
-void nixie_display_enable(uint8_t enable)
+void nixie_layer_remove(nixie_layer_t *layer)
 {
-    if (enable) {
-        nixie_control.one_cycle_only = 0;
-        nixie_control.refresh_enable = 1;
-        BSET(DRIVER_ENABLE);
+    nixie_layer_t *prev;
+
+    if (nixie_layers == layer) {
+        nixie_layers = layer->next;
     }
     else {
-        nixie_control.refresh_enable = 0;
-        BCLR(DRIVER_ENABLE);
+        for (prev = nixie_layers; prev && (prev->next != layer); prev = prev->next) {
+            ;
+        }
+        if (!prev) {
+            return;
+        }
+        prev->next = layer->next;
+    }
+
+    if (layer->visible) {
+        layer->visible = 0;
+        nixie_compose();
     }
 }
 
 /******************************************************************************
- * clear_nixie_display(*segdata)
+ * nixie_layer_show(*layer, visible)
  *
- * Reset all segment data to 0 (off), clearing the (virtual) display
+ * Show or hide a display layer
  *
- * Inputs:  *segdata    Pointer to an array containing nixie display segment
- *                      intensity data.  All segment data in the array will be
- *                      reset to 0 (off).
+ * Inputs:  *layer      Layer previously added by nixie_layer_init()
+ *          visible     Nonzero to show the layer, 0 to hide it
  *
  * Returns: Nothing
  ******************************************************************************/
 
-static void clear_nixie_display(uint8_t *segdata)
+void nixie_layer_show(nixie_layer_t *layer, uint8_t visible)
 {
-    uint8_t count;
-
-    for (count = NIXIE_SEGMENTS; count; count--) {
-        *segdata = 0;
-        segdata++;
+    visible = (visible != 0);
+    if (layer->visible != visible) {
+        layer->visible = visible;
+        nixie_compose();
     }
 }
 
 /******************************************************************************
- * nixie_control_init(*control)
+ * nixie_layer_mask(*layer, mask)
  *
- * Initialize control data for a nixie display stream
+ * Change the digits owned by a display layer
  *
- * Inputs:  *control    Pointer to a nixie_stream_t control structure
- *                      that holds control and state information for a virtual
- *                      display.  This is the structure pointed to by the
- *                      <udata> field in a nixie display FILE structure, and
- *                      used/updated by the nixie_out() function.
+ * Inputs:  *layer      Layer previously added by nixie_layer_init()
+ *          mask        Digits owned by the layer, bit n = digit n
  *
  * Returns: Nothing
  ******************************************************************************/
 
-static void nixie_control_init(nixie_stream_t *control)
+void nixie_layer_mask(nixie_layer_t *layer, uint16_t mask)
 {
-    clear_nixie_display(control->segdata);
-    control->cursor = 0;
-    control->intensity = MAX_NIXIE_INTENSITY;
-    control->control.all = 0;
-    control->state = NORMAL_OUTPUT;
+    mask &= NIXIE_DIRTY_ALL;
+    if (layer->mask != mask) {
+        layer->mask = mask;
+        if (layer->visible) {
+            nixie_compose();
+        }
+    }
 }
 
 /******************************************************************************
- * nixie_stream_init(*stream, *control, *segdata)
+ * nixie_load_frame(*stream, *frame)
  *
- * Initialize a stdio FILE object for use as a nixie virtual display
- * output stream
+ * Replace the entire segment pattern of a display stream
  *
- * Inputs:  *stream     Pointer to a FILE object (as defined in stdio.h) that
- *                      will be used as a nixie virtual display output stream.
- *                      Following initialization, the FILE object can be passed
- *                      by any stdio fxxx(FILE, ...) or fxxx_P(FILE, ....)
- *                      function to output data to a virtual display.
- *          *control    Points to a nixie_stream_t object to be associated
- *                      with the <stream>.  The <control> object is used by
- *                      nixie_out(), and contains the control data needed to
- *                      implement the virtual display.
- *          *segdata    Points to an array of 64 (NIXIE_SEGMENTS) byte values
- *                      which represent the segment intensity levels of each
- *                      display emitter or visual element.  Data in this array
- *                      is manipulated based on the character stream received and
- *                      processed by nixie_out().  If the virtual display is
- *                      mapped to the physical display via nixie_show_stream(),
- *                      this data is used by nixie_display_refresh() to control
- *                      physical display segment intensity.
+ * Inputs:  *stream     Pointer to a FILE object that has been initialized
+ *                      by nixie_stream_init()
+ *          *frame      Points to NIXIE_SEGDATA_BYTES bytes of segment
+ *                      intensity levels, packed as in a segment array
  *
  * Returns: Nothing
  *
- * Notes:   The caller must declare and allocate memory for the above objects,
- *          then pass pointers to them to this function, which will
- *          initialize them and link them together to build a FILE object
- *          that can be used by the stdio library output functions.
+ * Notes:   If <stream> is being shown on the physical display, any
+ *          crossfade in progress is cancelled.  If any digit is shown from
+ *          <stream> (directly or as a layer), the new pattern is shown
+ *          from the start of the next BCM frame.  Frames loaded faster than
+ *          the display can show them are counted by nixie_frame_drops().
+ *          All digits are marked as dirty if any segment changed.
  ******************************************************************************/
 
-void nixie_stream_init(FILE *stream, nixie_stream_t *control, uint8_t *segdata)
+void nixie_load_frame(FILE *stream, const uint8_t *frame)
 {
-    stream->put = &nixie_out;
-    stream->get = NULL;
-    stream->flags = _FDEV_SETUP_WRITE;
-    stream->udata = control;
+    nixie_stream_t *control;
+    uint8_t *segdata;
+    uint8_t index;
+    uint8_t changed;
 
-    ((nixie_stream_t *) (stream->udata))->segdata = segdata;
+    control = stream->udata;
+    segdata = control->segdata;
 
-    nixie_control_init(control);
+    if (segdata == nixie_segment_ptr) {
+        nixie_crossfade_cancel();
+    }
+
+    changed = 0;
+    for (index = 0; index < NIXIE_SEGDATA_BYTES; index++) {
+        if (segdata[index] != frame[index]) {
+            segdata[index] = frame[index];
+            changed = 1;
+        }
+    }
+
+    if (changed) {
+        control->dirty = NIXIE_DIRTY_ALL;
+        if (nixie_shown_digits(segdata)) {
+            nixie_plane_present();
+        }
+    }
 }
 
 /******************************************************************************
- * nixie_show_stream(*stream)
+ * uint8_t nixie_frame_drops(reset)
  *
- * Set nixie output stream to present on physical display
+ * Read/reset count of dropped display frames
  *
- * Inputs:  *stream     Pointer to a FILE object that has been initialized
- *                      by nixie_stream_init().  The <stream> specified will
- *                      be shown on the physical nixie display.
+ * Inputs:  reset       Resets count to 0 if nonzero
  *
- * Returns: Nothing
+ * Returns: Number of segment patterns that were replaced by another before
+ *          they could be shown
  ******************************************************************************/
 
-void nixie_show_stream(FILE *stream)
+uint8_t nixie_frame_drops(uint8_t reset)
 {
-    nixie_segment_ptr = ((nixie_stream_t *) stream->udata)->segdata;
+    uint8_t count;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        count = nixie_drop_count;
+        if (reset) {
+            nixie_drop_count = 0;
+        }
+    }
+
+    return count;
 }
 
 /******************************************************************************
@@ -426,84 +1452,202 @@ void nixie_show_stream(FILE *stream)
  *          creates a crossfading effect that is visually appealing and less
  *          'abrupt' than a sudden state change.
  *
- *          This routine will 'block' (not return) until the physical display
- *          has attained the state specified by the to_stream.  Depending on
- *          the state of the new (to_stream) and old displays, this can take
- *          several hundred milliseconds to complete.
+ *          Segment intensities are stepped by one level per BCM frame (or
+ *          every <rate+1> frames, see nixie_crossfade_rate()).
+ *
+ *          This routine only starts the crossfade and returns immediately.
+ *          The crossfade is performed by nixie_crossfade_service(), and a
+ *          CROSSFADE_DONE event is posted once the physical display has
+ *          attained the state specified by the to_stream.  Depending on the
+ *          state of the new (to_stream) and old displays, this can take
+ *          several hundred milliseconds.  Calling this routine again while
+ *          a crossfade is in progress redirects it to the new to_stream.
+ *
+ *          Only the digits marked dirty in the to_stream and the displayed
+ *          stream (plus any left over from a cancelled crossfade) are
+ *          processed, unless the to_stream differs from the one used by the
+ *          previous crossfade, in which case all digits are processed.  If
+ *          no digits need processing, CROSSFADE_DONE is posted at once.
+ *          Changes written to the to_stream while a crossfade is in progress
+ *          are picked up by the next call to this routine.
  ******************************************************************************/
 
 void nixie_crossfade(FILE *to_stream)
 {
-    register uint8_t *p_from;
-    register uint8_t *p_to;
-    register uint8_t activity;
-    register uint8_t index;
+    nixie_stream_t *to;
+    uint8_t done;
+
+    to = to_stream->udata;
 
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        nixie_control.one_cycle_only = 1;
-        nixie_control.one_cycle_done = 0;
-        nixie_control.crossfade_count = 3;
+        if (to->segdata != nixie_crossfade_ptr) {
+            nixie_crossfade_ptr = to->segdata;
+            nixie_crossfade_mask = NIXIE_DIRTY_ALL;
+        }
+
+        nixie_crossfade_mask |= to->dirty;
+        to->dirty = 0;
+        if (nixie_display_stream) {
+            nixie_crossfade_mask |= nixie_display_stream->dirty;
+            nixie_display_stream->dirty = 0;
+        }
+
+        done = !nixie_crossfade_mask;
+        if (!done) {
+            nixie_control.one_cycle_done = 0;
+            nixie_control.crossfade_count = 3;
+            nixie_fade_frames = NIXIE_FADE_FRAMES - 1;
+            nixie_control.crossfade_active = 1;
+        }
     }
 
-    do {
-        // Set up for next crossfade pass
-        // Reset pointers to segment data arrays
+    // Nothing has changed, crossfade is already complete
 
-        p_from = nixie_segment_ptr;
-        p_to = ((nixie_stream_t *) to_stream->udata)->segdata;
+    if (done) {
+        add_event(CROSSFADE_DONE, 0);
+    }
+    else {
+        event_trace_display();
+    }
+}
+
+/******************************************************************************
+ * nixie_crossfade_busy()
+ *
+ * Determine if a crossfade is in progress
+ *
+ * Inputs:  None
+ *
+ * Returns: Non-zero if a crossfade started by nixie_crossfade() has not yet
+ *          completed, 0 otherwise
+ ******************************************************************************/
+
+uint8_t nixie_crossfade_busy(void)
+{
+    return nixie_control.crossfade_active;
+}
+
+/******************************************************************************
+ * nixie_crossfade_service()
+ *
+ * Step a crossfade in progress
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Intended to be called from the timer tick interrupt, at a rate of
+ *          at least one call per display BCM frame.  Does nothing unless a
+ *          crossfade is in progress and a full BCM frame has been displayed
+ *          since the last step.  Segments are stepped by one intensity level
+ *          every NIXIE_FADE_FRAMES BCM frames (more at slower crossfade
+ *          rates).  Must not be pre-empted by code that modifies the
+ *          displayed segment data.
+ ******************************************************************************/
 
-        // Wait for one display PWM cycle to complete
-        //
-        // With one_cycle_only in effect, refresh is suspended after one full
-        // PWM cycle has completed.
+void nixie_crossfade_service(void)
+{
+    register uint8_t *p_from;
+    register uint8_t *p_to;
+    register uint8_t activity;
+    register uint8_t count;
+    uint8_t level;
+    uint16_t digits;
+    uint8_t digit;
+    uint8_t index;
+
+    // Wait for one display BCM frame to complete
+    //
+    // Refresh keeps running while the segment data is adjusted, any
+    // bit-plane updated mid-frame simply takes effect one frame early.
+
+    if (!nixie_control.crossfade_active || !nixie_control.one_cycle_done) {
+        return;
+    }
 
-        while (! nixie_control.one_cycle_done) ;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
         nixie_control.one_cycle_done = 0;
 
-        // Perform crossfade intensity adjustment only every other cycle if
-        // slow crossfade mode is enabled
+        // Perform crossfade intensity adjustment only every NIXIE_FADE_FRAMES
+        // cycles, or less often if slow crossfade mode is enabled
 
-        if (nixie_control.crossfade_count < nixie_control.crossfade_rate) {
-            nixie_control.refresh_enable = 1;
+        if (++nixie_fade_frames < NIXIE_FADE_FRAMES) {
+            activity = 1;
+        }
+        else if (nixie_control.crossfade_count < nixie_control.crossfade_rate) {
+            nixie_fade_frames = 0;
             nixie_control.crossfade_count++;
             activity = 1;
+        }
+        else {
+            nixie_fade_frames = 0;
+            nixie_control.crossfade_count = 0;
+            activity = 0;
+        }
+    }
+
+    if (activity) {
+        return;
+    }
+
+    // Process only the digits that need it
+
+    digits = nixie_crossfade_mask;
+    for (digit = 0; digits; digit++, digits >>= 1) {
+        if (!(digits & 0x01)) {
             continue;
         }
 
+        // Set up pointers to segment data arrays, and index of first
+        // segment of digit
+
+        index = pgm_read_byte(&nixie_digit_offset[digit]);
+        p_from = nixie_segment_ptr;
+        p_to = nixie_crossfade_ptr;
+        count = (digit < NIXIE_DISPLAY_WIDTH) ? NIXIE_SEGMENTS_PER_DIGIT : 1;
+
         // Fade segments that are ON in "to" display up 
         // Fade segments that are OFF in "to" display down
 
-        activity = 0;
-        for (index = 0; index < NIXIE_SEGMENTS; index++) {
-            if (*p_to) {            // Is segment in new display on ?
-                if (*p_from < *p_to) {
+        for ( ; count; count--, index++) {
+            level = segment_level(p_from, index);
+            if (segment_level(p_to, index)) {   // Is segment in new display on ?
+                if (level < segment_level(p_to, index)) {
                     // Fade segment up to new intensity level
-                    (*p_from)++;
-                    activity++;
+                    level++;
+                }
+                else {
+                    continue;
                 }
             }
-            else if (*p_from) {     // Is segment that is supposed to be off still on?
+            else if (level) {       // Is segment that is supposed to be off still on?
                 // Fade segment down to off
-                (*p_from)--;
-                activity++;
+                level--;
+            }
+            else {
+                continue;
             }
 
-            // Point to next segment to work on
-
-            p_from++;
-            p_to++;
+            set_segment_level(p_from, index, level);
+            if (!nixie_digit_source[digit]) {
+                nixie_plane_update(index, level);
+            }
+            activity++;
         }
+    }
 
-        // One crossfade cycle completed, perform another PWM cycle
-
-        nixie_control.refresh_enable = 1;
-        nixie_control.crossfade_count = 0;
-    } while (activity);
-
-    // Crossfading complete, enable normal display refresh
+    // Crossfading complete, notify application
 
-    nixie_control.one_cycle_only = 0;
+    if (!activity) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            nixie_control.crossfade_active = 0;
+            nixie_crossfade_mask = 0;
+        }
+        add_event(CROSSFADE_DONE, 0);
+    }
 }
 
 /******************************************************************************
@@ -527,66 +1671,90 @@ void nixie_crossfade_rate(uint8_t rate)
 }
 
 /******************************************************************************
- * clear_nixie_digit(*segdata, digit)
+ * draw_nixie_digit(*control, digit, mask, intensity, overlay)
  *
- * Turn off all segments in the selected display tube (digit)
+ * Set the segment pattern of a display digit (tube)
  *
- * Inputs:  *segdata    Pointer to an array containing nixie display segment
- *                      intensity data for all 64 available display segments
- *          digit       The digit (nixie tube) to clear by turning off (setting
- *                      to 0) all segments associated with it.
+ * Inputs:  *control    Pointer to a nixie virtual display control structure
+ *          digit       The digit (tube number) to update.  Display digits
+ *                      0-5 have 10 segments, pseudo-digits such as the neon
+ *                      lamp "decimal points" have 1.
+ *          mask        Segments to turn on, bit n = segment n
+ *          intensity   The intensity level to drive the selected segments at
+ *          overlay     If nonzero, segments not in <mask> are left as they
+ *                      are, otherwise they are turned off
  *
  * Returns: Nothing
  *
- * Notes:   For 'normal' nixie digits (tubes) 0-5, the 10 segments associated
- *          with the selected display position will be turned off.  For pseudo-
- *          digits such as the neon lamp decimal points, only one segment
- *          will be turned off.
+ * Notes:   Only segments that actually change are written, and the digit is
+ *          marked dirty only if at least one segment changed.
  ******************************************************************************/
 
-static void clear_nixie_digit(uint8_t *segdata, uint8_t digit)
+static void draw_nixie_digit(nixie_stream_t *control, uint8_t digit, uint16_t mask, uint8_t intensity, uint8_t overlay)
 {
+    uint8_t *segdata;
     uint8_t count;
+    uint8_t index;
+    uint8_t value;
+    uint8_t changed;
 
-    // If clearing a normal digit/tube, clear 10 segments.
-    // For pseudo-digits such as the neon lamp "decimal points", turn off
-    // only one segment.
-
+    segdata = control->segdata;
     count = (digit < NIXIE_DISPLAY_WIDTH) ? NIXIE_SEGMENTS_PER_DIGIT : 1;
+    index = pgm_read_byte(&nixie_digit_offset[digit]);
+    changed = 0;
 
-    // Get segment offset for selected digit/tube
+    for ( ; count; count--) {
+        if (mask & 0x01) {
+            value = intensity;
+        }
+        else {
+            value = overlay ? segment_level(segdata, index) : 0;
+        }
 
-    segdata += pgm_read_byte(&nixie_digit_offset[digit]);
+        if (set_segment_level(segdata, index, value)) {
+            nixie_segment_changed(segdata, digit, index);
+            changed = 1;
+        }
 
-    // Turn off segment(s) in selected digit
+        mask >>= 1;
+        index++;
+    }
 
-    for ( ; count; count--) {
-        *segdata = 0;
-        segdata++;
+    if (changed) {
+        control->dirty |= (uint16_t) BM(digit);
     }
 }
 
 /******************************************************************************
- * set_nixie_segment(*segdata, digit, segment, intensity)
+ * set_nixie_segment(*control, digit, segment, intensity)
  *
  * Set intensity of a single display segment
  *
- * Inputs:  *segdata    Pointer to an array containing nixie display segment
- *                      intensity data for all 64 available display segments
+ * Inputs:  *control    Pointer to a nixie virtual display control structure
  *          digit       The digit, (tube number) of the segment to be set
  *          segment     The segment within the selected digit position to
  *                      be set.  Segment numbers 0..9 correspond one-to-one with
  *                      the nixie tube emitters that form the digits 0..9.
  *          intensity   The intensity level that the selected segment should be
- *                      driven at. 0=Off, 9 (MAX_NIXIE_INTENSITY) is full on.
+ *                      driven at. 0=Off, MAX_NIXIE_INTENSITY is full on.
  *
  * Returns: Nothing
+ *
+ * Notes:   The digit is marked dirty if the segment intensity changed.
  ******************************************************************************/
 
-static void set_nixie_segment(uint8_t *segdata, uint8_t digit, uint8_t segment, uint8_t intensity)
+static void set_nixie_segment(nixie_stream_t *control, uint8_t digit, uint8_t segment, uint8_t intensity)
 {
-    segdata += pgm_read_byte(&nixie_digit_offset[digit]) + segment;
-    *segdata = intensity;
+    uint8_t *segdata;
+    uint8_t index;
+
+    segdata = control->segdata;
+    index = pgm_read_byte(&nixie_digit_offset[digit]) + segment;
+
+    if (set_segment_level(segdata, index, intensity)) {
+        nixie_segment_changed(segdata, digit, index);
+        control->dirty |= (uint16_t) BM(digit);
+    }
 }
 
 /******************************************************************************
@@ -665,7 +1833,29 @@ static void dec_cursor(nixie_stream_t *control)
 }
 
 /******************************************************************************
- * int16_t nixie_out(ch, *stream)
+ * nixie_stream_write_begin(*p)
+ *
+ * Prepare to modify the segment data of a display stream
+ *
+ * Inputs:  *p          Display stream control structure
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Writing directly to the displayed stream cancels any crossfade in
+ *          progress, as the crossfade would otherwise be modifying the same
+ *          segment data from interrupt context (the tick interrupt may
+ *          pre-empt a read-modify-write of a packed segment byte).
+ ******************************************************************************/
+
+static inline void nixie_stream_write_begin(const nixie_stream_t *p)
+{
+    if ((p->segdata == nixie_segment_ptr) && nixie_control.crossfade_active) {
+        nixie_crossfade_cancel();
+    }
+}
+
+/******************************************************************************
+ * int nixie_out(ch, *stream)
  *
  * Output a character to a nixie virtual display stream
  * stdio library compliant
@@ -695,13 +1885,16 @@ static void dec_cursor(nixie_stream_t *control)
  *          can be found near the start of this source file.
  ******************************************************************************/
 
-int16_t nixie_out(char ch, FILE *stream)
+int nixie_out(char ch, FILE *stream)
 {
     register nixie_stream_t *p;
-    uint8_t char_type;
+    uint16_t entry;
+    uint16_t arg;
 
     p = stream->udata;
 
+    nixie_stream_write_begin(p);
+
     // If previous command character requires a parameter digit, interpret
     // the next character as a parameter and set value according to previous
     // character sent.
@@ -710,8 +1903,8 @@ int16_t nixie_out(char ch, FILE *stream)
         ch -= '0';
 
         if (p->state == SET_INTENSITY) {
-            if (ch <= MAX_NIXIE_INTENSITY) {
-                p->intensity = ch;
+            if (ch <= 9) {
+                p->intensity = NIXIE_INTENSITY_STEP(ch);
             }
         }
  
@@ -725,45 +1918,19 @@ int16_t nixie_out(char ch, FILE *stream)
         return 0;
     }
 
-    // Determine if character is displayable
-    // char_type = 0 : Not displayable
-    // char_type = 1 : Single digit
-    // char_type = 2 : Single digit plus '0' segment
-    // char_type = 3 : Space
+    // Look up character action
+    // Displayable characters (the common case) are drawn without further
+    // decoding
 
-    char_type = 0;
-    if ((ch >= '0') && (ch <= '9'))  {
-        char_type = 1;
-        ch -= '0';
-    }
-    else if ((ch >= 'A') && (ch <= 'I')) {
-        char_type = 2;
-        ch -= 'A';
-    }
-    else if ((ch >= 'a') && (ch <= 'i')) {
-        char_type = 2;
-        ch -= 'a';
-    }
-    else if (ch == ' ') {
-        char_type = 3;
+    entry = ENTRY(ACT_IGNORE, 0);
+    if (!(ch & 0x80)) {
+        entry = pgm_read_word(&nixie_char_action[(uint8_t) ch]);
     }
 
-    // If character is displayable, turn on appropriate segment(s)
-    // on the nixie display
-
-    if (char_type) {
+    if (entry <= ACT_ARG_MASK) {
         if (p->cursor < NIXIE_DISPLAY_WIDTH) {
-            if (! (p->control.overlay || p->control.single_overlay)) {
-                clear_nixie_digit(p->segdata, p->cursor);
-            }
-
-            if (char_type == 2) {
-                set_nixie_segment(p->segdata, p->cursor, 0, p->intensity);
-                ch++;
-            }
-            if (char_type != 3) {
-                set_nixie_segment(p->segdata, p->cursor, ch, p->intensity);
-            }
+            draw_nixie_digit(p, p->cursor, entry, p->intensity,
+                             p->control.overlay || p->control.single_overlay);
         }
 
         inc_cursor(p, 1);
@@ -772,148 +1939,95 @@ int16_t nixie_out(char ch, FILE *stream)
     }
 
     // Character is not displayable
-    // Check for valid control characters
+    // Perform control action
 
-    switch(ch) {
-        case '<' :                      // Turn on left neon lamp
-            set_nixie_segment(p->segdata, NIXIE_LEFT_LAMP, 0, p->intensity);
-            break;
- 
-        case '>' :                      // Turn on right neon lamp
-            set_nixie_segment(p->segdata, NIXIE_RIGHT_LAMP, 0, p->intensity);
-            break;
+    arg = entry & ACT_ARG_MASK;
 
-        case '(' :                      // Turn off left neon lamp
-            set_nixie_segment(p->segdata, NIXIE_LEFT_LAMP, 0, 0);
+    switch (entry >> ACT_SHIFT) {
+        case ACT_LAMP_ON :              // Turn on lamp or aux output
+            set_nixie_segment(p, arg, 0, p->intensity);
             break;
 
-        case ')' :                      // Turn off right neon lamp
-            set_nixie_segment(p->segdata, NIXIE_RIGHT_LAMP, 0, 0);
+        case ACT_LAMP_OFF :             // Turn off lamp or aux output
+            set_nixie_segment(p, arg, 0, 0);
             break;
 
-        case '`' :                      // Turn off both neon lamps
-            set_nixie_segment(p->segdata, NIXIE_LEFT_LAMP, 0, 0);
-            set_nixie_segment(p->segdata, NIXIE_RIGHT_LAMP, 0, 0);
+        case ACT_LAMPS_OFF :            // Turn off both neon lamps
+            set_nixie_segment(p, NIXIE_LEFT_LAMP, 0, 0);
+            set_nixie_segment(p, NIXIE_RIGHT_LAMP, 0, 0);
             break;
 
-        case '.' :                      // Turn on lamp to left of cursor
+        case ACT_LAMP_LEFT :            // Turn on lamp to left of cursor
             if ((p->cursor == 2) || (p->cursor == 3)) {
-                set_nixie_segment(p->segdata, NIXIE_LEFT_LAMP, 0, p->intensity);
+                set_nixie_segment(p, NIXIE_LEFT_LAMP, 0, p->intensity);
             }
             else if (p->cursor > 3) {
-                set_nixie_segment(p->segdata, NIXIE_RIGHT_LAMP, 0, p->intensity);
+                set_nixie_segment(p, NIXIE_RIGHT_LAMP, 0, p->intensity);
             }
             break;
 
-        case ',' :                      // Turn on lamp to right of cursor
+        case ACT_LAMP_RIGHT :           // Turn on lamp to right of cursor
             if ((p->cursor == 0) || (p->cursor == 1)) {
-                set_nixie_segment(p->segdata, NIXIE_LEFT_LAMP, 0, p->intensity);
+                set_nixie_segment(p, NIXIE_LEFT_LAMP, 0, p->intensity);
             }
             else if (p->cursor < 4) {
-                set_nixie_segment(p->segdata, NIXIE_RIGHT_LAMP, 0, p->intensity);
+                set_nixie_segment(p, NIXIE_RIGHT_LAMP, 0, p->intensity);
             }
             break;
 
-        case 'X' :                      // Turn on AUX output A
-            set_nixie_segment(p->segdata, NIXIE_AUX_A, 0, p->intensity);
-            break;
-
-        case 'x' :                      // Turn off AUX output A
-            set_nixie_segment(p->segdata, NIXIE_AUX_A, 0, 0);
-            break;
-
-        case 'Y' :                      // Turn on AUX output B
-            set_nixie_segment(p->segdata, NIXIE_AUX_B, 0, p->intensity);
-            break;
-
-        case 'y' :                      // Turn off AUX output B
-            set_nixie_segment(p->segdata, NIXIE_AUX_B, 0, 0);
-            break;
-
-
-        case '[' :                      // Decrease intensity by 1
+        case ACT_DIMMER :               // Decrease intensity by 1
             if (p->intensity) {
                 p->intensity--;
             }
             break;
 
-        case ']' :                      // Increase intensity by 1
+        case ACT_BRIGHTER :             // Increase intensity by 1
             if (p->intensity < MAX_NIXIE_INTENSITY) {
                 p->intensity++;
             }
             break;
 
-        case '*' :                      // Set intensity to following digit
-            p->state = SET_INTENSITY;
-            break;
-
-        case '~' :                      // Set intensity to max/nominal
+        case ACT_NOMINAL :              // Set intensity to max/nominal
             p->intensity = NOMINAL_NIXIE_INTENSITY;
             break;
 
-        case '$' :                      // Enable cursor auto-increment
-            p->control.no_cursor_inc = 0;
-            break;
-
-        case '#' :                      // Disable cursor auto-increment
-            p->control.no_cursor_inc = 1;
-            break;
-
-        case '!' :                      // Next char does not auto-inc cursor
-            p->control.single_no_inc = 1;
-            break;
-
-        case '&' :                      // Disable overlay mode
-            p->control.overlay = 0;
+        case ACT_PARAMETER :            // Next character is a parameter
+            p->state = arg;
             break;
 
-        case '|' :                      // Enable overlay mode
-            p->control.overlay = 1;
+        case ACT_SET_FLAGS :            // Set output control flag(s)
+            p->control.all |= arg;
             break;
 
-        case '_' :                      // Next char will overlay
-            p->control.single_overlay = 1;
+        case ACT_CLEAR_FLAGS :          // Clear output control flag(s)
+            p->control.all &= ~arg;
             break;
 
-        case '^' :                      // Dec cursor, next char overlays
+        case ACT_BACK_OVERLAY :         // Dec cursor, next char overlays
             dec_cursor(p);
             p->control.single_overlay = 1;
             break;
 
-        case '@' :                      // Set cursor to absolute position
-            p->state = SET_CURSOR_POS;
-            break;
-
-        case '{' :                      // Disable cursor auto-wraparound
-            p->control.no_cursor_wrap = 1;
-            break;
-
-        case '}' :                      // Enable cursor auto-wraparound
-            p->control.no_cursor_wrap = 0;
-            break;
-
-        case '\f' :                     // Clear display, cursor to left
-            clear_nixie_display(p->segdata);
-            p->cursor = 0;
+        case ACT_CLEAR :                // Clear display, cursor to left
+            clear_nixie_display(p);
+            if (arg) {
+                p->cursor = 0;
+            }
             break;
 
-        case '\r' :                     // Move cursor to leftmost digit
+        case ACT_HOME :                 // Move cursor to leftmost digit
             p->cursor = 0;
             break;
 
-        case '\n' :                     // Clear display
-            clear_nixie_display(p->segdata);
-            break;
-
-        case '\b' :                     // Move cursor left 1 digit
+        case ACT_LEFT :                 // Move cursor left 1 digit
             dec_cursor(p);
             break;
 
-        case '\t' :                     // Move cursor right 1 digit
+        case ACT_RIGHT :                // Move cursor right 1 digit
             inc_cursor(p, 0);
             break;
 
-        case '\v' :                     // Partial display init
+        case ACT_RESET :                // Partial display init
             p->intensity = MAX_NIXIE_INTENSITY;
             p->cursor = 0;
             p->control.all = 0;
@@ -922,3 +2036,70 @@ int16_t nixie_out(char ch, FILE *stream)
 
     return 0;
 }
+
+/******************************************************************************
+ * nixie_put_bcd(*stream, digit, bcd)
+ *
+ * Write a two-digit packed BCD value directly into a display stream
+ *
+ * Inputs:  *stream     Pointer to a FILE object that has been initialized
+ *                      by nixie_stream_init()
+ *          digit       Display position of the first (tens) digit, 0..4
+ *          bcd         Packed BCD value: tens in the upper 4 bits, units in
+ *                      the lower 4 bits.  A nibble above 9 (e.g.
+ *                      NIXIE_BCD_BLANK) turns the digit off.
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Equivalent to printing the two digits at the cursor position
+ *          <digit> with nixie_out() in normal (not overlay) mode, at the
+ *          stream's present intensity, but without the stdio and character
+ *          decoding overhead.  The cursor is not moved.  Only digits that
+ *          actually change are written and marked dirty.  As with
+ *          nixie_out(), writing to the displayed stream cancels any
+ *          crossfade in progress.
+ ******************************************************************************/
+
+void nixie_put_bcd(FILE *stream, uint8_t digit, uint8_t bcd)
+{
+    nixie_stream_t *p;
+    uint8_t count;
+    uint8_t n;
+
+    p = stream->udata;
+    nixie_stream_write_begin(p);
+
+    for (count = 2; count; count--, digit++) {
+        n = bcd >> 4;
+        draw_nixie_digit(p, digit, (n <= 9) ? BM(n) : 0, p->intensity, 0);
+        bcd <<= 4;
+    }
+}
+
+/******************************************************************************
+ * nixie_put_lamps(*stream, left, right)
+ *
+ * Set the neon lamps of a display stream
+ *
+ * Inputs:  *stream     Pointer to a FILE object that has been initialized
+ *                      by nixie_stream_init()
+ *          left        Nonzero to turn the left lamp on, 0 to turn it off
+ *          right       Nonzero to turn the right lamp on, 0 to turn it off
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Lamps are turned on at the stream's present intensity.  As with
+ *          nixie_out(), writing to the displayed stream cancels any
+ *          crossfade in progress.
+ ******************************************************************************/
+
+void nixie_put_lamps(FILE *stream, uint8_t left, uint8_t right)
+{
+    nixie_stream_t *p;
+
+    p = stream->udata;
+    nixie_stream_write_begin(p);
+
+    set_nixie_segment(p, NIXIE_LEFT_LAMP, 0, left ? p->intensity : 0);
+    set_nixie_segment(p, NIXIE_RIGHT_LAMP, 0, right ? p->intensity : 0);
+}
@@ -14,12 +14,18 @@ Content:    Simple single-note music player, loosely based on IBM/GW BASIC
 ------------------------------------------------------------------------------*/
 
 #include <stdint.h>
+#include <string.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
-#include <avr/eeprom.h>
+#include <util/atomic.h>
 
 #include "portdef.h"
 #include "player.h"
+#include "sound.h"
+#include "serial.h"
+#include "timer.h"
+#include "profile.h"
+#include "config.h"
 
 #define debug_out(x) { while (!(UCSR0A & BM(UDRE0))); UDR0 = x; }
 
@@ -90,549 +96,1064 @@ Content:    Simple single-note music player, loosely based on IBM/GW BASIC
 #define NOTE_16TH           16
 #define NOTE_32ND           32
 
+// Sound generator voice used by the player
+
+#define PLAYER_VOICE        0
+
 // Player run states
 
 #define PLAYER_STOP         0
 #define PLAYER_RUN          1
 #define PLAYER_INIT         2
 
+// Compiled player code
+//
+// player_start() translates the play string into a compact list of
+// instructions, so that player_service() does not have to parse digits,
+// key signatures or tempo arithmetic in interrupt context.  Octave, key,
+// transposition, tempo and note/rest ratio are resolved at compile time;
+// each note or rest becomes a two-byte instruction:
+//
+//   <note> <duration>
+//
+// <note> is a sound_note() note number (octave * 12 + note), or CODE_REST.
+// <duration> is an index into player_duration[], which holds the distinct
+// note/rest time pairs used by the string.
+//
+// Other instructions are identified by the upper bits of their first byte:
+
+#define CODE_REST           SOUND_NOTES
+#define CODE_VOLUME         0x80    // + volume (0..9)
+#define CODE_MARK           0x90    // + bookmark #, followed by repeat count
+#define CODE_GOTO           0xA0    // + bookmark #
+#define CODE_RESET          0xB0    // Reset output to default volume
+#define CODE_NEXT           0xC0    // Continue in other stream buffer half
+#define CODE_END            0xFF    // End of string, stop player
+
+#define CODE_OP(x)          ((x) & 0xF0)
+#define CODE_ARG(x)         ((x) & 0x0F)
+
+#if PLAYER_CODE_SIZE > 255
+  #error PLAYER_CODE_SIZE must not exceed 255 bytes
+#endif
+
+// Bookmark position value for undefined bookmarks
+
+#define NO_BOOKMARK         0xFF
+
+// Maximum number of instructions executed per player_service() call
+// (bounds interrupt time, e.g. for a bookmark loop containing no notes)
+
+#define MAX_CODE_STEPS      8
+
+// Stream input
+// A stream is compiled into one half of player_code[] and player_duration[]
+// while the other half is being played.  The stream ends at an EOT
+// character, or if no data arrives for PLAYER_STREAM_TIMEOUT ticks while
+// a command is being read.
+// Received data is held in a small buffer until a whole command is there to
+// be compiled.  A command longer than the buffer ends the stream.
+
+#define PLAYER_STREAM_HALF  (PLAYER_CODE_SIZE / 2)
+#define STREAM_END          0x04    // EOT (Ctrl-D)
+#define STREAM_TIMEOUT      MS_TO_TICKS(2000)
+#define STREAM_BUFFER_SIZE  32
+
+#if PLAYER_DURATIONS & 1
+  #error PLAYER_DURATIONS must be even
+#endif
+
+// player_starved values
+
+#define STARVED_NO          0       // Player has code to play
+#define STARVED_YES         1       // Player ran out of code (underrun)
+#define STARVED_START       2       // Player waiting for first buffer half
+
+// compile_token() results
+
+#define COMPILE_OK          0
+#define COMPILE_END         1
+#define COMPILE_FULL        2
+#define COMPILE_PENDING     3
+
+// compile_region() argument selecting the entire code buffer
+
+#define COMPILE_WHOLE       0xFF
+
 // Type definitions
 
+typedef enum {          // Stream compiler states
+    STREAM_IDLE,        //   No stream being read
+    STREAM_WAIT,        //   Wait for buffer half to finish playing
+    STREAM_FILL         //   Compile stream into buffer half
+} stream_state_t;
+
 typedef enum {          // Player execution states
-    STATE_RESET,        //   Reset player to defaults
-    STATE_GET_NOTE,     //   Get note or command
-    STATE_GET_MODIFIER, //   Get note modifiers (length, octave, accidentals)
-    STATE_START_NOTE,   //   Start playing note
+    STATE_FETCH,        //   Fetch and execute next instruction
     STATE_WAIT_NOTE,    //   Wait for note to finish
-    STATE_START_REST,   //   Start playing rest
     STATE_WAIT_REST,    //   Wait for rest to finish
-    STATE_GET_DIGIT,    //   Get single-digit parameter for command
-    STATE_GET_NUMBER,   //   Get multi-digit parameter for command (init)
-    STATE_GET_NUMBER_2, //   Get parameter digits until non-digit encountered
-    STATE_SET_OCTAVE,   //   Complete "set octave" command
-    STATE_SET_NOTE_RATIO, // Complete "set note/rest ratio" command
-    STATE_SET_VOLUME,   //   Complete "set volume" command
-    STATE_SET_TRANSPOSITION, // Complete "set transposition" command
-    STATE_SET_KEY,      //   1st stage of "set key" command
-    STATE_SET_KEY_2,    //   Fetch sharp/flat notes for "set key" command
-    STATE_SET_TEMPO,    //   1st stage of "set tempo" command (beat unit fetched)
-    STATE_SET_TEMPO_2,  //   Complete "set tempo" command (beats/min fetched)
-    STATE_SET_BOOKMARK, //   1st stage of "set bookmark" command (bookmark # fetched)
-    STATE_SET_BOOKMARK_2, // Complete "set bookmark" command (repeat count fetched)
-    STATE_GOTO_BOOKMARK,//   Complete "goto bookmark" command 
-    STATE_STOP          //   Stop playing (mute output)
+    STATE_NEXT_CODE     //   Wait for next stream buffer half
 } player_state_t;
 
 
-typedef struct {        // Note data
-    uint16_t period;    //   Timer period (output compare value)
-    prescale_t prescale;//   Prescaler selection
-} note_t;
+typedef struct {        // Note timing, PLAYER_TICKS_PER_SECOND units
+    uint16_t note;      //   Note play period
+    uint16_t rest;      //   Rest (silence) period following note
+} duration_t;
 
 typedef struct {        // Player bookmark info
-    uint8_t *position;  //   Bookmark position in string
+    uint8_t position;   //   Bookmark position in player code
     uint8_t repeat;     //   # times to repeat
 } bookmark_t;
 
+typedef struct {        // Score settings, tracked while compiling
+    int8_t note;            // Note #
+    int8_t octave;          // Octave #
+    int8_t accidental;      // Accidental: -1=Flat 0=Natural +1=Sharp
+    int8_t transposition;   // # of halfsteps to transpose notes up
+    uint8_t note_size;      // Note size fraction; e.g. 4=quarter note
+    uint8_t size_modifier;  // Note size modifier flags: 0:Dotted 1:Triplet 2:Tied 3:Staccato
+    uint8_t note_rest_ratio;// Note-to-rest ratio, in 8ths
+    uint16_t whole_note_period; // # ticks in a whole note
+    int8_t scale[7];        // Note letter-to-number conversion, adjusted for key signature
+} score_t;
+
 // Module (private) variables
 
 static uint16_t         player_timer;
 static uint8_t          *player_ptr;
 static player_space_t   player_mem_space;
-static uint8_t          player_enable;
+static volatile uint8_t player_enable;
 static bookmark_t       bookmark[NUM_BOOKMARKS];
 
+static uint8_t          player_code[PLAYER_CODE_SIZE];
+static uint8_t          player_code_size;
+static uint8_t          player_code_limit;
+static duration_t       player_duration[PLAYER_DURATIONS];
+static uint8_t          player_durations;
+static uint8_t          player_duration_first;
+static uint8_t          player_duration_limit;
+static score_t          player_score;
+
+// Stream state
+// player_ready has one bit per code buffer half, set by player_poll() when
+// the half has been compiled and cleared by player_service() once it has
+// been played.
+
+static stream_state_t   player_stream;
+static uint8_t          player_fill;
+static uint8_t          player_pending;
+static volatile uint8_t player_ready;
+static volatile uint8_t player_starved;
+static volatile uint8_t player_underrun_count;
+static uint8_t          player_half;
+
+// Stream data not yet compiled
+// stream_player_char() reads from stream_buffer[stream_pos], and sets
+// stream_short if it runs out of data before the end of the stream has
+// been seen; the command being compiled is then compiled again once more
+// data has been received.
+
+static uint8_t          stream_buffer[STREAM_BUFFER_SIZE];
+static uint8_t          stream_count;   // Bytes held in stream_buffer[]
+static uint8_t          stream_pos;     // Read position, may pass stream_count
+static uint8_t          stream_short;   // Ran out of data part way through a command
+static uint8_t          stream_ended;   // No more data will be added
+static uint32_t         stream_time;    // Time data was last received, or filling started
+
 //-----------------------------------------------------------------------------
 
-// Note table
+/******************************************************************************
+ * uint8_t stream_player_char()
+ *
+ * Fetch next character of a stream from the stream buffer
+ *
+ * Inputs:  None
+ *
+ * Returns: Character received, or 0 at the end of the buffered data.  Line
+ *          breaks and tabs are returned as spaces.
+ *
+ * Notes:   Never waits.  Reading past the end of the buffered data sets
+ *          stream_short, unless the stream has ended; see player_poll().
+ ******************************************************************************/
 
-// Note frequencies are calculated by applying the formula:
-//   Note[n] = Note[n-1] * 2 ^ (1/12)     2 ^ (1/12) = 1.059463094
-// Or equivalently:
-//   Note[n] = Note[0] * (2^(1/12))^n
-//   Note[0] = Low C (C0) = 16.35 Hz
-//
-// If the 16-bit timer is used, almost any audible frequency - including all
-// octave 0 notes - should be attainable even if running at 20 MHz.
-// Use of a 8-bit timer is possible, but several parts of the code that deal
-// with the timer subsystem will have to be modified.  Also, depending on
-// what F_CPU is, some of the lowest octave notes may not be attainable, even
-// when the prescaler is set to max (f/1024).
-//
-// Consider this example for 8-bit timer use with F_CPU = 12000000:
-//
-// Octave 0 is not entirely attainable when F_CPU = 12000000, because:
-//   F_CPU / 21.82 (F0) / 1024 (max prescale) / 2 - 0.5 ~= 268
-//   268 exceeds 8-bit timer resolution of 255
-//   F#0 is attainable with a period of 252
-//
-// Period is the reciprocal of frequency, and for any of the AVR timers it is
-// calculated as:
-//
-//   F_CPU / frequency / prescaler / 2 - 0.5
-//
-// Must divide by 2 since timer inverts output on each compare match, so
-// one complete on-off cycle is two timer output compare match events.
-//  Subtraction of 0.5 is done for rounding purposes.  Normally, one would ADD
-// 0.5 to the result to 'round up', but the output period of the timer is
-// actually what is put in the output compare register PLUS 1, so by 'rounding
-// down' this requirement is satisfied while still selecting a period that is
-// close to ideal as the timer resolution will allow.
-//
-// Tonal quality is limited by the timer resolution and prescaler selections,
-// so some notes - particularily those in octave 6 and 7 - may sound somewhat
-// flat or sharp if a 8-bit timer is used.
+static uint8_t stream_player_char(void)
+{
+    uint8_t data;
 
-#define NOTE_PERIOD(freq, prescale)     (F_CPU / freq / prescale / 2 - 0.5)
-#define NOTE_FAULT_(freq, prescale)     (255)
+    if (stream_pos < stream_count) {
+        data = stream_buffer[stream_pos];
+    }
+    else {
+        data = 0;
+        if (!stream_ended) {
+            stream_short = 1;
+        }
+    }
+    stream_pos++;
 
-static const note_t note_table[OCTAVES][NOTES_PER_OCTAVE] PROGMEM =
+    if (data == STREAM_END) {
+        data = 0;
+    }
+    else if ((data == '\r') || (data == '\n') || (data == '\t')) {
+        data = ' ';
+    }
+
+    return data;
+}
+
+/******************************************************************************
+ * uint8_t next_player_char()
+ *
+ * Fetch next character from the play string in the selected memory space
+ *
+ * Inputs:  None passed in - uses these local module variables:
+ *          player_mem_space    Memory space containing player music string,
+ *                              as defined in the player_space_t enum.
+ *          player_ptr          Pointer to player music string.  Incremented to
+ *                              point to the next character in the string on
+ *                              exit.
+ *
+ * Returns: Character pointed to by player_ptr on entry, converted to uppercase.
+ ******************************************************************************/
+
+static uint8_t next_player_char(void)
 {
-    {
-        {.period = NOTE_PERIOD(16.35,  8), .prescale = PRESCALE_8   },  // C0
-        {.period = NOTE_PERIOD(17.32,  8), .prescale = PRESCALE_8   },  // C#0
-        {.period = NOTE_PERIOD(18.35,  8), .prescale = PRESCALE_8   },  // D0
-        {.period = NOTE_PERIOD(19.44,  8), .prescale = PRESCALE_8   },  // D#0
-        {.period = NOTE_PERIOD(20.60,  8), .prescale = PRESCALE_8   },  // E0
-        {.period = NOTE_PERIOD(21.82,  8), .prescale = PRESCALE_8   },  // F0
-        {.period = NOTE_PERIOD(23.12,  8), .prescale = PRESCALE_8   },  // F#0
-        {.period = NOTE_PERIOD(24.50,  8), .prescale = PRESCALE_8   },  // G0
-        {.period = NOTE_PERIOD(25.95,  8), .prescale = PRESCALE_8   },  // G#0
-        {.period = NOTE_PERIOD(27.50,  8), .prescale = PRESCALE_8   },  // A0
-        {.period = NOTE_PERIOD(29.13,  8), .prescale = PRESCALE_8   },  // A#0
-        {.period = NOTE_PERIOD(30.86,  8), .prescale = PRESCALE_8   },  // B0
-    },
-    {
-        {.period = NOTE_PERIOD(32.70,  8), .prescale = PRESCALE_8   },  // C1
-        {.period = NOTE_PERIOD(34.65,  8), .prescale = PRESCALE_8   },  // C#1
-        {.period = NOTE_PERIOD(36.71,  8), .prescale = PRESCALE_8   },  // D1
-        {.period = NOTE_PERIOD(38.89,  8), .prescale = PRESCALE_8   },  // D#1
-        {.period = NOTE_PERIOD(41.20,  8), .prescale = PRESCALE_8   },  // E1
-        {.period = NOTE_PERIOD(43.65,  8), .prescale = PRESCALE_8   },  // F1
-        {.period = NOTE_PERIOD(46.25,  8), .prescale = PRESCALE_8   },  // F#1
-        {.period = NOTE_PERIOD(49.00,  8), .prescale = PRESCALE_8   },  // G1
-        {.period = NOTE_PERIOD(51.91,  8), .prescale = PRESCALE_8   },  // G#1
-        {.period = NOTE_PERIOD(55.00,  8), .prescale = PRESCALE_8   },  // A1
-        {.period = NOTE_PERIOD(58.27,  8), .prescale = PRESCALE_8   },  // A#1
-        {.period = NOTE_PERIOD(61.73,  8), .prescale = PRESCALE_8   },  // B1
-    },
-    {
-        {.period = NOTE_PERIOD(65.41,  8), .prescale = PRESCALE_8   },  // C2
-        {.period = NOTE_PERIOD(69.30,  8), .prescale = PRESCALE_8   },  // C#2
-        {.period = NOTE_PERIOD(73.42,  8), .prescale = PRESCALE_8   },  // D2
-        {.period = NOTE_PERIOD(77.78,  8), .prescale = PRESCALE_8   },  // D#2
-        {.period = NOTE_PERIOD(82.41,  8), .prescale = PRESCALE_8   },  // E2
-        {.period = NOTE_PERIOD(87.31,  8), .prescale = PRESCALE_8   },  // F2
-        {.period = NOTE_PERIOD(92.50,  8), .prescale = PRESCALE_8   },  // F#2
-        {.period = NOTE_PERIOD(98.00,  8), .prescale = PRESCALE_8   },  // G2
-        {.period = NOTE_PERIOD(103.8,  8), .prescale = PRESCALE_8   },  // G#2
-        {.period = NOTE_PERIOD(110.0,  8), .prescale = PRESCALE_8   },  // A2
-        {.period = NOTE_PERIOD(116.5,  8), .prescale = PRESCALE_8   },  // A#2
-        {.period = NOTE_PERIOD(123.5,  1), .prescale = PRESCALE_1   },  // B2
-    },
-    {
-        {.period = NOTE_PERIOD(130.8,  1), .prescale = PRESCALE_1   },  // C3
-        {.period = NOTE_PERIOD(138.6,  1), .prescale = PRESCALE_1   },  // C#3
-        {.period = NOTE_PERIOD(146.8,  1), .prescale = PRESCALE_1   },  // D3
-        {.period = NOTE_PERIOD(155.6,  1), .prescale = PRESCALE_1   },  // D#3
-        {.period = NOTE_PERIOD(164.8,  1), .prescale = PRESCALE_1   },  // E3
-        {.period = NOTE_PERIOD(174.6,  1), .prescale = PRESCALE_1   },  // F3
-        {.period = NOTE_PERIOD(185.0,  1), .prescale = PRESCALE_1   },  // F#3
-        {.period = NOTE_PERIOD(196.0,  1), .prescale = PRESCALE_1   },  // G3
-        {.period = NOTE_PERIOD(207.7,  1), .prescale = PRESCALE_1   },  // G#3
-        {.period = NOTE_PERIOD(220.0,  1), .prescale = PRESCALE_1   },  // A3
-        {.period = NOTE_PERIOD(233.1,  1), .prescale = PRESCALE_1   },  // A#3
-        {.period = NOTE_PERIOD(246.9,  1), .prescale = PRESCALE_1   },  // B3
-    },
-    {
-        {.period = NOTE_PERIOD(261.6,  1), .prescale = PRESCALE_1   },  // C4
-        {.period = NOTE_PERIOD(277.2,  1), .prescale = PRESCALE_1   },  // C#4
-        {.period = NOTE_PERIOD(293.7,  1), .prescale = PRESCALE_1   },  // D4
-        {.period = NOTE_PERIOD(311.1,  1), .prescale = PRESCALE_1   },  // D#4
-        {.period = NOTE_PERIOD(329.6,  1), .prescale = PRESCALE_1   },  // E4
-        {.period = NOTE_PERIOD(349.2,  1), .prescale = PRESCALE_1   },  // F4
-        {.period = NOTE_PERIOD(370.0,  1), .prescale = PRESCALE_1   },  // F#4
-        {.period = NOTE_PERIOD(392.0,  1), .prescale = PRESCALE_1   },  // G4
-        {.period = NOTE_PERIOD(415.3,  1), .prescale = PRESCALE_1   },  // G#4
-        {.period = NOTE_PERIOD(440.0,  1), .prescale = PRESCALE_1   },  // A4
-        {.period = NOTE_PERIOD(466.2,  1), .prescale = PRESCALE_1   },  // A#4
-        {.period = NOTE_PERIOD(493.9,  1), .prescale = PRESCALE_1   },  // B4
-    },
-    {
-        {.period = NOTE_PERIOD(523.3,  1), .prescale = PRESCALE_1   },  // C5
-        {.period = NOTE_PERIOD(554.4,  1), .prescale = PRESCALE_1   },  // C#5
-        {.period = NOTE_PERIOD(587.3,  1), .prescale = PRESCALE_1   },  // D5
-        {.period = NOTE_PERIOD(622.3,  1), .prescale = PRESCALE_1   },  // D#5
-        {.period = NOTE_PERIOD(659.3,  1), .prescale = PRESCALE_1   },  // E5
-        {.period = NOTE_PERIOD(698.5,  1), .prescale = PRESCALE_1   },  // F5
-        {.period = NOTE_PERIOD(740.0,  1), .prescale = PRESCALE_1   },  // F#5
-        {.period = NOTE_PERIOD(784.0,  1), .prescale = PRESCALE_1   },  // G5
-        {.period = NOTE_PERIOD(830.6,  1), .prescale = PRESCALE_1   },  // G#5
-        {.period = NOTE_PERIOD(880.0,  1), .prescale = PRESCALE_1   },  // A5
-        {.period = NOTE_PERIOD(932.3,  1), .prescale = PRESCALE_1   },  // A#5
-        {.period = NOTE_PERIOD(987.8,  1), .prescale = PRESCALE_1   },  // B5
-    },
-    {
-        {.period = NOTE_PERIOD(1047,   1), .prescale = PRESCALE_1   },  // C6
-        {.period = NOTE_PERIOD(1109,   1), .prescale = PRESCALE_1   },  // C#6
-        {.period = NOTE_PERIOD(1175,   1), .prescale = PRESCALE_1   },  // D6
-        {.period = NOTE_PERIOD(1245,   1), .prescale = PRESCALE_1   },  // D#6
-        {.period = NOTE_PERIOD(1319,   1), .prescale = PRESCALE_1   },  // E6
-        {.period = NOTE_PERIOD(1397,   1), .prescale = PRESCALE_1   },  // F6
-        {.period = NOTE_PERIOD(1480,   1), .prescale = PRESCALE_1   },  // F#6
-        {.period = NOTE_PERIOD(1568,   1), .prescale = PRESCALE_1   },  // G6
-        {.period = NOTE_PERIOD(1661,   1), .prescale = PRESCALE_1   },  // G#6
-        {.period = NOTE_PERIOD(1760,   1), .prescale = PRESCALE_1   },  // A6
-        {.period = NOTE_PERIOD(1865,   1), .prescale = PRESCALE_1   },  // A#6
-        {.period = NOTE_PERIOD(1976,   1), .prescale = PRESCALE_1   },  // B6
-    },
-    {
-        {.period = NOTE_PERIOD(2093,   1), .prescale = PRESCALE_1   },  // C7
-        {.period = NOTE_PERIOD(2217,   1), .prescale = PRESCALE_1   },  // C#7
-        {.period = NOTE_PERIOD(2349,   1), .prescale = PRESCALE_1   },  // D7
-        {.period = NOTE_PERIOD(2489,   1), .prescale = PRESCALE_1   },  // D#7
-        {.period = NOTE_PERIOD(2637,   1), .prescale = PRESCALE_1   },  // E7
-        {.period = NOTE_PERIOD(2794,   1), .prescale = PRESCALE_1   },  // F7
-        {.period = NOTE_PERIOD(2960,   1), .prescale = PRESCALE_1   },  // F#7
-        {.period = NOTE_PERIOD(3136,   1), .prescale = PRESCALE_1   },  // G7
-        {.period = NOTE_PERIOD(3322,   1), .prescale = PRESCALE_1   },  // G#7
-        {.period = NOTE_PERIOD(3520,   1), .prescale = PRESCALE_1   },  // A7
-        {.period = NOTE_PERIOD(3729,   1), .prescale = PRESCALE_1   },  // A#7
-        {.period = NOTE_PERIOD(3951,   1), .prescale = PRESCALE_1   },  // B7
-    },
-    {
-        {.period = NOTE_PERIOD(4186,   1), .prescale = PRESCALE_1   },  // C8
-        {.period = NOTE_PERIOD(4434,   1), .prescale = PRESCALE_1   },  // C#8
-        {.period = NOTE_PERIOD(4698,   1), .prescale = PRESCALE_1   },  // D8
-        {.period = NOTE_PERIOD(4978,   1), .prescale = PRESCALE_1   },  // D#8
-        {.period = NOTE_PERIOD(5274,   1), .prescale = PRESCALE_1   },  // E8
-        {.period = NOTE_PERIOD(5588,   1), .prescale = PRESCALE_1   },  // F8
-        {.period = NOTE_PERIOD(5920,   1), .prescale = PRESCALE_1   },  // F#8
-        {.period = NOTE_PERIOD(6272,   1), .prescale = PRESCALE_1   },  // G8
-        {.period = NOTE_PERIOD(6645,   1), .prescale = PRESCALE_1   },  // G#8
-        {.period = NOTE_PERIOD(7040,   1), .prescale = PRESCALE_1   },  // A8
-        {.period = NOTE_PERIOD(7459,   1), .prescale = PRESCALE_1   },  // A#8
-        {.period = NOTE_PERIOD(7902,   1), .prescale = PRESCALE_1   },  // B8
-    },
-    {
-        {.period = NOTE_PERIOD(8372,   1), .prescale = PRESCALE_1   },  // C9
-        {.period = NOTE_PERIOD(8870,   1), .prescale = PRESCALE_1   },  // C#9
-        {.period = NOTE_PERIOD(9397,   1), .prescale = PRESCALE_1   },  // D9
-        {.period = NOTE_PERIOD(9956,   1), .prescale = PRESCALE_1   },  // D#9
-        {.period = NOTE_PERIOD(10548,  1), .prescale = PRESCALE_1   },  // E9
-        {.period = NOTE_PERIOD(11175,  1), .prescale = PRESCALE_1   },  // F9
-        {.period = NOTE_PERIOD(11840,  1), .prescale = PRESCALE_1   },  // F#9
-        {.period = NOTE_PERIOD(12544,  1), .prescale = PRESCALE_1   },  // G9
-        {.period = NOTE_PERIOD(13290,  1), .prescale = PRESCALE_1   },  // G#9
-        {.period = NOTE_PERIOD(14080,  1), .prescale = PRESCALE_1   },  // A9
-        {.period = NOTE_PERIOD(14917,  1), .prescale = PRESCALE_1   },  // A#9
-        {.period = NOTE_PERIOD(15804,  1), .prescale = PRESCALE_1   },  // B9
+    uint8_t data;
+
+    if (player_mem_space == PLAYER_MEM_RAM) {
+        data = *player_ptr;
     }
-};
+    else if (player_mem_space == PLAYER_MEM_PGM) {
+        data = pgm_read_byte(player_ptr);
+    }
+    else if (player_mem_space == PLAYER_MEM_EEPROM) {
+        data = config_read_byte(player_ptr);     // Safe with background write-back
+    }
+    else if (player_mem_space == PLAYER_MEM_STREAM) {
+        data = stream_player_char();
+    }
+    else {
+        data = 0;
+    }
+
+    if ((data >= 'a') && (data <= 'z')) {
+        data &= (uint8_t) ~0x20;
+    }
+
+    player_ptr++;
+
+    return data;
+}
 
 /******************************************************************************
- * beeper_init()
+ * unget_player_char()
  *
- * Initialize tone generator (timer)
+ * Push back the last character fetched by next_player_char()
  *
  * Inputs:  None
  *
  * Returns: Nothing
  *
- * Notes:   16-bit TIMER1 is used for the purpose of generating tones in this
- *          application.  A different timer may be used but all functions
- *          in this library, along with the prescaler selections in note_table
- *          will need to be modified.
+ * Notes:   Only one character may be pushed back.
  ******************************************************************************/
 
-void beeper_init(void)
+static void unget_player_char(void)
 {
-    // Stop timer 1 during init
-    // Disable timer 1 interrupts
+    if (player_mem_space == PLAYER_MEM_STREAM) {
+        stream_pos--;
+    }
+    player_ptr--;
+}
+
+// C major:                                A  B  C  D  E  F  G
+static const int8_t c_major_scale[7] PROGMEM = { 9,11, 0, 2, 4, 5, 7};
 
-    TCCR1B &= (uint8_t) ~PRESCALE_STOP;
-    TCNT1 = 0;
-    TIMSK1 = 0;
+#define NOTE_IS_REST    0xFF
 
-    // Set initial frequency to 440 Hz
+/******************************************************************************
+ * uint8_t get_digit(*digit)
+ *
+ * Fetch a single-digit command parameter from the play string
+ *
+ * Inputs:  *digit      Location to store the parameter value
+ *
+ * Returns: Nonzero if a valid parameter was fetched.  A separator character
+ *          is interpreted as '0'.
+ ******************************************************************************/
 
-    OCR1A = F_CPU / 1 / 440 / 2;
+static uint8_t get_digit(int8_t *digit)
+{
+    uint8_t ch;
 
-    // Timer 1 configuration:
-    // Toggle OC1A on compare match and reset counter
-    // Keep counter stopped, use beep_period() to enable
+    ch = next_player_char();
+    if (is_separator(ch)) {
+        *digit = 0;
+    }
+    else if (is_digit(ch)) {
+        *digit = ch - '0';
+    }
+    else {
+        return 0;
+    }
 
-    TCCR1A = _BV(COM1A0);                   // Toggle OC1A on compare match
-    TCCR1B = _BV(WGM12);                    // CTC mode, reset when count == OCR1A
-    DDR(BEEPER_PORT) |= _BV(BEEPER_PIN);
-    BEEPER_PORT &= (uint8_t) ~_BV(BEEPER_PIN);
+    return 1;
 }
 
 /******************************************************************************
- * beep_period(period, prescale)
+ * uint16_t get_number()
  *
- * Turn on the tone generator
+ * Fetch a multi-digit command parameter from the play string
  *
- * Inputs:  period      Timer period
- *          prescale    Timer prescaler selection (from prescale_t enum)
+ * Inputs:  None
+ *
+ * Returns: Integerized parameter value, 0 if no digits were found
+ *
+ * Notes:   Skips over an optional leading separator character.  The play
+ *          string pointer is left at the first non-digit character.
+ ******************************************************************************/
+
+static uint16_t get_number(void)
+{
+    uint16_t number = 0;
+    uint8_t ch;
+
+    ch = next_player_char();
+    if (is_separator(ch)) {
+        ch = next_player_char();
+    }
+
+    while (is_digit(ch)) {
+        number = (number * 10) + (ch - '0');
+        ch = next_player_char();
+    }
+    unget_player_char();
+
+    return number;
+}
+
+/******************************************************************************
+ * get_modifiers(*score)
+ *
+ * Fetch note time and pitch modifiers (length, octave, accidentals)
+ *
+ * Inputs:  *score      Score settings, updated by the modifiers found
  *
  * Returns: Nothing
  *
- * Notes:   Output frequency = F_CPU / selected prescaler / (period+1) / 2
+ * Notes:   Stops at (and consumes) a separator, or stops before the first
+ *          character that is not a modifier.
  ******************************************************************************/
 
-void beep_period(uint16_t period, prescale_t prescale)
+static void get_modifiers(score_t *score)
 {
-    // Stop counter & reset it
+    uint8_t ch;
 
-    TCCR1B &= (uint8_t) ~PRESCALE_STOP;
-    TCNT1 = 0;
+    do {
+        ch = next_player_char();
+        if (is_separator(ch)) {
+            break;
+        }
+        else if (is_octave_mod(ch)) {
+            score->octave = ch - '0';
+        }
+        else if (is_dotted(ch)) {
+            score->size_modifier |= MOD_DOTTED;
+        }
+        else if (is_triplet(ch)) {
+            score->size_modifier |= MOD_TRIPLET;
+        }
+        else if (is_tied(ch)) {
+            score->size_modifier |= MOD_TIED;
+        }
+        else if (is_staccato(ch)) {
+            score->size_modifier |= MOD_STACCATO;
+        }
+        else if (is_flat(ch)) {
+            score->accidental = ACCIDENTAL_FLAT;
+        }
+        else if (is_natural(ch)) {
+            score->accidental = ACCIDENTAL_NATURAL;
+        }
+        else if (is_sharp(ch)) {
+            score->accidental = ACCIDENTAL_SHARP;
+        }
+        else if (is_whole(ch)) {
+            score->note_size = NOTE_WHOLE;
+            score->size_modifier = 0;
+        }
+        else if (is_half(ch)) {
+            score->note_size = NOTE_HALF;
+            score->size_modifier = 0;
+        }
+        else if (is_quarter(ch)) {
+            score->note_size = NOTE_QUARTER;
+            score->size_modifier = 0;
+        }
+        else if (is_8th(ch)) {
+            score->note_size = NOTE_8TH;
+            score->size_modifier = 0;
+        }
+        else if (is_16th(ch)) {
+            score->note_size = NOTE_16TH;
+            score->size_modifier = 0;
+        }
+        else if (is_32nd(ch)) {
+            score->note_size = NOTE_32ND;
+            score->size_modifier = 0;
+        }
+        else {
+            unget_player_char();
+            break;
+        }
+    } while (1);
+}
 
-    // Set period & prescaler
+/******************************************************************************
+ * reset_score(*score)
+ *
+ * Reset score settings to their defaults
+ *
+ * Inputs:  *score      Score settings to reset
+ *
+ * Returns: Nothing
+ ******************************************************************************/
 
-#if CS10 != 0
-    prescale <<= CS10;
-#endif
+static void reset_score(score_t *score)
+{
+    uint8_t index;
+
+    for (index = 0; index < 7; index++) {
+        score->scale[index] = pgm_read_byte(&c_major_scale[index]);
+    }
+    score->note = 0;
+    score->octave = 4;
+    score->accidental = ACCIDENTAL_NATURAL;
+    score->transposition = 0;
+    score->note_size = 4;
+    score->size_modifier = 0;
+    score->note_rest_ratio = 7;
+    score->whole_note_period = (uint16_t) (PLAYER_TICKS_PER_SECOND * 60U * (uint32_t) DEFAULT_BEAT / DEFAULT_TEMPO);
+}
+
+/******************************************************************************
+ * uint8_t compile_note(*score)
+ *
+ * Add a note or rest instruction to the player code
+ *
+ * Inputs:  *score      Current score settings; score->note is the note
+ *                      to add, or NOTE_IS_REST
+ *
+ * Returns: Nonzero if successful, 0 if the player code or duration table
+ *          is full
+ *
+ * Notes:   Only the part of player_code[] and player_duration[] selected by
+ *          compile_region() is used.
+ ******************************************************************************/
+
+static uint8_t compile_note(score_t *score)
+{
+    uint16_t note_period;
+    uint16_t rest_period;
+    uint8_t ratio;
+    int8_t tone;
+    int8_t octave;
+    uint8_t index;
+
+    if (player_code_size + 2 >= player_code_limit) {
+        return 0;
+    }
+
+    rest_period = score->whole_note_period;
+    // If dotted flag set, note period is 50% longer
+    if (score->size_modifier & MOD_DOTTED) {
+        rest_period += rest_period >> 1;
+    }
+    // If triplet flag set, note period is divided by 3
+    if (score->size_modifier & MOD_TRIPLET) {
+        rest_period /= 3;
+    }
+    // Divide base (whole note) period by note size
+    // e.g. if quarter note, divide by 4
+    rest_period /= score->note_size;
+
+    if ((uint8_t) score->note == NOTE_IS_REST) {
+        note_period = 0;
+        index = CODE_REST;
+    }
+    else {
+        // Calculate note play time and rest time
+        // The ratio of note to rest time is specified by <note_rest_ratio>
+        // with a fixed dividend of 8
+        // e.g. if note_rest_ratio = 5, play note for 5/8 of note time and
+        // rest for 3/8 of note time
+        // If note is tied or staccato, ignore note/rest ratio setting and
+        // force it to 8 (tied) or 2 (staccato).
+        if (score->size_modifier & MOD_TIED) {
+            ratio = 8;
+        }
+        else if (score->size_modifier & MOD_STACCATO) {
+            ratio = 2;
+        }
+        else {
+            ratio = score->note_rest_ratio;
+        }
+        note_period = (rest_period * ratio) >> 3;
+        rest_period -= note_period;
+        // Adjust note tone to be played by accidental and transposition factors
+        tone = score->note + score->accidental + score->transposition;
+        octave = score->octave;
+        // Check for note over/underflow
+        if (tone < 0) {
+            tone += NOTES_PER_OCTAVE;
+            octave--;
+        }
+        else if (tone >= NOTES_PER_OCTAVE) {
+            tone -= NOTES_PER_OCTAVE;
+            octave++;
+        }
+        // Check for octave over/underflow
+        if (octave < 0) {
+            octave = 0;
+        }
+        else if (octave >= OCTAVES) {
+            octave = OCTAVES - 1;
+        }
+        index = octave * NOTES_PER_OCTAVE + tone;
+    }
+
+    player_code[player_code_size++] = index;
+
+    // Find or allocate duration table entry
+
+    for (index = player_duration_first; index < player_durations; index++) {
+        if ((player_duration[index].note == note_period) &&
+            (player_duration[index].rest == rest_period)) {
+            break;
+        }
+    }
+    if (index == player_durations) {
+        if (player_durations >= player_duration_limit) {
+            player_code_size--;
+            return 0;
+        }
+        player_duration[index].note = note_period;
+        player_duration[index].rest = rest_period;
+        player_durations++;
+    }
+
+    player_code[player_code_size++] = index;
+
+    return 1;
+}
+
+/******************************************************************************
+ * uint8_t compile_token(*score)
+ *
+ * Translate one note or command from the play string into player code
+ *
+ * Inputs:  *score      Score settings, updated by the command compiled
+ *
+ * Returns: COMPILE_OK      Note or command compiled
+ *          COMPILE_END     End of play string, or character not recognized
+ *          COMPILE_FULL    No room left in the code region; nothing was read
+ *          COMPILE_PENDING A note was read, but the code region or duration
+ *                          table is full.  The note is described by <score>
+ *                          and may be added to the next region using
+ *                          compile_note().
+ *
+ * Notes:   Bookmark commands are ignored when compiling a stream, as code
+ *          regions are reused once they have been played.
+ ******************************************************************************/
+
+static uint8_t compile_token(score_t *score)
+{
+    uint8_t ch;
+    int8_t digit = 0;
+    uint16_t number;
+    uint8_t ok = 1;
+
+    // Every command compiles to 3 bytes or less.  Checking for space before
+    // reading the command ensures that no command is lost for lack of space.
+
+    if (player_code_size + 3 >= player_code_limit) {
+        return COMPILE_FULL;
+    }
+
+    ch = next_player_char();
+    if (is_separator(ch)) {
+        return COMPILE_OK;
+    }
+    else if (is_note(ch)) {
+        score->note = score->scale[ch - 'A'];
+        score->accidental = ACCIDENTAL_NATURAL;
+        get_modifiers(score);
+        return compile_note(score) ? COMPILE_OK : COMPILE_PENDING;
+    }
+    else if (is_rest(ch)) {
+        score->note = NOTE_IS_REST;
+        get_modifiers(score);
+        return compile_note(score) ? COMPILE_OK : COMPILE_PENDING;
+    }
+    else if (is_repeat_note(ch)) {
+        return compile_note(score) ? COMPILE_OK : COMPILE_PENDING;
+    }
+    else if (is_octave_cmd(ch)) {
+        ok = get_digit(&digit);
+        score->octave = digit;
+    }
+    else if (is_octave_up(ch)) {
+        if (score->octave < (OCTAVES - 1)) {
+            score->octave++;
+        }
+    }
+    else if (is_octave_down(ch)) {
+        if (score->octave > 0) {
+            score->octave--;
+        }
+    }
+    else if (is_ratio_cmd(ch)) {
+        ok = get_digit(&digit);
+        // Bound ratio to maximum
+        if (digit > 8) {
+            digit = 8;
+        }
+        score->note_rest_ratio = digit;
+    }
+    else if (is_volume_cmd(ch)) {
+        ok = get_digit(&digit);
+        if (ok) {
+            player_code[player_code_size++] = CODE_VOLUME + digit;
+        }
+    }
+    else if (is_transpose_cmd(ch)) {
+        // Set new transposition value if it is within a one-octave range.
+        // Otherwise, force it to 0
+        number = get_number();
+        if (number < NOTES_PER_OCTAVE) {
+            score->transposition = number;
+        }
+        else {
+            score->transposition = 0;
+        }
+    }
+    else if (is_key_cmd(ch)) {
+        for (digit = 0; digit < 7; digit++) {
+            score->scale[digit] = pgm_read_byte(&c_major_scale[digit]);
+        }
+        score->accidental = ACCIDENTAL_SHARP;   // Default: Sharps
+        do {
+            ch = next_player_char();
+            if (is_note(ch)) {
+                ch -= 'A';
+                score->scale[ch] = pgm_read_byte(&c_major_scale[ch]) + score->accidental;
+            }
+            else if (is_flat(ch)) {
+                score->accidental = ACCIDENTAL_FLAT;
+            }
+            else if (is_natural(ch)) {
+                score->accidental = ACCIDENTAL_NATURAL;
+            }
+            else if (is_sharp(ch)) {
+                score->accidental = ACCIDENTAL_SHARP;
+            }
+            else {
+                unget_player_char();
+                break;
+            }
+        } while (1);
+    }
+    else if (is_tempo_cmd(ch)) {
+        // Assume quarter note gets 1 beat
+        score->note_size = DEFAULT_BEAT;
+        score->size_modifier = 0;
+        // Get a note size if specified
+        ch = next_player_char();
+        unget_player_char();
+        if (!is_separator(ch) && !is_digit(ch)) {
+            get_modifiers(score);
+        }
+        // Use 120 BPM if no BPM rate specified
+        number = get_number();
+        if (!number) {
+            number = DEFAULT_TEMPO;
+        }
+        // Calculate whole note period based on beat unit and beats/min
+        score->whole_note_period =
+            (uint16_t) (PLAYER_TICKS_PER_SECOND * 60U * (uint32_t) score->note_size / number);
+        // Add 50% to beat time if dotted
+        if (score->size_modifier & MOD_DOTTED) {
+            score->whole_note_period += score->whole_note_period >> 1;
+        }
+        // One-third of beat time if tripleted
+        if (score->size_modifier & MOD_TRIPLET) {
+            score->whole_note_period /= 3;
+        }
+    }
+    else if (is_bookmark(ch)) {
+        ok = get_digit(&digit);
+        number = get_number();
+        if (ok && (player_mem_space != PLAYER_MEM_STREAM)) {
+            if (number > 0xFE) {        // Bound repeat count to 8-bit max - 1
+                number = 0xFE;
+            }
+            if (! number) {             // Repeat count of 0 means "infinite"
+                number = 0xFF;
+            }
+            player_code[player_code_size++] = CODE_MARK + digit;
+            player_code[player_code_size++] = number;
+            // Record bookmark so it may be forward-referenced
+            bookmark[digit].position = player_code_size;
+            bookmark[digit].repeat = number;
+        }
+    }
+    else if (is_goto_mark(ch)) {
+        ok = get_digit(&digit);
+        if (ok && (player_mem_space != PLAYER_MEM_STREAM)) {
+            player_code[player_code_size++] = CODE_GOTO + digit;
+        }
+    }
+    else if (is_reset_cmd(ch)) {
+        reset_score(score);
+        player_code[player_code_size++] = CODE_RESET;
+    }
+    else {
+        // End of string, or character not recognized
+        ok = 0;
+    }
 
-    OCR1A = period;
-    TCCR1B |= prescale & (0x07 << CS10);
+    return ok ? COMPILE_OK : COMPILE_END;
 }
 
 /******************************************************************************
- * beep_mute(mute)
+ * uint8_t stream_compile_token()
+ *
+ * Compile one whole command from the stream buffer
  *
- * Turn off tone generator (stop timer)
+ * Inputs:  None
  *
- * Inputs:  mute        Mutes output if nonzero
+ * Returns: As compile_token(), or COMPILE_PENDING with stream_short set if
+ *          the command is not yet complete
+ *
+ * Notes:   A command that runs past the end of the buffered data is undone
+ *          (score settings, code and duration table entries), and left in
+ *          the buffer to be compiled again when more data has arrived.
+ ******************************************************************************/
+
+static uint8_t stream_compile_token(void)
+{
+    score_t score;
+    uint8_t code_size;
+    uint8_t durations;
+    uint8_t result;
+
+    score = player_score;
+    code_size = player_code_size;
+    durations = player_durations;
+
+    stream_pos = 0;
+    stream_short = 0;
+    result = compile_token(&player_score);
+
+    if (stream_short) {
+        player_score = score;
+        player_code_size = code_size;
+        player_durations = durations;
+        return COMPILE_PENDING;
+    }
+
+    // Drop the command from the buffer, keeping anything read ahead and
+    // pushed back
+
+    if (stream_pos > stream_count) {
+        stream_pos = stream_count;
+    }
+    stream_count -= stream_pos;
+    memmove(stream_buffer, &stream_buffer[stream_pos], stream_count);
+
+    return result;
+}
+
+/******************************************************************************
+ * compile_region(half)
+ *
+ * Select the part of player_code[] and player_duration[] to compile into
+ *
+ * Inputs:  half        Stream buffer half (0 or 1), or COMPILE_WHOLE to use
+ *                      the entire code buffer and duration table
  *
  * Returns: Nothing
  ******************************************************************************/
 
-void beep_mute(uint8_t mute)
+static void compile_region(uint8_t half)
 {
-    if (mute) {
-        TCCR1B &= (uint8_t) ~PRESCALE_STOP;
+    if (half == COMPILE_WHOLE) {
+        player_code_size = 0;
+        player_code_limit = PLAYER_CODE_SIZE;
+        player_duration_first = 0;
+        player_duration_limit = PLAYER_DURATIONS;
     }
+    else {
+        player_code_size = half * (PLAYER_CODE_SIZE / 2);
+        player_code_limit = player_code_size + (PLAYER_CODE_SIZE / 2);
+        player_duration_first = half * (PLAYER_DURATIONS / 2);
+        player_duration_limit = player_duration_first + (PLAYER_DURATIONS / 2);
+    }
+    player_durations = player_duration_first;
 }
 
 /******************************************************************************
- * beep_gain(gain)
+ * player_compile()
  *
- * Set output gain (volume)
+ * Translate the play string into player code
  *
- * Inputs:  gain        Output gain/volume setting to apply
+ * Inputs:  None passed in - the play string is read using next_player_char()
  *
  * Returns: Nothing
  *
- * Notes:   This function is provided for those designs that provide a means by
- *          which the output volume can be set.  This typically requires some
- *          sort of external hardware support.  If such hardware is not
- *          available, this function should be declared empty.
+ * Notes:   Fills player_code[], player_duration[] and bookmark[].  Compiling
+ *          stops at the end of the play string, at an unrecognized
+ *          character, or when the player code or duration table is full;
+ *          the string is played up to that point.
+ *
+ *          Bookmarks may be forward-referenced, as all bookmark positions
+ *          are known once compiling is complete.
  ******************************************************************************/
 
-void beep_gain(uint8_t gain)
+static void player_compile(void)
 {
+    compile_region(COMPILE_WHOLE);
+
+    while (compile_token(&player_score) == COMPILE_OK) ;
+
+    // Space for the end marker is always reserved
+
+    player_code[player_code_size++] = CODE_END;
 }
 
 /******************************************************************************
- * uint8_t next_player_char()
+ * player_start(*str, mem_space)
  *
- * Fetch next character from the play string in the selected memory space
+ * Start playing a music string (initialize player)
  *
- * Inputs:  None passed in - uses these local module variables:
- *          player_mem_space    Memory space containing player music string,
- *                              as defined in the player_space_t enum.
- *          player_ptr          Pointer to player music string.  Incremented to
- *                              point to the next character in the string on
- *                              exit.
+ * Inputs:  *str        Pointer to the music string to play
+ *          mem_space   The memory space in which <str> resides, as selected
+ *                      from the player_space_t enum.  A music string may
+ *                      reside in data RAM (1), program memory space (2), or
+ *                      in EEPROM (3), or be read from the serial port
+ *                      (PLAYER_MEM_STREAM, <str> is not used).
+ *
+ *          In addition, the following local module variables are used:
+ *
+ *          player_ptr          Set to <str>; points to string to play.
+ *          player_mem_space    Set to <mem_space>
+ *          player_enable       Set to 2, forcing the player to initialize
+ *                              its internal variables and start playing
+ *                              the specified music string.
+ *          player_code[]       The play string is compiled into player code
+ *                              by player_compile().  The string is not
+ *                              referenced again once this function returns.
+ *
+ * Returns: Nothing
+ *
+ * Notes:   The player_service() function must be called periodically, typically
+ *          from a timer interrupt, for the music <str> to be played back.
  *
- * Returns: Character pointed to by player_ptr on entry, converted to uppercase.
+ *          When playing a stream, player_poll() must also be called
+ *          regularly to read and compile the stream.
  ******************************************************************************/
 
-static uint8_t next_player_char(void)
+void player_start(const char *str, player_space_t mem_space)
 {
-    uint8_t data;
+    uint8_t index;
 
-    if (player_mem_space == PLAYER_MEM_RAM) {
-        data = *player_ptr;
+    // Set player string index and memory space to values passed in
+
+    player_stop();                      // Stop playing previous string
+    if (player_stream != STREAM_IDLE) {
+        serial_flow_control(0);
+        player_stream = STREAM_IDLE;
     }
-    else if (player_mem_space == PLAYER_MEM_PGM) {
-        data = pgm_read_byte(player_ptr);
+    player_ptr = (uint8_t *) str;       // Typecast prevents compiler warning
+    player_mem_space = mem_space;
+
+    for (index = 0; index < NUM_BOOKMARKS; index++) {
+        bookmark[index].position = NO_BOOKMARK;
+        bookmark[index].repeat = 0;
     }
-    else if (player_mem_space == PLAYER_MEM_EEPROM) {
-        data = eeprom_read_byte(player_ptr);
+    reset_score(&player_score);
+
+    // Translate play string into player code.  Parsing is done here, rather
+    // than during playback, to keep player_service() execution time short.
+    // Streams are compiled one half of the code buffer at a time by
+    // player_poll(), while the other half is being played.
+
+    if (mem_space == PLAYER_MEM_STREAM) {
+        stream_count = 0;
+        stream_ended = 0;
+        player_pending = 0;
+        player_ready = 0;
+        player_fill = 0;
+        player_stream = STREAM_WAIT;
+        serial_flow_control(1);
     }
     else {
-        data = 0;
-    }
-
-    if ((data >= 'a') && (data <= 'z')) {
-        data &= (uint8_t) ~0x20;
+        player_compile();
     }
 
-    player_ptr++;
+    // Allow playback to start
 
-    return data;
+    player_enable = PLAYER_INIT;
 }
 
 /******************************************************************************
- * uint8_t find_bookmark(search_mark)
+ * uint8_t player_poll()
+ *
+ * Read and compile a music stream
  *
- * Locate bookmark(s) in the player music string
+ * Inputs:  None
  *
- * Inputs:  search_mark     The bookmark # to search for in the player string.
- *                          If the value 0xFF is passed in, ALL bookmarks in
- *                          the player string are found and their positions
- *                          recorded in bookmark[].
+ * Returns: Nonzero while a stream started by player_start() is still being
+ *          read.  Returns 0 once the end of the stream has been reached,
+ *          if playback has been stopped, or if no stream is being played.
  *
- *          In addition, the following local module variables are used:
+ * Notes:   Compiles the data available from the serial port into whichever
+ *          half of the code buffer is not being played.  A half is handed
+ *          to the player when it is full, at the end of the stream, or
+ *          early if the player has run out of code to play.  Playback
+ *          starts once the first half is full.
+ *
+ *          Serial input flow control (XON/XOFF) is enabled while a stream
+ *          is being read, so the sender is paused whenever both halves of
+ *          the code buffer are in use.
+ *
+ *          The end of a stream is marked by an EOT (Ctrl-D) character.  If
+ *          no data is received for PLAYER_STREAM_TIMEOUT ticks in the middle
+ *          of a command, the stream is also ended.
  *
- *          bookmark[]      This array records the positions (pointers to) the
- *                          bookmark(s) searched for and the repeat count
- *                          associated with it.  If all bookmarks are pre-
- *                          searched before the music string starts playing,
- *                          some play-time execution overhead can be saved.
- *          player_mem_space
- *          player_ptr      These variables are used by the next_player_char()
- *                          function which is called within this function.
- *                          The value of player_ptr is preserved and reset to
- *                          its original value upon exit.
- *
- * Returns: Pointer to position in player music string where the specified
- *          <search_mark> bookmark was found, or NULL if not found.  Will
- *          also return NULL if a all-bookmark search is requested.
+ *          Never waits for data: only whole commands are compiled, a
+ *          command split between serial transfers is kept in the stream
+ *          buffer until the rest of it arrives.
  ******************************************************************************/
 
-static uint8_t * find_bookmark(uint8_t search_mark)
+uint8_t player_poll(void)
 {
-    uint8_t found_mark;                 // Nonzero when bookmark <search_mark> found
-    uint8_t ch;                         // Character fetched from play string
-    uint8_t mark;                       // Bookmark # being processed
-    uint16_t repeat;                    // Repeat count for current bookmark
-    uint8_t *save_ptr;                  // Saved [start] address of play string
-    uint8_t *return_ptr;                // Function return value (pointer to bookmark)
+    uint8_t result = COMPILE_OK;
 
-    // Save the current player string address so it can be restored when bookmark
-    // scanning is completed.
+    if (player_stream == STREAM_IDLE) {
+        return 0;
+    }
 
-    save_ptr = player_ptr;
-    found_mark = 0;                     // Bookmark not found yet
+    if (player_enable == PLAYER_STOP) {
+        serial_flow_control(0);
+        player_stream = STREAM_IDLE;
+        return 0;
+    }
 
-    // Scan play string for bookmark(s)
+    // Wait for the half to be filled to finish playing
 
-    do {
-        ch = next_player_char();
-        if (is_bookmark(ch)) {          // Bookmark lead-in character found
-            repeat = 0;
-            mark = next_player_char();  // Fetch bookmark #
+    if (player_stream == STREAM_WAIT) {
+        if (player_ready & BM(player_fill)) {
+            return 1;
+        }
+        compile_region(player_fill);
+        player_stream = STREAM_FILL;
+        stream_time = timer_ticks();
+        if (player_pending) {
+            compile_note(&player_score);
+            player_pending = 0;
+        }
+    }
 
-            if (is_separator(mark)) {   // Assume bookmark #0 if seperator
-                mark = 0;
-            }
-            else if (is_digit(ch)) {    // Convert bookmark # to integer
-                mark -= '0';
+    // Compile as much of the stream as has been received
+
+    do {
+        if (!stream_ended) {
+            if (!serial_in_empty()) {
+                stream_time = timer_ticks();
             }
-            else {                      // Skip analysis if bookmark # invalid
-                continue;
+            while ((stream_count < STREAM_BUFFER_SIZE) && !serial_in_empty()) {
+                stream_buffer[stream_count++] = serial_in();
             }
+        }
+        if (!stream_count && !stream_ended) {
+            break;
+        }
 
-            ch = next_player_char();    // Fetch 1st digit of repeat count
-            if (is_separator(ch)) {     // Skip past possible seperator
-                ch = next_player_char();
-            }
+        result = stream_compile_token();
 
-            while (is_digit(ch)) {      // Convert repeat count to integer
-                ch -= '0';
-                repeat = repeat * 10 + ch;
-                ch = next_player_char();
-            }
-            player_ptr--;               // Last char not a digit, back up
+        // An incomplete command waits for more data, unless none has come
+        // for too long or it does not fit in the buffer
 
-            if (repeat > 0xFE) {        // Valid repeat counts are 0..254
-                repeat = 0xFE;          //   Force to maximum if > 254
-            }
-            if (! repeat) {             // Repeat count of 0 is "infinite"
-                repeat = 0xFF;          //   0xFF = infinite, never decremented
+        if (stream_short) {
+            if ((stream_count < STREAM_BUFFER_SIZE) &&
+                (timer_ticks() - stream_time < STREAM_TIMEOUT)) {
+                result = COMPILE_OK;
+                break;
             }
+            stream_ended = 1;
+            result = COMPILE_OK;
+        }
+    } while (result == COMPILE_OK);
 
-            // Save bookmark data
+    // Keep filling unless the half is full, the stream has ended, or the
+    // player has run out of code.  The first half is always filled
+    // completely, to give the sender a head start.
 
-            found_mark = (mark == search_mark);
-            if (found_mark || (search_mark == 0xFF)) {
-                bookmark[mark].repeat = repeat;
-                bookmark[mark].position = player_ptr;
-            }
+    if (result == COMPILE_OK) {
+        if ((player_starved != STARVED_YES) ||
+            (player_code_size == player_fill * (PLAYER_CODE_SIZE / 2))) {
+            return 1;
         }
-    } while (ch && !found_mark);
+    }
+    else if (result == COMPILE_PENDING) {
+        player_pending = 1;
+    }
 
-    // Return address of play string immediately following bookmark spec
-    // Restore play string pointer to position it was at upon entry
+    // Hand filled half over to the player
 
-    return_ptr = player_ptr;
-    player_ptr = save_ptr;
+    player_code[player_code_size++] = (result == COMPILE_END) ? CODE_END : CODE_NEXT;
 
-    // Return NULL if bookmark #<search_mark> not found
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        player_ready |= BM(player_fill);
+    }
 
-    if (! found_mark) {
-        return_ptr = 0;
+    if (result == COMPILE_END) {
+        serial_flow_control(0);
+        player_stream = STREAM_IDLE;
+        return 0;
     }
 
-    return return_ptr;
+    player_fill ^= 1;
+    player_stream = STREAM_WAIT;
+
+    return 1;
 }
 
 /******************************************************************************
- * player_start(*str, mem_space)
- *
- * Start playing a music string (initialize player)
- *
- * Inputs:  *str        Pointer to the music string to play
- *          mem_space   The memory space in which <str> resides, as selected
- *                      from the player_space_t enum.  A music string may
- *                      reside in data RAM (1), program memory space (2), or
- *                      in EEPROM (3).
- *
- *          In addition, the following local module variables are used:
+ * uint8_t player_underruns(reset)
  *
- *          player_ptr          Set to <str>; points to string to play.
- *          player_mem_space    Set to <mem_space>
- *          player_enable       Set to 2, forcing the player to initialize
- *                              its internal variables and start playing
- *                              the specified music string.
- *          bookmark[]          This routine pre-scans for bookmarks in the
- *                              player string via the find_bookmark() function.
+ * Read/reset count of stream underruns
  *
- * Returns: Nothing
+ * Inputs:  reset       Resets count to 0 if nonzero
  *
- * Notes:   The player_service() function must be called periodically, typically
- *          from a timer interrupt, for the music <str> to be played back.
+ * Returns: Number of times the player ran out of stream data to play
  ******************************************************************************/
 
-void player_start(const char *str, player_space_t mem_space)
+uint8_t player_underruns(uint8_t reset)
 {
-    uint8_t index;
-
-    // Set player string index and memory space to values passed in
-
-    player_stop();                      // Stop playing previous string
-    player_ptr = (uint8_t *) str;       // Typecast prevents compiler warning
-    player_mem_space = mem_space;
-
-    // Clear all bookmarks
+    uint8_t count;
 
-    for (index = 0; index < NUM_BOOKMARKS; index++) {
-        bookmark[index].repeat = 0;
-        bookmark[index].position = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        count = player_underrun_count;
+        if (reset) {
+            player_underrun_count = 0;
+        }
     }
 
-    // Scan play string for bookmarks and initialize them.
-    // This pre-scan allows bookmarks to be forward-referenced without having
-    // to perform time-consuming bookmark scanning during playback.
-
-    find_bookmark(0xFF);
-
-    // Allow playback to start
-
-    player_enable = PLAYER_INIT;
+    return count;
 }
 
 /******************************************************************************
@@ -648,8 +1169,7 @@ void player_start(const char *str, player_space_t mem_space)
 void player_stop(void)
 {
     player_enable = PLAYER_STOP;
-    beep_mute(1);
-    beep_period(0xFF, PRESCALE_STOP);
+    sound_off();
 }
 
 /******************************************************************************
@@ -675,33 +1195,21 @@ uint8_t player_is_stopped(void)
  *
  * Must be called periodically at the rate defined by PLAYER_TICKS_PER_SECOND
  * which is set in "player.h"
+ *
+ * Notes:   Executes the player code built by player_start().  At most
+ *          MAX_CODE_STEPS instructions are executed per call.
  ******************************************************************************/
 
-// C major:                                A  B  C  D  E  F  G
-static const int8_t c_major_scale[7] PROGMEM = { 9,11, 0, 2, 4, 5, 7};
-
-#define NOTE_IS_REST    0xFF
-
 void player_service(void)
 {
     static player_state_t state;        // Player execution state
-    static player_state_t next_state;   // State to advance to when done with present state
-    static int8_t note;                 // Note #
-    static int8_t octave;               // Octave #
-    static int8_t accidental;           // Accidental: -1=Flat 0=Natural +1=Sharp
-    static int8_t transposition;        // # of halfsteps to transpose notes up
-    static uint8_t note_size;           // Note size fraction; e.g. 4=quarter note
-    static uint8_t size_modifier;       // Note size modifier flags: 0:Dotted 1:Triplet 2:Tied 3:Staccato
-    static uint8_t note_rest_ratio;     // Note-to-rest ratio, in 8ths
-    static uint16_t whole_note_period;  // # ticks in a whole note
+    static uint8_t pc;                  // Index of next instruction in player_code[]
     static uint16_t note_period;        // Note play period, PLAYER_TICKS_PER_SECOND units
     static uint16_t rest_period;        // Rest (silence) period, PLAYER_TICKS_PER_SECOND units
-    static int8_t scale[7];             // Note letter-to-number conversion, adjusted for key signature
 
-    int8_t ch;                          // Character fetched from play string
-    int8_t digit;                       // Integerized single-digit parameter
-    uint16_t number;                    // Integerized multi-digit parameter
-    note_t *n;                          // Pointer to tone generator note data
+    uint8_t code;                       // Instruction fetched from player code
+    uint8_t arg;                        // Instruction argument
+    uint8_t steps;                      // Instructions remaining for this call
 
     // Exit player if stopped
 
@@ -709,309 +1217,41 @@ void player_service(void)
         return;
     }
 
-    // <number> and <digit> init not really needed, but prevents compiler
-    // from complaining
-
-    number = 0;
-    digit = 0;
-    ch = 0;
-
     player_timer++;
 
-    // Interpret and execute play string
-    // Use of do { } while(1) allows use of <break> and <continue> to facilitate
-    // state machine execution.
-
-    do {
-
-        // RESET state
-        // Resets all player variables to their default state.
-        // This state is forced as the first state to be executed when
-        // a new play string is defined using the start_player() function.
-
-        if ((state == STATE_RESET) ||
-            (player_enable == PLAYER_INIT)) {
-            for (digit = 0; digit < 7; digit++) {
-                scale[digit] = pgm_read_byte(&c_major_scale[digit]);
-            }
-            note = 0;
-            octave = 4;
-            accidental = ACCIDENTAL_NATURAL;
-            transposition = 0;
-            note_size = 4;
-            size_modifier = 0;
-            note_rest_ratio = 7;
-            whole_note_period = (uint16_t) (PLAYER_TICKS_PER_SECOND * 60U * (uint32_t) DEFAULT_BEAT / DEFAULT_TEMPO);
-            player_timer = 0;
-            beep_period(0xFF, PRESCALE_STOP);
-            beep_mute(0);
-            beep_gain(5);
-            player_enable = PLAYER_RUN;
-            state = STATE_GET_NOTE;
-            continue;
-        }
-
-        // GET NOTE state
-        // This is the base state for the player.  Characters are fetched from
-        // the play string, and interpreted as notes or commands.
-
-        else if (state == STATE_GET_NOTE) {
-            ch = next_player_char();
-            if (is_separator(ch)) {
-                continue;
-            }
-            else if (is_note(ch)) {
-                ch -= 'A';
-                note = scale[ch];
-                accidental = ACCIDENTAL_NATURAL;
-                state = STATE_GET_MODIFIER;
-                next_state = STATE_START_NOTE;
-                continue;
-            }
-            else if (is_rest(ch)) {
-                note = NOTE_IS_REST;
-                state = STATE_GET_MODIFIER;
-                next_state = STATE_START_NOTE;
-                continue;
-            }
-            else if (is_repeat_note(ch)) {
-                state = STATE_START_NOTE;
-                continue;
-            }
-            else if (is_octave_cmd(ch)) {
-                state = STATE_GET_DIGIT;
-                next_state = STATE_SET_OCTAVE;
-                continue;
-            }
-            else if (is_octave_up(ch)) {
-                if (octave < (OCTAVES - 1)) {
-                    octave++;
-                }
-                continue;
-            }
-            else if (is_octave_down(ch)) {
-                if (octave > 0) {
-                    octave--;
-                }
-                continue;
-            }
-            else if (is_ratio_cmd(ch)) {
-                state = STATE_GET_DIGIT;
-                next_state = STATE_SET_NOTE_RATIO;
-                continue;
-            }
-            else if (is_volume_cmd(ch)) {
-                state = STATE_GET_DIGIT;
-                next_state = STATE_SET_VOLUME;
-                continue;
-            }
-            else if (is_transpose_cmd(ch)) {
-                state = STATE_GET_NUMBER;
-                next_state = STATE_SET_TRANSPOSITION;
-            }
-            else if (is_key_cmd(ch)) {
-                state = STATE_SET_KEY;
-                continue;
-            }
-            else if (is_tempo_cmd(ch)) {
-                // Assume quarter note gets 1 beat
-                note_size = DEFAULT_BEAT;
-                size_modifier = 0;
-                ch = next_player_char();
-                // Use default note size if not specified
-                if (is_separator(ch) || is_digit(ch)) {
-                    player_ptr--;
-                    state = STATE_GET_NUMBER;
-                    next_state = STATE_SET_TEMPO_2;
-                }
-                // Get a note size
-                else {
-                    state = STATE_GET_MODIFIER;
-                    next_state = STATE_SET_TEMPO;
-                }
-                continue;
-            }
-            else if (is_bookmark(ch)) {
-                state = STATE_GET_DIGIT;
-                next_state = STATE_SET_BOOKMARK;
-                continue;
-            }
-            else if (is_goto_mark(ch)) {
-                state = STATE_GET_DIGIT;
-                next_state = STATE_GOTO_BOOKMARK;
-                continue;
-            }
-            else if (is_reset_cmd(ch)) {
-                state = STATE_RESET;
-                continue;
-            }
-            else if (!ch) {
-                player_ptr--;
-            }
-            // Character not recognized, stop player
-            state = STATE_STOP;
-            continue;
+    // Reset player to its default state when a new string is started
+
+    if (player_enable == PLAYER_INIT) {
+        pc = 0;
+        player_timer = 0;
+        sound_release(PLAYER_VOICE);
+        sound_mute(0);
+        sound_gain(5);
+        player_enable = PLAYER_RUN;
+        state = STATE_FETCH;
+        // A stream starts by waiting for the first buffer half.  The
+        // initial wait is not counted as an underrun.
+        if (player_mem_space == PLAYER_MEM_STREAM) {
+            player_half = 1;
+            player_starved = STARVED_START;
+            state = STATE_NEXT_CODE;
         }
+    }
 
-        // GET MODIFIER state
-        // This state is entered after a note or rest value has been parsed.
-        // Note time and pitch modifiers are fetched and processed in this
-        // state.
+    // Execute player code
+    // Use of do { } while(1) allows use of <break> and <continue> to facilitate
+    // state machine execution.
 
-        else if (state == STATE_GET_MODIFIER) {
-            ch = next_player_char();
-            if (is_separator(ch)) {
-                state = next_state;
-                continue;
-            }
-            else if (is_octave_mod(ch)) {
-                octave = ch - '0';
-                continue;
-            }
-            else if (is_dotted(ch)) {
-                size_modifier |= MOD_DOTTED;
-                continue;
-            }
-            else if (is_triplet(ch)) {
-                size_modifier |= MOD_TRIPLET;
-                continue;
-            }
-            else if (is_tied(ch)) {
-                size_modifier |= MOD_TIED;
-                continue;
-            }
-            else if (is_staccato(ch)) {
-                size_modifier |= MOD_STACCATO;
-                continue;
-            }
-            else if (is_flat(ch)) {
-                accidental = ACCIDENTAL_FLAT;
-                continue;
-            }
-            else if (is_natural(ch)) {
-                accidental = ACCIDENTAL_NATURAL;
-                continue;
-            }
-            else if (is_sharp(ch)) {
-                accidental = ACCIDENTAL_SHARP;
-                continue;
-            }
-            else if (is_whole(ch)) {
-                note_size = NOTE_WHOLE;
-                size_modifier = 0;
-                continue;
-            }
-            else if (is_half(ch)) {
-                note_size = NOTE_HALF;
-                size_modifier = 0;
-                continue;
-            }
-            else if (is_quarter(ch)) {
-                note_size = NOTE_QUARTER;
-                size_modifier = 0;
-                continue;
-            }
-            else if (is_8th(ch)) {
-                note_size = NOTE_8TH;
-                size_modifier = 0;
-                continue;
-            }
-            else if (is_16th(ch)) {
-                note_size = NOTE_16TH;
-                size_modifier = 0;
-                continue;
-            }
-            else if (is_32nd(ch)) {
-                note_size = NOTE_32ND;
-                size_modifier = 0;
-                continue;
-            }
-            else {
-                player_ptr--;
-                state = next_state;
-                continue;
-            }
-        }
+    steps = MAX_CODE_STEPS;
 
-        // START NOTE state
-        // Entered following the completion of a note or rest specification.
-        // Calculates note frequency and timing parameters and configures
-        // beeper (unless note is a rest).  Advances to WAIT NOTE or WAIT REST
-        // state as appropriate.
-
-        else if (state == STATE_START_NOTE) {
-            rest_period = whole_note_period;
-            // If dotted flag set, note period is 50% longer
-            if (size_modifier & MOD_DOTTED) {
-                rest_period += rest_period >> 1;
-            }
-            // If triplet flag set, note period is divided by 3
-            if (size_modifier & MOD_TRIPLET) {
-                rest_period /= 3;
-            }
-            // Divide base (whole note) period by note size
-            // e.g. if quarter note, divide by 4
-            rest_period /= note_size;
-            // Note # 0xFF designates a rest
-            if (note == NOTE_IS_REST) {
-                state = STATE_START_REST;
-                continue;
-            }
-            // Calculate note play time and rest time
-            // The ratio of note to rest time is specified by <note_rest_ratio>
-            // with a fixed dividend of 8
-            // e.g. if note_rest_ratio = 5, play note for 5/8 of note time and
-            // rest for 3/8 of note time
-            // If note is tied or staccato, ignore note/rest ratio setting and
-            // force it to 8 (tied) or 2 (staccato).
-            if (size_modifier & MOD_TIED) {
-                digit = 8;
-            }
-            else if (size_modifier & MOD_STACCATO) {
-                digit = 2;
-            }
-            else {
-                digit = note_rest_ratio;
-            }
-            note_period = (rest_period * digit) >> 3;
-            rest_period -= note_period;
-            // Adjust note tone to be played by accidental and transposition factors
-            // <digit> is used as a temporary to hold the adjusted note tone
-            // <ch> is temporarily used to hold adjusted octave
-            digit = note + accidental + transposition;
-            ch = octave;
-            // Check for note over/underflow
-            if (digit < 0) {
-                digit += NOTES_PER_OCTAVE;
-                ch--;
-            }
-            else if (digit >= NOTES_PER_OCTAVE) {
-                digit -= NOTES_PER_OCTAVE;
-                ch++;
-            }
-            // Check for octave over/underflow
-            if (ch < 0) {
-                ch = 0;
-            }
-            else if (ch >= OCTAVES) {
-                ch = OCTAVES - 1;
-            }
-            // Fetch timer period and prescaler from note table
-            n = (note_t *) &note_table[ch][digit];
-            number = pgm_read_word(&n->period);
-            digit = pgm_read_byte(&n->prescale);
-            // Start playing note and advance to wait state
-            beep_period(number, digit);
-            state = STATE_WAIT_NOTE;
-            continue;
-        }
+    do {
+        PROFILE_PASS(PROFILE_PLAYER);
 
         // WAIT NOTE state
-        // Entered following the initiation of note playback (beeper
-        // turned on).  Idles player until <note_period> ticks have
+        // Entered following the initiation of note playback.  Idles player until <note_period> ticks have
         // elapsed.
 
-        else if (state == STATE_WAIT_NOTE) {
+        if (state == STATE_WAIT_NOTE) {
             // Wait until note play period has elapsed
             if (player_timer < note_period) {
                 break;
@@ -1022,338 +1262,148 @@ void player_service(void)
             // ensures that tempo is maintained, even if note/rest timing is
             // less than precise.
             player_timer -= note_period;
-            // If the note has a rest period, advance to the rest state.
-            // Otherwise, skip rest state and resume note/command scanning.
+            // If the note has a rest period, end the note and advance to
+            // the rest state.  Otherwise, fetch the next instruction.
             if (rest_period) {
-                state = STATE_START_REST;
+                sound_release(PLAYER_VOICE);
+                state = STATE_WAIT_REST;
             }
             else {
-                state = STATE_GET_NOTE;
+                state = STATE_FETCH;
             }
             continue;
         }
 
-        // START REST state
-        // Entered following note playback or when a rest is requested.
-        // Silences beeper output and sets up for rest delay.
-
-        if (state == STATE_START_REST) {
-            // Start of note rest period
-            // Turn off beeper timer to silence it
-            beep_period(0xFF, PRESCALE_STOP);
-            // Advance to wait-for-rest state
-            state = STATE_WAIT_REST;
-            continue;
-        }
-
         // WAIT REST state
         // Idles player until <rest_period> ticks have elapsed.
-        // Usually entered when a rest ('R') is specified, or
-        // following note playback to implement the silence period
-        // between notes as specified by the <note_rest_ratio>.
 
         else if (state == STATE_WAIT_REST) {
             // Wait until rest period has elapsed
             if (player_timer < rest_period) {
                 break;
             }
-            // Reset tick counter
-            // Subtract time from it instead of zeroing it in case some ticks
-            // were "missed" due to insufficiently fast polling.  Doing this
-            // ensures that tempo is maintained, even if note/rest timing is
-            // less than precise.
             player_timer -= rest_period;
-            // Resume note/command scanning
-            state = STATE_GET_NOTE;
+            state = STATE_FETCH;
             continue;
         }
 
-        // GET DIGIT state
-        // Fetches a single ASCII decimal character and converts it to
-        // an integer representation in <digit>.  Seperator characters
-        // are interpreted as '0'.
-
-        else if (state == STATE_GET_DIGIT) {
-            // Assume no errors: Advance to state that will utilize digit
-            state = next_state;
-            // Get digit character
-            digit = next_player_char();
-            // Assume '0' for digit if seperator character
-            if (is_separator(digit)) {
-                digit = 0;
-            }
-            // If digit, convert it to integer
-            else if (is_digit(digit)) {
-                digit -= '0';
-            }
-            // If not a seperator or digit, play string is misformed.
-            // Abort playback
-            else {
-                state = STATE_STOP;
-            }
-            continue;
-        }
-
-        // GET NUMBER state
-        // Setup to fetch a multi-digit ASCII decimal value and convert it
-        // to an integer representation.  Skips over any optional seperator
-        // character.
-
-        else if (state == STATE_GET_NUMBER) {
-            // Clear number accumulator
-            number = 0;
-            // Skip past (optional) data separator
-            ch = next_player_char();
-            if (is_separator(ch)) {
-                ch = next_player_char();
+        // NEXT CODE state
+        // Entered at the end of a stream buffer half.  Idles player until
+        // player_poll() has compiled the other half, then continues there.
+        // Timing restarts when the player has had to wait.
+
+        else if (state == STATE_NEXT_CODE) {
+            if (!(player_ready & BM(player_half ^ 1))) {
+                if (player_starved == STARVED_NO) {
+                    player_starved = STARVED_YES;
+                    if (player_underrun_count < 0xFF) {
+                        player_underrun_count++;
+                    }
+                }
+                break;
             }
-            // Advance to state that will decode the multi-digit number
-            state = STATE_GET_NUMBER_2;
-            continue;
-        }
-
-        // GET NUMBER 2 state
-        // Entered following execution of the GET NUMBER state
-        // Fetches ASCII decimal digits and decimal-shifts them into the
-        // <number> accumulator.  Exit from this state occurs when a
-        // non-digit character is encountered.
-
-        else if (state == STATE_GET_NUMBER_2) {
-            while (is_digit(ch)) {
-                ch -= '0';
-                number = (number * 10) + ch;
-                ch = next_player_char();
+            player_ready &= (uint8_t) ~BM(player_half);
+            player_half ^= 1;
+            pc = player_half * PLAYER_STREAM_HALF;
+            if (player_starved != STARVED_NO) {
+                player_starved = STARVED_NO;
+                player_timer = 0;
             }
-            // If not a valid digit, end of number has been reached.
-            // Back up pointer so non-digit char is processed as a note/command.
-            // Advance to state that will utilize numeric parameter
-            player_ptr--;
-            state = next_state;
+            state = STATE_FETCH;
             continue;
         }
 
-        // SET OCTAVE state
-        // Entered after the octave value (single digit #) has been fetched.
-        // Sets <octave> to the value specified.
+        // FETCH state
+        // Fetches and executes the next instruction
 
-        else if (state == STATE_SET_OCTAVE) {
-            octave = digit;
-            state = STATE_GET_NOTE;
-            continue;
+        if (!steps) {
+            break;
         }
+        steps--;
 
-        // SET NOTE RATIO state
-        // Entered after the note ratio (single-digit #) has been fetched.
-        // Sets <note_rest_ratio> to the value specified.
+        code = player_code[pc++];
+        arg = CODE_ARG(code);
 
-        else if (state == STATE_SET_NOTE_RATIO) {
-            // Bound ratio to maximum
-            if (digit > 8) {
-                digit = 8;
-            }
-            // Set note/rest ratio and resume note/command scanning
-            note_rest_ratio = digit;
-            state = STATE_GET_NOTE;
-            continue;
-        }
-
-        // SET VOLUME state
-        // Entered after the volume level (single-digit #) has been fetched.
-        // Sets the programmable gain amp to the gain value (0-7) specified.
+        // Note or rest
 
-        else if (state == STATE_SET_VOLUME) {
-            // If specified volume is 0, mute speaker
-            if (digit == 0) {
-                beep_mute(1);
+        if (code <= CODE_REST) {
+            arg = player_code[pc++];
+            note_period = player_duration[arg].note;
+            rest_period = player_duration[arg].rest;
+            if ((code == CODE_REST) || !note_period) {
+                // Silence output for entire note time
+                sound_release(PLAYER_VOICE);
+                state = STATE_WAIT_REST;
             }
-            // Volume > 0, set PGA to selected volume
             else {
-                digit--;                // 1..8 -> 0..7
-                if (digit > 7) {        // Bound to maximum setting
-                    digit = 7;
-                }
-                beep_gain(digit);       // Set volume
-                beep_mute(0);           // Un-mute speaker
+                sound_note(PLAYER_VOICE, code);
+                state = STATE_WAIT_NOTE;
             }
-            // Resume note/command scanning
-            state = STATE_GET_NOTE;
-            continue;
         }
 
-        // SET TRANSPOSITION state
-        // Entered after the transposition factor (multi-digit #) has been
-        // fetched.  Sets the note transposition factor to the value
-        // specified.
+        // Set volume
+        // If specified volume is 0, mute speaker.  Otherwise, set selected
+        // volume (1..8 -> 0..7)
 
-        else if (state == STATE_SET_TRANSPOSITION) {
-            // Set new transposition value if it is within a one-octave range.
-            // Otherwise, force it to 0
-            if (number < NOTES_PER_OCTAVE) {
-                transposition = number;
+        else if (CODE_OP(code) == CODE_VOLUME) {
+            if (arg == 0) {
+                sound_mute(1);
             }
             else {
-                transposition = 0;
+                arg--;
+                if (arg > SOUND_MAX_GAIN) { // Bound to maximum setting
+                    arg = SOUND_MAX_GAIN;
+                }
+                sound_gain(arg);        // Set volume
+                sound_mute(0);          // Un-mute speaker
             }
-            // Resume note/command scanning
-            state = STATE_GET_NOTE;
-            continue;
         }
 
-        // SET KEY state
+        // Set bookmark
+        // Records the present position and the repeat count following the
+        // instruction, for use by the goto bookmark instruction.
 
-        else if (state == STATE_SET_KEY) {
-            for (digit = 0; digit < 7; digit++) {
-                scale[digit] = pgm_read_byte(&c_major_scale[digit]);
-            }
-            accidental = ACCIDENTAL_SHARP;  // Default: Sharps
-            state = STATE_SET_KEY_2;
-            continue;
+        else if (CODE_OP(code) == CODE_MARK) {
+            bookmark[arg].repeat = player_code[pc++];
+            bookmark[arg].position = pc;
         }
 
-        // SET KEY 2 state
+        // Goto bookmark
+        // Jump to bookmark position if:
+        //   - It is defined
+        //   - Bookmark repeat count is not 0
 
-        else if (state == STATE_SET_KEY_2) {
-            ch = next_player_char();
-            if (is_note(ch)) {
-                ch -= 'A';
-                digit = pgm_read_byte(&c_major_scale[ch]);
-                digit += accidental;
-                scale[ch] = digit;
-                continue;
-            }
-            else if (is_flat(ch)) {
-                accidental = ACCIDENTAL_FLAT;
-                continue;
-            }
-            else if (is_natural(ch)) {
-                accidental = ACCIDENTAL_NATURAL;
-                continue;
-            }
-            else if (is_sharp(ch)) {
-                accidental = ACCIDENTAL_SHARP;
-                continue;
+        else if (CODE_OP(code) == CODE_GOTO) {
+            if (bookmark[arg].repeat && (bookmark[arg].position != NO_BOOKMARK)) {
+                // Decrement repeat count if it is not 'infinite'
+                if (bookmark[arg].repeat != 0xFF) {
+                    bookmark[arg].repeat--;
+                }
+                pc = bookmark[arg].position;
             }
-            player_ptr--;
-            state = STATE_GET_NOTE;
-            continue;
-        }
-
-        // SET TEMPO state
-        // Entered after the beat unit (WHQISY) has been fetched, but before
-        // the beats/min parameter is fetched.
-
-        else if (state == STATE_SET_TEMPO) {
-            // Upon entry to this state, the beat unit <note_size> has been
-            // fetched.  Now fetch beats/min parameter.
-            state = STATE_GET_NUMBER;
-            next_state = STATE_SET_TEMPO_2;
-            continue;
         }
 
-        // SET TEMPO 2 state
-        // Entered following the fetch of the beat unit (WHQISY) and beats/min
-        // (multi-digit #) specification.
-        // Sets <whole_note_period> based on this information, on which all
-        // note timing is based.
-
-        else if (state == STATE_SET_TEMPO_2) {
-            // Use 120 BPM if no BPM rate specified
-            if (!number) {
-                number = DEFAULT_TEMPO;
-            }
-            // Both note unit (<note_size>, <size_modifier>) and beats/min
-            // (<number>) parameters have been fetched
-            // Calculate whole note period based on these parameters
-            whole_note_period =
-                (uint16_t) (PLAYER_TICKS_PER_SECOND * 60U * (uint32_t) note_size / number);
-           // Add 50% to beat time if dotted
-            if (size_modifier & MOD_DOTTED) {
-                whole_note_period += whole_note_period >> 1;
-            }
-            // One-thrid of beat time if tripleted
-            if (size_modifier & MOD_TRIPLET) {
-                whole_note_period /= 3;
-            }
-            // Resume note/command scanning
-            state = STATE_GET_NOTE;
-            continue;            
-        }
+        // Reset player
 
-        // SET BOOKMARK state
-        // Entered following the fetch of the bookmark number, but before
-        // the repeat count is fetched.
-
-        else if (state == STATE_SET_BOOKMARK) {
-            // Upon entry to this state, the bookmark # has been fetched
-            // and is in <digit>.
-            // Set up to fetch repeat count
-            state = STATE_GET_NUMBER;
-            // After repeat count is fetched, finalize bookmark setting
-            next_state = STATE_SET_BOOKMARK_2;
-            continue;
+        else if (code == CODE_RESET) {
+            player_timer = 0;
+            sound_release(PLAYER_VOICE);
+            sound_mute(0);
+            sound_gain(5);
         }
 
-        // SET BOOKARMK 2 state
-        // Entered following the fetch of the bookmark number and repeat count
-        // The current play string pointer along with the specified repeat
-        // count are stored in the specified bookmark record.  This information
-        // is used by the GOTO BOOKMARK state/command.
-
-        else if (state == STATE_SET_BOOKMARK_2) {
-            // Both bookmark # <digit> and repeat count <number> have
-            // been fetched.  Set bookmark based on these parameters,
-            // along with the present value of <player_ptr>.
-            if (number > 0xFE) {        // Bound repeat count to 8-bit max - 1
-                number = 0xFE;
-            }
-            if (! number) {             // Repeat count of 0 means "infinite"
-                number = 0xFF;
-            }
-            bookmark[digit].repeat = number;
-            bookmark[digit].position = player_ptr;
-            // Resume note/command scanning
-            state = STATE_GET_NOTE;
-            continue;
-        }
+        // End of stream buffer half
 
-        // GOTO BOOKMARK state
-        // Enered following the fetch of a bookmark # (digit)
-        // Sets playback pointer to the specified bookmark location if the
-        // bookmark's repeat counter is nonzero.
-
-        else if (state == STATE_GOTO_BOOKMARK) {
-            // Bookmark # has been fetched
-            // Jump to bookmark position if:
-            //   - It is defined (e.g. not NULL)
-            //   - Bookmark repeat count is not 0
-            if (bookmark[digit].repeat && bookmark[digit].position) {
-                // Decrement repeat count if it is not 'infinite'
-                if (bookmark[digit].repeat != 0xFF) {
-                    bookmark[digit].repeat--;
-                }
-                player_ptr = bookmark[digit].position;
-            }
-            // Resume note/command processing at new position
-            state = STATE_GET_NOTE;
-            continue;
+        else if (code == CODE_NEXT) {
+            state = STATE_NEXT_CODE;
         }
 
-        // STOP state
-        // This state will be entered when the end of the play string is
-        // encountered or a parsing error occurs.
+        // End of string - stop playing (mute output)
 
-        else if (state == STATE_STOP) {
+        else {
             player_stop();
-            state = STATE_RESET;
             break;
         }
-
-        // Unknown state - force to STOP
-
-        else {
-            state = STATE_STOP;
-            continue;
-        }
     } while (1);
 }
 
@@ -1421,7 +1471,7 @@ Knnn...:        Set key, nnn... is a list of notes and accidentals
                 Accidentals may occur anywhere in the string; e.g. "K-C+G:" will
                 flatten C and sharpen G.
 
-Vn              Set volume to n (0-7)
+Vn              Set volume to n (1-8), 0 mutes output
                 e.g. "V5:" Set volume to 5
 
 [n:rrr:         Set bookmark <n> (0-9) with repeat count <r>
@@ -1432,4 +1482,12 @@ Vn              Set volume to n (0-7)
 
 *               Reset player
 
+--------------------------------------------------------------------------------
+
+Play strings are compiled into player code by player_start(), so score
+settings (octave, key, transposition, tempo, note/rest ratio and note
+modifiers) are those in effect at each note's position in the string.  A
+section repeated using a bookmark replays the same notes each time, even if
+it changes settings such as the octave.
+
 *******************************************************************************/
@@ -0,0 +1,227 @@
+/*------------------------------------------------------------------------------
+Name:       power.c
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: ATmega168 or ATmega328
+
+Content:    Display power management
+------------------------------------------------------------------------------*/
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#include "portdef.h"
+#include "clock.h"
+#include "nixie.h"
+#include "power.h"
+
+//------------------------------------------------------------------------------
+
+// Schedule in use
+static power_schedule_t power_sched;
+
+// Set by power_activity(), cleared by power_tick()
+static volatile uint8_t power_input;
+
+// Seconds since the last user input
+static uint16_t power_idle;
+
+// Seconds left for which the blank window is overridden
+static uint8_t power_wake;
+
+#if POWER_LIGHT_SENSOR
+
+// Light sensor reading, filtered, times 8
+static uint16_t power_light;
+
+#endif
+
+/******************************************************************************
+ * uint8_t power_window(hour, start, end)
+ *
+ * Determine if an hour falls in a scheduled window
+ *
+ * Inputs:  hour        Hour to test, 0..23
+ *          start       First hour of the window
+ *          end         Hour after the last hour of the window
+ *
+ * Returns: Nonzero if <hour> is in the window
+ *
+ * Notes:   A window with <start> after <end> spans midnight.  A window
+ *          with <start> equal to <end> is disabled.
+ ******************************************************************************/
+
+static uint8_t power_window(uint8_t hour, uint8_t start, uint8_t end)
+{
+    if (start < end) {
+        return (hour >= start) && (hour < end);
+    }
+    if (start > end) {
+        return (hour >= start) || (hour < end);
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * power_init(*schedule)
+ *
+ * Initialize power management
+ *
+ * Inputs:  *schedule   Power management schedule
+ *
+ * Returns: Nothing
+ *
+ * Notes:   The display starts at full intensity.  If a light sensor is
+ *          fitted, the ADC is set up and its first conversion started.
+ ******************************************************************************/
+
+void power_init(const power_schedule_t *schedule)
+{
+    power_schedule(schedule);
+    nixie_display_dim(NIXIE_DIM_FULL);
+
+#if POWER_LIGHT_SENSOR
+    power_light = 1023 << 3;
+
+    ADMUX = BM(REFS0) | POWER_LIGHT_CHANNEL;    // AVcc reference
+    ADCSRA = BM(ADEN) | BM(ADSC) | BM(ADPS2) | BM(ADPS1) | BM(ADPS0);   // f/128
+#endif
+}
+
+/******************************************************************************
+ * power_schedule(*schedule)
+ *
+ * Change the power management schedule
+ *
+ * Inputs:  *schedule   New schedule
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Takes effect at the next power_tick().
+ ******************************************************************************/
+
+void power_schedule(const power_schedule_t *schedule)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        power_sched = *schedule;
+    }
+}
+
+/******************************************************************************
+ * power_activity()
+ *
+ * Note user input
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Called by the event manager whenever a button or encoder event
+ *          is posted.  Only sets a flag, so it is safe to call from
+ *          interrupt handlers.
+ ******************************************************************************/
+
+void power_activity(void)
+{
+    power_input = 1;
+}
+
+/******************************************************************************
+ * power_tick()
+ *
+ * Power management service
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Must be called once per second, after the time has been
+ *          advanced (typically from the timekeeping interrupt).  Sets the
+ *          global dimming level, and starts the hourly cathode exercise.
+ *          Light sensor conversions are started here and read a second
+ *          later, so nothing waits for the ADC.
+ ******************************************************************************/
+
+void power_tick(void)
+{
+    power_schedule_t sched;
+    time_t now;
+    uint8_t target;
+    uint8_t level;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        sched = power_sched;
+        if (power_input) {
+            power_input = 0;
+            power_idle = 0;
+            power_wake = POWER_WAKE_TIME;
+        }
+        else {
+            if (power_idle < 0xFFFF) {
+                power_idle++;
+            }
+            if (power_wake) {
+                power_wake--;
+            }
+        }
+    }
+
+    get_time_24(&now);
+
+    // Lowest level called for by the schedule, idle time and light level
+
+    target = NIXIE_DIM_FULL;
+
+    if (power_window(now.hour, sched.dim_start, sched.dim_end)) {
+        target = POWER_DIM_LEVEL;
+    }
+    if (sched.idle_dim && (power_idle >= sched.idle_dim * 60U) &&
+        (target > POWER_IDLE_LEVEL)) {
+        target = POWER_IDLE_LEVEL;
+    }
+    if (sched.idle_blank && (power_idle >= sched.idle_blank * 60U)) {
+        target = 0;
+    }
+    if (!power_wake && power_window(now.hour, sched.blank_start, sched.blank_end)) {
+        target = 0;
+    }
+
+#if POWER_LIGHT_SENSOR
+    if (!(ADCSRA & BM(ADSC))) {
+        power_light += ADC - (power_light >> 3);
+        ADCSRA |= BM(ADSC);
+    }
+
+    level = POWER_LIGHT_MIN +
+        (((power_light >> 3) * (NIXIE_DIM_FULL - POWER_LIGHT_MIN)) >> 10);
+    if (level < target) {
+        target = level;
+    }
+#endif
+
+    // Fade down gradually, brighten at once
+
+    level = nixie_display_level();
+    if (target < level) {
+        level = (level - target > POWER_FADE_STEP) ? level - POWER_FADE_STEP : target;
+    }
+    else {
+        level = target;
+    }
+    nixie_display_dim(level);
+
+    // Exercise the cathodes on the hour, while the display is lit
+
+    if (level && !now.minute && !now.second) {
+        nixie_exercise(POWER_EXERCISE_PASSES);
+    }
+}
@@ -0,0 +1,287 @@
+/*------------------------------------------------------------------------------
+Name:       profile.c
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: ATmega168 or ATmega328
+
+Content:    Interrupt service cycle-budget profiler
+------------------------------------------------------------------------------*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "portdef.h"
+#include "timer.h"
+#include "profile.h"
+
+//------------------------------------------------------------------------------
+
+// Per-stage statistics
+
+typedef struct {
+    uint8_t min;            // Shortest run, TIMER2 ticks
+    uint8_t max;            // Longest run, TIMER2 ticks
+    uint16_t samples;       // Number of runs accumulated in total
+    uint32_t total;         // Sum of run times, TIMER2 ticks
+    uint8_t passes;         // Inner loop passes during current run
+    uint8_t max_passes;     // Largest number of passes in a single run
+    uint8_t active;         // Non-zero while stage is running
+    uint8_t overruns;       // Number of times the stage was re-entered
+} profile_t;
+
+static profile_t profile_data[PROFILE_STAGES];
+
+// Stage names, printed by profile_dump()
+
+#define STAGE_NAME_SIZE     8
+
+static const char stage_name[PROFILE_STAGES][STAGE_NAME_SIZE] PROGMEM = {
+    "tick",
+    "refresh",
+    "xfade",
+    "button",
+    "timer",
+    "player"
+};
+
+/******************************************************************************
+ * profile_start(stage)
+ *
+ * Mark entry to a profiled stage
+ *
+ * Inputs:  stage       Stage being entered
+ *
+ * Returns: TIMER2 timestamp, to be passed to profile_end()
+ *
+ * Notes:   If the stage is entered again before a previous run has ended
+ *          (e.g. a re-enabled interrupt taking longer than its period),
+ *          the overrun count for that stage is incremented.
+ ******************************************************************************/
+
+uint8_t profile_start(profile_stage_t stage)
+{
+    register profile_t *p = &profile_data[stage];
+    uint8_t now;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        now = TCNT2;
+        if (p->active) {
+            if (p->overruns < 0xFF) {
+                p->overruns++;
+            }
+        }
+        else {
+            p->passes = 0;
+        }
+        p->active++;
+    }
+
+    return now;
+}
+
+/******************************************************************************
+ * profile_end(stage, start)
+ *
+ * Mark exit from a profiled stage and update its statistics
+ *
+ * Inputs:  stage       Stage being exited
+ *          start       Timestamp returned by profile_start()
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Elapsed time is measured modulo the TIMER2 period, so runs
+ *          longer than TIMER2_PERIOD_TICKS are under-reported.  When the
+ *          sample count saturates, both it and the running total are halved
+ *          so that the mean keeps tracking recent behaviour.
+ ******************************************************************************/
+
+void profile_end(profile_stage_t stage, uint8_t start)
+{
+    register profile_t *p = &profile_data[stage];
+    uint8_t now;
+    uint8_t elapsed;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        now = TCNT2;
+        elapsed = now - start;
+        if (now < start) {
+            elapsed -= 256 - TIMER2_PERIOD_TICKS;
+        }
+
+        if (!p->samples || (elapsed < p->min)) {
+            p->min = elapsed;
+        }
+        if (elapsed > p->max) {
+            p->max = elapsed;
+        }
+
+        if (p->samples == 0xFFFF) {
+            p->samples >>= 1;
+            p->total >>= 1;
+        }
+        p->samples++;
+        p->total += elapsed;
+
+        if (p->passes > p->max_passes) {
+            p->max_passes = p->passes;
+        }
+
+        if (p->active) {
+            p->active--;
+        }
+    }
+}
+
+/******************************************************************************
+ * profile_pass(stage)
+ *
+ * Count one pass through the inner loop of a profiled stage
+ *
+ * Inputs:  stage       Stage whose loop is executing
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+void profile_pass(profile_stage_t stage)
+{
+    register profile_t *p = &profile_data[stage];
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (p->passes < 0xFF) {
+            p->passes++;
+        }
+    }
+}
+
+/******************************************************************************
+ * profile_overrun(stage)
+ *
+ * Count an overrun of a profiled stage
+ *
+ * Inputs:  stage       Stage that overran
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+void profile_overrun(profile_stage_t stage)
+{
+    register profile_t *p = &profile_data[stage];
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (p->overruns < 0xFF) {
+            p->overruns++;
+        }
+    }
+}
+
+/******************************************************************************
+ * profile_reset()
+ *
+ * Clear all profiler statistics
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+void profile_reset(void)
+{
+    register profile_t *p;
+    uint8_t stage;
+
+    for (stage = 0; stage < PROFILE_STAGES; stage++) {
+        p = &profile_data[stage];
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            p->min = 0;
+            p->max = 0;
+            p->samples = 0;
+            p->total = 0;
+            p->max_passes = 0;
+            p->overruns = 0;
+        }
+    }
+}
+
+/******************************************************************************
+ * profile_summary(stage, *summary)
+ *
+ * Read profiler statistics for one stage
+ *
+ * Inputs:  stage       Stage to read
+ *          *summary    Location to store the statistics
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Times are converted to microseconds.  The statistics are copied
+ *          with interrupts disabled so that a consistent set is returned.
+ ******************************************************************************/
+
+void profile_summary(profile_stage_t stage, profile_summary_t *summary)
+{
+    profile_t copy;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        copy = profile_data[stage];
+    }
+
+    if (!copy.samples) {
+        summary->min = 0;
+        summary->mean = 0;
+    }
+    else {
+        summary->min = copy.min * TIMER2_US_PER_TICK;
+        summary->mean = (copy.total * TIMER2_US_PER_TICK + copy.samples / 2) / copy.samples;
+    }
+    summary->max = copy.max * TIMER2_US_PER_TICK;
+    summary->max_passes = copy.max_passes;
+    summary->overruns = copy.overruns;
+    summary->samples = copy.samples;
+}
+
+/******************************************************************************
+ * profile_dump(stream)
+ *
+ * Print profiler statistics
+ *
+ * Inputs:  stream      Output stream (typically &serial_f)
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Times are printed in microseconds.  Stages are not all sampled
+ *          at the same instant.
+ ******************************************************************************/
+
+void profile_dump(FILE *stream)
+{
+    profile_summary_t summary;
+    uint8_t stage;
+
+    fprintf_P(stream, PSTR("\r\nstage       min   max  mean  pass  ovr     n\r\n"));
+
+    for (stage = 0; stage < PROFILE_STAGES; stage++) {
+        profile_summary(stage, &summary);
+
+        fprintf_P(stream, PSTR("%-8S %5u %5u %5u %5u %4u %5u\r\n"),
+            stage_name[stage],
+            summary.min,
+            summary.max,
+            summary.mean,
+            summary.max_passes,
+            summary.overruns,
+            summary.samples);
+    }
+}
@@ -0,0 +1,543 @@
+/*------------------------------------------------------------------------------
+Name:       proto.c
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: ATmega168 or ATmega328
+
+Content:    Binary framed host command/telemetry protocol
+
+            See proto.h for the frame format and command list.
+
+            PROTO_TELEMETRY reply payload:
+
+            0       Events lost due to a full queue (event_overflows())
+            1       Music stream underruns (player_underruns())
+            2       Frames received with a bad CRC or length (proto_errors())
+            3       Display frames dropped (nixie_frame_drops())
+            4       Number of profiled stages (PROFILE_STAGES)
+            5...    For each profiled stage, 8 bytes:
+                        min(2) max(2) mean(2) run time, microseconds
+                        max. inner loop passes(1) overruns(1)
+
+            Counters and profiler statistics are reset after being read if
+            the command payload is a single nonzero byte.
+------------------------------------------------------------------------------*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+
+#include "portdef.h"
+#include "serial.h"
+#include "timer.h"
+#include "event.h"
+#include "clock.h"
+#include "nixie.h"
+#include "player.h"
+#include "profile.h"
+#include "config.h"
+#include "power.h"
+#include "proto.h"
+
+//------------------------------------------------------------------------------
+
+// Frame receiver states
+
+typedef enum {
+    STATE_SYNC,             // Waiting for PROTO_SYNC
+    STATE_LENGTH,           // Waiting for payload length
+    STATE_TYPE,             // Waiting for frame type
+    STATE_DATA,             // Receiving payload
+    STATE_CRC_LO,           // Waiting for CRC, low byte
+    STATE_CRC_HI            // Waiting for CRC, high byte
+} proto_state_t;
+
+// Number of display streams that may be loaded by PROTO_FRAME
+
+#define PROTO_STREAMS       2
+
+// Size of PROTO_SET_CLOCK / PROTO_GET_CLOCK payload
+
+#define CLOCK_PAYLOAD       7
+
+// Size of PROTO_TELEMETRY reply payload
+
+#define TELEMETRY_STAGE     8
+#define TELEMETRY_PAYLOAD   (5 + PROFILE_STAGES * TELEMETRY_STAGE)
+
+#if TELEMETRY_PAYLOAD > PROTO_MAX_PAYLOAD
+  #error Telemetry reply does not fit in PROTO_MAX_PAYLOAD
+#endif
+
+#if (NIXIE_SEGDATA_BYTES + 1) > PROTO_MAX_PAYLOAD
+  #error Display frame does not fit in PROTO_MAX_PAYLOAD
+#endif
+
+// Module (private) variables
+
+static proto_state_t    proto_state;
+static uint8_t          proto_length;
+static uint8_t          proto_type;
+static uint8_t          proto_count;
+static uint16_t         proto_crc;
+static uint16_t         proto_rx_crc;
+static uint32_t         proto_last;
+static uint8_t          proto_error_count;
+static FILE             *proto_stream[PROTO_STREAMS];
+
+// Payload buffer, also used to build replies
+// One spare byte allows a play string to be terminated in place
+
+static uint8_t          proto_payload[PROTO_MAX_PAYLOAD + 1];
+
+//------------------------------------------------------------------------------
+
+/******************************************************************************
+ * put16(*dest, value)
+ *
+ * Store a 16-bit value in little-endian byte order
+ *
+ * Inputs:  *dest       Location to store value
+ *          value       Value to store
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+static void put16(uint8_t *dest, uint16_t value)
+{
+    dest[0] = (uint8_t) value;
+    dest[1] = (uint8_t) (value >> 8);
+}
+
+/******************************************************************************
+ * proto_send(type, *data, length)
+ *
+ * Send a frame
+ *
+ * Inputs:  type        Frame type
+ *          *data       Frame payload
+ *          length      Number of payload bytes
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+static void proto_send(uint8_t type, const uint8_t *data, uint8_t length)
+{
+    uint8_t header[3];
+    uint8_t trailer[2];
+    uint16_t crc;
+    uint8_t index;
+
+    header[0] = PROTO_SYNC;
+    header[1] = length;
+    header[2] = type;
+
+    crc = _crc_xmodem_update(0, length);
+    crc = _crc_xmodem_update(crc, type);
+    for (index = 0; index < length; index++) {
+        crc = _crc_xmodem_update(crc, data[index]);
+    }
+    put16(trailer, crc);
+
+    serial_write(header, sizeof(header));
+    serial_write(data, length);
+    serial_write(trailer, sizeof(trailer));
+}
+
+/******************************************************************************
+ * proto_status(type, status)
+ *
+ * Send a reply frame containing a status code
+ *
+ * Inputs:  type        Reply frame type
+ *          status      PROTO_STATUS_xxx code
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+static void proto_status(uint8_t type, uint8_t status)
+{
+    proto_send(type, &status, 1);
+}
+
+/******************************************************************************
+ * uint8_t set_clock(*data)
+ *
+ * Set time and date from a PROTO_SET_CLOCK payload
+ *
+ * Inputs:  *data       Payload: hour minute second year(2) month day
+ *
+ * Returns: PROTO_STATUS_xxx code
+ *
+ * Notes:   Time and date are set together, so the clock cannot advance
+ *          between the two.
+ ******************************************************************************/
+
+static uint8_t set_clock(const uint8_t *data)
+{
+    time_t time;
+    date_t date;
+
+    time.hour = data[0];
+    time.minute = data[1];
+    time.second = data[2];
+    date.year = data[3] | ((uint16_t) data[4] << 8);
+    date.month = data[5];
+    date.day = data[6];
+
+    if ((time.hour > 23) || (time.minute > 59) || (time.second > 59) ||
+        (date.year < CLOCK_EPOCH_YEAR) || (date.year > CLOCK_LAST_YEAR) ||
+        (date.month < 1) || (date.month > 12) ||
+        (date.day < 1) || (date.day > days_in_month(date.month, date.year))) {
+        return PROTO_STATUS_VALUE;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        set_time_24(&time);
+        set_date(&date);
+    }
+
+    return PROTO_STATUS_OK;
+}
+
+/******************************************************************************
+ * get_clock(*data)
+ *
+ * Build a PROTO_GET_CLOCK reply payload
+ *
+ * Inputs:  *data       Location to store payload (CLOCK_PAYLOAD bytes)
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+static void get_clock(uint8_t *data)
+{
+    time_t time;
+    date_t date;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        get_time_24(&time);
+        get_date(&date);
+    }
+
+    data[0] = time.hour;
+    data[1] = time.minute;
+    data[2] = time.second;
+    put16(&data[3], date.year);
+    data[5] = date.month;
+    data[6] = date.day;
+}
+
+/******************************************************************************
+ * get_telemetry(*data, reset)
+ *
+ * Build a PROTO_TELEMETRY reply payload
+ *
+ * Inputs:  *data       Location to store payload (TELEMETRY_PAYLOAD bytes)
+ *          reset       Reset counters and profiler statistics if nonzero
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+static void get_telemetry(uint8_t *data, uint8_t reset)
+{
+    profile_summary_t summary;
+    uint8_t stage;
+
+    *data++ = event_overflows(reset);
+    *data++ = player_underruns(reset);
+    *data++ = proto_errors(reset);
+    *data++ = nixie_frame_drops(reset);
+    *data++ = PROFILE_STAGES;
+
+    for (stage = 0; stage < PROFILE_STAGES; stage++) {
+        profile_summary(stage, &summary);
+        put16(&data[0], summary.min);
+        put16(&data[2], summary.max);
+        put16(&data[4], summary.mean);
+        data[6] = summary.max_passes;
+        data[7] = summary.overruns;
+        data += TELEMETRY_STAGE;
+    }
+
+    if (reset) {
+        profile_reset();
+    }
+}
+
+/******************************************************************************
+ * uint8_t set_power(*data)
+ *
+ * Change and save the power management schedule
+ *
+ * Inputs:  *data       PROTO_POWER payload (power_schedule_t layout)
+ *
+ * Returns: PROTO_STATUS_OK, or PROTO_STATUS_VALUE if an hour is out of range
+ ******************************************************************************/
+
+static uint8_t set_power(const uint8_t *data)
+{
+    config_t config;
+    uint8_t index;
+
+    for (index = 0; index < 4; index++) {
+        if (data[index] > 23) {
+            return PROTO_STATUS_VALUE;
+        }
+    }
+
+    config_get(&config);
+    config.power.dim_start = data[0];
+    config.power.dim_end = data[1];
+    config.power.blank_start = data[2];
+    config.power.blank_end = data[3];
+    config.power.idle_dim = data[4];
+    config.power.idle_blank = data[5];
+    config_put(&config);
+    power_schedule(&config.power);
+
+    return PROTO_STATUS_OK;
+}
+
+/******************************************************************************
+ * proto_execute()
+ *
+ * Execute a received command frame and send its reply
+ *
+ * Inputs:  None - uses proto_type, proto_length and proto_payload[]
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+static void proto_execute(void)
+{
+    uint8_t reply = proto_type | PROTO_REPLY;
+    uint8_t status = PROTO_STATUS_LENGTH;
+    uint8_t index;
+    int16_t trim;
+    config_t config;
+
+    if (proto_type == PROTO_PING) {
+        if (proto_length == 0) {
+            proto_status(reply, PROTO_VERSION);
+            return;
+        }
+    }
+
+    else if (proto_type == PROTO_SET_CLOCK) {
+        if (proto_length == CLOCK_PAYLOAD) {
+            status = set_clock(proto_payload);
+        }
+    }
+
+    else if (proto_type == PROTO_GET_CLOCK) {
+        if (proto_length == 0) {
+            get_clock(proto_payload);
+            proto_send(reply, proto_payload, CLOCK_PAYLOAD);
+            return;
+        }
+    }
+
+    else if (proto_type == PROTO_FRAME) {
+        if (proto_length == NIXIE_SEGDATA_BYTES + 1) {
+            index = proto_payload[0];
+            if ((index < PROTO_STREAMS) && proto_stream[index]) {
+                nixie_load_frame(proto_stream[index], &proto_payload[1]);
+                status = PROTO_STATUS_OK;
+            }
+            else {
+                status = PROTO_STATUS_VALUE;
+            }
+        }
+    }
+
+    else if (proto_type == PROTO_PLAY) {
+        if (proto_length == 0) {
+            player_stop();
+        }
+        else {
+            proto_payload[proto_length] = 0;
+            player_start((const char *) proto_payload, PLAYER_MEM_RAM);
+        }
+        status = PROTO_STATUS_OK;
+    }
+
+    else if (proto_type == PROTO_TRIM) {
+        if (proto_length == 0) {
+            put16(proto_payload, clock_get_trim());
+            proto_send(reply, proto_payload, 2);
+            return;
+        }
+        if (proto_length == 2) {
+            trim = proto_payload[0] | ((uint16_t) proto_payload[1] << 8);
+            if ((trim > CLOCK_MAX_TRIM) || (trim < -CLOCK_MAX_TRIM)) {
+                status = PROTO_STATUS_VALUE;
+            }
+            else {
+                clock_trim(trim);
+                status = PROTO_STATUS_OK;
+            }
+        }
+    }
+
+    else if (proto_type == PROTO_POWER) {
+        if (proto_length == 0) {
+            config_get(&config);
+            proto_send(reply, (const uint8_t *) &config.power, sizeof(power_schedule_t));
+            return;
+        }
+        if (proto_length == sizeof(power_schedule_t)) {
+            status = set_power(proto_payload);
+        }
+    }
+
+    else if (proto_type == PROTO_TELEMETRY) {
+        if (proto_length <= 1) {
+            get_telemetry(proto_payload, proto_length && proto_payload[0]);
+            proto_send(reply, proto_payload, TELEMETRY_PAYLOAD);
+            return;
+        }
+    }
+
+    else {
+        status = PROTO_STATUS_TYPE;
+    }
+
+    proto_status(reply, status);
+}
+
+/******************************************************************************
+ * proto_init(*stream0, *stream1)
+ *
+ * Initialize protocol handler
+ *
+ * Inputs:  *stream0    Display stream loaded by PROTO_FRAME stream # 0
+ *          *stream1    Display stream loaded by PROTO_FRAME stream # 1
+ *                      Either may be NULL if it is not to be loaded.
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+void proto_init(FILE *stream0, FILE *stream1)
+{
+    proto_stream[0] = stream0;
+    proto_stream[1] = stream1;
+    proto_state = STATE_SYNC;
+    proto_error_count = 0;
+}
+
+/******************************************************************************
+ * uint8_t proto_input(ch)
+ *
+ * Process one byte of serial input
+ *
+ * Inputs:  ch          Byte received
+ *
+ * Returns: Nonzero if the byte was taken as part of a frame.  Zero if no
+ *          frame is being received and <ch> is not PROTO_SYNC; the caller
+ *          may then treat it as ordinary input.
+ *
+ * Notes:   The command is executed and its reply sent when the last byte
+ *          of a frame is received.  A frame that stops arriving part way
+ *          through is abandoned after PROTO_TIMEOUT.
+ ******************************************************************************/
+
+uint8_t proto_input(uint8_t ch)
+{
+    uint32_t now;
+
+    now = timer_ticks();
+    if ((proto_state != STATE_SYNC) && (now - proto_last >= PROTO_TIMEOUT)) {
+        proto_state = STATE_SYNC;
+    }
+    proto_last = now;
+
+    if (proto_state == STATE_SYNC) {
+        if (ch != PROTO_SYNC) {
+            return 0;
+        }
+        proto_state = STATE_LENGTH;
+    }
+
+    else if (proto_state == STATE_LENGTH) {
+        if (ch > PROTO_MAX_PAYLOAD) {
+            if (proto_error_count < 0xFF) {
+                proto_error_count++;
+            }
+            proto_status(PROTO_NAK, PROTO_STATUS_LENGTH);
+            proto_state = STATE_SYNC;
+        }
+        else {
+            proto_length = ch;
+            proto_crc = _crc_xmodem_update(0, ch);
+            proto_state = STATE_TYPE;
+        }
+    }
+
+    else if (proto_state == STATE_TYPE) {
+        proto_type = ch;
+        proto_crc = _crc_xmodem_update(proto_crc, ch);
+        proto_count = 0;
+        proto_state = proto_length ? STATE_DATA : STATE_CRC_LO;
+    }
+
+    else if (proto_state == STATE_DATA) {
+        proto_payload[proto_count++] = ch;
+        proto_crc = _crc_xmodem_update(proto_crc, ch);
+        if (proto_count >= proto_length) {
+            proto_state = STATE_CRC_LO;
+        }
+    }
+
+    else if (proto_state == STATE_CRC_LO) {
+        proto_rx_crc = ch;
+        proto_state = STATE_CRC_HI;
+    }
+
+    else {
+        proto_rx_crc |= (uint16_t) ch << 8;
+        proto_state = STATE_SYNC;
+        if (proto_rx_crc == proto_crc) {
+            proto_execute();
+        }
+        else {
+            if (proto_error_count < 0xFF) {
+                proto_error_count++;
+            }
+            proto_status(PROTO_NAK, PROTO_STATUS_CRC);
+        }
+    }
+
+    return 1;
+}
+
+/******************************************************************************
+ * uint8_t proto_errors(reset)
+ *
+ * Read/reset count of frames that could not be received
+ *
+ * Inputs:  reset       Resets count to 0 if nonzero
+ *
+ * Returns: Number of frames received with a bad CRC or length
+ ******************************************************************************/
+
+uint8_t proto_errors(uint8_t reset)
+{
+    uint8_t count;
+
+    count = proto_error_count;
+    if (reset) {
+        proto_error_count = 0;
+    }
+
+    return count;
+}
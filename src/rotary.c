@@ -10,14 +10,30 @@ Revision:   $Id$
 Target CPU: ATmega168 or ATmega328
 
 Content:    Rotary encoder support
+
+            Both encoder channels generate pin change interrupts.  Each
+            change is decoded with a state transition table, indexed by the
+            previous and present channel states, which gives the direction
+            of a valid quarter step and rejects transitions where both
+            channels changed at once (missed edge or contact bounce).
+            Quarter steps are accumulated, and a step is only counted when
+            the encoder arrives at a detent position, so bounce around a
+            detent cancels out.
+
+            Steps may be accelerated: the time between steps, measured in
+            TIMER0 ticks, selects a multiplier from a table so that a fast
+            spin moves a long way.
 ------------------------------------------------------------------------------*/
 
 #include <stdint.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <util/atomic.h>
 
 #include "portdef.h"
+#include "timer.h"
+#include "event.h"
 #include "rotary.h"
 
 //------------------------------------------------------------------------------
@@ -36,16 +52,73 @@ typedef union {
     };
 } rotary_state_t;
 
+// Per-encoder decoder state
+
+typedef struct {
+    uint8_t state;              // Previous channel state, BA
+    int8_t quarter;             // Quarter steps counted since last detent
+    int8_t direction;           // Direction of last step
+    uint8_t interval;           // Time between last two steps, TIMER0 ticks
+    uint16_t last_step;         // Time of last step, TIMER0 ticks
+    uint16_t first_step;        // Time of first step not yet read
+    uint8_t accelerate;         // Non-zero if acceleration is enabled
+    volatile int16_t position;  // Accumulated position
+} encoder_t;
+
+// Channel states (BA) at which the encoder rests in a detent
+
+#define DETENT_00           0x00
+#define DETENT_11           0x03
+
+// Quarter steps between detents
+
+#define QUARTERS_PER_STEP   2
+
+// Slowest step interval tracked for acceleration (TIMER0 ticks)
+
+#define SLOW_INTERVAL       0xFF
+
+//------------------------------------------------------------------------------
+
+// Quadrature state transition table
+// Indexed by (previous BA << 2) | present BA
+// CW sequence is BA = 00, 01, 11, 10
+
+static const int8_t quadrature[16] PROGMEM = {
+//  00  01  10  11      present BA
+     0, +1, -1,  0,     // previous 00
+    -1,  0,  0, +1,     // previous 01
+    +1,  0,  0, -1,     // previous 10
+     0, -1, +1,  0      // previous 11
+};
+
+// Acceleration table
+// A step arriving within <interval> TIMER0 ticks of the previous one
+// (averaged over the last two steps) counts as <multiplier> steps.
+// Entries are in order of increasing interval.
+
+typedef struct {
+    uint8_t interval;
+    uint8_t multiplier;
+} accel_t;
+
+static const accel_t acceleration[] PROGMEM = {
+    { MS_TO_TICKS(25),  8 },    // 40 steps/second or faster
+    { MS_TO_TICKS(50),  4 },    // 20 steps/second
+    { MS_TO_TICKS(100), 2 }     // 10 steps/second
+};
+
+#define ACCEL_ENTRIES       (sizeof(acceleration) / sizeof(accel_t))
+
 //------------------------------------------------------------------------------
 
 // Local (module) variables
 
 static rotary_state_t previous;
 
-static volatile int8_t left_position;
-static volatile uint8_t left_movement;
-static volatile int8_t right_position;
-static volatile uint8_t right_movement;
+static encoder_t encoder[ROTARY_ENCODERS];
+
+static volatile uint8_t rotary_error_count;
 
 /******************************************************************************
  *
@@ -53,17 +126,13 @@ static volatile uint8_t right_movement;
 
 void rotary_init(void)
 {
+    uint8_t index;
+
     // Disable pin interrupts during setup
     // This needs to change if encoder is not wired to Port D
 
     PCICR &= INVBM(PCIE2);
 
-    previous.all = 0;
-    left_position = 0;
-    left_movement = 0;
-    right_position = 0;
-    right_movement = 0;
-
     // Configure pins associated with rotary encoders as inputs
     // Turn OFF pull-ups for these pins
 
@@ -77,12 +146,46 @@ void rotary_init(void)
     BCLR(RIGHT_A);
     BCLR(RIGHT_B);
 
-    // Enable pin change interrupts for encoder 'B' inputs
+    // Start decoding from the present encoder positions
+
+    previous.all = 0;
+    if (PINREAD(LEFT_A)) {
+        previous.left_a = 1;
+    }
+    if (PINREAD(LEFT_B)) {
+        previous.left_b = 1;
+    }
+    if (PINREAD(RIGHT_A)) {
+        previous.right_a = 1;
+    }
+    if (PINREAD(RIGHT_B)) {
+        previous.right_b = 1;
+    }
+
+    for (index = 0; index < ROTARY_ENCODERS; index++) {
+        encoder[index].quarter = 0;
+        encoder[index].direction = 0;
+        encoder[index].interval = SLOW_INTERVAL;
+        encoder[index].position = 0;
+    }
+    encoder[ROTARY_LEFT].state = previous.all & 0x03;
+    encoder[ROTARY_RIGHT].state = (previous.all >> 2) & 0x03;
+
+    // The left encoder selects between a few items, the right one
+    // adjusts values
+
+    encoder[ROTARY_LEFT].accelerate = 0;
+    encoder[ROTARY_RIGHT].accelerate = 1;
+
+    rotary_error_count = 0;
+
+    // Enable pin change interrupts for both encoder inputs
     // Note: PCMSK2 is associated with Port D pins.  IF the encoder inputs are
     //       moved to a different port, the assignment below must be done
     //       to the appropriate PCMSKx register.
 
-    PCMSK2 |= BM(LEFT_B_PIN) | BM(RIGHT_B_PIN);
+    PCMSK2 |= BM(LEFT_A_PIN) | BM(LEFT_B_PIN) |
+              BM(RIGHT_A_PIN) | BM(RIGHT_B_PIN);
 
     // Enable pin interrupts on port D
     // Note: This needs to be change if rotary encoder inputs are moved
@@ -91,6 +194,24 @@ void rotary_init(void)
     PCICR |= BM(PCIE2);
 }
 
+/******************************************************************************
+ * rotary_acceleration(index, enable)
+ *
+ * Enable or disable acceleration of an encoder
+ *
+ * Inputs:  index       Encoder, ROTARY_LEFT or ROTARY_RIGHT
+ *          enable      Non-zero to enable acceleration
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Acceleration is enabled for the right encoder by rotary_init().
+ ******************************************************************************/
+
+void rotary_acceleration(uint8_t index, uint8_t enable)
+{
+    encoder[index].accelerate = enable;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -101,26 +222,112 @@ uint8_t rotary_status(void)
 }
 
 /******************************************************************************
+ * uint8_t rotary_errors(reset)
+ *
+ * Read/reset count of invalid encoder transitions
  *
+ * Inputs:  reset       Non-zero to reset the count
+ *
+ * Returns: Number of transitions rejected (both channels changed at once)
  ******************************************************************************/
 
-int8_t left_rotary_relative(void)
+uint8_t rotary_errors(uint8_t reset)
+{
+    uint8_t count;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        count = rotary_error_count;
+        if (reset) {
+            rotary_error_count = 0;
+        }
+    }
+
+    return count;
+}
+
+/******************************************************************************
+ * uint16_t rotary_timestamp(index)
+ *
+ * Read the time of the first encoder step not yet read
+ *
+ * Inputs:  index       Encoder, ROTARY_LEFT or ROTARY_RIGHT
+ *
+ * Returns: TIMER0 tick count (low 16 bits) of the first step accumulated
+ *          since the last left/right_rotary_relative() call
+ ******************************************************************************/
+
+uint16_t rotary_timestamp(uint8_t index)
+{
+    uint16_t time;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        time = encoder[index].first_step;
+    }
+
+    return time;
+}
+
+/******************************************************************************
+ * int8_t rotary_relative(index)
+ *
+ * Read and clear the movement of an encoder
+ *
+ * Inputs:  index       Encoder, ROTARY_LEFT or ROTARY_RIGHT
+ *
+ * Returns: Steps moved since last call (positive = CW)
+ *
+ * Notes:   Movement beyond the range of the return value is left in the
+ *          accumulator, and the event manager is signalled to read it.
+ ******************************************************************************/
+
+static int8_t rotary_relative(uint8_t index)
 {
-    int8_t ret;
+    encoder_t *e = &encoder[index];
+    int16_t position;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        position = e->position;
+        if (position > 127) {
+            position = 127;
+        }
+        else if (position < -127) {
+            position = -127;
+        }
+        e->position -= position;
+        if (e->position) {
+            event_signal(EVENT_WAKE_ROTARY);
+        }
+    }
+
+    return position;
+}
 
-    ret = left_position;
-    left_position = 0;
+/******************************************************************************
+ *
+ ******************************************************************************/
 
-    return ret;
+int8_t left_rotary_relative(void)
+{
+    return rotary_relative(ROTARY_LEFT);
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
 
-int8_t left_rotary_absolute(void)
+int16_t left_rotary_absolute(void)
 {
-    return left_position;
+    int16_t position;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        position = encoder[ROTARY_LEFT].position;
+    }
+
+    return position;
 }
 
 /******************************************************************************
@@ -129,21 +336,121 @@ int8_t left_rotary_absolute(void)
 
 int8_t right_rotary_relative(void)
 {
-    uint8_t ret;
+    return rotary_relative(ROTARY_RIGHT);
+}
 
-    ret = right_position;
-    right_position = 0;
+/******************************************************************************
+ *
+ ******************************************************************************/
 
-    return ret;
+int16_t right_rotary_absolute(void)
+{
+    int16_t position;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        position = encoder[ROTARY_RIGHT].position;
+    }
+
+    return position;
 }
 
 /******************************************************************************
+ * uint8_t rotary_decode(*e, present)
+ *
+ * Decode a change of encoder channel state
  *
+ * Inputs:  *e          Encoder
+ *          present     Present channel state, BA
+ *
+ * Returns: Non-zero if the encoder moved by one or more steps
+ *
+ * Notes:   Called from the pin change ISR.
  ******************************************************************************/
 
-int8_t right_rotary_absolute(void)
+static uint8_t rotary_decode(encoder_t *e, uint8_t present)
 {
-    return right_position;
+    int8_t direction;
+    uint16_t now;
+    uint16_t elapsed;
+    uint8_t interval;
+    uint8_t multiplier;
+    uint8_t index;
+
+    if (present == e->state) {
+        return 0;                   // Other encoder moved
+    }
+
+    direction = pgm_read_byte(&quadrature[(e->state << 2) | present]);
+    e->state = present;
+
+    if (!direction) {
+        if (rotary_error_count < 0xFF) {
+            rotary_error_count++;
+        }
+        return 0;
+    }
+
+    e->quarter += direction;
+    if ((present != DETENT_00) && (present != DETENT_11)) {
+        return 0;
+    }
+
+    // Arrived at a detent, count a step if it has moved far enough
+
+    direction = 0;
+    if (e->quarter >= QUARTERS_PER_STEP) {
+        direction = 1;
+    }
+    else if (e->quarter <= -QUARTERS_PER_STEP) {
+        direction = -1;
+    }
+    e->quarter = 0;
+
+    if (!direction) {
+        return 0;
+    }
+
+    // Measure step rate; a change of direction starts again from slow
+
+    now = timer_ticks();
+    elapsed = now - e->last_step;
+    e->last_step = now;
+
+    if ((direction != e->direction) || (elapsed > SLOW_INTERVAL)) {
+        elapsed = SLOW_INTERVAL;
+    }
+    e->direction = direction;
+
+    interval = (e->interval + elapsed + 1) >> 1;
+    e->interval = elapsed;
+
+    multiplier = 1;
+    if (e->accelerate) {
+        for (index = 0; index < ACCEL_ENTRIES; index++) {
+            if (interval <= pgm_read_byte(&acceleration[index].interval)) {
+                multiplier = pgm_read_byte(&acceleration[index].multiplier);
+                break;
+            }
+        }
+    }
+
+    if (!e->position) {
+        e->first_step = now;
+    }
+
+    if (direction > 0) {
+        if (e->position <= INT16_MAX - multiplier) {
+            e->position += multiplier;
+        }
+    }
+    else {
+        if (e->position >= INT16_MIN + multiplier) {
+            e->position -= multiplier;
+        }
+    }
+
+    return 1;
 }
 
 /******************************************************************************
@@ -155,6 +462,7 @@ int8_t right_rotary_absolute(void)
 ISR(PCINT2_vect, ISR_BLOCK)
 {
     register rotary_state_t present;
+    uint8_t moved;
 
     // Read present rotary encoder state
     // Note: if (PINREAD(x)) y = 1; is the most efficient way to do this, it
@@ -175,56 +483,16 @@ ISR(PCINT2_vect, ISR_BLOCK)
         present.right_b = 1;
     }
 
-    // Check for left encoder movement
-    // LEFT_B toggles state every time encoder is moved
-    //
-    // Note: Must check if LEFT_B has changed state since last entry because
-    // both left and right encoder movement will trigger the same interrupt.
+    // Both encoders share this interrupt; each decoder ignores an
+    // unchanged state
 
-    if (present.left_b != previous.left_b) {
-        left_movement++;
-        if (present.left_b) {
-            if (present.left_a) {
-                left_position++;    // CW rotation, BA = 11
-            }
-            else {
-                left_position--;    // CCW rotation, BA = 10
-            }
-        }
-        else {
-            if (present.left_a) {
-                left_position--;    // CCW rotation, BA = 01
-            }
-            else {
-                left_position++;    // CW rotation, BA = 00
-            }
-        }
-    }
+    moved = rotary_decode(&encoder[ROTARY_LEFT], present.all & 0x03);
+    moved |= rotary_decode(&encoder[ROTARY_RIGHT], (present.all >> 2) & 0x03);
 
-    // Check for right encoder movement
-    // RIGHT_B changes state every time encoder is moved
-    //
-    // Note: Must check if RIGHT_B has changed state since last entry because
-    // both left and right encoder movement will trigger the same interrupt.
+    // Let the event manager know an encoder has moved
 
-    if (present.right_b != previous.right_b) {
-        right_movement++;
-        if (present.right_b) {
-            if (present.right_a) {
-                right_position++;   // CW rotation, BA = 11
-            }
-            else {
-                right_position--;   // CCW rotation, BA = 10
-            }
-        }
-        else {
-            if (present.right_a) {
-                right_position--;   // CW rotation, BA = 01
-            }
-            else {
-                right_position++;   // CCW rotation, BA = 00
-            }
-        }
+    if (moved) {
+        event_signal(EVENT_WAKE_ROTARY);
     }
 
     previous = present;
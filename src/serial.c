@@ -13,36 +13,60 @@ Content:    Serial I/O library, polled or interrupt driven
 ------------------------------------------------------------------------------*/
 
 #include <stdint.h>
+#include <string.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
 #include <avr/interrupt.h>
 #include <util/atomic.h>
 
 #include "portdef.h"
+#include "event.h"
 #include "serial.h"
 
 // Constants and defines
 
-#ifndef RX_BUFSIZE
-#define RX_BUFSIZE          16          // Receive buffer size
+// Buffer indexes run freely and wrap at the serial_t range; the buffer
+// position is found by masking.  The number of bytes queued is always
+// (head - tail), so no separate empty/full state is needed, and each index
+// is only ever written by one side (ISR or caller).
+
+#if (RX_BUFSIZE & (RX_BUFSIZE - 1)) || (TX_BUFSIZE & (TX_BUFSIZE - 1))
+  #error RX_BUFSIZE and TX_BUFSIZE must be powers of 2
 #endif
-#ifndef TX_BUFSIZE
-#define TX_BUFSIZE          16          // Transmit buffer size
+#if !defined(SERIAL_LARGE_BUFFERS) && ((RX_BUFSIZE > 128) || (TX_BUFSIZE > 128))
+  #error Buffers larger than 128 bytes require SERIAL_LARGE_BUFFERS
 #endif
 
+#define RX_MASK             (RX_BUFSIZE - 1)
+#define TX_MASK             (TX_BUFSIZE - 1)
+
+// 16-bit indexes cannot be read or written in one instruction, so access
+// to them must be protected from interrupts
+
+#ifdef SERIAL_LARGE_BUFFERS
+#define INDEX_BLOCK         ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#else
+#define INDEX_BLOCK
+#endif
+
+// Compiler memory barrier
+// Ensures buffer contents are written before the index that publishes them
+
+#define barrier()           __asm__ __volatile__ ("" ::: "memory")
+
 // Variable declarations
 
-static volatile uint8_t  rx_buffer[RX_BUFSIZE];  // Receive buffer
-static volatile uint8_t  tx_buffer[TX_BUFSIZE];  // Transmit buffer
-static volatile serial_t rx_head;       // Receive buffer head index
+static uint8_t           rx_buffer[RX_BUFSIZE];  // Receive buffer
+static uint8_t           tx_buffer[TX_BUFSIZE];  // Transmit buffer
+static volatile serial_t rx_head;       // Receive buffer head index (ISR)
 static volatile serial_t rx_tail;       // Receive buffer tail index
 /*static*/ volatile serial_t tx_head;              // Transmit buffer head index
-/*static*/ volatile serial_t tx_tail;              // Transmit buffer tail index
+/*static*/ volatile serial_t tx_tail;              // Transmit buffer tail index (ISR)
 
 /*static*/ volatile uint8_t rx_ctrl;        // Receiver status/control:
 // 7  6  5  4  3  2  1  0
-// |  |  |  |  |  |  |  |______________ Receive buffer empty
-// |  |  |  |  |  |  |_________________ Receive buffer full
+// |  |  |  |  |  |  |  |______________ Unused/reserved
+// |  |  |  |  |  |  |_________________ Receive stalled (buffer full, RXCIE off)
 // |  |  |  |  |  |____________________ Unused/reserved
 // |  |  |  |  |_______________________ Unused/reserved
 // |  |  |  |__________________________ Use polling mode for receive/input
@@ -50,13 +74,12 @@ static volatile serial_t rx_tail;       // Receive buffer tail index
 // |  |________________________________ Unused/reserved
 // |___________________________________ Unused/reserved
 
-#define rx_empty()          (rx_ctrl & BM(0))
-#define set_rx_empty()      rx_ctrl |= BM(0)
-#define clear_rx_empty()    rx_ctrl &= INVBM(0)
+#define rx_empty()          (rx_count() == 0)
+#define rx_full()           (rx_count() == RX_BUFSIZE)
 
-#define rx_full()           (rx_ctrl & BM(1))
-#define set_rx_full()       rx_ctrl |= BM(1)
-#define clear_rx_full()     rx_ctrl &= INVBM(1)
+#define rx_stalled()        (rx_ctrl & BM(1))
+#define set_rx_stalled()    rx_ctrl |= BM(1)
+#define clear_rx_stalled()  rx_ctrl &= INVBM(1)
 
 #define rx_poll()           (rx_ctrl & BM(4))
 #define set_rx_poll()       rx_ctrl |= BM(4)
@@ -68,8 +91,8 @@ static volatile serial_t rx_tail;       // Receive buffer tail index
 
 /*static*/ volatile uint8_t tx_ctrl;               // Transmitter control/status bits:
 // 7  6  5  4  3  2  1  0
-// |  |  |  |  |  |  |  |______________ Transmit buffer empty
-// |  |  |  |  |  |  |_________________ Transmit buffer full
+// |  |  |  |  |  |  |  |______________ Transmitter idle (UDRIE off)
+// |  |  |  |  |  |  |_________________ Unused/reserved
 // |  |  |  |  |  |____________________ Unused/reserved
 // |  |  |  |  |_______________________ Unused/reserved
 // |  |  |  |__________________________ Use polling mode for transmit/output
@@ -77,13 +100,12 @@ static volatile serial_t rx_tail;       // Receive buffer tail index
 // |  |________________________________ serial_putc() sends CR/LF when LF passed
 // |___________________________________ Unused/reserved
 
-#define tx_empty()          (tx_ctrl & BM(0))
-#define set_tx_empty()      tx_ctrl |= BM(0)
-#define clear_tx_empty()    tx_ctrl &= INVBM(0)
+#define tx_empty()          (tx_count() == 0)
+#define tx_full()           (tx_count() == TX_BUFSIZE)
 
-#define tx_full()           (tx_ctrl & BM(1))
-#define set_tx_full()       tx_ctrl |= BM(1)
-#define clear_tx_full()     tx_ctrl &= INVBM(1)
+#define tx_idle()           (tx_ctrl & BM(0))
+#define set_tx_idle()       tx_ctrl |= BM(0)
+#define clear_tx_idle()     tx_ctrl &= INVBM(0)
 
 #define tx_poll()           (tx_ctrl & BM(4))
 #define set_tx_poll()       tx_ctrl |= BM(4)
@@ -97,6 +119,18 @@ static volatile serial_t rx_tail;       // Receive buffer tail index
 #define set_auto_newline()   tx_ctrl |= BM(6)
 #define clear_auto_newline() tx_ctrl &= INVBM(6)
 
+// Software (XON/XOFF) flow control
+
+#define XON                 0x11
+#define XOFF                0x13
+
+#define FLOW_OFF            0           // Flow control disabled
+#define FLOW_ON             1           // Enabled, remote transmitter running
+#define FLOW_PAUSED         2           // Enabled, XOFF sent to pause remote
+
+static volatile uint8_t flow_state;     // Flow control state (FLOW_xxx)
+static volatile uint8_t flow_char;      // XON/XOFF to send next, 0 if none
+
 // stdio-compatible file handle for serial I/O
 
 #ifdef SERIAL_INCLUDE_STDIO
@@ -127,6 +161,108 @@ static inline void tx_int_on(void)
     UCSR0B |= BM(UDRIE0);
 }
 
+/*******************************************************************************
+Buffer fill levels
+*******************************************************************************/
+
+static inline serial_t rx_count(void)
+{
+    serial_t count;
+
+    INDEX_BLOCK
+    {
+        count = rx_head - rx_tail;
+    }
+
+    return count;
+}
+
+static inline serial_t tx_count(void)
+{
+    serial_t count;
+
+    INDEX_BLOCK
+    {
+        count = tx_head - tx_tail;
+    }
+
+    return count;
+}
+
+/*******************************************************************************
+Restart interrupt-driven transfers
+
+The receive and transmit ISRs turn their own interrupt off, and mark the
+receiver stalled or the transmitter idle, when there is no room for more
+data or no data left to send.  The ISRs make that decision with interrupts
+disabled, so these functions cannot miss a stall or double-start an ISR.
+*******************************************************************************/
+
+static void rx_restart(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (rx_stalled()) {
+            clear_rx_stalled();
+            rx_int_on();
+        }
+    }
+}
+
+static void tx_restart(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (tx_idle()) {
+            clear_tx_idle();
+            tx_int_on();
+        }
+    }
+}
+
+/*******************************************************************************
+Send flow control character
+
+The character is sent ahead of any data in the transmit buffer.  In polled
+transmit mode it is only sent if the transmit data register is empty.
+*******************************************************************************/
+
+static void send_flow(uint8_t ch)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (tx_poll()) {
+            if (UCSR0A & BM(UDRE0))
+                UDR0 = ch;
+        }
+        else {
+            flow_char = ch;
+            tx_restart();
+        }
+    }
+}
+
+/*******************************************************************************
+Receive data consumed
+
+Called after data has been removed from the receive buffer.  Restarts
+reception if it was stalled, and resumes the remote transmitter once the
+buffer has drained.
+*******************************************************************************/
+
+static void rx_consumed(void)
+{
+    rx_restart();
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if ((flow_state == FLOW_PAUSED) && (rx_count() <= RX_XON_LEVEL)) {
+            flow_state = FLOW_ON;
+            send_flow(XON);
+        }
+    }
+}
+
 /*******************************************************************************
 void serial_in_blocking(mode)
 
@@ -173,6 +309,37 @@ void serial_out_blocking(uint8_t mode)
     }
 }
 
+/*******************************************************************************
+void serial_flow_control(mode)
+
+Usage:  Control software (XON/XOFF) flow control for serial input
+
+Inputs: mode        If nonzero, XOFF is sent when the receive buffer fills to
+                    RX_XOFF_LEVEL bytes, and XON once serial_in() has drained
+                    it to RX_XON_LEVEL bytes.
+
+Return: (none)
+
+Notes:  Requires interrupt-driven reception.  Disabling flow control while
+        the remote transmitter is paused sends XON.
+*******************************************************************************/
+
+void serial_flow_control(uint8_t mode)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (mode) {
+            if (flow_state == FLOW_OFF)
+                flow_state = FLOW_ON;
+        }
+        else {
+            if (flow_state == FLOW_PAUSED)
+                send_flow(XON);
+            flow_state = FLOW_OFF;
+        }
+    }
+}
+
 /*******************************************************************************
 uint8_t serial_in_empty(void)
 
@@ -233,35 +400,10 @@ Return: (return)    Number of bytes in the serial input queue.
 
 serial_t serial_in_used(void)
 {
-    serial_t used;
-
     if (rx_poll())
         return 0;
 
-    // Disable receive interrupt during buffer index evaluation
-
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-    {
-        rx_int_off();
-    }
-
-    // Calculate used space in receive buffer
-
-    if (rx_full())
-        used = RX_BUFSIZE;
-    else if (rx_head >= rx_tail)
-        used = rx_head - rx_tail;
-    else
-        used = RX_BUFSIZE - rx_tail + rx_head;
-
-    // Enable transmit interrupt & exit
-
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-    {
-        rx_int_on();
-    }
-
-    return used;
+    return rx_count();
 }
 
 /*******************************************************************************
@@ -276,37 +418,12 @@ Return: (return)    Number of unused bytes in the serial input queue.
                     is active.
 *******************************************************************************/
 
-uint8_t serial_in_free(void)
+serial_t serial_in_free(void)
 {
-    serial_t free;
-
     if (rx_poll())
         return 0;
 
-    // Disable receive interrupt during buffer index evaluation
-
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-    {
-        rx_int_off();
-    }
-
-    // Calculate free space in receive buffer
-
-    if (rx_empty())
-        free = RX_BUFSIZE;
-    else if (rx_head >= rx_tail)
-        free = RX_BUFSIZE - rx_head + rx_tail;
-    else
-        free = rx_tail - rx_head;
-
-    // Enable transmit interrupt & exit
-
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-    {
-        rx_int_on();
-    }
-
-    return free;
+    return RX_BUFSIZE - rx_count();
 }
 
 /*******************************************************************************
@@ -397,37 +514,10 @@ Return: (return)    Number of bytes in the serial output queue.
 
 serial_t serial_out_used(void)
 {
-    serial_t used;
-
     if (tx_poll())
         return 0;
 
-    // Disable transmit interrupt during buffer index evaluation
-
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-    {
-        tx_int_off();
-    }
-
-    // Calculate used space in transmit buffer
-
-    if (tx_full())
-        used = TX_BUFSIZE;
-    else if (tx_head >= tx_tail)
-        used = tx_head - tx_tail;
-    else
-        used = TX_BUFSIZE - tx_tail + tx_head;
-
-    // Enable transmit interrupt & exit
-
-    if (! tx_empty()) {
-        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-        {
-            tx_int_on();
-        }
-    }
-
-    return used;
+    return tx_count();
 }
 
 /*******************************************************************************
@@ -444,37 +534,120 @@ Return: (return)    Number of unused bytes in the serial output queue.
 
 serial_t serial_out_free(void)
 {
-    serial_t free;
-
     if (tx_poll())
         return 0;
 
-    // Disable transmit interrupt during buffer index evaluation
+    return TX_BUFSIZE - tx_count();
+}
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+/*******************************************************************************
+serial_t serial_in_span(**data)
+
+Usage:  Get direct access to data in the serial input buffer
+
+Inputs: **data      Set to point to the oldest data in the receive buffer
+
+Return: (return)    Number of bytes that may be read, in sequence, starting at
+                    <*data>.  This may be less than serial_in_used() when the
+                    data wraps around the end of the buffer.  Returns 0 in
+                    polled mode.
+
+Notes:  Call serial_in_consume() to remove the bytes from the buffer once
+        they have been used.
+*******************************************************************************/
+
+serial_t serial_in_span(const uint8_t **data)
+{
+    serial_t count;
+    serial_t tail;
+
+    if (rx_poll())
+        return 0;
+
+    count = rx_count();
+    tail = rx_tail & RX_MASK;
+    if (count > RX_BUFSIZE - tail)
+        count = RX_BUFSIZE - tail;
+
+    *data = &rx_buffer[tail];
+
+    return count;
+}
+
+/*******************************************************************************
+void serial_in_consume(count)
+
+Usage:  Remove data read through serial_in_span() from the input buffer
+
+Inputs: count       Number of bytes to remove, not more than the count
+                    returned by serial_in_span()
+
+Return: (none)
+*******************************************************************************/
+
+void serial_in_consume(serial_t count)
+{
+    barrier();
+    INDEX_BLOCK
     {
-        tx_int_off();
+        rx_tail += count;
     }
+    rx_consumed();
+}
 
-    // Calculate free space in transmit buffer
+/*******************************************************************************
+serial_t serial_out_span(**data)
 
-    if (tx_empty())
-        free = TX_BUFSIZE;
-    else if (tx_head >= tx_tail)
-        free = TX_BUFSIZE - tx_head + tx_tail;
-    else
-        free = tx_tail - tx_head;
+Usage:  Get direct access to free space in the serial output buffer
 
-    // Enable transmit interrupt & exit
+Inputs: **data      Set to point to the first free byte in the transmit buffer
 
-    if (! tx_empty()) {
-        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-        {
-            tx_int_on();
-        }
-    }
+Return: (return)    Number of bytes that may be written, in sequence, starting
+                    at <*data>.  This may be less than serial_out_free() when
+                    the free space wraps around the end of the buffer.
+                    Returns 0 in polled mode.
 
-    return free;
+Notes:  Call serial_out_commit() to queue the bytes for transmission once
+        they have been written.
+*******************************************************************************/
+
+serial_t serial_out_span(uint8_t **data)
+{
+    serial_t count;
+    serial_t head;
+
+    if (tx_poll())
+        return 0;
+
+    count = TX_BUFSIZE - tx_count();
+    head = tx_head & TX_MASK;
+    if (count > TX_BUFSIZE - head)
+        count = TX_BUFSIZE - head;
+
+    *data = &tx_buffer[head];
+
+    return count;
+}
+
+/*******************************************************************************
+void serial_out_commit(count)
+
+Usage:  Queue data written through serial_out_span() for transmission
+
+Inputs: count       Number of bytes written, not more than the count returned
+                    by serial_out_span()
+
+Return: (none)
+*******************************************************************************/
+
+void serial_out_commit(serial_t count)
+{
+    barrier();
+    INDEX_BLOCK
+    {
+        tx_head += count;
+    }
+    tx_restart();
 }
 
 /*******************************************************************************
@@ -522,8 +695,10 @@ uint16_t serial_init(uint16_t baud, uint8_t mode)
     tx_tail = 0;
     tx_ctrl = 0;
 
-    set_rx_empty();
-    set_tx_empty();
+    flow_state = FLOW_OFF;
+    flow_char = 0;
+
+    set_tx_idle();
     set_tx_block();
 
     // Set baud rate divisor
@@ -614,35 +789,17 @@ int16_t serial_in(void)
             return -1;
     }
 
-    // Disable receive interrupt during buffer/status update
-
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-    {
-        rx_int_off();
-    }
-
     // Get data from receive buffer
 
-    data = rx_buffer[rx_tail++];
-
-    // Check for tail index wraparound
-
-    if (rx_tail >= RX_BUFSIZE)
-        rx_tail = 0;
-
-    // Set receive buffer empty flag if buffer empty
-
-    clear_rx_full();
-    if (rx_head == rx_tail)
-        set_rx_empty();
-    
-    // Enable receive interrupt & exit
-
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    data = rx_buffer[rx_tail & RX_MASK];
+    barrier();
+    INDEX_BLOCK
     {
-        rx_int_on();
+        rx_tail++;
     }
 
+    rx_consumed();
+
     return data;
 }
 
@@ -693,34 +850,152 @@ void serial_out(uint8_t data)
             return;
     }
 
-    // Disable transmit interrupt during buffer/status update
+    // Put data in transmit buffer
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    tx_buffer[tx_head & TX_MASK] = data;
+    barrier();
+    INDEX_BLOCK
     {
-        tx_int_off();
+        tx_head++;
     }
 
-    // Put data in transmit buffer
-    
-    tx_buffer[tx_head++] = data;
+    tx_restart();
+}
 
-    // Check for head index wraparound
+/*******************************************************************************
+uint16_t serial_write(*data, length)
 
-    if (tx_head >= TX_BUFSIZE)
-        tx_head = 0;
+Usage:  Write a block of data to the serial output buffer
 
-    // Set transmit buffer full flag if buffer full
+Inputs: *data       Data to send
+        length      Number of bytes to send
 
-    clear_tx_empty();
-    if (tx_head == tx_tail)
-        set_tx_full();
+Return: (return)    Number of bytes queued or sent.  Less than <length> if
+                    output blocking is disabled and the buffer filled.
 
-    // Enable transmit interrupt & exit
+Notes:  In interrupt-driven mode, data is copied into the transmit buffer in
+        contiguous runs rather than one byte at a time.
+*******************************************************************************/
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-    {
-        tx_int_on();
+uint16_t serial_write(const void *data, uint16_t length)
+{
+    const uint8_t *src = data;
+    uint16_t done = 0;
+    uint8_t *dst;
+    serial_t count;
+
+    if (tx_poll()) {
+        while (done < length)
+            serial_out(src[done++]);
+        return done;
+    }
+
+    while (done < length) {
+        count = serial_out_span(&dst);
+        if (! count) {
+            if (! tx_block())
+                break;
+            continue;
+        }
+        if (count > length - done)
+            count = length - done;
+        memcpy(dst, &src[done], count);
+        serial_out_commit(count);
+        done += count;
+    }
+
+    return done;
+}
+
+/*******************************************************************************
+uint16_t serial_write_P(*data, length)
+
+Usage:  Write a block of data in program space (FLASH) to the serial output
+        buffer
+
+Inputs: *data       Data in program space to send
+        length      Number of bytes to send
+
+Return: (return)    Number of bytes queued or sent.  Less than <length> if
+                    output blocking is disabled and the buffer filled.
+*******************************************************************************/
+
+uint16_t serial_write_P(const void *data, uint16_t length)
+{
+    const uint8_t *src = data;
+    uint16_t done = 0;
+    uint8_t *dst;
+    serial_t count;
+
+    if (tx_poll()) {
+        while (done < length)
+            serial_out(pgm_read_byte(&src[done++]));
+        return done;
+    }
+
+    while (done < length) {
+        count = serial_out_span(&dst);
+        if (! count) {
+            if (! tx_block())
+                break;
+            continue;
+        }
+        if (count > length - done)
+            count = length - done;
+        memcpy_P(dst, &src[done], count);
+        serial_out_commit(count);
+        done += count;
+    }
+
+    return done;
+}
+
+/*******************************************************************************
+uint16_t serial_read(*data, length)
+
+Usage:  Read a block of data from the serial input buffer
+
+Inputs: *data       Location to store data received
+        length      Maximum number of bytes to read
+
+Return: (return)    Number of bytes read.  If input blocking is enabled, does
+                    not return until <length> bytes have been read; otherwise
+                    returns whatever data is available (possibly none).
+*******************************************************************************/
+
+uint16_t serial_read(void *data, uint16_t length)
+{
+    uint8_t *dst = data;
+    uint16_t done = 0;
+    const uint8_t *src;
+    serial_t count;
+    int16_t ch;
+
+    if (rx_poll()) {
+        while (done < length) {
+            ch = serial_in();
+            if (ch < 0)
+                break;
+            dst[done++] = ch;
+        }
+        return done;
+    }
+
+    while (done < length) {
+        count = serial_in_span(&src);
+        if (! count) {
+            if (! rx_block())
+                break;
+            continue;
+        }
+        if (count > length - done)
+            count = length - done;
+        memcpy(&dst[done], src, count);
+        serial_in_consume(count);
+        done += count;
     }
+
+    return done;
 }
 
 #ifdef SERIAL_INCLUDE_STDIO
@@ -909,13 +1184,7 @@ Return: (none)
 
 void serial_puts(const char *s)
 {
-    char ch;
-
-    do {
-        ch = *s++;
-        if (! ch) break;
-        serial_out(ch);
-    } while (1);
+    serial_write(s, strlen(s));
 }
 
 /*******************************************************************************
@@ -930,13 +1199,7 @@ Return: (none)
 
 void serial_puts_P(const char *s)
 {
-    char ch;
-
-    do {
-        ch = pgm_read_byte(s++);
-        if (! ch) break;
-        serial_out(ch);
-    } while (1);
+    serial_write_P(s, strlen_P(s));
 }
 
 /*******************************************************************************
@@ -969,24 +1232,33 @@ ISR(USART_RXC_vect, ISR_BLOCK)
 
         // Place received data in buffer
 
-        rx_buffer[rx_head++] = data;
+        rx_buffer[rx_head & RX_MASK] = data;
+        barrier();
+        INDEX_BLOCK
+        {
+            rx_head++;
+        }
 
-        // Check for head index wraparound
+        // Pause remote transmitter if the buffer is filling up
 
-        if (rx_head >= RX_BUFSIZE)
-            rx_head = 0;
+        if ((flow_state == FLOW_ON) && (rx_count() >= RX_XOFF_LEVEL)) {
+            flow_state = FLOW_PAUSED;
+            send_flow(XOFF);
+        }
 
-        // Set receive buffer full flag if buffer full
-        // Do not enable receive interrupt if buffer is full
+        // Wake up any idle loop waiting for serial input
 
-        clear_rx_empty();
-        if (rx_head == rx_tail)
-            set_rx_full();
-        else {
-            cli();
-            rx_int_on();
-        }
+        event_signal(EVENT_WAKE_SERIAL);
     }
+
+    // Stall reception if the buffer is full, leaving further data in the
+    // USART until serial_in() makes room.  rx_restart() resumes reception.
+
+    cli();
+    if (rx_full())
+        set_rx_stalled();
+    else
+        rx_int_on();
 }
     
 /*******************************************************************************
@@ -1009,28 +1281,28 @@ ISR(USART_UDRE_vect, ISR_BLOCK)
     tx_int_off();
     sei();
 
-    // Do not transmit new data if buffer is empty
-
-    if (! tx_empty()) {
+    // Flow control character takes priority over buffered data
 
-        // Transmit next byte in buffer
+    if (flow_char) {
+        UDR0 = flow_char;
+        flow_char = 0;
+    }
 
-        UDR0 = tx_buffer[tx_tail++];
-        
-        // Check for tail index wraparound
+    // Transmit next byte in buffer
 
-        if (tx_tail >= TX_BUFSIZE)
-            tx_tail = 0;
+    else if (! tx_empty()) {
+        UDR0 = tx_buffer[tx_tail & TX_MASK];
+        INDEX_BLOCK
+        {
+            tx_tail++;
+        }
+    }
 
-        // Set transmit buffer empty flag if buffer empty
-        // Do not re-enable transmit interrupt if the buffer is empty
+    // Go idle if nothing is left to send.  tx_restart() resumes transmission.
 
-        clear_tx_full();
-        if (tx_head == tx_tail)
-            set_tx_empty();
-        else {
-            cli();
-            tx_int_on();
-        }
-    }            
+    cli();
+    if (tx_empty() && ! flow_char)
+        set_tx_idle();
+    else
+        tx_int_on();
 }
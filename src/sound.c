@@ -0,0 +1,429 @@
+/*------------------------------------------------------------------------------
+Name:       sound.c
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: ATmega168/328
+
+Content:    Wavetable (DDS) sound generator
+
+            TIMER1 runs in fast PWM mode, driving the beeper from OC1A.  On
+            each PWM cycle the overflow interrupt advances a phase
+            accumulator for each sounding voice, looks up the waveform in a
+            wavetable, scales it by the voice's envelope and the volume
+            setting, and sets the duty cycle for the next cycle to the sum.
+------------------------------------------------------------------------------*/
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "portdef.h"
+#include "sound.h"
+
+// PWM duty cycle corresponding to a zero sample (silence)
+
+#define SOUND_PWM_MID       ((SOUND_PWM_TOP + 1) / 2)
+
+// Envelope states
+
+#define ENV_OFF             0
+#define ENV_ATTACK          1
+#define ENV_DECAY           2
+#define ENV_SUSTAIN         3
+#define ENV_RELEASE         4
+
+// Type definitions
+
+typedef struct {        // Voice data
+    uint16_t phase;     //   Phase accumulator, upper 8 bits index wavetable
+    uint16_t increment; //   Phase increment per sample (sets frequency)
+    uint8_t level;      //   Output level, envelope scaled by volume
+    uint8_t envelope;   //   Envelope level
+    uint8_t state;      //   Envelope state (ENV_xxx)
+} voice_t;
+
+// Module (private) variables
+
+static voice_t          voice[SOUND_VOICES];
+static uint8_t          sound_scale;
+static uint8_t          sound_muted;
+
+//-----------------------------------------------------------------------------
+
+// Note table
+
+// Each entry is the phase accumulator increment which produces the note's
+// frequency at SOUND_SAMPLE_RATE:
+//
+//   increment = frequency * 65536 / SOUND_SAMPLE_RATE
+//
+// Note frequencies are calculated by applying the formula:
+//   Note[n] = Note[0] * (2^(1/12))^n
+//   Note[0] = Low C (C0) = 16.35 Hz
+//
+// Frequency resolution is SOUND_SAMPLE_RATE / 65536, about 0.5 Hz, so the
+// lowest octaves are somewhat out of tune.  Notes in octave 9 above
+// SOUND_SAMPLE_RATE / 2 alias to lower frequencies.
+
+#define NOTE_INC(freq)      ((uint16_t) ((freq) * 65536.0 / SOUND_SAMPLE_RATE + 0.5))
+
+static const uint16_t note_increment[SOUND_NOTES] PROGMEM =
+{
+    NOTE_INC(16.35), NOTE_INC(17.32), NOTE_INC(18.35), NOTE_INC(19.44), NOTE_INC(20.60), NOTE_INC(21.82),
+    NOTE_INC(23.12), NOTE_INC(24.50), NOTE_INC(25.95), NOTE_INC(27.50), NOTE_INC(29.13), NOTE_INC(30.86),   // Octave 0
+    NOTE_INC(32.70), NOTE_INC(34.65), NOTE_INC(36.71), NOTE_INC(38.89), NOTE_INC(41.20), NOTE_INC(43.65),
+    NOTE_INC(46.25), NOTE_INC(49.00), NOTE_INC(51.91), NOTE_INC(55.00), NOTE_INC(58.27), NOTE_INC(61.73),   // Octave 1
+    NOTE_INC(65.41), NOTE_INC(69.30), NOTE_INC(73.42), NOTE_INC(77.78), NOTE_INC(82.41), NOTE_INC(87.31),
+    NOTE_INC(92.50), NOTE_INC(98.00), NOTE_INC(103.8), NOTE_INC(110.0), NOTE_INC(116.5), NOTE_INC(123.5),   // Octave 2
+    NOTE_INC(130.8), NOTE_INC(138.6), NOTE_INC(146.8), NOTE_INC(155.6), NOTE_INC(164.8), NOTE_INC(174.6),
+    NOTE_INC(185.0), NOTE_INC(196.0), NOTE_INC(207.7), NOTE_INC(220.0), NOTE_INC(233.1), NOTE_INC(246.9),   // Octave 3
+    NOTE_INC(261.6), NOTE_INC(277.2), NOTE_INC(293.7), NOTE_INC(311.1), NOTE_INC(329.6), NOTE_INC(349.2),
+    NOTE_INC(370.0), NOTE_INC(392.0), NOTE_INC(415.3), NOTE_INC(440.0), NOTE_INC(466.2), NOTE_INC(493.9),   // Octave 4
+    NOTE_INC(523.3), NOTE_INC(554.4), NOTE_INC(587.3), NOTE_INC(622.3), NOTE_INC(659.3), NOTE_INC(698.5),
+    NOTE_INC(740.0), NOTE_INC(784.0), NOTE_INC(830.6), NOTE_INC(880.0), NOTE_INC(932.3), NOTE_INC(987.8),   // Octave 5
+    NOTE_INC(1047), NOTE_INC(1109), NOTE_INC(1175), NOTE_INC(1245), NOTE_INC(1319), NOTE_INC(1397),
+    NOTE_INC(1480), NOTE_INC(1568), NOTE_INC(1661), NOTE_INC(1760), NOTE_INC(1865), NOTE_INC(1976),   // Octave 6
+    NOTE_INC(2093), NOTE_INC(2217), NOTE_INC(2349), NOTE_INC(2489), NOTE_INC(2637), NOTE_INC(2794),
+    NOTE_INC(2960), NOTE_INC(3136), NOTE_INC(3322), NOTE_INC(3520), NOTE_INC(3729), NOTE_INC(3951),   // Octave 7
+    NOTE_INC(4186), NOTE_INC(4434), NOTE_INC(4698), NOTE_INC(4978), NOTE_INC(5274), NOTE_INC(5588),
+    NOTE_INC(5920), NOTE_INC(6272), NOTE_INC(6645), NOTE_INC(7040), NOTE_INC(7459), NOTE_INC(7902),   // Octave 8
+    NOTE_INC(8372), NOTE_INC(8870), NOTE_INC(9397), NOTE_INC(9956), NOTE_INC(10548), NOTE_INC(11175),
+    NOTE_INC(11840), NOTE_INC(12544), NOTE_INC(13290), NOTE_INC(14080), NOTE_INC(14917), NOTE_INC(15804),   // Octave 9
+};
+
+// Wavetable: one cycle of a sine wave, signed 8-bit samples
+
+static const int8_t wave_table[256] PROGMEM =
+{
+       0,    3,    6,    9,   12,   16,   19,   22,   25,   28,   31,   34,   37,   40,   43,   46,
+      49,   51,   54,   57,   60,   63,   65,   68,   71,   73,   76,   78,   81,   83,   85,   88,
+      90,   92,   94,   96,   98,  100,  102,  104,  106,  107,  109,  111,  112,  113,  115,  116,
+     117,  118,  120,  121,  122,  122,  123,  124,  125,  125,  126,  126,  126,  127,  127,  127,
+     127,  127,  127,  127,  126,  126,  126,  125,  125,  124,  123,  122,  122,  121,  120,  118,
+     117,  116,  115,  113,  112,  111,  109,  107,  106,  104,  102,  100,   98,   96,   94,   92,
+      90,   88,   85,   83,   81,   78,   76,   73,   71,   68,   65,   63,   60,   57,   54,   51,
+      49,   46,   43,   40,   37,   34,   31,   28,   25,   22,   19,   16,   12,    9,    6,    3,
+       0,   -3,   -6,   -9,  -12,  -16,  -19,  -22,  -25,  -28,  -31,  -34,  -37,  -40,  -43,  -46,
+     -49,  -51,  -54,  -57,  -60,  -63,  -65,  -68,  -71,  -73,  -76,  -78,  -81,  -83,  -85,  -88,
+     -90,  -92,  -94,  -96,  -98, -100, -102, -104, -106, -107, -109, -111, -112, -113, -115, -116,
+    -117, -118, -120, -121, -122, -122, -123, -124, -125, -125, -126, -126, -126, -127, -127, -127,
+    -127, -127, -127, -127, -126, -126, -126, -125, -125, -124, -123, -122, -122, -121, -120, -118,
+    -117, -116, -115, -113, -112, -111, -109, -107, -106, -104, -102, -100,  -98,  -96,  -94,  -92,
+     -90,  -88,  -85,  -83,  -81,  -78,  -76,  -73,  -71,  -68,  -65,  -63,  -60,  -57,  -54,  -51,
+     -49,  -46,  -43,  -40,  -37,  -34,  -31,  -28,  -25,  -22,  -19,  -16,  -12,   -9,   -6,   -3,
+};
+
+// Volume setting to output level scale factor (approx. 3 dB steps)
+
+static const uint8_t gain_scale[SOUND_MAX_GAIN + 1] PROGMEM =
+{
+    32, 45, 64, 90, 128, 160, 208, 255
+};
+
+/******************************************************************************
+ * sound_init()
+ *
+ * Initialize sound generator
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   16-bit TIMER1 is used in fast PWM mode (mode 14, TOP = ICR1),
+ *          with output on OC1A.  The PWM output idles at 50% duty cycle;
+ *          the sample interrupt is only enabled while a voice is sounding.
+ ******************************************************************************/
+
+void sound_init(void)
+{
+    uint8_t index;
+
+    // Stop timer 1 during init
+    // Disable timer 1 interrupts
+
+    TCCR1B = 0;
+    TIMSK1 = 0;
+    TCNT1 = 0;
+
+    for (index = 0; index < SOUND_VOICES; index++) {
+        voice[index].increment = 0;
+        voice[index].level = 0;
+        voice[index].envelope = 0;
+        voice[index].state = ENV_OFF;
+    }
+    sound_muted = 0;
+    sound_gain(5);
+
+    // Timer 1 configuration:
+    // Clear OC1A on compare match, set at BOTTOM (non-inverting PWM)
+    // Fast PWM mode, TOP = ICR1, no prescaling
+
+    ICR1 = SOUND_PWM_TOP;
+    OCR1A = SOUND_PWM_MID;
+    TCCR1A = BM(COM1A1) | BM(WGM11);
+    TCCR1B = BM(WGM13) | BM(WGM12) | BM(CS10);
+    TIFR1 = BM(TOV1);
+
+    DDR(BEEPER_PORT) |= BM(BEEPER_PIN);
+}
+
+/******************************************************************************
+ * sound_note(voice_id, note)
+ *
+ * Start playing a note
+ *
+ * Inputs:  voice_id    Voice to play note on, 0..SOUND_VOICES - 1
+ *          note        Note to play, 0..SOUND_NOTES - 1 (octave * 12 + semitone)
+ *
+ * Returns: Nothing
+ *
+ * Notes:   The envelope restarts its attack from the present level and the
+ *          waveform phase is not reset, so notes played back-to-back on a
+ *          voice change pitch without a click.
+ ******************************************************************************/
+
+void sound_note(uint8_t voice_id, uint8_t note)
+{
+    register voice_t *v;
+    uint16_t increment;
+
+    if ((voice_id >= SOUND_VOICES) || (note >= SOUND_NOTES)) {
+        return;
+    }
+
+    v = &voice[voice_id];
+    increment = pgm_read_word(&note_increment[note]);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        v->increment = increment;
+        v->state = ENV_ATTACK;
+        TIMSK1 |= BM(TOIE1);
+    }
+}
+
+/******************************************************************************
+ * sound_release(voice_id)
+ *
+ * End the note playing on a voice
+ *
+ * Inputs:  voice_id    Voice to release
+ *
+ * Returns: Nothing
+ *
+ * Notes:   The voice fades out at SOUND_RELEASE_STEP per sound_service() call.
+ ******************************************************************************/
+
+void sound_release(uint8_t voice_id)
+{
+    if (voice_id >= SOUND_VOICES) {
+        return;
+    }
+
+    if (voice[voice_id].state != ENV_OFF) {
+        voice[voice_id].state = ENV_RELEASE;
+    }
+}
+
+/******************************************************************************
+ * sound_off()
+ *
+ * Silence all voices immediately
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ ******************************************************************************/
+
+void sound_off(void)
+{
+    uint8_t index;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        TIMSK1 &= INVBM(TOIE1);
+        OCR1A = SOUND_PWM_MID;
+        for (index = 0; index < SOUND_VOICES; index++) {
+            voice[index].level = 0;
+            voice[index].envelope = 0;
+            voice[index].state = ENV_OFF;
+        }
+    }
+}
+
+/******************************************************************************
+ * sound_mute(mute)
+ *
+ * Mute or un-mute output
+ *
+ * Inputs:  mute        Mutes output if nonzero
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Voices continue to play (and their envelopes to run) while muted.
+ ******************************************************************************/
+
+void sound_mute(uint8_t mute)
+{
+    uint8_t index;
+
+    sound_muted = mute;
+    if (mute) {
+        for (index = 0; index < SOUND_VOICES; index++) {
+            voice[index].level = 0;
+        }
+    }
+}
+
+/******************************************************************************
+ * sound_gain(gain)
+ *
+ * Set output volume
+ *
+ * Inputs:  gain        Volume, 0 (quietest) to SOUND_MAX_GAIN (loudest)
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Takes effect at the next sound_service() call.
+ ******************************************************************************/
+
+void sound_gain(uint8_t gain)
+{
+    if (gain > SOUND_MAX_GAIN) {
+        gain = SOUND_MAX_GAIN;
+    }
+
+    sound_scale = pgm_read_byte(&gain_scale[gain]);
+}
+
+/******************************************************************************
+ * uint8_t sound_active()
+ *
+ * Determine if any voice is sounding
+ *
+ * Inputs:  None
+ *
+ * Returns: Nonzero if any voice is playing a note or fading out
+ ******************************************************************************/
+
+uint8_t sound_active(void)
+{
+    uint8_t index;
+
+    for (index = 0; index < SOUND_VOICES; index++) {
+        if (voice[index].state != ENV_OFF) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * sound_service()
+ *
+ * Advance voice envelopes
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Called from the TIMER2 (player) interrupt, PLAYER_TICKS_PER_SECOND
+ *          times per second.  The sample interrupt is disabled once all
+ *          voices have faded out.
+ ******************************************************************************/
+
+void sound_service(void)
+{
+    register voice_t *v;
+    uint8_t env;
+    uint8_t active = 0;
+
+    for (v = voice; v < &voice[SOUND_VOICES]; v++) {
+        env = v->envelope;
+
+        if (v->state == ENV_ATTACK) {
+            if (env < 255 - SOUND_ATTACK_STEP) {
+                env += SOUND_ATTACK_STEP;
+            }
+            else {
+                env = 255;
+                v->state = ENV_DECAY;
+            }
+        }
+        else if (v->state == ENV_DECAY) {
+            if (env > SOUND_SUSTAIN_LEVEL + SOUND_DECAY_STEP) {
+                env -= SOUND_DECAY_STEP;
+            }
+            else {
+                env = SOUND_SUSTAIN_LEVEL;
+                v->state = ENV_SUSTAIN;
+            }
+        }
+        else if (v->state == ENV_RELEASE) {
+            if (env > SOUND_RELEASE_STEP) {
+                env -= SOUND_RELEASE_STEP;
+            }
+            else {
+                env = 0;
+                v->state = ENV_OFF;
+            }
+        }
+
+        v->envelope = env;
+        v->level = sound_muted ? 0 : (uint8_t) ((env * sound_scale) >> 8);
+
+        if (v->state != ENV_OFF) {
+            active = 1;
+        }
+    }
+
+    if (!active) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            TIMSK1 &= INVBM(TOIE1);
+            OCR1A = SOUND_PWM_MID;
+        }
+    }
+}
+
+/******************************************************************************
+ * ISR(TIMER1_OVF_vect)
+ *
+ * Sample interrupt, SOUND_SAMPLE_RATE times per second
+ *
+ * Notes:   The mixed output is clipped to the PWM range.  A single voice at
+ *          full volume uses the entire range, so chords at high volume
+ *          settings will clip.
+ ******************************************************************************/
+
+ISR(TIMER1_OVF_vect, ISR_BLOCK)
+{
+    register voice_t *v;
+    int16_t sum = 0;
+    int8_t sample;
+
+    for (v = voice; v < &voice[SOUND_VOICES]; v++) {
+        if (v->level) {
+            v->phase += v->increment;
+            sample = pgm_read_byte(&wave_table[v->phase >> 8]);
+            sum += (sample * v->level) >> 7;
+        }
+    }
+
+    if (sum >= SOUND_PWM_MID) {
+        sum = SOUND_PWM_MID - 1;
+    }
+    else if (sum < -SOUND_PWM_MID) {
+        sum = -SOUND_PWM_MID;
+    }
+
+    OCR1A = SOUND_PWM_MID + sum;
+}
@@ -16,23 +16,43 @@ Content:    SPI (Serial Peripheral Interface) support routines
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <util/atomic.h>
 
 #include "portdef.h"
 #include "spi.h"
 
+//------------------------------------------------------------------------------
+
+// Transmit engine state, shared with the SPI transfer-complete interrupt
+
+static const uint8_t *spi_tx_ptr;       // Next byte to send
+static volatile uint8_t spi_tx_count;   // Bytes left to send after the one in progress
+static volatile uint8_t spi_tx_flags;   // SPI_xxx options for transfer in progress
+static volatile uint8_t spi_tx_busy;    // Non-zero while a transfer is in progress
+
 /******************************************************************************
+ * spi_init()
+ *
+ * Initialize SPI subsystem and display driver control pins
+ *
+ * Inputs:  None
  *
+ * Returns: Nothing
  ******************************************************************************/
 
 void spi_init(void)
 {
     // Configure SPI subsystem
     // Master mode, SPI mode 2, LSbit sent first
+    // Transfer-complete interrupt is enabled only while a transfer is queued
 
     SPCR = BM(SPE) | BM(MSTR) | BM(CPOL) | BM(DORD);
     SPSR = BM(WCOL);
     SPDR = 0;
 
+    spi_tx_count = 0;
+    spi_tx_busy = 0;
+
     // Configure port pin direction for SPI (nixie driver) control pins
 
     DDR(DRIVER_DATA_PORT) |= BM(DRIVER_DATA_PIN);
@@ -47,21 +67,154 @@ void spi_init(void)
 }
 
 /******************************************************************************
+ * ISR(SPI_STC_vect)
+ *
+ * SPI transfer-complete interrupt, sends the next byte of a queued transfer
  *
+ * Notes:   When the last byte has been shifted out, the interrupt disables
+ *          itself and, if requested, pulses the display driver latch pin.
  ******************************************************************************/
 
-void spi_data_out(void *data, uint8_t size)
+ISR(SPI_STC_vect)
 {
-    // Send data block
+    if (spi_tx_count) {
+        SPDR = *spi_tx_ptr;
+        spi_tx_ptr++;
+        spi_tx_count--;
+    }
+    else {
+        SPCR &= INVBM(SPIE);
+
+        if (spi_tx_flags & SPI_LATCH) {
+            BSET(DRIVER_LATCH);
+            BCLR(DRIVER_LATCH);
+        }
 
-    while (size) {
-        SPDR = *((uint8_t *) data++);
-        while (!(SPSR & BM(SPIF)));
-        size--;
+        spi_tx_busy = 0;
     }
+}
 
-    // Pulse latch-data pin
+/******************************************************************************
+ * spi_data_queue(*data, size, flags)
+ *
+ * Start an interrupt-driven transfer of a data block out the SPI port
+ *
+ * Inputs:  *data       Pointer to data block to send
+ *          size        Number of bytes to send
+ *          flags       Transfer options:
+ *                      SPI_LATCH - Pulse display driver latch pin when done
+ *
+ * Returns: Non-zero if the transfer was started, 0 if a previous transfer
+ *          is still in progress (the new transfer is not queued)
+ *
+ * Notes:   Returns as soon as the first byte has been written to the SPI
+ *          data register; the rest is sent from the SPI transfer-complete
+ *          interrupt.  The data block must remain valid (and should not be
+ *          modified) until spi_busy() returns 0.
+ *
+ *          May be called from interrupt context.
+ ******************************************************************************/
 
+uint8_t spi_data_queue(const void *data, uint8_t size, uint8_t flags)
+{
+    uint8_t started = 0;
+
+    if (!size) {
+        return 1;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (!spi_tx_busy) {
+            spi_tx_busy = 1;
+            spi_tx_flags = flags;
+            spi_tx_ptr = (const uint8_t *) data + 1;
+            spi_tx_count = size - 1;
+
+            // Reading SPSR followed by the SPDR write clears any stale SPIF
+            // flag, so the interrupt fires only when this byte completes
+
+            (void) SPSR;
+            SPDR = *((const uint8_t *) data);
+            SPCR |= BM(SPIE);
+
+            started = 1;
+        }
+    }
+
+    return started;
+}
+
+/******************************************************************************
+ * spi_busy()
+ *
+ * Determine if a queued SPI transfer is still in progress
+ *
+ * Inputs:  None
+ *
+ * Returns: Non-zero if transfer in progress, 0 if SPI port is idle
+ ******************************************************************************/
+
+uint8_t spi_busy(void)
+{
+    return spi_tx_busy;
+}
+
+/******************************************************************************
+ * spi_wait()
+ *
+ * Wait for a queued SPI transfer to finish
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Interrupts must be enabled, or this function will never return
+ *          when a transfer is in progress.
+ ******************************************************************************/
+
+void spi_wait(void)
+{
+    while (spi_tx_busy);
+}
+
+/******************************************************************************
+ * spi_latch()
+ *
+ * Pulse display driver latch pin, transferring the data shifted into the
+ * driver to its outputs
+ *
+ * Inputs:  None
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Used with transfers queued without the SPI_LATCH option, when the
+ *          data must be latched at a specific time rather than as soon as
+ *          the last byte has been sent.
+ ******************************************************************************/
+
+void spi_latch(void)
+{
     BSET(DRIVER_LATCH);
     BCLR(DRIVER_LATCH);
 }
+
+/******************************************************************************
+ * spi_data_out(*data, size)
+ *
+ * Send a data block out the SPI port and latch it into the display driver
+ *
+ * Inputs:  *data       Pointer to data block to send
+ *          size        Number of bytes to send
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Waits for any transfer already in progress to finish, then queues
+ *          the new one and returns without waiting for it to complete.  The
+ *          data block must remain valid until spi_busy() returns 0.
+ ******************************************************************************/
+
+void spi_data_out(const void *data, uint8_t size)
+{
+    while (!spi_data_queue(data, size, SPI_LATCH));
+}
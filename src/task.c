@@ -0,0 +1,244 @@
+/*------------------------------------------------------------------------------
+Name:       task.c
+Project:    NixieClock
+Author:     Mark Schultz <n9xmj@yahoo.com>, Daniel Henderson <tindrum@mac.com>
+Date:       14-Oct-2026
+Tabsize:    4
+Copyright:  None
+License:    None
+Revision:   $Id$
+Target CPU: ATmega168 or ATmega328
+
+Content:    Cooperative (stackless) task scheduler
+------------------------------------------------------------------------------*/
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "portdef.h"
+#include "event.h"
+#include "task.h"
+
+//------------------------------------------------------------------------------
+
+// Run queue, in the order tasks were started
+// Tasks that have ended stay in the queue until the end of the scheduler
+// pass, so the queue may be walked while tasks are started and stopped.
+
+static task_t *task_list;
+
+/******************************************************************************
+ * task_start(*task, run, keep)
+ *
+ * Add a task to the run queue
+ *
+ * Inputs:  *task       Task control block
+ *          run         Task function
+ *          keep        Event classes handled by the task (EM_xxx), kept in
+ *                      the queue while the task runs, 0 if none
+ *
+ * Returns: Nothing
+ *
+ * Notes:   The task first runs on the next scheduler pass (the present one,
+ *          if called from another task).  A task that is already running
+ *          is restarted from the beginning of its task function.
+ *
+ *          <keep> should cover every class the task waits for, so that
+ *          events arriving while it is busy waiting for something else are
+ *          not lost.  Kept events are not discarded until they are handed
+ *          to a task, so a class kept but seldom waited for may fill its
+ *          queue.
+ ******************************************************************************/
+
+void task_start(task_t *task, task_fn_t run, uint16_t keep)
+{
+    task_t *p;
+
+    task->run = run;
+    task->keep = keep;
+    task->resume = NULL;
+    task->wait = TASK_READY;
+    task->event.event = NO_EVENT;
+
+    for (p = task_list; p; p = p->next) {
+        if (p == task) {
+            return;                     // Already queued
+        }
+    }
+
+    task->next = NULL;
+    if (!task_list) {
+        task_list = task;
+    }
+    else {
+        for (p = task_list; p->next; p = p->next);
+        p->next = task;
+    }
+}
+
+/******************************************************************************
+ * task_stop(*task)
+ *
+ * End a task
+ *
+ * Inputs:  *task       Task to end
+ *
+ * Returns: Nothing
+ *
+ * Notes:   The task function is not called again.  A task should end itself
+ *          with TASK_END() instead.
+ ******************************************************************************/
+
+void task_stop(task_t *task)
+{
+    task->wait = TASK_DONE;
+}
+
+/******************************************************************************
+ * task_running(*task)
+ *
+ * Determine if a task is running
+ *
+ * Inputs:  *task       Task to check
+ *
+ * Returns: Nonzero if the task has been started and has not ended
+ *
+ * Notes:   The task control block must have been passed to task_start(),
+ *          or be zero-initialized (static).
+ ******************************************************************************/
+
+uint8_t task_running(const task_t *task)
+{
+    return (task->wait != TASK_DONE);
+}
+
+/******************************************************************************
+ * task_step(*task)
+ *
+ * Call a task function once
+ *
+ * Inputs:  *task       Task to run
+ *
+ * Returns: Nonzero if the task is ready to run again or has ended, so that
+ *          the scheduler must not sleep before its next pass
+ ******************************************************************************/
+
+static uint8_t task_step(task_t *task)
+{
+    task->wait = TASK_DONE;             // Unless the task waits again
+    task->run(task);
+
+    if (task->wait == TASK_DONE) {
+        task->resume = NULL;
+        return 1;                       // Others may be waiting for it
+    }
+
+    return (task->wait & TASK_READY);
+}
+
+/******************************************************************************
+ * task_run()
+ *
+ * Run tasks
+ *
+ * Inputs:  None
+ *
+ * Returns: When no tasks are left in the run queue
+ *
+ * Notes:   Each pass of the scheduler:
+ *
+ *          - Discards the waiting events of classes no running task handles
+ *            (see task_start()) or is waiting for
+ *          - Hands the next event (if any) to every task waiting for an
+ *            event of its class
+ *          - Runs the tasks that are ready or testing a condition
+ *          - Sleeps until the next interrupt, unless some task is ready to
+ *            run or an event source has signalled activity
+ *
+ *          Conditions waited for are only tested again after an interrupt
+ *          (or after another task has run), so they must depend on
+ *          something that an interrupt handler or a task changes.
+ ******************************************************************************/
+
+void task_run(void)
+{
+    task_t *task;
+    task_t *prev;
+    event_t event;
+    uint16_t waiting;
+    uint16_t keep;
+    uint16_t pending;
+    uint16_t class;
+    uint8_t busy;
+
+    while (task_list) {
+        busy = 0;
+
+        // Event classes tasks are waiting for now, and classes kept for
+        // tasks that will wait for them later; others are discarded
+
+        waiting = 0;
+        keep = 0;
+        for (task = task_list; task; task = task->next) {
+            if (task->wait & TASK_EVENT) {
+                waiting |= task->mask;
+            }
+            if (task->wait != TASK_DONE) {
+                keep |= task->keep;
+            }
+        }
+        keep |= waiting;
+
+        pending = event_scan();
+        if (pending & ~keep) {
+            flush_events(pending & ~keep);
+        }
+
+        // One event per pass, so each task sees events in order and waits
+        // for the next one with an up-to-date mask
+
+        if (pending & waiting) {
+            event = get_next_event(waiting);
+            if (event.event != NO_EVENT) {
+                class = event_mask(event.event);
+                for (task = task_list; task; task = task->next) {
+                    if ((task->wait & TASK_EVENT) && (task->mask & class)) {
+                        task->event = event;
+                        task_step(task);
+                    }
+                }
+                busy = 1;               // More events may be waiting
+            }
+        }
+
+        // Ready and polling tasks
+
+        for (task = task_list; task; task = task->next) {
+            if (task->wait & (TASK_READY | TASK_POLL)) {
+                task->event.event = NO_EVENT;
+                busy |= task_step(task);
+            }
+        }
+
+        // Remove tasks that have ended
+
+        prev = NULL;
+        for (task = task_list; task; task = task->next) {
+            if (task->wait == TASK_DONE) {
+                if (prev) {
+                    prev->next = task->next;
+                }
+                else {
+                    task_list = task->next;
+                }
+            }
+            else {
+                prev = task;
+            }
+        }
+
+        if (!busy) {
+            event_idle();               // Nothing to do until next interrupt
+        }
+    }
+}
@@ -24,7 +24,11 @@ Content:    General purpose timing functions and RTC routines
 #include "event.h"
 #include "clock.h"
 #include "player.h"
+#include "sound.h"
 #include "timer.h"
+#include "profile.h"
+#include "config.h"
+#include "power.h"
 
 #if TIMER0_PRESCALER == 1
   #define TIMER0_PRESCALER_BITS     BM(CS00)
@@ -41,13 +45,63 @@ Content:    General purpose timing functions and RTC routines
   #warning Invalid timer 0 prescaler selected (must be 1, 8, 64, 256 or 1024)
 #endif
 
+#if TIMER2_PRESCALER == 1
+  #define TIMER2_PRESCALER_BITS     BM(CS20)
+#elif TIMER2_PRESCALER == 8
+  #define TIMER2_PRESCALER_BITS     BM(CS21)
+#elif TIMER2_PRESCALER == 32
+  #define TIMER2_PRESCALER_BITS     BM(CS21) | BM(CS20)
+#elif TIMER2_PRESCALER == 64
+  #define TIMER2_PRESCALER_BITS     BM(CS22)
+#elif TIMER2_PRESCALER == 128
+  #define TIMER2_PRESCALER_BITS     BM(CS22) | BM(CS20)
+#elif TIMER2_PRESCALER == 256
+  #define TIMER2_PRESCALER_BITS     BM(CS22) | BM(CS21)
+#elif TIMER2_PRESCALER == 1024
+  #define TIMER2_PRESCALER_BITS     BM(CS22) | BM(CS21) | BM(CS20)
+#else
+  #define TIMER2_PRESCALER_BITS     0
+  #warning Invalid timer 2 prescaler selected (must be 1, 8, 32, 64, 128, 256 or 1024)
+#endif
+
+#if TIMER2_FREQUENCY != PLAYER_TICKS_PER_SECOND
+  #error TIMER2 period must be set to suit PLAYER_TICKS_PER_SECOND
+#endif
+
+#if TIMER2_PERIOD_TICKS > 256
+  #error TIMER2_PERIOD_TICKS must not exceed 256
+#endif
+
+#if (NIXIE_BCM_UNIT << (NIXIE_BCM_BITS - 1)) >= TIMER0_PERIOD_TICKS
+  #error Longest nixie BCM bit-plane must be shorter than TIMER0_PERIOD_TICKS
+#endif
+
+// Least number of TIMER0 counts ahead of TCNT0 that a display refresh
+// interrupt can be scheduled, when it has fallen behind
+
+#define TIMER0_REARM_TICKS  2
+
 //------------------------------------------------------------------------------
 
-static uint16_t seconds_prescaler;
+// Free-running tick counter, incremented every TIMER0 interrupt
+
+static volatile uint32_t timer_tick_count;
+
+// Event timers
+//
+// Running timers are kept in a delta queue: a linked list sorted by expiry
+// time, where each entry holds the number of ticks between its predecessor's
+// expiry and its own.  Only the head entry has to be decremented on each
+// tick, and entries are added or removed by walking the list only when a
+// timer is started, stopped or expires.
 
-static volatile uint16_t timer_count[NUM_EVENT_TIMERS];
-static uint16_t timer_period[NUM_EVENT_TIMERS];
-static volatile uint8_t timer_flag;
+static uint16_t timer_delta[NUM_EVENT_TIMERS];  // Ticks after previous timer in queue expires
+static uint8_t timer_next[NUM_EVENT_TIMERS];    // Next timer in queue, or TIMER_NONE
+static uint16_t timer_period[NUM_EVENT_TIMERS]; // Reload period, 0 if not recurring
+static uint8_t timer_queued[NUM_EVENT_TIMERS];  // Non-zero if timer is in the queue
+static volatile uint8_t timer_head;             // First (next to expire) timer in queue
+static volatile uint8_t timer_flag[(NUM_EVENT_TIMERS + 7) / 8]; // Expired flags, 1 bit per timer
+static volatile uint8_t timer_flag_count;       // Number of expired flags set
 
 /******************************************************************************
  *
@@ -55,20 +109,189 @@ static volatile uint8_t timer_flag;
 
 void timer_init(void)
 {
+    uint8_t timer_id;
+
     TCCR0B = 0;                         // Stop timer during init
 
     TCCR0A = BM(WGM01);                 // OC0x pins disabled, CTC mode (WGM02..0 = 010)
     TCNT0 = 0;                          // Reset timer counter
     OCR0A = TIMER0_PERIOD_TICKS - 1;    // 625x/sec interval when prescaler = f/256 w/16MHz clock
-    OCR0B = 0;                          // Set some known value in OCR0B (not used)
-    TIMSK0 = BM(OCIE0A);                // Enable output compare A interrupt
+    OCR0B = TIMER0_PERIOD_TICKS / 2;    // First display refresh (BCM bit-plane) interrupt
+    TIMSK0 = BM(OCIE0B) | BM(OCIE0A);   // Enable output compare A & B interrupts
     TIFR0 = BM(OCF0B) | BM(OCF0A) | BM(TOV0); // Clear all timer interrupt flags
 
-    seconds_prescaler = TIMER0_FREQUENCY;
+    TCCR2B = 0;                         // Stop timer 2 during init
+
+    TCCR2A = BM(WGM21);                 // OC2x pins disabled, CTC mode (WGM22..0 = 010)
+    TCNT2 = 0;
+    OCR2A = TIMER2_PERIOD_TICKS - 1;    // 500x/sec when prescaler = f/128 w/16MHz clock
+    TIFR2 = BM(OCF2B) | BM(OCF2A) | BM(TOV2);
+    TIMSK2 = BM(OCIE2A);                // Enable output compare A (player) interrupt
+    TCCR2B = TIMER2_PRESCALER_BITS;
+
+    timer_head = TIMER_NONE;
+    for (timer_id = 0; timer_id < NUM_EVENT_TIMERS; timer_id++) {
+        timer_queued[timer_id] = 0;
+        timer_period[timer_id] = 0;
+    }
 
     TCCR0B = TIMER0_PRESCALER_BITS;     // Select f/256 prescaler, start counter
 }
 
+/******************************************************************************
+ * timer_insert(timer_id, ticks)
+ *
+ * Add a timer to the delta queue
+ *
+ * Inputs:  timer_id    Timer to add, must not already be in the queue
+ *          ticks       Number of ticks from now until the timer expires
+ *                      (must be non-zero)
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Must be called with interrupts disabled (or from the timer ISR).
+ *          The timer is placed after any timers that expire at the same
+ *          time, so timers expire in the order they were started.
+ ******************************************************************************/
+
+static void timer_insert(uint8_t timer_id, uint16_t ticks)
+{
+    register uint8_t prev;
+    register uint8_t cur;
+
+    prev = TIMER_NONE;
+    cur = timer_head;
+
+    while ((cur != TIMER_NONE) && (ticks >= timer_delta[cur])) {
+        ticks -= timer_delta[cur];
+        prev = cur;
+        cur = timer_next[cur];
+    }
+
+    timer_delta[timer_id] = ticks;
+    timer_next[timer_id] = cur;
+    if (cur != TIMER_NONE) {
+        timer_delta[cur] -= ticks;
+    }
+
+    if (prev == TIMER_NONE) {
+        timer_head = timer_id;
+    }
+    else {
+        timer_next[prev] = timer_id;
+    }
+
+    timer_queued[timer_id] = 1;
+}
+
+/******************************************************************************
+ * timer_remove(timer_id)
+ *
+ * Remove a timer from the delta queue
+ *
+ * Inputs:  timer_id    Timer to remove
+ *
+ * Returns: Nothing
+ *
+ * Notes:   Must be called with interrupts disabled.  Does nothing if the
+ *          timer is not in the queue.
+ ******************************************************************************/
+
+static void timer_remove(uint8_t timer_id)
+{
+    register uint8_t prev;
+    register uint8_t cur;
+
+    if (!timer_queued[timer_id]) {
+        return;
+    }
+
+    prev = TIMER_NONE;
+    cur = timer_head;
+
+    while (cur != timer_id) {
+        prev = cur;
+        cur = timer_next[cur];
+    }
+
+    cur = timer_next[timer_id];
+    if (cur != TIMER_NONE) {
+        timer_delta[cur] += timer_delta[timer_id];
+    }
+
+    if (prev == TIMER_NONE) {
+        timer_head = cur;
+    }
+    else {
+        timer_next[prev] = cur;
+    }
+
+    timer_queued[timer_id] = 0;
+}
+
+/******************************************************************************
+ * timer_remaining(timer_id)
+ *
+ * Determine number of ticks until a timer expires
+ *
+ * Inputs:  timer_id    Timer to check
+ *
+ * Returns: Ticks until expiry, 0 if timer is not running
+ *
+ * Notes:   Must be called with interrupts disabled.
+ ******************************************************************************/
+
+static uint16_t timer_remaining(uint8_t timer_id)
+{
+    register uint8_t cur;
+    uint16_t ticks;
+
+    if (!timer_queued[timer_id]) {
+        return 0;
+    }
+
+    ticks = 0;
+    cur = timer_head;
+    do {
+        ticks += timer_delta[cur];
+        if (cur == timer_id) {
+            break;
+        }
+        cur = timer_next[cur];
+    } while (cur != TIMER_NONE);
+
+    return ticks;
+}
+
+/******************************************************************************
+ * timer_clear_flag(timer_id)
+ *
+ * Reset timer-expired flag
+ *
+ * Inputs:  timer_id    Timer whose flag is to be reset
+ *
+ * Returns: Non-zero if the flag was set
+ *
+ * Notes:   Must be called with interrupts disabled.
+ ******************************************************************************/
+
+static uint8_t timer_clear_flag(uint8_t timer_id)
+{
+    register uint8_t mask;
+    register uint8_t index;
+
+    index = timer_id >> 3;
+    mask = BM(timer_id & 0x07);
+
+    if (timer_flag[index] & mask) {
+        timer_flag[index] &= (uint8_t) ~mask;
+        timer_flag_count--;
+        return 1;
+    }
+
+    return 0;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -76,27 +299,28 @@ void timer_init(void)
 uint8_t timer_start(uint16_t period, uint8_t recurring)
 {
     uint8_t timer_id;
-    uint16_t count;
+    uint8_t found = 0;
 
     for (timer_id = 0; timer_id < NUM_EVENT_TIMERS; timer_id++) {
         ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
         {
-            count = timer_count[timer_id];
-        }
-        if (!count && !timer_period[timer_id]) {
-            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-            {
-                timer_count[timer_id] = period;
+            if (!timer_queued[timer_id] && !timer_period[timer_id]) {
+                if (period) {
+                    timer_insert(timer_id, period);
+                }
                 if (recurring) {
                     timer_period[timer_id] = period;
                 }
-                timer_flag &= (uint8_t) ~(1 << timer_id);
+                timer_clear_flag(timer_id);
+                found = 1;
             }
+        }
+        if (found) {
             return timer_id;
         }
     }
 
-    return -1;
+    return TIMER_NONE;
 }
 
 /******************************************************************************
@@ -105,9 +329,13 @@ uint8_t timer_start(uint16_t period, uint8_t recurring)
 
 void timer_stop(uint8_t timer_id)
 {
+    if (timer_id >= NUM_EVENT_TIMERS) {
+        return;
+    }
+
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        timer_count[timer_id] = 0;
+        timer_remove(timer_id);
         timer_period[timer_id] = 0;
     }
 }
@@ -118,13 +346,20 @@ void timer_stop(uint8_t timer_id)
 
 void timer_restart(uint8_t timer_id, uint16_t period, uint8_t recurring)
 {
+    if (timer_id >= NUM_EVENT_TIMERS) {
+        return;
+    }
+
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        timer_count[timer_id] = period;
+        timer_remove(timer_id);
+        if (period) {
+            timer_insert(timer_id, period);
+        }
         if (recurring) {
             timer_period[timer_id] = period;
         }
-        timer_flag &= (uint8_t) ~(1 << timer_id);
+        timer_clear_flag(timer_id);
     }
 }
 
@@ -134,10 +369,17 @@ void timer_restart(uint8_t timer_id, uint16_t period, uint8_t recurring)
 
 void timer_reset(uint8_t timer_id)
 {
+    if (timer_id >= NUM_EVENT_TIMERS) {
+        return;
+    }
+
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        timer_count[timer_id] = timer_period[timer_id];
-        timer_flag &= (uint8_t) ~(1 << timer_id);
+        timer_remove(timer_id);
+        if (timer_period[timer_id]) {
+            timer_insert(timer_id, timer_period[timer_id]);
+        }
+        timer_clear_flag(timer_id);
     }
 }
 
@@ -147,14 +389,65 @@ void timer_reset(uint8_t timer_id)
 
 uint16_t timer_read(uint8_t timer_id)
 {
-    uint16_t count;
+    uint16_t count = 0;
+
+    if (timer_id < NUM_EVENT_TIMERS) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            count = timer_remaining(timer_id);
+        }
+    }
+
+    return count;
+}
+
+/******************************************************************************
+ * timer_expiry(timer_id)
+ *
+ * Determine when a timer will expire
+ *
+ * Inputs:  timer_id    Timer to check
+ *
+ * Returns: Value of timer_ticks() at which the timer will expire.  If the
+ *          timer is not running, the present timer_ticks() value.
+ ******************************************************************************/
+
+uint32_t timer_expiry(uint8_t timer_id)
+{
+    uint32_t when;
 
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        count = timer_count[timer_id];
+        when = timer_tick_count;
+        if (timer_id < NUM_EVENT_TIMERS) {
+            when += timer_remaining(timer_id);
+        }
     }
 
-    return count;
+    return when;
+}
+
+/******************************************************************************
+ * timer_ticks()
+ *
+ * Read free-running tick counter
+ *
+ * Inputs:  None
+ *
+ * Returns: Number of TIMER0 ticks (TIMER0_FREQUENCY per second) since
+ *          timer_init() was called
+ ******************************************************************************/
+
+uint32_t timer_ticks(void)
+{
+    uint32_t ticks;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        ticks = timer_tick_count;
+    }
+
+    return ticks;
 }
 
 /******************************************************************************
@@ -165,12 +458,15 @@ uint8_t timer_expired(uint8_t timer_id, uint8_t reset)
 {
     uint8_t flag;
 
-    flag = 1 << timer_id;
+    if (timer_id >= NUM_EVENT_TIMERS) {
+        return 0;
+    }
+
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        flag &= timer_flag;
-        if (reset) {
-            timer_flag &= (uint8_t) ~flag;
+        flag = timer_flag[timer_id >> 3] & BM(timer_id & 0x07);
+        if (flag && reset) {
+            timer_clear_flag(timer_id);
         }
     }
 
@@ -181,63 +477,213 @@ uint8_t timer_expired(uint8_t timer_id, uint8_t reset)
     return flag;
 }
 
+/******************************************************************************
+ * timer_next_expired()
+ *
+ * Find an expired timer and reset its timer-expired flag
+ *
+ * Inputs:  None
+ *
+ * Returns: ID of an expired timer (lowest ID first), or TIMER_NONE if no
+ *          timer-expired flags are set
+ ******************************************************************************/
+
+uint8_t timer_next_expired(void)
+{
+    uint8_t timer_id = TIMER_NONE;
+    uint8_t index;
+    uint8_t bits;
+
+    if (!timer_flag_count) {
+        return TIMER_NONE;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (index = 0; index < sizeof(timer_flag); index++) {
+            bits = timer_flag[index];
+            if (bits) {
+                timer_id = index << 3;
+                while (!(bits & 0x01)) {
+                    bits >>= 1;
+                    timer_id++;
+                }
+                timer_clear_flag(timer_id);
+                break;
+            }
+        }
+    }
+
+    return timer_id;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
 
 uint8_t timer_status(void)
 {
-    return timer_flag;
+    return timer_flag_count;
 }
 
 /******************************************************************************
+ * timer_update()
  *
+ * Advance event timers by one tick
+ *
+ * Notes:   Called from the TIMER0 tick interrupt.  Only the timer at the
+ *          head of the delta queue is decremented; expired timers are
+ *          flagged, removed and (if recurring) re-queued.
  ******************************************************************************/
 
 static void timer_update(void)
 {
-    register uint8_t index;
-    register uint8_t mask;
-    register uint16_t count;
-
-    mask = 0x01;
-    for (index = 0; index < NUM_EVENT_TIMERS; index++) {
-        count = timer_count[index];
-        if (count) {
-            count--;
-            if (!count) {
-                count = timer_period[index];
-                timer_flag |= mask;
+    register uint8_t timer_id;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        timer_tick_count++;
+
+        timer_id = timer_head;
+        if (timer_id != TIMER_NONE) {
+            timer_delta[timer_id]--;
+        }
+
+        while ((timer_id != TIMER_NONE) && !timer_delta[timer_id]) {
+            timer_head = timer_next[timer_id];
+            timer_queued[timer_id] = 0;
+
+            if (!(timer_flag[timer_id >> 3] & BM(timer_id & 0x07))) {
+                timer_flag[timer_id >> 3] |= BM(timer_id & 0x07);
+                timer_flag_count++;
+            }
+            event_signal(EVENT_WAKE_TIMER);
+
+            if (timer_period[timer_id]) {
+                timer_insert(timer_id, timer_period[timer_id]);
             }
-            timer_count[index] = count;
+
+            timer_id = timer_head;
         }
-        mask <<= 1;
     }
 }
 
+/******************************************************************************
+ * ISR(TIMER0_COMPB_vect)
+ *
+ * Display refresh interrupt
+ *
+ * Notes:   Runs at the end of each nixie display BCM bit-plane.  OCR0B is
+ *          advanced by the duration of the next bit-plane, wrapping at the
+ *          TIMER0 period, so bit-plane timing is not affected by interrupt
+ *          latency.
+ *
+ *          If the interrupt was held off for so long that the advanced
+ *          compare value has already gone by, it would not match again
+ *          until TIMER0 came round a whole period later; the next
+ *          interrupt is then scheduled a little ahead of TCNT0 instead.
+ *
+ *          OCR0B is written before the following bit-plane is queued (and
+ *          before profiling starts), so that neither delays it.
+ ******************************************************************************/
+
+ISR(TIMER0_COMPB_vect, ISR_BLOCK)
+{
+    register uint8_t duration;
+    register uint8_t late;
+    register uint8_t now;
+    register uint8_t next;
+
+    duration = nixie_display_refresh();
+
+    // Counts by which this interrupt ran after its compare match
+
+    now = TCNT0;
+    late = now - OCR0B;
+    if (now < OCR0B) {
+        late += TIMER0_PERIOD_TICKS;
+    }
+
+    if (late + TIMER0_REARM_TICKS > duration) {
+        next = now + TIMER0_REARM_TICKS;
+    }
+    else {
+        next = OCR0B + duration;
+    }
+    if (next >= TIMER0_PERIOD_TICKS) {
+        next -= TIMER0_PERIOD_TICKS;
+    }
+    OCR0B = next;
+
+    PROFILE_START(PROFILE_REFRESH);
+    nixie_display_queue();
+    PROFILE_END(PROFILE_REFRESH);
+}
 
 /******************************************************************************
+ * ISR(TIMER0_COMPA_vect)
  *
+ * System tick interrupt, TIMER0_FREQUENCY times per second
+ *
+ * Notes:   Interrupts are re-enabled on entry so that the display refresh
+ *          (TIMER0_COMPB), SPI, serial and rotary encoder interrupts are not
+ *          held off while the button and timer services run.
  ******************************************************************************/
 
-ISR(TIMER0_COMPA_vect, ISR_BLOCK)
+ISR(TIMER0_COMPA_vect, ISR_NOBLOCK)
 {
+    PROFILE_START(PROFILE_TICK);
 
     // Operations performed every entry
 
-    nixie_display_refresh();
+    PROFILE_START(PROFILE_CROSSFADE);
+    nixie_crossfade_service();
+    PROFILE_END(PROFILE_CROSSFADE);
+
+    nixie_exercise_service();
+
+    PROFILE_START(PROFILE_BUTTON);
     button_scan();
+    PROFILE_END(PROFILE_BUTTON);
+
+    PROFILE_START(PROFILE_TIMER);
     timer_update();
-    player_service();
+    PROFILE_END(PROFILE_TIMER);
+
+    PROFILE_END(PROFILE_TICK);
+}
+
+/******************************************************************************
+ * ISR(TIMER2_COMPA_vect)
+ *
+ * Timekeeping, music player and sound envelope interrupt,
+ * PLAYER_TICKS_PER_SECOND times per second
+ *
+ * Notes:   The player has its own interrupt so that the time taken by
+ *          player_service() does not depend on, or delay, the system tick
+ *          and display refresh.  Interrupts are re-enabled while the player
+ *          runs, with this interrupt masked so that it cannot nest.
+ ******************************************************************************/
 
-    seconds_prescaler--;
-    if (!seconds_prescaler) {
+ISR(TIMER2_COMPA_vect, ISR_BLOCK)
+{
+    TIMSK2 &= INVBM(OCIE2A);
+    sei();
 
-        // Operations performed once per second
+    if (clock_tick()) {
+        add_event(ONE_SECOND_ELAPSED, 1);
+        config_tick();
+        power_tick();
+    }
 
-        seconds_prescaler += TIMER0_FREQUENCY;
+    PROFILE_START(PROFILE_PLAYER);
+    sound_service();
+    player_service();
+    PROFILE_END(PROFILE_PLAYER);
 
-        time_date_update();
-        add_event(ONE_SECOND_ELAPSED, 0);
+    cli();
+    if (TIFR2 & BM(OCF2A)) {            // Next player tick already due
+        PROFILE_OVERRUN(PROFILE_PLAYER);
     }
+    TIMSK2 |= BM(OCIE2A);
 }